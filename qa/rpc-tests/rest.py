@@ -24,6 +24,32 @@ def deser_uint256(f):
         r += t << (i * 32)
     return r
 
+def deser_string(f):
+    nit = unpack("<B", f.read(1))[0]
+    if nit == 253:
+        nit = unpack("<H", f.read(2))[0]
+    elif nit == 254:
+        nit = unpack("<I", f.read(4))[0]
+    elif nit == 255:
+        nit = unpack("<Q", f.read(8))[0]
+    return f.read(nit).decode('utf-8')
+
+#reads the height and hash of the tip that prefix the binary club and reward responses
+def deser_chain_prefix(f):
+    chainHeight = unpack("<i", f.read(4))[0]
+    chaintipHash = hex(deser_uint256(f))[2:].zfill(64)
+    return chainHeight, chaintipHash
+
+def deser_rest_member(f):
+    member = {}
+    member['address'] = deser_string(f)
+    member['clubminer'] = deser_string(f)
+    member['father'] = deser_string(f)
+    member['clubpower'] = unpack("<Q", f.read(8))[0]
+    member['selfpower'] = unpack("<Q", f.read(8))[0]
+    member['rewards'] = unpack("<q", f.read(8))[0]
+    return member
+
 #allows simple http get calls
 def http_get_call(host, port, path, response_object = 0):
     conn = http.client.HTTPConnection(host, port)
@@ -53,7 +79,8 @@ class RESTTest (BitcoinTestFramework):
         self.num_nodes = 3
 
     def setup_network(self, split=False):
-        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir)
+        # node 0 keeps the reward rates served by /rest/reward/
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [["-updaterewardrate=true"], [], []])
         connect_nodes_bi(self.nodes,0,1)
         connect_nodes_bi(self.nodes,1,2)
         connect_nodes_bi(self.nodes,0,2)
@@ -331,5 +358,78 @@ class RESTTest (BitcoinTestFramework):
         json_obj = json.loads(json_string)
         assert_equal(json_obj['bestblockhash'], bb_hash)
 
+        ###############################################
+        # /rest/member/, /rest/club/ and /rest/reward/ #
+        ###############################################
+        tip_height = self.nodes[0].getblockcount()
+        block_json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/block/'+bb_hash+self.FORMAT_SEPARATOR+'json'))
+        member = block_json_obj['tx'][0]['vout'][0]['scriptPubKey']['addresses'][0] # the packager of the tip
+        rpc_member = self.nodes[0].getmemberinfo(member)
+
+        # json matches getmemberinfo at the same tip
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/member/'+member+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['chainHeight'], tip_height)
+        assert_equal(json_obj['chaintipHash'], bb_hash)
+        for key in ['address', 'clubminer', 'clubpower', 'selfpower', 'father', 'rewards']:
+            assert_equal(json_obj[key], rpc_member[key])
+
+        # binary holds the tip and then the same member, hex is the binary in hex
+        response = http_get_call(url.hostname, url.port, '/rest/member/'+member+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        member_bin = response.read()
+        output = BytesIO(member_bin)
+        assert_equal(deser_chain_prefix(output), (tip_height, bb_hash))
+        bin_member = deser_rest_member(output)
+        assert_equal(output.read(), b'')
+        for key in bin_member:
+            assert_equal(bin_member[key], json_obj[key])
+        response = http_get_call(url.hostname, url.port, '/rest/member/'+member+self.FORMAT_SEPARATOR+'hex', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read(), encode(member_bin, "hex_codec") + b"\n")
+
+        # the club of the member is described by its leader
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/club/'+member+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['chainHeight'], tip_height)
+        assert_equal(json_obj['chaintipHash'], bb_hash)
+        assert_equal(json_obj['clubminer'], rpc_member['clubminer'])
+        assert_equal(json_obj['clubpower'], rpc_member['clubpower'])
+        rpc_leader = self.nodes[0].getmemberinfo(rpc_member['clubminer'])
+        assert_equal(json_obj['selfpower'], rpc_leader['selfpower'])
+        assert_equal(json_obj['rewards'], rpc_leader['rewards'])
+        response = http_get_call(url.hostname, url.port, '/rest/club/'+member+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        output = BytesIO(response.read())
+        assert_equal(deser_chain_prefix(output), (tip_height, bb_hash))
+        bin_leader = deser_rest_member(output)
+        assert_equal(bin_leader['address'], rpc_member['clubminer'])
+        for key in ['clubminer', 'clubpower', 'selfpower', 'rewards']:
+            assert_equal(bin_leader[key], json_obj[key])
+
+        # the reward rate of the tip matches getrewardrate
+        rpc_rate = self.nodes[0].getrewardrate(tip_height)
+        json_obj = json.loads(http_get_call(url.hostname, url.port, '/rest/reward/'+str(tip_height)+self.FORMAT_SEPARATOR+'json'))
+        assert_equal(json_obj['chainHeight'], tip_height)
+        assert_equal(json_obj['chaintipHash'], bb_hash)
+        for key in ['height', 'address', 'rewardrate']:
+            assert_equal(json_obj[key], rpc_rate[key])
+        response = http_get_call(url.hostname, url.port, '/rest/reward/'+str(tip_height)+self.FORMAT_SEPARATOR+'bin', True)
+        assert_equal(response.status, 200)
+        output = BytesIO(response.read())
+        assert_equal(deser_chain_prefix(output), (tip_height, bb_hash))
+        assert_equal(deser_string(output), rpc_rate['address'])
+        assert_equal(unpack("<d", output.read(8))[0], rpc_rate['rewardrate'])
+        assert_equal(output.read(), b'')
+
+        # invalid and unknown requests
+        response = http_get_call(url.hostname, url.port, '/rest/member/notanaddress'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 400)
+        response = http_get_call(url.hostname, url.port, '/rest/club/'+self.nodes[0].getnewaddress()+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404) # a new address is in no club
+        response = http_get_call(url.hostname, url.port, '/rest/reward/'+str(tip_height + 1)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404)
+        url1 = urllib.parse.urlparse(self.nodes[1].url)
+        response = http_get_call(url1.hostname, url1.port, '/rest/reward/'+str(tip_height)+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 404) # node 1 keeps no reward rates
+
 if __name__ == '__main__':
     RESTTest ().main ()
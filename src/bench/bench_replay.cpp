@@ -0,0 +1,295 @@
+// Copyright (c) 2018- The imorpheus Core developers at pos
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#if defined(HAVE_CONFIG_H)
+#include "config/taucoin-config.h"
+#endif
+
+#include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "main.h"
+#include "random.h"
+#include "rewarddb/addrinfodb.h"
+#include "rewarddb/clubinfodb.h"
+#include "txdb.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <stdio.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <univalue.h>
+
+using namespace std;
+
+static const int DEFAULT_REPLAY_BLOCKS = 100;
+
+static std::string HelpMessageReplay()
+{
+    string strUsage;
+    strUsage += HelpMessageGroup(_("Options:"));
+    strUsage += HelpMessageOpt("-?", _("This help message"));
+    strUsage += HelpMessageOpt("-snapshot=<dir>", _("Data directory of a stopped node to replay the newest blocks of, it is not modified"));
+    strUsage += HelpMessageOpt("-blocks=<n>", strprintf(_("Number of blocks below the tip of the snapshot to disconnect and connect again (default: %u)"), DEFAULT_REPLAY_BLOCKS));
+    strUsage += HelpMessageOpt("-scratchdir=<dir>", _("Directory the snapshot is copied to, it must not exist (default: a new directory in the temporary path)"));
+    strUsage += HelpMessageOpt("-keepscratchdir", _("Keep the scratch directory after the replay"));
+    strUsage += HelpMessageOpt("-output=<file>", _("Write the results to <file> instead of the standard output"));
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-prefetchinputs", strprintf(_("Read the inputs of a block on the script verification threads before connecting it, compare the connect_block times with and without (default: %u)"), DEFAULT_PREFETCH_INPUTS));
+    strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-lazyrewarddb", strprintf(_("Read address reward records from disk on demand instead of loading all of them at startup (default: %u)"), DEFAULT_REWARDDB_LAZYLOAD));
+    strUsage += HelpMessageOpt("-debug=bench", _("Log the time of every phase of every block"));
+    strUsage += HelpMessageOpt("-printtoconsole", _("Send the log to the console"));
+    AppendParamsHelpMessages(strUsage);
+
+    return strUsage;
+}
+
+/** Copies the snapshot, every file but the lock of the node that owned it. */
+static bool CopySnapshot(const boost::filesystem::path& from, const boost::filesystem::path& to)
+{
+    try {
+        boost::filesystem::create_directories(to);
+        boost::filesystem::recursive_directory_iterator end;
+        for (boost::filesystem::recursive_directory_iterator it(from); it != end; it++) {
+            boost::filesystem::path relative;
+            boost::filesystem::path::const_iterator itPath = it->path().begin();
+            for (boost::filesystem::path::const_iterator itFrom = from.begin(); itFrom != from.end(); itFrom++)
+                itPath++;
+            for (; itPath != it->path().end(); itPath++)
+                relative /= *itPath;
+
+            if (boost::filesystem::is_directory(it->status()))
+                boost::filesystem::create_directories(to / relative);
+            else if (relative.filename() != ".lock")
+                boost::filesystem::copy_file(it->path(), to / relative);
+        }
+    } catch (const boost::filesystem::filesystem_error& e) {
+        fprintf(stderr, "Error: copying the snapshot failed: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+/** Opens the copied databases and loads the chain with the steps of AppInit2. */
+static bool LoadChain(const CChainParams& chainparams)
+{
+    CDBCacheSizes cacheSizes = CalculateDBCacheSizes();
+    nCoinCacheUsage = cacheSizes.nCoinCacheUsage;
+    std::string strLoadError;
+    if (!OpenChainstateDBs(cacheSizes, false, false, strLoadError))
+        return error("%s: %s", __func__, strLoadError);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+
+    if (!LoadBlockIndex())
+        return error("%s: loading the block index failed", __func__);
+    if (mapBlockIndex.count(chainparams.GetConsensus().hashGenesisBlock) == 0)
+        return error("%s: the snapshot is not a data directory of this chain", __func__);
+    // The index is kept as the snapshot has it, rebuilt on the copy if it is of an older layout
+    bool fAddressIndex = false;
+    pblocktree->ReadFlag("txoutsbyaddressindex", fAddressIndex);
+    if (!LoadAddressIndex(fAddressIndex, strLoadError))
+        return error("%s: %s", __func__, strLoadError);
+    if (!RewindRewardDBs(chainparams))
+        return error("%s: rewinding the reward databases failed", __func__);
+
+    LOCK(cs_main);
+    if (chainActive.Tip() == NULL || paddrinfodb->GetCurrentHeight() != chainActive.Height() ||
+        pclubinfodb->GetCurrentHeight() != chainActive.Height())
+        return error("%s: the reward databases are not at the tip of the chain", __func__);
+    return true;
+}
+
+static UniValue PhaseTimes(const CBlockConnectTimes& begin, const CBlockConnectTimes& end)
+{
+    UniValue phases(UniValue::VOBJ);
+    phases.push_back(Pair("load_block_from_disk", 0.001 * (end.nReadFromDisk - begin.nReadFromDisk)));
+    phases.push_back(Pair("prefetch_inputs", 0.001 * (end.nPrefetch - begin.nPrefetch)));
+    phases.push_back(Pair("sanity_checks", 0.001 * (end.nCheck - begin.nCheck)));
+    phases.push_back(Pair("fork_checks", 0.001 * (end.nForks - begin.nForks)));
+    phases.push_back(Pair("connect_transactions", 0.001 * (end.nConnect - begin.nConnect)));
+    phases.push_back(Pair("verify_txins", 0.001 * (end.nVerify - begin.nVerify)));
+    phases.push_back(Pair("index_writing", 0.001 * (end.nIndex - begin.nIndex)));
+    phases.push_back(Pair("callbacks", 0.001 * (end.nCallbacks - begin.nCallbacks)));
+    phases.push_back(Pair("connect_total", 0.001 * (end.nConnectTotal - begin.nConnectTotal)));
+    phases.push_back(Pair("flush", 0.001 * (end.nFlush - begin.nFlush)));
+    phases.push_back(Pair("writing_chainstate", 0.001 * (end.nChainState - begin.nChainState)));
+    phases.push_back(Pair("connect_postprocess", 0.001 * (end.nPostConnect - begin.nPostConnect)));
+    phases.push_back(Pair("connect_block", 0.001 * (end.nTotal - begin.nTotal)));
+    return phases;
+}
+
+/**
+ * Disconnects the newest blocks of the chain and connects them again, the way invalidateblock and
+ * reconsiderblock do, and returns the times of both directions.
+ */
+static bool Replay(const CChainParams& chainparams, int nBlocks, UniValue& result)
+{
+    CBlockIndex* pindexTip;
+    CBlockIndex* pindexFirst;
+    uint64_t nTx = 0;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+        if (nBlocks < 1 || nBlocks > pindexTip->nHeight)
+            return error("%s: -blocks must be between 1 and the height of the snapshot, %d", __func__, pindexTip->nHeight);
+        pindexFirst = chainActive[pindexTip->nHeight - nBlocks + 1];
+        for (CBlockIndex* pindex = pindexTip; pindex != pindexFirst->pprev; pindex = pindex->pprev)
+            nTx += pindex->nTx;
+    }
+
+    CValidationState state;
+    CBlockConnectTimes timesStart = GetBlockConnectTimes();
+    int64_t nTimeStart = GetTimeMicros();
+    {
+        LOCK(cs_main);
+        if (!InvalidateBlock(state, chainparams, pindexFirst))
+            return error("%s: disconnecting the blocks failed: %s", __func__, FormatStateMessage(state));
+    }
+    CBlockConnectTimes timesDisconnected = GetBlockConnectTimes();
+    int64_t nTimeDisconnected = GetTimeMicros();
+
+    {
+        LOCK(cs_main);
+        ResetBlockFailureFlags(pindexFirst);
+    }
+    if (!ActivateBestChain(state, chainparams))
+        return error("%s: connecting the blocks failed: %s", __func__, FormatStateMessage(state));
+    CBlockConnectTimes timesConnected = GetBlockConnectTimes();
+    int64_t nTimeConnected = GetTimeMicros();
+
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() != pindexTip)
+            return error("%s: the chain did not return to its tip %s", __func__, pindexTip->GetBlockHash().ToString());
+    }
+
+    double nDisconnectSeconds = 0.000001 * (nTimeDisconnected - nTimeStart);
+    double nConnectSeconds = 0.000001 * (nTimeConnected - nTimeDisconnected);
+    result.push_back(Pair("chain", chainparams.NetworkIDString()));
+    result.push_back(Pair("first_height", pindexFirst->nHeight));
+    result.push_back(Pair("tip_height", pindexTip->nHeight));
+    result.push_back(Pair("tip_hash", pindexTip->GetBlockHash().GetHex()));
+    result.push_back(Pair("blocks", nBlocks));
+    result.push_back(Pair("transactions", nTx));
+    result.push_back(Pair("script_threads", nScriptCheckThreads));
+    result.push_back(Pair("prefetch_inputs", fPrefetchInputs));
+
+    // Both directions include the mempool updates of a reorganization, the phases only cover the blocks
+    UniValue disconnect(UniValue::VOBJ);
+    disconnect.push_back(Pair("elapsed_ms", 1000 * nDisconnectSeconds));
+    disconnect.push_back(Pair("blocks_per_second", nDisconnectSeconds > 0 ? nBlocks / nDisconnectSeconds : 0));
+    disconnect.push_back(Pair("disconnect_block_ms", 0.001 * (timesDisconnected.nDisconnect - timesStart.nDisconnect)));
+    result.push_back(Pair("disconnect", disconnect));
+
+    UniValue connect(UniValue::VOBJ);
+    connect.push_back(Pair("elapsed_ms", 1000 * nConnectSeconds));
+    connect.push_back(Pair("blocks_per_second", nConnectSeconds > 0 ? nBlocks / nConnectSeconds : 0));
+    connect.push_back(Pair("transactions_per_second", nConnectSeconds > 0 ? nTx / nConnectSeconds : 0));
+    connect.push_back(Pair("phases_ms", PhaseTimes(timesDisconnected, timesConnected)));
+    result.push_back(Pair("connect", connect));
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    SetupEnvironment();
+    ParseParameters(argc, argv);
+    if (argc < 2 || mapArgs.count("-?") || mapArgs.count("-h") || mapArgs.count("-help")) {
+        std::string strUsage = strprintf(_("%s block replay benchmark version"), _(PACKAGE_NAME)) + " " + FormatFullVersion() + "\n\n" +
+              _("Usage:") + "\n" +
+              "  bench_replay -snapshot=<dir> [options]  " + _("Disconnect and connect the newest blocks of a data directory copy") + "\n\n" +
+              HelpMessageReplay();
+        fprintf(stdout, "%s", strUsage.c_str());
+        return argc < 2 ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+    try {
+        SelectParams(ChainNameFromCommandLine());
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return EXIT_FAILURE;
+    }
+    const CChainParams& chainparams = Params();
+
+    boost::filesystem::path pathSnapshot = GetArg("-snapshot", "");
+    if (pathSnapshot.empty() || !boost::filesystem::is_directory(pathSnapshot)) {
+        fprintf(stderr, "Error: -snapshot must be the data directory of a stopped node\n");
+        return EXIT_FAILURE;
+    }
+    // The chain parameters may add a subdirectory to the data directory
+    pathSnapshot = boost::filesystem::system_complete(pathSnapshot) / BaseParams().DataDir();
+    boost::filesystem::path pathScratch = GetArg("-scratchdir",
+        (boost::filesystem::temp_directory_path() / strprintf("bench_replay_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000))).string());
+    if (boost::filesystem::exists(pathScratch)) {
+        fprintf(stderr, "Error: the scratch directory %s exists\n", pathScratch.string().c_str());
+        return EXIT_FAILURE;
+    }
+    if (!CopySnapshot(pathSnapshot, pathScratch / BaseParams().DataDir()))
+        return EXIT_FAILURE;
+    mapArgs["-datadir"] = pathScratch.string();
+    ClearDatadirCache();
+
+    fPrintToConsole = GetBoolArg("-printtoconsole", false);
+    fPrintToDebugLog = false;
+    fDebug = mapMultiArgs.count("-debug");
+
+    ECC_Start();
+    ECCVerifyHandle globalVerifyHandle;
+    nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
+    if (nScriptCheckThreads <= 0)
+        nScriptCheckThreads += GetNumCores();
+    if (nScriptCheckThreads <= 1)
+        nScriptCheckThreads = 0;
+    else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+        nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+    fPrefetchInputs = GetBoolArg("-prefetchinputs", DEFAULT_PREFETCH_INPUTS);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++) {
+        threadGroup.create_thread(&ThreadScriptCheck);
+    }
+
+    UniValue result(UniValue::VOBJ);
+    bool fSuccess = LoadChain(chainparams) && Replay(chainparams, GetArg("-blocks", DEFAULT_REPLAY_BLOCKS), result);
+    if (fSuccess) {
+        std::string strResult = result.write(2) + "\n";
+        if (mapArgs.count("-output")) {
+            FILE* file = fopen(mapArgs["-output"].c_str(), "w");
+            fSuccess = file && fwrite(strResult.data(), 1, strResult.size(), file) == strResult.size();
+            if (file)
+                fclose(file);
+            if (!fSuccess)
+                fprintf(stderr, "Error: writing %s failed\n", mapArgs["-output"].c_str());
+        } else
+            fprintf(stdout, "%s", strResult.c_str());
+    } else
+        fprintf(stderr, "Error: the replay failed, run with -printtoconsole for the details\n");
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    pcoinsTip = NULL;
+    delete pcoinsdbview;
+    pcoinsdbview = NULL;
+    delete pcoinsByScript;
+    pcoinsByScript = NULL;
+    delete pblocktree;
+    pblocktree = NULL;
+    delete paddrinfodb;
+    paddrinfodb = NULL;
+    delete pclubinfodb;
+    pclubinfodb = NULL;
+    delete prewardratedbview;
+    prewardratedbview = NULL;
+    ECC_Stop();
+    if (!GetBoolArg("-keepscratchdir", false))
+        boost::filesystem::remove_all(pathScratch);
+
+    return fSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2018- The imorpheus Core developers at pos
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "hash.h"
+#include "key.h"
+#include "pot.h"
+#include "utilstrencodings.h"
+
+#include <vector>
+#include <string>
+
+volatile uint64_t nPotBenchSum = 0; // volatile, global so not optimized away
+
+static void PotCalculateHit(benchmark::State& state)
+{
+    uint256 hash = uint256S("c2d3a0b3f2e4b7e0f6f5a6b9c7f0f4d1e2a3b4c5d6e7f8091a2b3c4d5e6f7081");
+    while (state.KeepRunning()) {
+        nPotBenchSum += calculateHitOfPOT(hash);
+        *hash.begin() += 1;
+    }
+}
+
+static void PotCheckProofOfTransaction(benchmark::State& state)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    const std::string pubkey = HexStr(key.GetPubKey());
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+
+    // Both outcomes of the check, a forger that has waited long enough and one that has not
+    std::vector<std::string> vGenSig;
+    for (int i = 0; i < 16; i++)
+        vGenSig.push_back(Hash(BEGIN(i), END(i)).GetHex());
+    size_t i = 0;
+    PotErr checkErr;
+    while (state.KeepRunning()) {
+        nPotBenchSum += CheckProofOfTransaction(vGenSig[i % vGenSig.size()], pubkey, 100, 1 + (i % 600),
+                                                0x369D0369D036978, 1000, consensusParams, checkErr);
+        i++;
+    }
+}
+
+static void PotNextRequired(benchmark::State& state)
+{
+    std::vector<CBlockIndex> vIndex(2016);
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        vIndex[i].pprev = i ? &vIndex[i - 1] : NULL;
+        vIndex[i].nHeight = i;
+        vIndex[i].nTime = 1500000000 + i * 60 + (i * 37) % 45;
+        vIndex[i].baseTarget = 0x369D0369D036978 - i;
+        vIndex[i].BuildSkip();
+    }
+
+    size_t i = 0;
+    while (state.KeepRunning()) {
+        nPotBenchSum += getNextPotRequired(&vIndex[i % vIndex.size()]);
+        i++;
+    }
+}
+
+BENCHMARK(PotCalculateHit);
+BENCHMARK(PotCheckProofOfTransaction);
+BENCHMARK(PotNextRequired);
@@ -0,0 +1,212 @@
+// Copyright (c) 2018- The imorpheus Core developers at pos
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "base58.h"
+#include "coins.h"
+#include "hash.h"
+#include "random.h"
+#include "rewarddb/addrinfodb.h"
+#include "rewarddb/clubinfodb.h"
+#include "util.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace {
+
+//! New members joining the club per block while it is built
+static const size_t BENCH_MEMBERS_PER_BLOCK = 1000;
+
+//! Spending transactions in the benchmarked block
+static const size_t BENCH_BLOCK_TXS = 20;
+
+/** Reward databases in memory holding one club, built by the updates of the blocks that would grow it. */
+class CBenchClub
+{
+public:
+    boost::filesystem::path pathTemp;
+    CClubInfoDB* pclubinfodb;
+    CAddrInfoDB* paddrinfodb;
+    std::vector<std::string> vaddresses; // vaddresses[0] is the leader
+    int nHeight;
+
+    CBenchClub(size_t nMembers);
+    ~CBenchClub();
+
+    //! The club of nMembers members, built on first use and shared by the benchmarks
+    static CBenchClub& Get(size_t nMembers);
+
+    CScript GetScript(size_t i) const
+    {
+        return GetScriptForDestination(CBitcoinAddress(vaddresses[i]).Get());
+    }
+};
+
+CBenchClub::CBenchClub(size_t nMembers) : nHeight(0)
+{
+    pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_rewarddb_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+
+    // The databases only read the data directory when they are opened
+    std::map<std::string, std::string>::const_iterator it = mapArgs.find("-datadir");
+    bool fDataDir = it != mapArgs.end();
+    std::string strDataDir = fDataDir ? it->second : std::string();
+    mapArgs["-datadir"] = pathTemp.string();
+    ClearDatadirCache();
+    pclubinfodb = new CClubInfoDB(1 << 20, true);
+    paddrinfodb = new CAddrInfoDB(1 << 20, pclubinfodb, true);
+    if (fDataDir)
+        mapArgs["-datadir"] = strDataDir;
+    else
+        mapArgs.erase("-datadir");
+    ClearDatadirCache();
+
+    for (size_t i = 0; i <= nMembers; i++) {
+        uint160 hash = Hash160(BEGIN(i), END(i));
+        vaddresses.push_back(CBitcoinAddress(CKeyID(hash)).ToString());
+    }
+
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    paddrinfodb->InitGenesisDB(std::vector<std::string>(1, vaddresses[0]));
+    paddrinfodb->Commit(nHeight);
+    paddrinfodb->ClearCache();
+
+    // Every member brings in four others, which makes the club about log4(nMembers) deep
+    for (size_t i = 1; i <= nMembers; i++) {
+        if (i % BENCH_MEMBERS_PER_BLOCK == 1)
+            nHeight++;
+        paddrinfodb->UpdateMpAndTotalMPByAddress(vaddresses[i], nHeight, vaddresses[(i - 1) / 4]);
+        if (i % BENCH_MEMBERS_PER_BLOCK == 0 || i == nMembers) {
+            paddrinfodb->Commit(nHeight);
+            paddrinfodb->ClearCache();
+        }
+    }
+}
+
+CBenchClub::~CBenchClub()
+{
+    delete paddrinfodb;
+    delete pclubinfodb;
+    boost::filesystem::remove_all(pathTemp);
+}
+
+CBenchClub& CBenchClub::Get(size_t nMembers)
+{
+    // Every benchmark leaves the club as it found it, so the larger ones are only built once
+    static std::map<size_t, boost::shared_ptr<CBenchClub> > mapClubs;
+    boost::shared_ptr<CBenchClub>& pclub = mapClubs[nMembers];
+    if (!pclub)
+        pclub.reset(new CBenchClub(nMembers));
+    return *pclub;
+}
+
+}
+
+volatile uint64_t nRewardBenchSum = 0; // volatile, global so not optimized away
+
+/**
+ * Connects a block paying the club leader and moving coins between members, then disconnects it,
+ * in the order of ConnectBlock and DisconnectRewards. With fLog the block is undone from its undo log,
+ * otherwise by replaying its transactions.
+ */
+static void ClubConnectAndUndoBlock(benchmark::State& state, size_t nMembers, bool fLog)
+{
+    CBenchClub& club = CBenchClub::Get(nMembers);
+    CCoinsView dummy;
+    CCoinsViewCache view(&dummy);
+
+    std::vector<CTransaction> vtx;
+    std::vector<std::map<std::string, CAmount> > vfather_amount;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].prevout.SetNull();
+    coinbase.vout.resize(1);
+    coinbase.vout[0].scriptPubKey = club.GetScript(0);
+    coinbase.vout[0].nValue = 4 * COIN;
+    vtx.push_back(coinbase);
+    vfather_amount.resize(1);
+    for (size_t i = 0; i < BENCH_BLOCK_TXS; i++) {
+        size_t from = 1 + (i * 7919) % nMembers;
+        size_t to = 1 + (i * 104729 + 1) % nMembers;
+
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = Hash(BEGIN(i), END(i));
+        tx.vin[0].prevout.n = 0;
+        CCoinsModifier coins = view.ModifyCoins(tx.vin[0].prevout.hash);
+        coins->vout.resize(1);
+        coins->vout[0].nValue = 10 * COIN;
+        coins->vout[0].scriptPubKey = club.GetScript(from);
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = club.GetScript(to);
+        tx.vout[0].nValue = 9 * COIN;
+        vtx.push_back(tx);
+
+        std::map<std::string, CAmount> vin_val;
+        vin_val[club.vaddresses[from]] = 10 * COIN;
+        vfather_amount.push_back(vin_val);
+    }
+    const CAmount blockReward = 5 * COIN;
+    const int nHeight = club.nHeight + 1;
+
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    while (state.KeepRunning()) {
+        for (size_t i = 0; i < vtx.size(); i++)
+            club.paddrinfodb->UpdateFatherAndMpByTX(vtx[i], view, nHeight);
+        club.paddrinfodb->UpdateRewardsByTX(vtx[0], blockReward, nHeight);
+        club.paddrinfodb->Commit(nHeight);
+        club.paddrinfodb->ClearCache();
+
+        club.paddrinfodb->ClearUndoCache();
+        if (fLog) {
+            club.paddrinfodb->UndoBlockByLog(nHeight);
+        } else {
+            club.paddrinfodb->UpdateRewardsByTX(vtx[0], blockReward, nHeight, true);
+            for (size_t i = vtx.size(); i-- > 0;)
+                club.paddrinfodb->UndoMiningPowerByTX(vtx[i], view, nHeight, vfather_amount[i]);
+            club.paddrinfodb->UndoClubMembers(nHeight);
+            club.paddrinfodb->UndoCacheRecords(nHeight);
+        }
+        club.paddrinfodb->Commit(nHeight - 1, true);
+        club.paddrinfodb->ClearUndoCache();
+        club.paddrinfodb->ClearCache();
+    }
+}
+
+static void ClubHarvestPower(benchmark::State& state, size_t nMembers)
+{
+    CBenchClub& club = CBenchClub::Get(nMembers);
+
+    // The leader has the harvest power of the club, its members have none
+    size_t i = 0;
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    while (state.KeepRunning()) {
+        nRewardBenchSum += club.paddrinfodb->GetHarvestPowerByAddress(club.vaddresses[i % 2 ? 0 : 1 + i % nMembers], club.nHeight);
+        i++;
+    }
+}
+
+static void ClubConnectAndUndoBlock10(benchmark::State& state) { ClubConnectAndUndoBlock(state, 10, false); }
+static void ClubConnectAndUndoBlock1K(benchmark::State& state) { ClubConnectAndUndoBlock(state, 1000, false); }
+static void ClubConnectAndUndoBlock100K(benchmark::State& state) { ClubConnectAndUndoBlock(state, 100000, false); }
+static void ClubConnectAndUndoBlock1M(benchmark::State& state) { ClubConnectAndUndoBlock(state, 1000000, false); }
+static void ClubConnectAndUndoBlockLog1K(benchmark::State& state) { ClubConnectAndUndoBlock(state, 1000, true); }
+static void ClubConnectAndUndoBlockLog1M(benchmark::State& state) { ClubConnectAndUndoBlock(state, 1000000, true); }
+static void ClubHarvestPower10(benchmark::State& state) { ClubHarvestPower(state, 10); }
+static void ClubHarvestPower1M(benchmark::State& state) { ClubHarvestPower(state, 1000000); }
+
+BENCHMARK(ClubConnectAndUndoBlock10);
+BENCHMARK(ClubConnectAndUndoBlock1K);
+BENCHMARK(ClubConnectAndUndoBlock100K);
+BENCHMARK(ClubConnectAndUndoBlock1M);
+BENCHMARK(ClubConnectAndUndoBlockLog1K);
+BENCHMARK(ClubConnectAndUndoBlockLog1M);
+BENCHMARK(ClubHarvestPower10);
+BENCHMARK(ClubHarvestPower1M);
@@ -11,8 +11,11 @@
 #include "tinyformat.h"
 #include "uint256.h"
 #include "pot.h"
+#include "utilstrencodings.h"
 #include <vector>
 
+#include <boost/shared_ptr.hpp>
+
 class CBlockFileInfo
 {
 public:
@@ -147,6 +150,106 @@ enum BlockStatus: uint32_t {
     BLOCK_OPT_WITNESS       =   128, //! block data in blk*.data was received with a witness-enforcing client
 };
 
+/**
+ * Hex string of a block header kept in binary in the block index. Headers normally hold the
+ * lowercase hex of N bytes, any other string is kept as it is so that the header is always
+ * rebuilt byte for byte. Serialized as the string.
+ */
+template<unsigned int N>
+class CBlockIndexHexField
+{
+private:
+    unsigned char data[N];
+    //! the string itself when it is not the hex of N bytes, the empty string until Set
+    boost::shared_ptr<const std::string> pstr;
+
+    static const boost::shared_ptr<const std::string>& EmptyString()
+    {
+        static const boost::shared_ptr<const std::string> pempty(new std::string());
+        return pempty;
+    }
+
+public:
+    CBlockIndexHexField() : pstr(EmptyString())
+    {
+        memset(data, 0, sizeof(data));
+    }
+
+    void Set(const std::string& str)
+    {
+        if (str.size() == 2 * N && IsHex(str))
+        {
+            std::vector<unsigned char> vch = ParseHex(str);
+            if (HexStr(vch) == str)
+            {
+                memcpy(data, &vch[0], N);
+                pstr.reset();
+                return;
+            }
+        }
+        memset(data, 0, sizeof(data));
+        pstr = str.empty() ? EmptyString() : boost::shared_ptr<const std::string>(new std::string(str));
+    }
+
+    bool IsEmpty() const
+    {
+        return pstr && pstr->empty();
+    }
+
+    std::string ToString() const
+    {
+        return pstr ? *pstr : HexStr(data, data + N);
+    }
+
+    //! Write the string to a hasher from the bytes, without building it
+    template<typename Hasher>
+    void WriteString(Hasher& hasher) const
+    {
+        if (pstr)
+        {
+            hasher.Write((const unsigned char*)pstr->data(), pstr->size());
+            return;
+        }
+        static const char hexmap[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
+                                         '8', '9', 'a', 'b', 'c', 'd', 'e', 'f' };
+        unsigned char hex[2 * N];
+        for (unsigned int i = 0; i < N; i++)
+        {
+            hex[2 * i] = hexmap[data[i] >> 4];
+            hex[2 * i + 1] = hexmap[data[i] & 15];
+        }
+        hasher.Write(hex, sizeof(hex));
+    }
+
+    void swap(CBlockIndexHexField& other)
+    {
+        unsigned char tmp[N];
+        memcpy(tmp, data, N);
+        memcpy(data, other.data, N);
+        memcpy(other.data, tmp, N);
+        pstr.swap(other.pstr);
+    }
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const
+    {
+        return ::GetSerializeSize(ToString(), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s, int nType, int nVersion) const
+    {
+        ::Serialize(s, ToString(), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType, int nVersion)
+    {
+        std::string str;
+        ::Unserialize(s, str, nType, nVersion);
+        Set(str);
+    }
+};
+
 /** The block chain is a tree shaped structure starting with the
  * genesis block at the root, with each block potentially having multiple
  * candidates to be the next block. A blockindex may have multiple pprev pointing
@@ -199,8 +302,8 @@ public:
     // add some data structure associated pot
     uint64_t baseTarget;
     uint64_t harvestPower;
-    std::string generationSignature;
-    std::string pubKeyOfpackager;
+    CBlockIndexHexField<32> generationSignature;
+    CBlockIndexHexField<33> pubKeyOfpackager;
     uint256 cumulativeDifficulty;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
@@ -245,8 +348,8 @@ public:
         //here maybe some conflict when verify a accepted block,but it in header not in cblock
         baseTarget     = block.baseTarget;
         harvestPower   = block.harvestPower;
-        generationSignature = block.generationSignature;
-        pubKeyOfpackager = block.pubKeyOfpackager;
+        generationSignature.Set(block.generationSignature);
+        pubKeyOfpackager.Set(block.pubKeyOfpackager);
         cumulativeDifficulty = block.cumulativeDifficulty;
     }
 
@@ -278,8 +381,8 @@ public:
         block.nTime          = nTime;
         block.baseTarget           = baseTarget;
         block.harvestPower         = harvestPower;
-        block.generationSignature  = generationSignature;
-        block.pubKeyOfpackager     = pubKeyOfpackager;
+        block.generationSignature  = generationSignature.ToString();
+        block.pubKeyOfpackager     = pubKeyOfpackager.ToString();
         block.cumulativeDifficulty = cumulativeDifficulty;
         return block;
     }
@@ -290,7 +393,7 @@ public:
     }
     //interface about pot
     std::string GetBlockGenerationSignature() const {
-       return generationSignature;
+       return generationSignature.ToString();
     }
 
     uint64_t GetBlockBaseTarget() const{
@@ -418,8 +521,8 @@ public:
 
         block.baseTarget           = baseTarget;
         block.harvestPower         = harvestPower;
-        block.generationSignature  = generationSignature;
-        block.pubKeyOfpackager     = pubKeyOfpackager;
+        block.generationSignature  = generationSignature.ToString();
+        block.pubKeyOfpackager     = pubKeyOfpackager.ToString();
         block.cumulativeDifficulty = cumulativeDifficulty;
         return block.GetHash();
     }
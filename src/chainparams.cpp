@@ -338,6 +338,8 @@ public:
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout = 0; // Never / undefined
 
         consensus.NoRewardHeight = 100000;
+        // Club rewards are only shared below height 45000, so the exact split is used from 40000 up to there
+        consensus.FixedPointRewardHeight = 40000;
 
         /**
          * The message start string is designed to be unlikely to occur in normal data.
@@ -429,6 +431,8 @@ public:
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout = 1493596800; // May 1st 2017
 
         consensus.NoRewardHeight = 100000;
+        // Club rewards are only shared below height 45000, so the exact split is used from 40000 up to there
+        consensus.FixedPointRewardHeight = 40000;
 
         pchMessageStart[0] = 0x69;
         pchMessageStart[1] = 0x6d;
@@ -514,6 +518,8 @@ public:
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nStartTime = 0;
         consensus.vDeployments[Consensus::DEPLOYMENT_SEGWIT].nTimeout = 999999999999ULL;        
         consensus.NoRewardHeight = 100000;
+        // Club rewards are only shared below height 45000, so regtest keeps the legacy split
+        consensus.FixedPointRewardHeight = 45000;
 
         pchMessageStart[0] = 0x69;
         pchMessageStart[1] = 0x6d;
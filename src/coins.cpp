@@ -9,6 +9,7 @@
 #include "memusage.h"
 #include "random.h"
 
+#include <algorithm>
 #include <assert.h>
 
 /**
@@ -126,6 +127,8 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
 CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid, bool coinbase) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    // The outputs of an entry that is replaced have to go from the parent view too
+    ret.first->second.MarkChangedOutputs(std::vector<bool>());
     ret.first->second.coins.Clear();
     if (!coinbase) {
         ret.first->second.flags = CCoinsCacheEntry::FRESH;
@@ -157,6 +160,22 @@ bool CCoinsViewCache::HaveCoinsInCache(const uint256 &txid) const {
     return it != cacheCoins.end();
 }
 
+bool CCoinsViewCache::GetCoinsFromBase(const uint256 &txid, CCoins &coins) const {
+    return base->GetCoins(txid, coins);
+}
+
+void CCoinsViewCache::AddPrefetchedCoins(const uint256 &txid, CCoins &coins) {
+    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
+    if (!ret.second)
+        return;
+    coins.swap(ret.first->second.coins);
+    if (ret.first->second.coins.IsPruned()) {
+        // Same as in FetchCoins, the parent only has an empty entry for this txid
+        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+    }
+    cachedCoinsUsage += ret.first->second.coins.DynamicMemoryUsage();
+}
+
 uint256 CCoinsViewCache::GetBestBlock() const {
     if (hashBlock.IsNull())
         hashBlock = base->GetBestBlock();
@@ -180,6 +199,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    entry.vDirtyOutputs.swap(it->second.vDirtyOutputs);
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
                     // We can mark it FRESH in the parent if it was FRESH in the child
@@ -200,6 +220,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // A normal modification.
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
+                    itUs->second.MergeDirtyOutputs(it->second.vDirtyOutputs);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 }
@@ -308,9 +329,35 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight, CAmount
     return tx.ComputePriority(dResult);
 }
 
+void CCoinsCacheEntry::MarkChangedOutputs(const std::vector<bool>& vAvailable)
+{
+    size_t nOutputs = std::max(vAvailable.size(), coins.vout.size());
+    if (vDirtyOutputs.size() < nOutputs)
+        vDirtyOutputs.resize(nOutputs, false);
+    for (size_t n = 0; n < nOutputs; n++) {
+        bool fAvailableBefore = n < vAvailable.size() && vAvailable[n];
+        if (fAvailableBefore != coins.IsAvailable(n))
+            vDirtyOutputs[n] = true;
+    }
+}
+
+void CCoinsCacheEntry::MergeDirtyOutputs(const std::vector<bool>& vDirty)
+{
+    if (vDirtyOutputs.size() < vDirty.size())
+        vDirtyOutputs.resize(vDirty.size(), false);
+    for (size_t n = 0; n < vDirty.size(); n++) {
+        if (vDirty[n])
+            vDirtyOutputs[n] = true;
+    }
+}
+
 CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    const CCoins& coins = it->second.coins;
+    vAvailable.resize(coins.vout.size());
+    for (size_t n = 0; n < coins.vout.size(); n++)
+        vAvailable[n] = !coins.vout[n].IsNull();
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -318,6 +365,7 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    it->second.MarkChangedOutputs(vAvailable);
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
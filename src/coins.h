@@ -304,6 +304,7 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    std::vector<bool> vDirtyOutputs; // The outputs that were spent or added since the entry came from the parent view.
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
@@ -311,6 +312,17 @@ struct CCoinsCacheEntry
     };
 
     CCoinsCacheEntry() : coins(), flags(0) {}
+
+    //! Whether output n is potentially different from the version in the parent view
+    bool IsOutputDirty(unsigned int n) const {
+        return n < vDirtyOutputs.size() && vDirtyOutputs[n];
+    }
+
+    //! Mark the outputs whose availability is not the one in vAvailable as dirty
+    void MarkChangedOutputs(const std::vector<bool>& vAvailable);
+
+    //! Mark the outputs that are dirty in vDirty as dirty too
+    void MergeDirtyOutputs(const std::vector<bool>& vDirty);
 };
 
 typedef boost::unordered_map<uint256, CCoinsCacheEntry, SaltedTxidHasher> CCoinsMap;
@@ -392,6 +404,7 @@ private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    std::vector<bool> vAvailable; // Which outputs of the CCoins object were unspent before modification
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -437,6 +450,20 @@ public:
      */
     bool HaveCoinsInCache(const uint256 &txid) const;
 
+    /**
+     * Read the coins of txid from the backing view without caching them, so
+     * that they can be read ahead on other threads. The backing view has to
+     * allow concurrent reads, as CCoinsViewDB does, and this cache must not be
+     * modified meanwhile.
+     */
+    bool GetCoinsFromBase(const uint256 &txid, CCoins &coins) const;
+
+    /**
+     * Add coins read ahead by GetCoinsFromBase, as if they were fetched now.
+     * Nothing is done if the cache already has a version of them.
+     */
+    void AddPrefetchedCoins(const uint256 &txid, CCoins &coins);
+
     /**
      * Return a pointer to CCoins in the cache, or NULL if not found. This is
      * more efficient than GetCoins. Modifications to other cache entries are
@@ -8,44 +8,92 @@
 
 #include <assert.h>
 
-CCoinsViewByScript::CCoinsViewByScript(CCoinsViewDB* viewIn) : base(viewIn) { }
+namespace {
+
+/** Passes on the outputs read from the database that have not been changed in the cache */
+struct CUncachedOutputFilter
+{
+    const CAddressOutputMap& cache;
+    const uint256& hash;
+    const AddressOutputVisitor& visitor;
+    bool& fStopped;
+
+    CUncachedOutputFilter(const CAddressOutputMap& cacheIn, const uint256& hashIn, const AddressOutputVisitor& visitorIn, bool& fStoppedIn) :
+        cache(cacheIn), hash(hashIn), visitor(visitorIn), fStopped(fStoppedIn) { }
+
+    bool operator()(const COutPoint& outpoint, const CAddressOutput& output) const {
+        if (cache.count(std::make_pair(hash, outpoint)))
+            return true;
+        if (!visitor(outpoint, output))
+            fStopped = true;
+        return !fStopped;
+    }
+};
+
+struct COutPointCollector
+{
+    std::set<COutPoint>& setCoins;
 
-bool CCoinsViewByScript::GetCoinsByScript(const CScript &script, CCoinsByScript &coins) {
-    const uint256 key = CCoinsViewByScript::getKey(script);
-    if (cacheCoinsByScript.count(key)) {
-        coins = cacheCoinsByScript[key];
+    COutPointCollector(std::set<COutPoint>& setCoinsIn) : setCoins(setCoinsIn) { }
+
+    bool operator()(const COutPoint& outpoint, const CAddressOutput& output) const {
+        setCoins.insert(outpoint);
         return true;
     }
-    if (base->GetCoinsByHashOfScript(key, coins)) {
-        cacheCoinsByScript[key] = coins;
+};
+
+struct CValueSummer
+{
+    CAmount& nTotal;
+
+    CValueSummer(CAmount& nTotalIn) : nTotal(nTotalIn) { }
+
+    bool operator()(const COutPoint& outpoint, const CAddressOutput& output) const {
+        nTotal += output.nValue;
         return true;
     }
-    return false;
+};
+
 }
 
-CCoinsMapByScript::iterator CCoinsViewByScript::FetchCoinsByScript(const CScript &script, bool fRequireExisting) {
-    const uint256 key = CCoinsViewByScript::getKey(script);
-    CCoinsMapByScript::iterator it = cacheCoinsByScript.find(key);
-    if (it != cacheCoinsByScript.end())
-        return it;
-    CCoinsByScript tmp;
-    if (!base->GetCoinsByHashOfScript(key, tmp))
-    {
-        if (fRequireExisting)
-            return cacheCoinsByScript.end();
+CCoinsViewByScript::CCoinsViewByScript(CCoinsViewDB* viewIn) : base(viewIn) { }
+
+void CCoinsViewByScript::AddOutput(const CScript &script, const COutPoint &outpoint, const CAddressOutput &output) {
+    cacheAddressOutputs[std::make_pair(getKey(script), outpoint)] = output;
+}
+
+void CCoinsViewByScript::SpendOutput(const CScript &script, const COutPoint &outpoint) {
+    // Keep a null entry even if the output was only added in the cache, it may have been flushed already
+    cacheAddressOutputs[std::make_pair(getKey(script), outpoint)].SetNull();
+}
+
+bool CCoinsViewByScript::ForEachOutputByScript(const CScript &script, const AddressOutputVisitor &visitor) const {
+    const uint256 hash = getKey(script);
+    bool fStopped = false;
+    if (!base->ForEachAddressOutput(hash, CUncachedOutputFilter(cacheAddressOutputs, hash, visitor, fStopped)))
+        return false;
+    if (fStopped)
+        return true;
+
+    CAddressOutputMap::const_iterator it = cacheAddressOutputs.lower_bound(std::make_pair(hash, COutPoint(uint256(), 0)));
+    for (; it != cacheAddressOutputs.end() && it->first.first == hash; ++it) {
+        if (it->second.IsNull())
+            continue;
+        if (!visitor(it->first.second, it->second))
+            break;
     }
-    CCoinsMapByScript::iterator ret = cacheCoinsByScript.insert(it, std::make_pair(key, CCoinsByScript()));
-    tmp.swap(ret->second);
-    return ret;
+    return true;
 }
 
-CCoinsByScript &CCoinsViewByScript::GetCoinsByScript(const CScript &script, bool fRequireExisting) {
-    CCoinsMapByScript::iterator it = FetchCoinsByScript(script, fRequireExisting);
-    assert(it != cacheCoinsByScript.end());
-    return it->second;
+bool CCoinsViewByScript::GetCoinsByScript(const CScript &script, CCoinsByScript &coins) const {
+    return ForEachOutputByScript(script, COutPointCollector(coins.setCoins));
+}
+
+bool CCoinsViewByScript::GetBalanceByScript(const CScript &script, CAmount &nBalance) const {
+    nBalance = 0;
+    return ForEachOutputByScript(script, CValueSummer(nBalance));
 }
 
 uint256 CCoinsViewByScript::getKey(const CScript &script) {
     return Hash(script.begin(), script.end());
 }
-
@@ -10,6 +10,11 @@
 #include "serialize.h"
 #include "uint256.h"
 
+#include <map>
+#include <set>
+
+#include <boost/function.hpp>
+
 class CCoinsViewDB;
 class CScript;
 
@@ -39,6 +44,47 @@ public:
 
 typedef std::map<uint256, CCoinsByScript> CCoinsMapByScript; // uint160 = hash of script
 
+/** An unspent output in the address index, stored under the hash of its script and its outpoint */
+class CAddressOutput
+{
+public:
+    CAmount nValue;
+    int nHeight;
+    bool fCoinBase;
+
+    CAddressOutput() { SetNull(); }
+    CAddressOutput(CAmount nValueIn, int nHeightIn, bool fCoinBaseIn) : nValue(nValueIn), nHeight(nHeightIn), fCoinBase(fCoinBaseIn) { }
+
+    //! A null entry in the cache erases the output from the database
+    void SetNull() {
+        nValue = -1;
+        nHeight = 0;
+        fCoinBase = false;
+    }
+
+    bool IsNull() const {
+        return (nValue == -1);
+    }
+
+    ADD_SERIALIZE_METHODS;
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(nValue);
+        READWRITE(VARINT(nCode));
+        if (ser_action.ForRead()) {
+            nHeight = nCode / 2;
+            fCoinBase = nCode & 1;
+        }
+    }
+};
+
+typedef std::pair<uint256, COutPoint> CAddressOutputKey; // hash of script, outpoint
+typedef std::map<CAddressOutputKey, CAddressOutput> CAddressOutputMap;
+
+//! Called for every unspent output of a script, returns false to stop the iteration
+typedef boost::function<bool(const COutPoint&, const CAddressOutput&)> AddressOutputVisitor;
+
 /** Adds a memory cache for coins by address */
 class CCoinsViewByScript
 {
@@ -46,18 +92,18 @@ private:
     CCoinsViewDB *base;
 
 public:
-    CCoinsMapByScript cacheCoinsByScript; // accessed also from CCoinsViewDB in txdb.cpp
+    CAddressOutputMap cacheAddressOutputs; // changes since the last flush, written by CCoinsViewDB in txdb.cpp
     CCoinsViewByScript(CCoinsViewDB* baseIn);
 
-    bool GetCoinsByScript(const CScript &script, CCoinsByScript &coins);
+    void AddOutput(const CScript &script, const COutPoint &outpoint, const CAddressOutput &output);
+    void SpendOutput(const CScript &script, const COutPoint &outpoint);
 
-    // Return a modifiable reference to a CCoinsByScript.
-    CCoinsByScript &GetCoinsByScript(const CScript &script, bool fRequireExisting = true);
+    //! Visit the unspent outputs of a script without loading them all, cached changes take precedence over the database
+    bool ForEachOutputByScript(const CScript &script, const AddressOutputVisitor &visitor) const;
+    bool GetCoinsByScript(const CScript &script, CCoinsByScript &coins) const;
+    bool GetBalanceByScript(const CScript &script, CAmount &nBalance) const;
 
     static uint256 getKey(const CScript &script); // we use the hash of the script as key in the database
-
-private:
-    CCoinsMapByScript::iterator FetchCoinsByScript(const CScript &script, bool fRequireExisting);
 };
 
 #endif // BITCOIN_COINSBYSCRIPT_H
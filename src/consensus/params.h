@@ -56,6 +56,8 @@ struct Params {
     /** Block height and hash at which BIP34 becomes active */
     int BIP34Height;
     int NoRewardHeight;
+    /** Block height from which club rewards are split with exact integer arithmetic */
+    int FixedPointRewardHeight;
     uint256 BIP34Hash;
     /**
      * Minimum blocks including miner confirmation of the total of 2016 blocks in a retargetting period,
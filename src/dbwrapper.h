@@ -276,6 +276,25 @@ public:
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /** Iterate over the database as it was when the snapshot was taken */
+    CDBIterator *NewIterator(const leveldb::Snapshot* snapshot)
+    {
+        leveldb::ReadOptions snapshotoptions = iteroptions;
+        snapshotoptions.snapshot = snapshot;
+        return new CDBIterator(*this, pdb->NewIterator(snapshotoptions));
+    }
+
+    /** Pin the current state of the database, it must be released with ReleaseSnapshot */
+    const leveldb::Snapshot* GetSnapshot()
+    {
+        return pdb->GetSnapshot();
+    }
+
+    void ReleaseSnapshot(const leveldb::Snapshot* snapshot)
+    {
+        pdb->ReleaseSnapshot(snapshot);
+    }
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
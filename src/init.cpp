@@ -65,6 +65,8 @@ using namespace std;
 
 bool fFeeEstimatesInitialized = false;
 static const bool DEFAULT_PROXYRANDOMIZE = true;
+//! Memory for the newest address records read on demand, 0 when they are all loaded at startup
+static int64_t nRewardReadCache = 0;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
@@ -159,7 +161,6 @@ public:
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
-static CCoinsViewDB *pcoinsdbview = NULL;
 static CCoinsViewErrorCatcher *pcoinscatcher = NULL;
 static boost::scoped_ptr<ECCVerifyHandle> globalVerifyHandle;
 
@@ -227,16 +228,7 @@ void Shutdown()
 		
         delete pblocktree;
         pblocktree = NULL;
-        {
-            LOCK(cs_addrinfo);
-            if (!paddrinfodb->WriteNewestDataToDisk(chainActive.Height(), true))
-                LogPrintf("%s: Failed to write addrInfoDB to disk\n", __func__);
-        }
-        {
-            LOCK(cs_clubinfo);
-            if (!pclubinfodb->WriteDataToDisk(chainActive.Height(), true))
-                LogPrintf("%s: Failed to write clubInfoDB to disk\n", __func__);
-        }
+        // The reward databases were flushed together with the chainstate above
         delete paddrinfodb;
         paddrinfodb = NULL;
         delete pclubinfodb;
@@ -341,6 +333,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
+    strUsage += HelpMessageOpt("-lazyrewarddb", strprintf(_("Read address reward records from disk on demand instead of loading all of them at startup (default: %u)"), DEFAULT_REWARDDB_LAZYLOAD));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
@@ -420,7 +413,9 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-checkclubs", strprintf("Recompute the members and mining power below every club member after each block and compare them with the ones kept in memory (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-prefetchinputs", strprintf("Read the coins and address records of a block on the script verification threads before connecting it (default: %u)", DEFAULT_PREFETCH_INPUTS));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
         strUsage += HelpMessageOpt("-testsafemode", strprintf("Force safe mode (default: %u)", DEFAULT_TESTSAFEMODE));
@@ -431,6 +426,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitancestorsize=<n>", strprintf("Do not accept transactions whose size with all in-mempool ancestors exceeds <n> kilobytes (default: %u)", DEFAULT_ANCESTOR_SIZE_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantcount=<n>", strprintf("Do not accept transactions if any ancestor would have <n> or more in-mempool descendants (default: %u)", DEFAULT_DESCENDANT_LIMIT));
         strUsage += HelpMessageOpt("-limitdescendantsize=<n>", strprintf("Do not accept transactions if any ancestor would have more than <n> kilobytes of in-mempool descendants (default: %u).", DEFAULT_DESCENDANT_SIZE_LIMIT));
+        strUsage += HelpMessageOpt("-limitrewardspends=<n>", strprintf("Do not accept transactions spending the rewards of a pubkey with <n> or more in-mempool reward spends (default: %u)", DEFAULT_REWARD_SPEND_LIMIT));
     }
     string debugCategories = "addrman, alert, bench, coindb, db, http, libevent, lock, mempool, mempoolrej, net, proxy, prune, rand, reindex, rpc, selectcoins, tor, zmq, pot, club, reward"; // Don't translate these and qt below
     if (mode == HMM_BITCOIN_QT)
@@ -626,6 +622,8 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         else
             pclubinfodb = new CClubInfoDB(nTotalCache / 8);
         paddrinfodb = new CAddrInfoDB(nTotalCache / 8, pclubinfodb);
+        if (nRewardReadCache > 0)
+            paddrinfodb->EnableLazyLoad(nRewardReadCache);
 
         int nFile = 0;
         InitBlockIndex(chainparams);
@@ -933,12 +931,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (mapArgs.count("-blockminsize"))
         InitWarning("Unsupported argument -blockminsize ignored.");
 
-    // Checkmempool and checkblockindex default to true in regtest mode
+    // Checkmempool, checkblockindex and checkclubs default to true in regtest mode
     int ratio = std::min<int>(std::max<int>(GetArg("-checkmempool", chainparams.DefaultConsistencyChecks() ? 1 : 0), 0), 1000000);
     if (ratio != 0) {
         mempool.setSanityCheck(1.0 / ratio);
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
+    fCheckClubs = GetBoolArg("-checkclubs", chainparams.DefaultConsistencyChecks());
+    fPrefetchInputs = GetBoolArg("-prefetchinputs", DEFAULT_PREFETCH_INPUTS);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
     // mempool limits
@@ -1268,23 +1268,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     // cache size calculations
-    int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
-    nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
-    nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    nBlockTreeDBCache = std::min(nBlockTreeDBCache, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
-    nTotalCache -= nBlockTreeDBCache;
-    int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
-    nCoinDBCache = std::min(nCoinDBCache, nMaxCoinsDBCache << 20); // cap total coins db cache
-    nTotalCache -= nCoinDBCache;
-    nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    CDBCacheSizes cacheSizes = CalculateDBCacheSizes();
+    nRewardReadCache = cacheSizes.nRewardRead;
+    nCoinCacheUsage = cacheSizes.nCoinCacheUsage;
     LogPrintf("Cache configuration:\n");
-    LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
-    LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for block index database\n", cacheSizes.nBlockTreeDB * (1.0 / 1024 / 1024));
+    LogPrintf("* Using %.1fMiB for chain state database\n", cacheSizes.nCoinDB * (1.0 / 1024 / 1024));
+    if (nRewardReadCache > 0)
+        LogPrintf("* Using %.1fMiB for address reward records\n", nRewardReadCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool fLoaded = false;
-    while (!fLoaded) {
+    while (!fLoaded && !fRequestShutdown) {
         bool fReset = fReindex;
         std::string strLoadError;
 
@@ -1302,30 +1297,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                 delete pclubinfodb;
                 delete prewardratedbview;
 
-                pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
-                pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
+                if (!OpenChainstateDBs(cacheSizes, fReindex, fReindex || fReindexChainState, strLoadError))
+                    break;
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
-                if (mapArgs.count("-updaterewardrate") && mapMultiArgs["-updaterewardrate"].size() > 0)
-                {
-                    string flag = mapMultiArgs["-updaterewardrate"][0];
-                    if (flag.compare("true") == 0)
-                        prewardratedbview = new CRewardRateViewDB();
-                    pclubinfodb = new CClubInfoDB(nTotalCache / 8, prewardratedbview);
-                }
-                else
-                    pclubinfodb = new CClubInfoDB(nTotalCache / 8);
-                if (!pclubinfodb->LoadDBToMemory())
-                {
-                    strLoadError = _("Error loading clubInfoDB from disk");
-                    break;
-                }
-                paddrinfodb = new CAddrInfoDB(nTotalCache / 8, pclubinfodb);
-                if (!paddrinfodb->LoadNewestDBToMemory())
-                {
-                    strLoadError = _("Error loading addrInfoDB from disk");
-                    break;
-                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1362,64 +1337,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     strLoadError = _("You need to rebuild the database using -reindex to go back to unpruned mode.  This will redownload the entire blockchain");
                     break;
                 }
-				
+
                 // Check -txoutsbyaddressindex
-               pblocktree->ReadFlag("txoutsbyaddressindex", fTxOutsByAddressIndex);
-               if (mapArgs.count("-txoutsbyaddressindex"))
-                {
-                    if (GetBoolArg("-txoutsbyaddressindex", false))
-                    {
-                        // build index
-                        if (!fTxOutsByAddressIndex)
-                        {
-                            if (!pcoinsdbview->DeleteAllCoinsByScript())
-                            {
-                                strLoadError = _("Error deleting txoutsbyaddressindex");
-                                break;
-                            }
-                            if (!pcoinsdbview->GenerateAllCoinsByScript())
-                            {
-                                strLoadError = _("Error building txoutsbyaddressindex");
-                                break;
-                            }
-                            CCoinsStats stats;
-                            if (!pcoinsdbview->GetStats(stats))
-                            {
-                               strLoadError = _("Error GetStats for txoutsbyaddressindex");
-                                break;
-                            }
-                            if (stats.nTransactionOutputs != stats.nAddressesOutputs)
-                            {
-                                strLoadError = _("Error compare stats for txoutsbyaddressindex");
-                                break;
-                            }
-                            pblocktree->WriteFlag("txoutsbyaddressindex", true);
-                            fTxOutsByAddressIndex = true;
-                        }
-                    }
-                    else
-                   {
-                       if (fTxOutsByAddressIndex)
-                        {
-                            // remove index
-                            pcoinsdbview->DeleteAllCoinsByScript();
-                            pblocktree->WriteFlag("txoutsbyaddressindex", false);
-                            fTxOutsByAddressIndex = false;
-                        }
-                    }
-                }
-                else if (fTxOutsByAddressIndex)
+                pblocktree->ReadFlag("txoutsbyaddressindex", fTxOutsByAddressIndex);
+                if (!mapArgs.count("-txoutsbyaddressindex") && fTxOutsByAddressIndex)
                     return InitError(_("You need to provide -txoutsbyaddressindex. Do -txoutsbyaddressindex=0 to delete the index."));
+                if (!LoadAddressIndex(GetBoolArg("-txoutsbyaddressindex", false), strLoadError))
+                    break;
 
-                // Init -txoutsbyaddressindex
-               if (fTxOutsByAddressIndex)
-               {
-                   pcoinsByScript = new CCoinsViewByScript(pcoinsdbview);
-                   pcoinsdbview->SetCoinsViewByScript(pcoinsByScript);
-               }
-				
                 if (!fReindex) {
                     uiInterface.InitMessage(_("Rewinding blocks..."));
+                    if (!RewindRewardDBs(chainparams)) {
+                        strLoadError = _("Error loading heights of addrInfoDB and clubInfoDB from disk");
+                        break;
+                    }
                     if (!RewindBlockIndex(chainparams)) {
                         strLoadError = _("Unable to rewind the database to a pre-fork state. You will need to redownload the blockchain");
                         break;
@@ -1466,7 +1397,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
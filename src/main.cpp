@@ -80,6 +80,8 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fCheckClubs = false;
+bool fPrefetchInputs = DEFAULT_PREFETCH_INPUTS;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -679,6 +681,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
     return chain.Genesis();
 }
 
+CCoinsViewDB *pcoinsdbview = NULL;
 CCoinsViewCache *pcoinsTip = NULL;
 CCoinsViewByScript *pcoinsByScript = NULL;
 CBlockTreeDB *pblocktree = NULL;
@@ -1166,6 +1169,29 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state)
     return true;
 }
 
+static void LimitMempoolRewardSpends(CTxMemPool& pool) {
+    AssertLockHeld(cs_main);
+    map<string, CAmount> mapPending;
+    {
+        LOCK(pool.cs);
+        for (std::map<std::string, CMemPoolRewardSpends>::const_iterator it = pool.mapMemReward.begin(); it != pool.mapMemReward.end(); it++)
+            mapPending[it->first] = it->second.nPending;
+    }
+    map<string, CAmount> mapOverspent;
+    for (map<string, CAmount>::const_iterator it = mapPending.begin(); it != mapPending.end(); it++) {
+        CAmount nBalance = paddrinfodb->GetRwdByPubkey(it->first);
+        if (it->second > nBalance)
+            mapOverspent[it->first] = nBalance;
+    }
+    if (mapOverspent.empty())
+        return;
+
+    // The newest spends of a pubkey whose reward balance went down are evicted until the rest fits
+    unsigned int nEvicted = pool.TrimRewardSpends(mapOverspent);
+    if (nEvicted != 0)
+        LogPrint("mempool", "Removed %u reward spends over the reward balance from the memory pool\n", nEvicted);
+}
+
 void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     int expired = pool.Expire(GetTime() - age);
     if (expired != 0)
@@ -1233,14 +1259,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
     // Check for conflicts with in-memory transactions
     set<uint256> setConflicts;
+    map<string, CAmount> mapPendingRewards;
     {
-    LOCK(pool.cs); // protect pool.mapNextTx && pool.mapRewardTx
-    BOOST_FOREACH(const CTxReward &txReward, tx.vreward)
-    {
-        auto itConflictReward = pool.mapMemReward.find(txReward.senderPubkey);
-        if (itConflictReward != pool.mapMemReward.end())
-            return state.Invalid(false, REJECT_CONFLICT, "txn-mempool-reward-conflict");
-    }
+    LOCK(pool.cs); // protect pool.mapNextTx && pool.mapMemReward
+    // Reward spends of a pubkey chain in the pool, up to a limit, as long as
+    // their sum stays within its reward balance
+    if (!pool.CalculateRewardSpends(tx, GetArg("-limitrewardspends", DEFAULT_REWARD_SPEND_LIMIT), mapPendingRewards))
+        return state.DoS(0, false, REJECT_NONSTANDARD, "too-long-mempool-reward-chain");
     BOOST_FOREACH(const CTxIn &txin, tx.vin)
     {
         auto itConflicting = pool.mapNextTx.find(txin.prevout);
@@ -1282,6 +1307,12 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     }
     }
 
+    for (map<string, CAmount>::const_iterator it = mapPendingRewards.begin(); it != mapPendingRewards.end(); it++)
+    {
+        if (!MoneyRange(it->second) || it->second > paddrinfodb->GetRwdByPubkey(it->first))
+            return state.Invalid(false, REJECT_CONFLICT, "txn-mempool-reward-overspend");
+    }
+
     {
         CCoinsView dummy;
         CCoinsViewCache view(&dummy);
@@ -1571,12 +1602,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
 
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true)) {
+        PrecomputedTransactionData txdata(tx);
+        if (!CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata)) {
             // SCRIPT_VERIFY_CLEANSTACK requires SCRIPT_VERIFY_WITNESS, so we
             // need to turn both off, and compare against just turning off CLEANSTACK
             // to see if the failure is specifically due to witness validation.
-            if (CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true) &&
-                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true)) {
+            if (CheckInputs(tx, state, view, true, scriptVerifyFlags & ~(SCRIPT_VERIFY_WITNESS | SCRIPT_VERIFY_CLEANSTACK), true, txdata) &&
+                !CheckInputs(tx, state, view, true, scriptVerifyFlags & ~SCRIPT_VERIFY_CLEANSTACK, true, txdata)) {
                 // Only the witness is wrong, so the transaction itself may be fine.
                 state.SetCorruptionPossible();
             }
@@ -1592,13 +1624,13 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
-        if (!CheckRewards(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true))
+        if (!CheckRewards(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata))
             return false;
 
         // Remove conflicting transactions from the mempool
@@ -1977,37 +2009,122 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
     UpdateCoins(tx, inputs, txundo, nHeight);
 }
 
-bool UpdateRewards(const CBlock& block, CAmount blockReward, int nHeight)
+static CCheckQueue<CCheckJob> scriptcheckqueue(128);
+
+void ThreadScriptCheck() {
+    RenameThread("bitcoin-scriptch");
+    scriptcheckqueue.Thread();
+}
+
+static void AddScriptChecks(CCheckQueueControl<CCheckJob>& control, std::vector<CScriptCheck>& vChecks)
+{
+    std::vector<CCheckJob> vJobs(vChecks.size());
+    for (unsigned int i = 0; i < vChecks.size(); i++)
+        vJobs[i].SetScriptCheck(vChecks[i]);
+    control.Add(vJobs);
+}
+
+/**
+ * Run a batch of checks on the script check threads, or on the calling thread when
+ * there are none. False if any of them fails. Callers hold cs_main, or run at startup
+ * before any block is connected, so batches never overlap.
+ */
+template <typename T>
+static bool RunCheckJobs(std::vector<T>& vChecks)
+{
+    if (nScriptCheckThreads && vChecks.size() > 1)
+    {
+        std::vector<CCheckJob> vJobs;
+        vJobs.reserve(vChecks.size());
+        BOOST_FOREACH(const T& check, vChecks)
+            vJobs.push_back(CCheckJob(check));
+        CCheckQueueControl<CCheckJob> control(&scriptcheckqueue);
+        control.Add(vJobs);
+        return control.Wait();
+    }
+
+    BOOST_FOREACH(T& check, vChecks)
+        if (!check())
+            return false;
+    return true;
+}
+
+bool CRewardSenderCheck::operator()() {
+    if (!ConvertPubkeyToAddress(senderPubkey, *pAddress))
+        return false;
+    if (CBitcoinAddress(*pAddress).IsScript())
+        return error("%s: the reward sender %s is a script, which is not allowed to be spent", __func__, *pAddress);
+    return true;
+}
+
+/**
+ * Apply the reward spends of a block. Only their senders are decoded on the script
+ * check threads, the changes are then applied club by club on the calling thread.
+ */
+static bool UpdateRewardSpends(const CBlock& block, int nHeight, bool isUndo)
 {
-    if (block.vtx.size() > 1)
+    size_t nRewards = 0;
+    for (unsigned int j = 1; j < block.vtx.size(); j++)
+        nRewards += block.vtx[j].vreward.size();
+    if (nRewards == 0)
+        return true;
+
+    // The checks write the sender addresses in place, so the changes must not be reallocated
+    std::vector<std::pair<std::string, CAmount> > vRewardChanges;
+    std::vector<CRewardSenderCheck> vChecks;
+    vRewardChanges.reserve(nRewards);
+    vChecks.reserve(nRewards);
+    for (unsigned int j = 1; j < block.vtx.size(); j++)
     {
-        for (unsigned int j = 1; j < block.vtx.size(); j++)
+        const CTransaction &tx = block.vtx[j];
+        for (unsigned int k = 0; k < tx.vreward.size(); k++)
         {
-            const CTransaction &tx = block.vtx[j];
-            if (!paddrinfodb->UpdateRewardsByTX(tx, blockReward, nHeight))
-                return false;
+            vRewardChanges.push_back(std::make_pair(std::string(), 0 - tx.vreward[k].rewardBalance));
+            vChecks.push_back(CRewardSenderCheck(tx.vreward[k].senderPubkey, &vRewardChanges.back().first));
         }
     }
 
+    if (!RunCheckJobs(vChecks))
+        return error("%s: invalid reward sender at height %d", __func__, nHeight);
+
+    if (!paddrinfodb->UpdateRewardsByChanges(vRewardChanges, nHeight, isUndo))
+        return error("%s: unable to apply the reward spends at height %d", __func__, nHeight);
+    return true;
+}
+
+/**
+ * With -checkclubs, recompute the subtrees of the club members from their records. The totals kept in
+ * memory answer the club RPCs and they are not written to disk.
+ */
+static void CheckClubs()
+{
+    if (!fCheckClubs)
+        return;
+    bool fConsistent = pclubinfodb->CheckSubtrees();
+    assert(fConsistent);
+}
+
+bool UpdateRewards(const CBlock& block, CAmount blockReward, int nHeight)
+{
+    if (!UpdateRewardSpends(block, nHeight, false))
+        return false;
+
     if (!paddrinfodb->UpdateRewardsByTX(block.vtx[0], blockReward, nHeight))
         return false;
 
     paddrinfodb->Commit(nHeight);
     paddrinfodb->ClearCache();
+    CheckClubs();
 
     return true;
 }
 
 bool UndoRewards(const CBlock& block, CAmount blockReward, int nHeight)
 {
-    for (unsigned int j = 0; j < block.vtx.size(); j++)
-    {
-        const CTransaction &tx = block.vtx[j];
-        if (!paddrinfodb->UpdateRewardsByTX(tx, blockReward, nHeight, true))
-            return false;
-    }
+    if (!paddrinfodb->UpdateRewardsByTX(block.vtx[0], blockReward, nHeight, true))
+        return false;
 
-    return true;
+    return UpdateRewardSpends(block, nHeight, true);
 }
 
 bool IsForgeScript(const CScript& script, CBitcoinAddress& addr, uint64_t& miningPower)
@@ -2030,9 +2147,11 @@ bool IsForgeScript(const CScript& script, CBitcoinAddress& addr, uint64_t& minin
 }
 
 bool CScriptCheck::operator()() {
+    if (fReward)
+        return RewardCheck();
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
     const CScriptWitness *witness = (nIn < ptxTo->wit.vtxinwit.size()) ? &ptxTo->wit.vtxinwit[nIn].scriptWitness : NULL;
-    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata), &error)) {
         return false;
     }
     return true;
@@ -2043,7 +2162,7 @@ bool CScriptCheck::RewardCheck()
     bool isCheckReward = true;
     const CScript &scriptSig = ptxTo->vreward[nIn].scriptSig;
     const CScriptWitness *witness = (nIn < ptxTo->wit.vtxinwit.size()) ? &ptxTo->wit.vtxinwit[nIn].scriptWitness : NULL;
-    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, isCheckReward), &error)) {
+    if (!VerifyScript(scriptSig, scriptPubKey, witness, nFlags, CachingTransactionSignatureChecker(ptxTo, nIn, amount, cacheStore, *txdata, isCheckReward), &error)) {
         return false;
     }
     return true;
@@ -2169,7 +2288,7 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
 }
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks)
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!tx.IsCoinBase())
     {
@@ -2196,7 +2315,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                 assert(coins);
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore);
+                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2209,7 +2328,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
                         CScriptCheck check2(*coins, tx, i,
-                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
+                                flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
                     }
@@ -2229,7 +2348,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
     return true;
 }
 
-bool CheckRewards(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore)
+bool CheckRewards(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks)
 {
     if (!CheckTxRewards(tx, state))
         return false;
@@ -2262,11 +2381,18 @@ bool CheckRewards(const CTransaction& tx, CValidationState &state, const CCoinsV
                     return state.DoS(100, false, REJECT_INVALID, "bad-txn-balance-largethandb");
                 }
             }
+        }
+
+        if (pvChecks)
+            pvChecks->reserve(pvChecks->size() + tx.vreward.size());
 
+        for (unsigned int i = 0; i < tx.vreward.size(); i++) {
             // Verify signature
-            CScriptCheck check(tx, i, flags, cacheStore);
-            if (!check.RewardCheck())
-            {
+            CScriptCheck check(tx, i, flags, cacheStore, &txdata);
+            if (pvChecks) {
+                pvChecks->push_back(CScriptCheck());
+                check.swap(pvChecks->back());
+            } else if (!check()) {
                 // Failures of other flags indicate a transaction that is
                 // invalid in new blocks, e.g. a invalid P2SH. We DoS ban
                 // such nodes as they are not following the protocol. That
@@ -2391,6 +2517,230 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
+/** Undo the rewards and the relationships of a block by replaying its transactions in reverse */
+static bool ReplayRewardsUndo(const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex, const CCoinsViewCache& view)
+{
+    AssertLockHeld(cs_addrinfo);
+    AssertLockHeld(cs_clubinfo);
+
+    // the spent outputs are taken from the undo data, so that the coins view is not needed
+    vector<map<string, CAmount> > vfather_amount;
+    vfather_amount.resize(block.vtx.size());
+    CAmount nFees = 0;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+        if (txundo.vprevout.size() != tx.vin.size())
+            return error("DisconnectRewards(): transaction and undo data inconsistent");
+        for (unsigned int j = tx.vin.size(); j-- > 0;) {
+            const CTxInUndo &undo = txundo.vprevout[j];
+            CBitcoinAddress addr;
+            string address;
+            if (!addr.ScriptPub2Addr(undo.txout.scriptPubKey, address))
+                return false;
+            vfather_amount[i][address] = undo.txout.nValue;
+            nFees += undo.txout.nValue;
+        }
+        for (unsigned int k = tx.vreward.size(); k-- > 0;)
+            nFees += tx.vreward[k].rewardBalance;
+        for (unsigned int o = tx.vout.size(); o-- > 0;)
+            nFees -= tx.vout[o].nValue;
+    }
+
+    if (!UndoRewards(block, nFees, pindex->nHeight))
+        return error("DisconnectRewards(): UndoRewards failed");
+    for (size_t k = block.vtx.size(); k-- > 0;)
+    {
+        const CTransaction &tx = block.vtx[k];
+        if (!paddrinfodb->UndoMiningPowerByTX(tx, view, pindex->nHeight, vfather_amount[k]))
+            return error("DisconnectRewards(): UndoMiningPowerByTX failed");
+    }
+    if (!paddrinfodb->UndoClubMembers(pindex->nHeight))
+        return error("DisconnectRewards(): UndoClubMembers failed");
+    paddrinfodb->UndoCacheRecords(pindex->nHeight);
+
+    return true;
+}
+
+bool DisconnectRewards(const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex, const CCoinsViewCache& view)
+{
+    if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
+        return error("DisconnectRewards(): block and undo data inconsistent");
+
+    bool isUndo = true;
+    paddrinfodb->ClearUndoCache();
+    paddrinfodb->ClearCache();
+    if (paddrinfodb->GetCurrentHeight() == pindex->nHeight)
+    {
+        LOCK2(cs_addrinfo, cs_clubinfo);
+        // Blocks connected with an undo log of their club changes are undone by reverting these changes,
+        // the older ones by replaying their transactions
+        int64_t nStart = GetTimeMicros();
+        if (pclubinfodb->HaveUndoLog(pindex->nHeight))
+        {
+            if (!paddrinfodb->UndoBlockByLog(pindex->nHeight))
+                return error("DisconnectRewards(): UndoBlockByLog failed");
+        }
+        else if (!ReplayRewardsUndo(block, blockUndo, pindex, view))
+            return false;
+        LogPrint("bench", "    - Undo rewards: %.2fms\n", 0.001 * (GetTimeMicros() - nStart));
+
+        paddrinfodb->Commit(pindex->nHeight-1, isUndo);
+        paddrinfodb->ClearUndoCache();
+        paddrinfodb->ClearCache();
+        CheckClubs();
+    }
+
+    return true;
+}
+
+bool RewindRewardDBs(const CChainParams& chainparams)
+{
+    LOCK(cs_main);
+
+    int nHeight = paddrinfodb->GetCurrentHeight();
+    if (nHeight != pclubinfodb->GetCurrentHeight())
+        return error("RewindRewardDBs: heights of addrInfoDB(%d) and clubInfoDB(%d) differ",
+                     nHeight, pclubinfodb->GetCurrentHeight());
+    if (nHeight <= chainActive.Height())
+        return true;
+
+    // The reward databases were flushed after the chainstate was, so they are ahead of it
+    // and the blocks in between are undone with their undo data
+    BlockMap::iterator mi = mapBlockIndex.find(paddrinfodb->GetFlushedBlockHash());
+    if (mi == mapBlockIndex.end())
+        return error("RewindRewardDBs: block of the reward databases at height %d not found", nHeight);
+    CBlockIndex* pindex = mi->second;
+    if (pindex->nHeight != nHeight || pindex->GetAncestor(chainActive.Height()) != chainActive.Tip())
+        return error("RewindRewardDBs: block of the reward databases is not on the active chain");
+
+    LogPrintf("%s: rewinding reward databases from height %d to %d\n", __func__, nHeight, chainActive.Height());
+    CCoinsViewCache view(pcoinsTip);
+    for (; pindex->nHeight > chainActive.Height(); pindex = pindex->pprev) {
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return error("RewindRewardDBs: ReadBlockFromDisk failed at height %d", pindex->nHeight);
+        CBlockUndo blockUndo;
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull() || !UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash()))
+            return error("RewindRewardDBs: failure reading undo data at height %d", pindex->nHeight);
+        if (!DisconnectRewards(block, blockUndo, pindex, view))
+            return error("RewindRewardDBs: DisconnectRewards failed at height %d", pindex->nHeight);
+    }
+
+    return true;
+}
+
+CDBCacheSizes CalculateDBCacheSizes()
+{
+    CDBCacheSizes sizes;
+    int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
+    nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
+    nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greated than nMaxDbcache
+    sizes.nBlockTreeDB = nTotalCache / 8;
+    sizes.nBlockTreeDB = std::min(sizes.nBlockTreeDB, (GetBoolArg("-txindex", DEFAULT_TXINDEX) ? nMaxBlockDBAndTxIndexCache : nMaxBlockDBCache) << 20);
+    nTotalCache -= sizes.nBlockTreeDB;
+    sizes.nCoinDB = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
+    sizes.nCoinDB = std::min(sizes.nCoinDB, nMaxCoinsDBCache << 20); // cap total coins db cache
+    nTotalCache -= sizes.nCoinDB;
+    sizes.nRewardRead = 0;
+    if (GetBoolArg("-lazyrewarddb", DEFAULT_REWARDDB_LAZYLOAD)) {
+        sizes.nRewardRead = nTotalCache / 8; // the newest address records read on demand
+        nTotalCache -= sizes.nRewardRead;
+    }
+    sizes.nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
+    sizes.nRewardDB = nTotalCache / 8;
+    return sizes;
+}
+
+bool OpenChainstateDBs(const CDBCacheSizes& cacheSizes, bool fWipeBlockTree, bool fWipeChainState, std::string& strLoadError)
+{
+    pblocktree = new CBlockTreeDB(cacheSizes.nBlockTreeDB, false, fWipeBlockTree);
+    pcoinsdbview = new CCoinsViewDB(cacheSizes.nCoinDB, false, fWipeChainState);
+    if (!pcoinsdbview->Upgrade()) {
+        strLoadError = _("Error upgrading chainstate database");
+        return false;
+    }
+    if (mapArgs.count("-updaterewardrate") && mapMultiArgs["-updaterewardrate"].size() > 0)
+    {
+        string flag = mapMultiArgs["-updaterewardrate"][0];
+        if (flag.compare("true") == 0)
+            prewardratedbview = new CRewardRateViewDB();
+        pclubinfodb = new CClubInfoDB(cacheSizes.nRewardDB, prewardratedbview);
+    }
+    else
+        pclubinfodb = new CClubInfoDB(cacheSizes.nRewardDB);
+    if (!pclubinfodb->LoadDBToMemory())
+    {
+        strLoadError = _("Error loading clubInfoDB from disk");
+        return false;
+    }
+    paddrinfodb = new CAddrInfoDB(cacheSizes.nRewardDB, pclubinfodb);
+    if (cacheSizes.nRewardRead > 0)
+        paddrinfodb->EnableLazyLoad(cacheSizes.nRewardRead);
+    if (!paddrinfodb->LoadNewestDBToMemory())
+    {
+        strLoadError = _("Error loading addrInfoDB from disk");
+        return false;
+    }
+    return true;
+}
+
+bool LoadAddressIndex(bool fAddressIndex, std::string& strLoadError)
+{
+    pblocktree->ReadFlag("txoutsbyaddressindex", fTxOutsByAddressIndex);
+    // Indexes built before the index kept one key per output have to be rebuilt
+    bool fAddressIndexByOutput = false;
+    pblocktree->ReadFlag("txoutsbyaddressoutput", fAddressIndexByOutput);
+    if (fAddressIndex)
+    {
+        // build index
+        if (!fTxOutsByAddressIndex || !fAddressIndexByOutput)
+        {
+            if (!pcoinsdbview->DeleteAllCoinsByScript())
+            {
+                strLoadError = _("Error deleting txoutsbyaddressindex");
+                return false;
+            }
+            if (!pcoinsdbview->GenerateAllCoinsByScript())
+            {
+                strLoadError = _("Error building txoutsbyaddressindex");
+                return false;
+            }
+            CCoinsStats stats;
+            if (!pcoinsdbview->GetStats(stats))
+            {
+                strLoadError = _("Error GetStats for txoutsbyaddressindex");
+                return false;
+            }
+            if (stats.nTransactionOutputs != stats.nAddressesOutputs)
+            {
+                strLoadError = _("Error compare stats for txoutsbyaddressindex");
+                return false;
+            }
+            pblocktree->WriteFlag("txoutsbyaddressindex", true);
+            pblocktree->WriteFlag("txoutsbyaddressoutput", true);
+            fTxOutsByAddressIndex = true;
+        }
+    }
+    else if (fTxOutsByAddressIndex)
+    {
+        // remove index
+        pcoinsdbview->DeleteAllCoinsByScript();
+        pblocktree->WriteFlag("txoutsbyaddressindex", false);
+        pblocktree->WriteFlag("txoutsbyaddressoutput", false);
+        fTxOutsByAddressIndex = false;
+    }
+
+    // Init -txoutsbyaddressindex
+    if (fTxOutsByAddressIndex)
+    {
+        pcoinsByScript = new CCoinsViewByScript(pcoinsdbview);
+        pcoinsdbview->SetCoinsViewByScript(pcoinsByScript);
+    }
+    return true;
+}
+
 bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, CBlockUndo& blockUndo, bool* pfClean)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
@@ -2411,9 +2761,6 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         return error("DisconnectBlock(): block and undo data inconsistent");
 
     // undo transactions in reverse order
-    vector<map<string, CAmount> > vfather_amount;
-    vfather_amount.resize(block.vtx.size());
-    CAmount nFees = 0;
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
@@ -2440,7 +2787,6 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         // restore inputs
         if (i > 0) { // not coinbases
             const CTxUndo &txundo = blockUndo.vtxundo[i-1];
-            map<string, CAmount> father_amount;
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
@@ -2448,47 +2794,15 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
-
-                CBitcoinAddress addr;
-                string address;
-                if (!addr.ScriptPub2Addr(undo.txout.scriptPubKey, address))
-                    return false;
-                father_amount[address] = undo.txout.nValue;
-                nFees += undo.txout.nValue;
             }
-            vfather_amount[i] = father_amount;
-            for (unsigned int k = tx.vreward.size(); k-- > 0;)
-                nFees += tx.vreward[k].rewardBalance;
-            for (unsigned int o = tx.vout.size(); o-- > 0;)
-                nFees -= tx.vout[o].nValue;
         }
     }
 
     if (fClean)
     {
         // restore rewards and relationship
-        bool isUndo = true;
-        paddrinfodb->ClearUndoCache();
-        paddrinfodb->ClearCache();
-        if (paddrinfodb->GetCurrentHeight() == pindex->nHeight)
-        {
-            LOCK2(cs_addrinfo, cs_clubinfo);
-            if (!UndoRewards(block, nFees, pindex->nHeight))
-                return error("DisconnectBlock(): UndoRewards failed");
-            for (size_t k = block.vtx.size(); k-- > 0;)
-            {
-                const CTransaction &tx = block.vtx[k];
-                if (!paddrinfodb->UndoMiningPowerByTX(tx, view, pindex->nHeight, vfather_amount[k]))
-                    return error("DisconnectBlock(): UndoMiningPowerByTX failed");
-            }
-            if (!paddrinfodb->UndoClubMembers(pindex->nHeight))
-                return error("DisconnectBlock(): UndoClubMembers failed");
-            paddrinfodb->UndoCacheRecords(pindex->nHeight);
-
-            paddrinfodb->Commit(pindex->nHeight-1, isUndo);
-            paddrinfodb->ClearUndoCache();
-            paddrinfodb->ClearCache();
-        }
+        if (!DisconnectRewards(block, blockUndo, pindex, view))
+            return false;
 
         // move best block pointer to prevout block
         view.SetBestBlock(pindex->pprev->GetBlockHash());
@@ -2528,11 +2842,215 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
-void ThreadScriptCheck() {
-    RenameThread("bitcoin-scriptch");
-    scriptcheckqueue.Thread();
+bool CProofOfTransactionCheck::operator()() {
+    PotErr error;
+    return CheckProofOfTransaction(prevGenerationSignature, pubKeyOfpackager, nHeight, nTime,
+                                   baseTarget, harvestPower, Params().GetConsensus(), error);
+}
+
+bool CheckProofOfTransactions(std::vector<CProofOfTransactionCheck>& vChecks)
+{
+    return RunCheckJobs(vChecks);
+}
+
+/** Look the balances of one resolved key up at nHeight */
+static void LookupAddressBalance(CAddressBalance& balance, const CScript& script, int nHeight)
+{
+    AssertLockHeld(cs_main);
+    balance.nUtxo = 0;
+    balance.nRewards = 0;
+    balance.nMiningPower = 0;
+    balance.club.clear();
+
+    if (fTxOutsByAddressIndex)
+        pcoinsByScript->GetBalanceByScript(script, balance.nUtxo);
+
+    CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(balance.address, nHeight);
+    if (addrInfo.father.compare(" ") != 0) {
+        std::string father = (addrInfo.father.compare("0") == 0) ? balance.address : addrInfo.father;
+        pclubinfodb->GetMemberMPAndReward(father, addrInfo.index, balance.nMiningPower, balance.nRewards);
+        balance.club = (addrInfo.miner.compare("0") == 0) ? balance.address : addrInfo.miner;
+    }
+}
+
+bool CAddressBalanceResolve::operator()() {
+    CAddressBalance& balance = *pBalance;
+    CBitcoinAddress address(balance.key);
+    if (!address.IsValid()) {
+        std::string strAddr;
+        if (!IsHex(balance.key) || !ConvertPubkeyToAddress(balance.key, strAddr))
+            return true;
+        address.SetString(strAddr);
+        if (!address.IsValid())
+            return true;
+    }
+    balance.address = address.ToString();
+    *pScript = GetScriptForDestination(address.Get());
+    return true;
+}
+
+//! Attempts at looking the balances up one key at a time before cs_main is held for all of them
+static const int MAX_ADDRESS_BALANCE_ATTEMPTS = 3;
+
+void GetAddressBalances(std::vector<CAddressBalance>& vBalances, int& nHeight, uint256& hashTip)
+{
+    int64_t nStart = GetTimeMicros();
+
+    // Decoding the keys is the part that needs no database, it is spread over the script check threads.
+    // They are shared with block validation, so cs_main is held for this batch only.
+    std::vector<CScript> vScripts(vBalances.size());
+    {
+        std::vector<CAddressBalanceResolve> vChecks;
+        vChecks.reserve(vBalances.size());
+        for (unsigned int i = 0; i < vBalances.size(); i++)
+            vChecks.push_back(CAddressBalanceResolve(&vBalances[i], &vScripts[i]));
+        LOCK(cs_main);
+        RunCheckJobs(vChecks);
+    }
+    int64_t nResolved = GetTimeMicros();
+
+    // The lookups start over when a block connects in between, the last attempt holds cs_main throughout
+    const CBlockIndex* pindexTip = NULL;
+    for (int nAttempt = 1; ; nAttempt++) {
+        bool fTipMoved = false;
+        {
+            LOCK(cs_main);
+            pindexTip = chainActive.Tip();
+            if (nAttempt == MAX_ADDRESS_BALANCE_ATTEMPTS) {
+                for (unsigned int i = 0; i < vBalances.size(); i++)
+                    if (!vBalances[i].address.empty())
+                        LookupAddressBalance(vBalances[i], vScripts[i], pindexTip->nHeight);
+                break;
+            }
+        }
+        for (unsigned int i = 0; i < vBalances.size() && !fTipMoved; i++) {
+            if (vBalances[i].address.empty())
+                continue;
+            LOCK(cs_main);
+            if (chainActive.Tip() != pindexTip)
+                fTipMoved = true;
+            else
+                LookupAddressBalance(vBalances[i], vScripts[i], pindexTip->nHeight);
+        }
+        if (!fTipMoved)
+            break;
+    }
+    nHeight = pindexTip->nHeight;
+    hashTip = pindexTip->GetBlockHash();
+
+    int64_t nTime = GetTimeMicros() - nStart;
+    LogPrint("bench", "- Address balances: %u lookups in %.2fms, %.2fms to resolve the keys (%.0f lookups/s)\n",
+             (unsigned int)vBalances.size(), nTime * 0.001, (nResolved - nStart) * 0.001,
+             nTime > 0 ? vBalances.size() * 1000000.0 / nTime : 0.0);
+}
+
+bool CPrefetchCheck::operator()() {
+    try {
+        if (!pEntry->txid.IsNull()) {
+            pEntry->fFound = pcoinsTip->GetCoinsFromBase(pEntry->txid, pEntry->coins);
+            return true;
+        }
+        // No lock is taken here, the records known already are skipped when the results are handed over
+        CBitcoinAddress addr;
+        pEntry->fFound = addr.ScriptPub2Addr(pEntry->scriptPubKey, pEntry->address) &&
+                         paddrinfodb->ReadNewestFromDisk(pEntry->address, pEntry->addrInfo);
+    } catch (const std::exception& e) {
+        pEntry->fFound = false;
+    }
+    return true;
+}
+
+/** Read the entries on the script check threads, then hand what was found to the caches */
+static void RunPrefetch(std::vector<CPrefetchEntry>& vEntries)
+{
+    if (vEntries.empty())
+        return;
+
+    std::vector<CPrefetchCheck> vChecks;
+    vChecks.reserve(vEntries.size());
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        vChecks.push_back(CPrefetchCheck(&vEntries[i]));
+    RunCheckJobs(vChecks);
+
+    BOOST_FOREACH(CPrefetchEntry& entry, vEntries) {
+        if (!entry.fFound)
+            continue;
+        if (!entry.txid.IsNull())
+            pcoinsTip->AddPrefetchedCoins(entry.txid, entry.coins);
+        else
+            paddrinfodb->AddPrefetchedNewest(entry.address, entry.addrInfo);
+    }
+}
+
+/**
+ * Read the coins spent by a block and the newest records of the addresses it pays
+ * or spends from on the script check threads, so that ConnectBlock finds them in memory
+ * instead of reading them from disk one at a time. The addresses of the inputs are
+ * only known from their coins, so they are read in a second round.
+ */
+static void PrefetchBlockInputs(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (!nScriptCheckThreads || !fPrefetchInputs)
+        return;
+
+    // The outputs created by the block itself are not on disk yet
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+
+    std::vector<CPrefetchEntry> vEntries;
+    std::set<uint256> setTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            const uint256& hash = txin.prevout.hash;
+            if (setBlockTxids.count(hash) || pcoinsTip->HaveCoinsInCache(hash) || !setTxids.insert(hash).second)
+                continue;
+            vEntries.push_back(CPrefetchEntry());
+            vEntries.back().txid = hash;
+        }
+    }
+
+    // The club records are all in memory, only the address records may be on disk
+    const bool fAddresses = paddrinfodb->IsLazyLoad();
+    std::set<CScript> setScripts;
+    if (fAddresses) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+            std::vector<CScript> vScripts;
+            BOOST_FOREACH(const CTxOut& txout, tx.vout)
+                vScripts.push_back(txout.scriptPubKey);
+            BOOST_FOREACH(const CTxReward& reward, tx.vreward)
+                vScripts.push_back(CScript() << ParseHex(reward.senderPubkey) << OP_CHECKSIG);
+            BOOST_FOREACH(const CScript& script, vScripts) {
+                if (!setScripts.insert(script).second)
+                    continue;
+                vEntries.push_back(CPrefetchEntry());
+                vEntries.back().scriptPubKey = script;
+            }
+        }
+    }
+    RunPrefetch(vEntries);
+    if (!fAddresses)
+        return;
+
+    vEntries.clear();
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (tx.IsCoinBase())
+            continue;
+        BOOST_FOREACH(const CTxIn& txin, tx.vin) {
+            if (setBlockTxids.count(txin.prevout.hash) || !pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
+                continue;
+            const CCoins* coins = pcoinsTip->AccessCoins(txin.prevout.hash);
+            if (!coins->IsAvailable(txin.prevout.n) || !setScripts.insert(coins->vout[txin.prevout.n].scriptPubKey).second)
+                continue;
+            vEntries.push_back(CPrefetchEntry());
+            vEntries.back().scriptPubKey = coins->vout[txin.prevout.n].scriptPubKey;
+        }
+    }
+    RunPrefetch(vEntries);
 }
 
 // Protected by cs_main
@@ -2715,7 +3233,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
-    CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CCheckJob> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<uint256> vOrphanErase;
     std::vector<int> prevheights;
@@ -2726,6 +3244,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
 
     {
         LOCK2(cs_addrinfo, cs_clubinfo);
@@ -2735,6 +3255,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             nInputs += tx.vin.size();
             nInputs += tx.vreward.size();
+            txdata.emplace_back(tx);
 
             // Update the TX count and the father
             if (!fJustCheck)
@@ -2795,13 +3316,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
                 std::vector<CScriptCheck> vChecks;
                 bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-                if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, nScriptCheckThreads ? &vChecks : NULL))
+                if (!CheckInputs(tx, state, view, fScriptChecks, flags, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                     return error("ConnectBlock(): CheckInputs on %s failed with %s",
                                  tx.GetHash().ToString(), FormatStateMessage(state));
-                if (!CheckRewards(tx, state, view, fScriptChecks, STANDARD_SCRIPT_VERIFY_FLAGS, fCacheResults))
+                if (!CheckRewards(tx, state, view, fScriptChecks, STANDARD_SCRIPT_VERIFY_FLAGS, fCacheResults, txdata[i], nScriptCheckThreads ? &vChecks : NULL))
                     return error("ConnectBlock(): CheckRewards on %s failed with %s",
                                  tx.GetHash().ToString(), FormatStateMessage(state));
-                control.Add(vChecks);
+                AddScriptChecks(control, vChecks);
             }
 
             CTxUndo undoDummy;
@@ -2818,6 +3339,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
         if (!fJustCheck && paddrinfodb->GetCurrentHeight() < pindex->nHeight)
         {
+            // The reward signatures are verified on the script check threads, the reward
+            // databases must not move on to a block with a bad one
+            if (!control.Wait())
+            {
+                paddrinfodb->ClearCache();
+                return state.DoS(100, error("ConnectBlock(): script checks failed"));
+            }
+
             // Commit relationship
             pclubinfodb->Commit(pindex->nHeight);
 
@@ -2910,6 +3439,23 @@ enum FlushStateMode {
  * if they're too large, if it's been a while since the last write,
  * or always and in all cases if we're in prune mode and are deleting files.
  */
+/**
+ * Write the reward database changes since the last flush, along with the block they were
+ * updated to. Restarting after a crash then only has to connect the blocks after it.
+ */
+bool static FlushRewardDBs(bool fSync)
+{
+    AssertLockHeld(cs_main);
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    int nHeight = paddrinfodb->GetCurrentHeight();
+    if (nHeight < 0 || nHeight > chainActive.Height())
+        return true;
+
+    if (!pclubinfodb->WriteDataToDisk(nHeight, fSync))
+        return false;
+    return paddrinfodb->WriteNewestDataToDisk(nHeight, chainActive[nHeight]->GetBlockHash(), fSync);
+}
+
 bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     const CChainParams& chainparams = Params();
     LOCK2(cs_main, cs_LastBlockFile);
@@ -2991,6 +3537,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // overwrite one. Still, use a conservative safety factor of 2.
         if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
+        // Flush the reward databases before the chainstate, so that they are never behind it.
+        if (!FlushRewardDBs(mode == FLUSH_STATE_ALWAYS))
+            return AbortNode(state, "Failed to write to reward databases");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
@@ -3018,19 +3567,19 @@ void PruneAndFlush() {
     FlushStateToDisk(state, FLUSH_STATE_NONE);
 }
 
-void static UpdateAddressIndex(const CTxOut& txout, const COutPoint& outpoint, bool fInsert)
+void static UpdateAddressIndex(const CTxOut& txout, const COutPoint& outpoint, int nHeight, bool fCoinBase, bool fInsert)
 {
     if (!txout.IsNull() && !txout.scriptPubKey.IsUnspendable())
     {
-        CCoinsByScript &coinsByScript = pcoinsByScript->GetCoinsByScript(txout.scriptPubKey, !fInsert);
         if (fInsert)
-            coinsByScript.setCoins.insert(outpoint);
+            pcoinsByScript->AddOutput(txout.scriptPubKey, outpoint, CAddressOutput(txout.nValue, nHeight, fCoinBase));
         else
-            coinsByScript.setCoins.erase(outpoint);
+            pcoinsByScript->SpendOutput(txout.scriptPubKey, outpoint);
     }
 }
 
-void static UpdateAddressIndex(const CBlock& block, CBlockUndo& blockundo, bool fConnect)
+/** Must be called after the coins of the block were flushed to pcoinsTip */
+void static UpdateAddressIndex(const CBlock& block, CBlockUndo& blockundo, int nHeight, bool fConnect)
 {
     if (!fTxOutsByAddressIndex)
         return;
@@ -3047,14 +3596,30 @@ void static UpdateAddressIndex(const CBlock& block, CBlockUndo& blockundo, bool
         if (i > 0)
         {
             for (unsigned int j = 0; j < tx.vin.size(); j++)
-                UpdateAddressIndex(blockundo.vtxundo[i-1].vprevout[j].txout, tx.vin[j].prevout, !fConnect);
+            {
+                const CTxInUndo& undo = blockundo.vtxundo[i-1].vprevout[j];
+                int nPrevHeight = undo.nHeight;
+                bool fPrevCoinBase = undo.fCoinBase;
+                if (!fConnect && nPrevHeight == 0)
+                {
+                    // The undo data only has the height of the last unspent output of a transaction,
+                    // the restored coins have it for the others
+                    const CCoins* coins = pcoinsTip->AccessCoins(tx.vin[j].prevout.hash);
+                    if (coins)
+                    {
+                        nPrevHeight = coins->nHeight;
+                        fPrevCoinBase = coins->fCoinBase;
+                    }
+                }
+                UpdateAddressIndex(undo.txout, tx.vin[j].prevout, nPrevHeight, fPrevCoinBase, !fConnect);
+            }
         }
 
         for (unsigned int j = 0; j < tx.vout.size(); j++)
         {
             CTxOut& txout = const_cast<CTxOut&>(tx.vout[j]);
             const COutPoint outpoint(tx.GetHash(),((uint32_t)j));
-            UpdateAddressIndex(txout, outpoint, fConnect);
+            UpdateAddressIndex(txout, outpoint, nHeight, tx.IsCoinBase(), fConnect);
         }
 
         if (fConnect)
@@ -3134,6 +3699,8 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
 
 }
 
+static int64_t nTimeDisconnect = 0;
+
 /** Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and manually re-limit mempool size after this, with cs_main held. */
 bool static DisconnectTip(CValidationState& state, const CChainParams& chainparams, bool fBare = false)
 {
@@ -3156,9 +3723,10 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
         if (!DisconnectBlock(block, state, pindexDelete, view, blockUndo, &dumy))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
-        UpdateAddressIndex(block, blockUndo, false);
+        UpdateAddressIndex(block, blockUndo, pindexDelete->nHeight, false);
     }
-    LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
+    nTimeDisconnect += GetTimeMicros() - nStart;
+    LogPrint("bench", "- Disconnect block: %.2fms [%.2fs]\n", (GetTimeMicros() - nStart) * 0.001, nTimeDisconnect * 0.000001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
         return false;
@@ -3195,11 +3763,33 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+CBlockConnectTimes GetBlockConnectTimes()
+{
+    LOCK(cs_main);
+    CBlockConnectTimes times;
+    times.nReadFromDisk = nTimeReadFromDisk;
+    times.nPrefetch = nTimePrefetch;
+    times.nCheck = nTimeCheck;
+    times.nForks = nTimeForks;
+    times.nConnect = nTimeConnect;
+    times.nVerify = nTimeVerify;
+    times.nIndex = nTimeIndex;
+    times.nCallbacks = nTimeCallbacks;
+    times.nConnectTotal = nTimeConnectTotal;
+    times.nFlush = nTimeFlush;
+    times.nChainState = nTimeChainState;
+    times.nPostConnect = nTimePostConnect;
+    times.nTotal = nTimeTotal;
+    times.nDisconnect = nTimeDisconnect;
+    return times;
+}
+
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -3224,6 +3814,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock);
+    int64_t nTimePrefetched = GetTimeMicros(); nTimePrefetch += nTimePrefetched - nTime2;
+    LogPrint("bench", "  - Prefetch inputs: %.2fms [%.2fs]\n", (nTimePrefetched - nTime2) * 0.001, nTimePrefetch * 0.000001);
     {
         CBlockUndo blockundo;
         CCoinsViewCache view(pcoinsTip);
@@ -3235,10 +3828,10 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
             return error("ConnectTip(): ConnectBlock %s failed", pindexNew->GetBlockHash().ToString());
         }
         mapBlockSource.erase(pindexNew->GetBlockHash());
-        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
-        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
+        nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTimePrefetched;
+        LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTimePrefetched) * 0.001, nTimeConnectTotal * 0.000001);
         assert(view.Flush());
-        UpdateAddressIndex(*pblock, blockundo, true);
+        UpdateAddressIndex(*pblock, blockundo, pindexNew->nHeight, true);
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -3409,6 +4002,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
         LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
     }
+    LimitMempoolRewardSpends(mempool);
     mempool.check(pcoinsTip);
 
     // Callbacks/notifications for a new best chain.
@@ -3556,6 +4150,7 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
     }
 
     LimitMempoolSize(mempool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+    LimitMempoolRewardSpends(mempool);
 
     // The resulting new best tip may not be in setBlockIndexCandidates anymore, so
     // add it again.
@@ -4008,7 +4603,7 @@ std::vector<unsigned char> GenerateCoinbaseCommitment(CBlock& block, const CBloc
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, CBlockIndex * const pindexPrev, int64_t nAdjustedTime)
 {
     // Check generation signature
-    if (!verifyGenerationSignature(pindexPrev->generationSignature,block.generationSignature, block.pubKeyOfpackager)) {
+    if (!verifyGenerationSignature(pindexPrev->generationSignature, block.generationSignature, block.pubKeyOfpackager)) {
         return state.DoS(90, false, REJECT_INVALID, "mismatch generation signature", false, "proof of tx fail");
     }
 
@@ -4130,7 +4725,8 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL,
+                              bool fCheckPOT=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4162,7 +4758,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (fCheckpointsEnabled && !CheckIndexAgainstCheckpoint(pindexPrev, state, chainparams, hash))
             return error("%s: CheckIndexAgainstCheckpoint(): %s", __func__, state.GetRejectReason().c_str());
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, pindexPrev))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOT, pindexPrev))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, GetAdjustedTime()))
@@ -4510,18 +5106,43 @@ bool static LoadBlockIndexDB()
         vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
     }
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+
+    // Here, we have to check proof of dry stake.
+    // For bitcoin, pow verification is implemented in "LoadBlockIndexGuts".
+    // But for pot, we have to do this work after all BlockIndexed are loaded.
+    // The checks are independent, so they run in batches on the check threads,
+    // and a failed batch is checked again one by one to report the bad index.
+    for (size_t nStart = 0; nStart < vSortedByHeight.size(); nStart += POT_CHECK_BATCH_SIZE)
     {
-        CBlockIndex* pindex = item.second;
+        boost::this_thread::interruption_point();
+        size_t nEnd = std::min(nStart + POT_CHECK_BATCH_SIZE, vSortedByHeight.size());
+        std::vector<CProofOfTransactionCheck> vChecks;
+        vChecks.reserve(nEnd - nStart);
+        for (size_t i = nStart; i < nEnd; i++)
+        {
+            const CBlockIndex* pindex = vSortedByHeight[i].second;
+            if (pindex->pprev)
+                vChecks.push_back(CProofOfTransactionCheck(pindex->GetBlockHeader(), pindex->pprev->generationSignature,
+                                                           pindex->pprev->nHeight, pindex->pprev->nTime));
+        }
+        if (CheckProofOfTransactions(vChecks))
+            continue;
 
-        // Here, we have to check proof of dry stake.
-        // For bitcoin, pow verification is implemented in "LoadBlockIndexGuts".
-        // But for pot, we have to do this work after all BlockIndexed are loaded.
-        if (pindex->pprev) {
-            if (!CheckProofOfTransaction(pindex->GetBlockHeader(), dummy, chainparams.GetConsensus(),
+        for (size_t i = nStart; i < nEnd; i++)
+        {
+            CBlockIndex* pindex = vSortedByHeight[i].second;
+            if (pindex->pprev && !CheckProofOfTransaction(pindex->GetBlockHeader(), dummy, chainparams.GetConsensus(),
                     pindex->pprev)) {
                 return error("LoadBlockIndex(): CheckProofOfTransaction failed: %s", pindex->ToString());
             }
+        }
+    }
+
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+    {
+        CBlockIndex* pindex = item.second;
+
+        if (pindex->pprev) {
 
             if (pindex->nChainDiff != pindex->pprev->nChainDiff + GetBlockProof(*pindex))
             {
@@ -6352,6 +6973,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        // Every header only needs the one before it for its proof of transaction, so check them all
+        // at once on the check threads. If one fails they are checked one by one below, to find it.
+        bool fCheckedPOT = false;
+        BlockMap::iterator miPrev = mapBlockIndex.find(headers[0].hashPrevBlock);
+        if (miPrev != mapBlockIndex.end()) {
+            const CBlockIndex* pindexPrev = miPrev->second;
+            std::vector<CProofOfTransactionCheck> vChecks;
+            vChecks.reserve(headers.size());
+            vChecks.push_back(CProofOfTransactionCheck(headers[0], pindexPrev->generationSignature,
+                                                       pindexPrev->nHeight, pindexPrev->nTime));
+            for (unsigned int n = 1; n < headers.size(); n++) {
+                vChecks.push_back(CProofOfTransactionCheck(headers[n], headers[n-1].generationSignature,
+                                                           pindexPrev->nHeight + n, headers[n-1].nTime));
+            }
+            fCheckedPOT = CheckProofOfTransactions(vChecks);
+        }
+
         CBlockIndex *pindexLast = NULL;
         BOOST_FOREACH(const CBlockHeader& header, headers) {
             CValidationState state;
@@ -6359,7 +6997,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, !fCheckedPOT)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
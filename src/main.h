@@ -33,6 +33,7 @@
 #include <utility>
 #include <vector>
 
+#include <boost/function.hpp>
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
@@ -75,6 +76,8 @@ static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
 static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 /** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
+/** Default for -limitrewardspends, max number of in-mempool transactions spending the rewards of one pubkey */
+static const unsigned int DEFAULT_REWARD_SPEND_LIMIT = 25;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
 /** The maximum size of a blk?????.dat file (since 0.8) */
@@ -84,6 +87,8 @@ static const unsigned int BLOCKFILE_CHUNK_SIZE = 0x1000000; // 16 MiB
 /** The pre-allocation chunk size for rev?????.dat files (since 0.8) */
 static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 
+/** Number of block indexes whose proof of transaction is checked in one batch at startup */
+static const size_t POT_CHECK_BATCH_SIZE = 4096;
 /** Maximum number of script-checking threads allowed */
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
@@ -140,6 +145,8 @@ static const bool DEFAULT_TESTSAFEMODE = false;
 static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
+/** Default for -prefetchinputs */
+static const bool DEFAULT_PREFETCH_INPUTS = true;
 
 /** Maximum number of headers to announce when relaying blocks with headers message.*/
 static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
@@ -173,6 +180,8 @@ extern bool fTxOutsByAddressIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+extern bool fCheckClubs;
+extern bool fPrefetchInputs;
 extern bool fCheckpointsEnabled;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
@@ -359,9 +368,15 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
  * instead of being performed inline.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                 unsigned int flags, bool cacheStore, std::vector<CScriptCheck> *pvChecks = NULL);
+                 unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
 
-bool CheckRewards(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks, unsigned int flags, bool cacheStore);
+/**
+ * Check whether all reward spends of this transaction are valid (balances & sigs). The balances are
+ * checked first, and if pvChecks is not NULL, signature checks are pushed onto it instead of being
+ * performed inline.
+ */
+bool CheckRewards(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
+                  unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
@@ -430,16 +445,18 @@ private:
     unsigned int nIn;
     unsigned int nFlags;
     bool cacheStore;
+    bool fReward; //!< Whether nIn is the position of a reward spend in vreward rather than of an input
     ScriptError error;
+    PrecomputedTransactionData *txdata;
 
 public:
-    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
+    CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), fReward(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(NULL) {}
+    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
-    CScriptCheck(const CTransaction& txToIn, unsigned int nRewardIn, unsigned int nFlagsIn, bool cacheIn) :
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), fReward(false), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
+    CScriptCheck(const CTransaction& txToIn, unsigned int nRewardIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
         scriptPubKey(CScript()<<ParseHex(txToIn.vreward[nRewardIn].senderPubkey)<<OP_CHECKREWARDSIG), amount(txToIn.vreward[nRewardIn].rewardBalance),
-        ptxTo(&txToIn), nIn(nRewardIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+        ptxTo(&txToIn), nIn(nRewardIn), nFlags(nFlagsIn), cacheStore(cacheIn), fReward(true), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
 
@@ -452,12 +469,198 @@ public:
         std::swap(nIn, check.nIn);
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
+        std::swap(fReward, check.fReward);
         std::swap(error, check.error);
+        std::swap(txdata, check.txdata);
     }
 
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * A job run on the script check threads. Script checks are held in place, the other
+ * jobs (reward senders, proof of transaction, prefetch and balance key decoding) are
+ * wrapped, so that all of them share the one queue. It takes a single batch at a time:
+ * its users hold cs_main, except the checks of the block index at startup, which run
+ * before any block is connected or any RPC is served.
+ */
+class CCheckJob
+{
+private:
+    CScriptCheck scriptCheck;
+    boost::function<bool()> check;
+
+public:
+    CCheckJob() {}
+
+    template <typename T>
+    explicit CCheckJob(const T& checkIn) : check(checkIn) {}
+
+    bool operator()() { return check.empty() ? scriptCheck() : check(); }
+
+    void SetScriptCheck(CScriptCheck& checkIn) {
+        scriptCheck.swap(checkIn);
+        check.clear();
+    }
+
+    void swap(CCheckJob &job) {
+        scriptCheck.swap(job.scriptCheck);
+        check.swap(job.check);
+    }
+};
+
+/**
+ * Closure decoding the sender address of one reward spend. The reward changes of
+ * the block are applied afterwards, serially.
+ */
+class CRewardSenderCheck
+{
+private:
+    std::string senderPubkey;
+    std::string* pAddress;
+
+public:
+    CRewardSenderCheck(): pAddress(NULL) {}
+    CRewardSenderCheck(const std::string& senderPubkeyIn, std::string* pAddressIn) :
+        senderPubkey(senderPubkeyIn), pAddress(pAddressIn) { }
+
+    bool operator()();
+
+    void swap(CRewardSenderCheck &check) {
+        senderPubkey.swap(check.senderPubkey);
+        std::swap(pAddress, check.pAddress);
+    }
+};
+
+/** Closure representing the proof of transaction check of one header against its previous block */
+class CProofOfTransactionCheck
+{
+private:
+    CBlockIndexHexField<32> prevGenerationSignature;
+    std::string pubKeyOfpackager;
+    int nHeight;
+    int64_t nTime;
+    uint64_t baseTarget;
+    uint64_t harvestPower;
+
+public:
+    CProofOfTransactionCheck(): nHeight(0), nTime(0), baseTarget(0), harvestPower(0) {}
+    CProofOfTransactionCheck(const CBlockHeader& block, const CBlockIndexHexField<32>& prevGenerationSignatureIn,
+                             int nPrevHeight, unsigned int nPrevTime) :
+        prevGenerationSignature(prevGenerationSignatureIn), pubKeyOfpackager(block.pubKeyOfpackager),
+        nHeight(nPrevHeight + 1), nTime(block.nTime - nPrevTime), baseTarget(block.baseTarget),
+        harvestPower(block.harvestPower) { }
+    CProofOfTransactionCheck(const CBlockHeader& block, const std::string& prevGenerationSignatureIn,
+                             int nPrevHeight, unsigned int nPrevTime) :
+        pubKeyOfpackager(block.pubKeyOfpackager),
+        nHeight(nPrevHeight + 1), nTime(block.nTime - nPrevTime), baseTarget(block.baseTarget),
+        harvestPower(block.harvestPower) {
+        prevGenerationSignature.Set(prevGenerationSignatureIn);
+    }
+
+    bool operator()();
+
+    void swap(CProofOfTransactionCheck &check) {
+        prevGenerationSignature.swap(check.prevGenerationSignature);
+        pubKeyOfpackager.swap(check.pubKeyOfpackager);
+        std::swap(nHeight, check.nHeight);
+        std::swap(nTime, check.nTime);
+        std::swap(baseTarget, check.baseTarget);
+        std::swap(harvestPower, check.harvestPower);
+    }
+};
+
+/** Run a batch of proof of transaction checks on the script check threads, false if any of them fails */
+bool CheckProofOfTransactions(std::vector<CProofOfTransactionCheck>& vChecks);
+
+/** The coins of a transaction or the newest record of an address, read from disk ahead of ConnectBlock */
+struct CPrefetchEntry
+{
+    uint256 txid;           //!< the coins of txid are read if it is not null
+    CScript scriptPubKey;   //!< otherwise the record of the address of this script
+    bool fFound;
+    CCoins coins;
+    std::string address;
+    CTAUAddrInfo addrInfo;
+
+    CPrefetchEntry() : fFound(false) {}
+};
+
+/** Closure reading one prefetch entry, results are written through the pointer */
+class CPrefetchCheck
+{
+private:
+    CPrefetchEntry* pEntry;
+
+public:
+    CPrefetchCheck(): pEntry(NULL) {}
+    CPrefetchCheck(CPrefetchEntry* pEntryIn) : pEntry(pEntryIn) { }
+
+    //! Always true, an entry that cannot be read is left to the validation thread
+    bool operator()();
+
+    void swap(CPrefetchCheck &check) {
+        std::swap(pEntry, check.pEntry);
+    }
+};
+
+//! Max keys in one balance request over RPC or REST
+static const unsigned int MAX_ADDRESS_BALANCE_LOOKUPS = 10000;
+
+/** Balances of a pubkey or an address at the tip of the chain */
+struct CAddressBalance
+{
+    std::string key;         //!< pubkey or address as requested
+    std::string address;     //!< address of the key, empty if the key is invalid
+    CAmount nUtxo;           //!< value of the unspent outputs, from the address index
+    CAmount nRewards;
+    uint64_t nMiningPower;
+    std::string club;        //!< leader of the club of the address, empty if it is in none
+
+    CAddressBalance() : nUtxo(0), nRewards(0), nMiningPower(0) {}
+    CAddressBalance(const std::string& keyIn) : key(keyIn), nUtxo(0), nRewards(0), nMiningPower(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(address);
+        READWRITE(nUtxo);
+        READWRITE(nRewards);
+        READWRITE(nMiningPower);
+        READWRITE(club);
+    }
+};
+
+/** Closure turning the key of one balance into its address and script, results are written through the pointers */
+class CAddressBalanceResolve
+{
+private:
+    CAddressBalance* pBalance;
+    CScript* pScript;
+
+public:
+    CAddressBalanceResolve(): pBalance(NULL), pScript(NULL) {}
+    CAddressBalanceResolve(CAddressBalance* pBalanceIn, CScript* pScriptIn) : pBalance(pBalanceIn), pScript(pScriptIn) { }
+
+    //! Always true, an invalid key is left with an empty address
+    bool operator()();
+
+    void swap(CAddressBalanceResolve &check) {
+        std::swap(pBalance, check.pBalance);
+        std::swap(pScript, check.pScript);
+    }
+};
+
+/**
+ * Look the balances of the keys up, all at the tip returned in nHeight and hashTip. An invalid key
+ * is reported by an empty address. The keys are resolved to addresses on the script check threads,
+ * the balances are then read on the calling thread. cs_main must not be held, it is taken for one
+ * key at a time so that blocks connect while a long list is looked up.
+ */
+void GetAddressBalances(std::vector<CAddressBalance>& vBalances, int& nHeight, uint256& hashTip);
+
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
@@ -488,6 +691,34 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
  *  of problems. Note that in any case, coins may be modified. */
 bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, CBlockUndo& blockundo, bool* pfClean = NULL);
 
+/** Undo the effects of this block (with given index) on the reward database set, using its undo data */
+bool DisconnectRewards(const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex, const CCoinsViewCache& view);
+
+/** When the reward databases are ahead of the chainstate after a crash, rewind them to the active tip */
+bool RewindRewardDBs(const CChainParams& chainparams);
+
+/** Sizes of the database caches, split from -dbcache */
+struct CDBCacheSizes
+{
+    int64_t nBlockTreeDB;
+    int64_t nCoinDB;
+    int64_t nRewardDB;      //!< for each of the club and address databases
+    int64_t nRewardRead;    //!< newest address records read on demand, 0 unless -lazyrewarddb
+    int64_t nCoinCacheUsage;
+};
+
+/** Split -dbcache between the databases, as set by -txindex and -lazyrewarddb */
+CDBCacheSizes CalculateDBCacheSizes();
+
+/**
+ * Open the block tree, coin and reward databases, upgrading the coin database and loading the
+ * reward records. pcoinsTip is left to the caller, it has to be created before LoadBlockIndex.
+ */
+bool OpenChainstateDBs(const CDBCacheSizes& cacheSizes, bool fWipeBlockTree, bool fWipeChainState, std::string& strLoadError);
+
+/** Build or delete the txoutsbyaddressindex of the opened coin database, once the block index is loaded */
+bool LoadAddressIndex(bool fAddressIndex, std::string& strLoadError);
+
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
@@ -520,9 +751,34 @@ bool InvalidateBlock(CValidationState& state, const CChainParams& chainparams, C
 /** Remove invalidity status from a block and its descendants. */
 bool ResetBlockFailureFlags(CBlockIndex *pindex);
 
+/** Time spent in the phases of connecting and disconnecting blocks since startup, in microseconds. */
+struct CBlockConnectTimes
+{
+    int64_t nReadFromDisk;
+    int64_t nPrefetch;
+    int64_t nCheck;
+    int64_t nForks;
+    int64_t nConnect;
+    int64_t nVerify;
+    int64_t nIndex;
+    int64_t nCallbacks;
+    int64_t nConnectTotal;
+    int64_t nFlush;
+    int64_t nChainState;
+    int64_t nPostConnect;
+    int64_t nTotal;
+    int64_t nDisconnect;
+};
+
+/** Get the times that are logged under -debug=bench. */
+CBlockConnectTimes GetBlockConnectTimes();
+
 /** The currently-connected chain of blocks (protected by cs_main). */
 extern CChain chainActive;
 
+/** The coin database below pcoinsTip (protected by cs_main) */
+extern CCoinsViewDB *pcoinsdbview;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
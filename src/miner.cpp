@@ -24,6 +24,8 @@
 #include "utilmoneystr.h"
 #include "validationinterface.h"
 
+#include "init.h"
+
 #include <algorithm>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
@@ -608,3 +610,37 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = txCoinbase;
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+CForgingTipWatcher::CForgingTipWatcher() : pindexTip(NULL)
+{
+    RegisterValidationInterface(this);
+}
+
+CForgingTipWatcher::~CForgingTipWatcher()
+{
+    UnregisterValidationInterface(this);
+}
+
+void CForgingTipWatcher::UpdatedBlockTip(const CBlockIndex *pindex)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    pindexTip = pindex;
+    condTipChanged.notify_all();
+}
+
+bool CForgingTipWatcher::WaitUntil(const CBlockIndex* pindexPrev, int64_t nTime)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    int64_t nNow = GetAdjustedTime();
+    while (nNow < nTime && !ShutdownRequested())
+    {
+        if (pindexTip != NULL && pindexTip != pindexPrev)
+            return false;
+        // Wake up at least every second to notice a shutdown
+        int64_t nWait = std::min(nTime - nNow, (int64_t)1);
+        condTipChanged.timed_wait(lock, boost::posix_time::seconds(nWait));
+        nNow = GetAdjustedTime();
+    }
+
+    return pindexTip == NULL || pindexTip == pindexPrev;
+}
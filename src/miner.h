@@ -8,11 +8,14 @@
 
 #include "primitives/block.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
 #include <memory>
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 class CBlockIndex;
 class CChainParams;
@@ -205,6 +208,30 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Lets a forging loop sleep until its forging deadline, waking it up early
+ * when the active chain tip changes and the deadline has to be recomputed.
+ */
+class CForgingTipWatcher : public CValidationInterface
+{
+private:
+    boost::mutex mutex;
+    boost::condition_variable condTipChanged;
+    //! The last tip notified since the watcher was created
+    const CBlockIndex* pindexTip;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex);
+
+public:
+    CForgingTipWatcher();
+    ~CForgingTipWatcher();
+
+    /** Wait until the adjusted time reaches nTime or the tip moves away from pindexPrev.
+     *  Returns false if the tip changed. */
+    bool WaitUntil(const CBlockIndex* pindexPrev, int64_t nTime);
+};
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
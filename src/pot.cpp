@@ -24,6 +24,7 @@
 #include "utilstrencodings.h"
 #include "hash.h"
 #include "tool.h"
+#include <limits>
 #include <stdint.h>
 #include <univalue.h>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
@@ -67,36 +68,49 @@ uint64_t getLatestBlockBaseTarget(){
     return pblockindex->GetBlockBaseTarget();
 }
 
-uint256 getPotHash(std::string generationSignature,std::string pubKey){
+uint256 getPotHash(const std::string& generationSignature, const std::string& pubKey){
     uint256 ret = Hash(generationSignature.begin(),generationSignature.end(),pubKey.begin(),pubKey.end());
     return ret;
 }
 
+uint256 getPotHash(const CBlockIndexHexField<32>& generationSignature, const std::string& pubKey){
+    uint256 ret;
+    CHash256 hasher;
+    generationSignature.WriteString(hasher);
+    hasher.Write((const unsigned char*)pubKey.data(), pubKey.size()).Finalize((unsigned char*)&ret);
+    return ret;
+}
+
+// The packager key as it is hashed for the generation signature and the hit. A key given as
+// 33 raw bytes is decompressed, while the hex keys of the block headers are hashed as they are.
+static std::string GetPubKeyForHash(const std::string& pukstr)
+{
+    if (pukstr.size() != 33 || (pukstr[0] != 2 && pukstr[0] != 3))
+        return pukstr;
+
+    CPubKey pubkey(pukstr.begin(), pukstr.end());
+    if (!pubkey.Decompress())
+        return std::string();
+    return HexStr(ToByteVector(pubkey));
+}
+
 std::string raiseGenerationSignature(std::string pukstr){
     std::string pSignature = getLatestBlockGenerationSignature();
-    CPubKey pubkey(pukstr.begin(), pukstr.end());
-    std::string strPubKey;
-    if (pubkey.IsCompressed() && pubkey.Decompress()) {
-        strPubKey = HexStr(ToByteVector(pubkey));
-    } else if (!pubkey.IsCompressed()) {
-        strPubKey = pukstr;
-    }
+    std::string strPubKey = GetPubKeyForHash(pukstr);
     uint256 ret = Hash(pSignature.begin(),pSignature.end(),strPubKey.begin(),strPubKey.end());
     return HexStr(ret);
 }
 
-bool verifyGenerationSignature(std::string pGS,std::string generationSignature,std::string pukstr){
-    CPubKey pubkey(pukstr.begin(), pukstr.end());
-    std::string strPubKey;
-    if (pubkey.IsCompressed() && pubkey.Decompress()) {
-        strPubKey = HexStr(ToByteVector(pubkey));
-    } else if (!pubkey.IsCompressed()) {
-        strPubKey = pukstr;
-    }
+bool verifyGenerationSignature(const std::string& pGS, const std::string& generationSignature, const std::string& pukstr){
+    std::string strPubKey = GetPubKeyForHash(pukstr);
     uint256 ret = Hash(pGS.begin(),pGS.end(),strPubKey.begin(),strPubKey.end());
     return generationSignature == HexStr(ret);
 }
 
+bool verifyGenerationSignature(const CBlockIndexHexField<32>& pGS, const std::string& generationSignature, const std::string& pukstr){
+    return generationSignature == HexStr(getPotHash(pGS, GetPubKeyForHash(pukstr)));
+}
+
 std::string GetPubKeyForPackage(){
     boost::shared_ptr<CReserveScript> coinbaseScript;
     GetMainSignals().ScriptForPackage(coinbaseScript);
@@ -185,36 +199,54 @@ uint256 GetNextCumulativeDifficulty(const CBlockIndex* pindexLast, uint64_t base
     return ArithToUint256(ret);
 }
 
-bool CheckProofOfTransaction(const std::string& prevGenerationSignature, const std::string& currPubKey,
-        int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, const Consensus::Params& consensusParams, PotErr& checkErr)
+static bool IsEmptySignature(const std::string& generationSignature)
+{
+    return generationSignature.empty();
+}
+
+static bool IsEmptySignature(const CBlockIndexHexField<32>& generationSignature)
+{
+    return generationSignature.IsEmpty();
+}
+
+static std::string SignatureToString(const std::string& generationSignature)
+{
+    return generationSignature;
+}
+
+static std::string SignatureToString(const CBlockIndexHexField<32>& generationSignature)
+{
+    return generationSignature.ToString();
+}
+
+// The hit of a pubkey on the previous generation signature
+template<typename Signature>
+static uint64_t GetHitOfPubkey(const Signature& prevGenerationSignature, const std::string& currPubKey)
+{
+    uint256 geneSignatureHash = getPotHash(prevGenerationSignature, GetPubKeyForHash(currPubKey));
+    return calculateHitOfPOT(geneSignatureHash);
+}
+
+template<typename Signature>
+static bool CheckProofOfTransactionImpl(const Signature& prevGenerationSignature, const std::string& currPubKey,
+        int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, PotErr& checkErr)
 {
     checkErr = POT_NO_ERR;
 
-    if (prevGenerationSignature.empty() || currPubKey.empty() || nHeight < 0 || nTime <= 0
+    if (IsEmptySignature(prevGenerationSignature) || currPubKey.empty() || nHeight < 0 || nTime <= 0
             || harverstPower == 0) {
         LogPrintf("POT failed, incorrect args, signatrue:%s, pubkey:%s, height:%d, time:%d, hp:%d\n",
-            prevGenerationSignature, currPubKey, nHeight, nTime, harverstPower);
+            SignatureToString(prevGenerationSignature), currPubKey, nHeight, nTime, harverstPower);
         checkErr = POT_ARGS_ERR;
         return false;
     }
 
-    if (fDebugPODS) {
-        LogPrint("pot", "signature:%s, pubkey:%s\n", prevGenerationSignature, currPubKey);
+    if (fDebugPODS && LogAcceptCategory("pot")) {
+        LogPrint("pot", "signature:%s, pubkey:%s\n", SignatureToString(prevGenerationSignature), currPubKey);
         LogPrint("pot", "height:%d, time:%d, baseTarget:%d\n", nHeight, nTime, baseTarget);
     }
 
-    // Note: in block header public key is compressed, but get hit value with uncompressed
-    // public key. So here firstly, we decompress publickey.
-    CPubKey pubkey(currPubKey.begin(), currPubKey.end());
-    std::string strPubKey;
-    if (pubkey.IsCompressed() && pubkey.Decompress()) {
-        strPubKey = HexStr(ToByteVector(pubkey));
-    } else if (!pubkey.IsCompressed()) {
-        strPubKey = currPubKey;
-    }
-
-    uint256 geneSignatureHash = getPotHash(prevGenerationSignature, strPubKey);
-    uint64_t hit = calculateHitOfPOT(geneSignatureHash);
+    uint64_t hit = GetHitOfPubkey(prevGenerationSignature, currPubKey);
 
     arith_uint256 thresold(baseTarget);
     thresold *= arith_uint256((uint64_t)nTime);
@@ -229,4 +261,34 @@ bool CheckProofOfTransaction(const std::string& prevGenerationSignature, const s
 
     return false;
 }
+
+bool CheckProofOfTransaction(const std::string& prevGenerationSignature, const std::string& currPubKey,
+        int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, const Consensus::Params& consensusParams, PotErr& checkErr)
+{
+    return CheckProofOfTransactionImpl(prevGenerationSignature, currPubKey, nHeight, nTime, baseTarget, harverstPower, checkErr);
+}
+
+bool CheckProofOfTransaction(const CBlockIndexHexField<32>& prevGenerationSignature, const std::string& currPubKey,
+        int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, const Consensus::Params& consensusParams, PotErr& checkErr)
+{
+    return CheckProofOfTransactionImpl(prevGenerationSignature, currPubKey, nHeight, nTime, baseTarget, harverstPower, checkErr);
+}
+
+int64_t GetProofOfTransactionDeadline(const std::string& prevGenerationSignature, const std::string& currPubKey,
+        uint64_t baseTarget, uint64_t harverstPower)
+{
+    if (prevGenerationSignature.empty() || currPubKey.empty() || baseTarget == 0 || harverstPower == 0)
+        return -1;
+
+    uint64_t hit = GetHitOfPubkey(prevGenerationSignature, currPubKey);
+
+    // The smallest time whose thresold baseTarget * time * harverstPower is above the hit
+    arith_uint256 rate(baseTarget);
+    rate *= arith_uint256(harverstPower);
+    arith_uint256 deadline = arith_uint256(hit) / rate + 1;
+    if (deadline > arith_uint256((uint64_t)std::numeric_limits<int64_t>::max()))
+        return -1;
+
+    return (int64_t)deadline.GetLow64();
+}
 #endif
@@ -16,6 +16,7 @@
 class CBlockHeader;
 class CBlockIndex;
 class uint256;
+template<unsigned int N> class CBlockIndexHexField;
 //verify your account's right to package block
 //algorithm is h  < Tb * S * Be
 //Tb = Tb * t (target before * 2016 average time of forging block)
@@ -39,11 +40,13 @@ uint256 getPotHash( UniValue value);
 uint64_t signatureCompactWithPubkey(const uint256 &phash, std::vector<unsigned char>& vchSig,CPubKey pubkey);
 
 std::string getLatestBlockGenerationSignature();
-uint256 getPotHash(std::string generationSignature,std::string pubKey);
+uint256 getPotHash(const std::string& generationSignature, const std::string& pubKey);
+uint256 getPotHash(const CBlockIndexHexField<32>& generationSignature, const std::string& pubKey);
 std::string GetPubKeyForPackage();
 uint64_t calculateHitOfPOT(const uint256 &phash);
 std::string raiseGenerationSignature(std::string pukstr);
-bool verifyGenerationSignature(std::string pGS,std::string generationSignature,std::string pukstr);
+bool verifyGenerationSignature(const std::string& pGS, const std::string& generationSignature, const std::string& pukstr);
+bool verifyGenerationSignature(const CBlockIndexHexField<32>& pGS, const std::string& generationSignature, const std::string& pukstr);
 int64_t getPastTimeFromLastestBlock();
 uint64_t getLatestBlockBaseTarget();
 uint64_t getNextPotRequired(const CBlockIndex* pindexLast);
@@ -52,5 +55,13 @@ uint256 GetNextCumulativeDifficulty(const CBlockIndex* pindexLast, uint64_t base
 
 bool CheckProofOfTransaction(const std::string& prevGenerationSignature, const std::string& currPubKey,
         int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, const Consensus::Params& consensusParams, PotErr& checkErr);
+//the same check on the generation signature held in the block index, without building its hex string
+bool CheckProofOfTransaction(const CBlockIndexHexField<32>& prevGenerationSignature, const std::string& currPubKey,
+        int nHeight, int64_t nTime, uint64_t baseTarget, uint64_t harverstPower, const Consensus::Params& consensusParams, PotErr& checkErr);
+
+//the earliest time since the previous block at which CheckProofOfTransaction passes for the pubkey,
+//or -1 if it never does
+int64_t GetProofOfTransactionDeadline(const std::string& prevGenerationSignature, const std::string& currPubKey,
+        uint64_t baseTarget, uint64_t harverstPower);
 
 #endif // TAUCOIN_POS_H
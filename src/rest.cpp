@@ -9,6 +9,8 @@
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "rewarddb/addrinfodb.h"
+#include "rewarddb/clubinfodb.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -58,6 +60,42 @@ struct CCoin {
     }
 };
 
+struct CRestMember {
+    std::string address;
+    std::string club;      // leader of the club
+    std::string father;
+    uint64_t nClubPower;
+    uint64_t nMiningPower;
+    CAmount nRewards;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(address);
+        READWRITE(club);
+        READWRITE(father);
+        READWRITE(nClubPower);
+        READWRITE(nMiningPower);
+        READWRITE(nRewards);
+    }
+};
+
+struct CRestRewardRate {
+    std::string address;   // leader of the club that mined the block
+    double rate;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(address);
+        READWRITE(rate);
+    }
+};
+
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
 extern UniValue mempoolInfoToJSON();
@@ -599,6 +637,303 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+/** Reply with obj prefixed by the height and hash of the tip for .bin and .hex, or with json */
+template <typename T>
+static bool RESTWriteChainObject(HTTPRequest* req, RetFormat rf, int nHeight, const uint256& hashTip, const T& obj, UniValue& json)
+{
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << nHeight << hashTip << obj;
+        string strBinary = ss.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, strBinary);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << nHeight << hashTip << obj;
+        string strHex = HexStr(ss.begin(), ss.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        json.push_back(Pair("chainHeight", nHeight));
+        json.push_back(Pair("chaintipHash", hashTip.GetHex()));
+        string strJSON = json.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+}
+
+/** Look the club membership of an address up at the tip, false if it is in no club. cs_main must be held. */
+static bool GetRestMember(const std::string& strAddress, CRestMember& member)
+{
+    AssertLockHeld(cs_main);
+    int nHeight = chainActive.Height();
+    CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(strAddress, nHeight);
+    if (addrInfo.father.compare(" ") == 0)
+        return false;
+
+    member.address = strAddress;
+    member.club = (addrInfo.miner.compare("0") == 0) ? strAddress : addrInfo.miner;
+    member.father = (addrInfo.father.compare("0") == 0) ? strAddress : addrInfo.father;
+    member.nMiningPower = 0;
+    member.nRewards = 0;
+    if (!pclubinfodb->GetMemberMPAndReward(member.father, addrInfo.index, member.nMiningPower, member.nRewards))
+        return false;
+    member.nClubPower = paddrinfodb->GetHarvestPowerByAddress(member.club, nHeight);
+    return true;
+}
+
+static bool rest_member(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string strAddress;
+    const RetFormat rf = ParseDataFormat(strAddress, strURIPart);
+
+    if (!CBitcoinAddress(strAddress).IsValid())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + strAddress);
+
+    CRestMember member;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        if (!GetRestMember(strAddress, member))
+            return RESTERR(req, HTTP_NOT_FOUND, strAddress + " is not a club member");
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    UniValue objMember(UniValue::VOBJ);
+    objMember.push_back(Pair("address", member.address));
+    objMember.push_back(Pair("clubminer", member.club));
+    objMember.push_back(Pair("clubpower", member.nClubPower));
+    objMember.push_back(Pair("selfpower", member.nMiningPower));
+    objMember.push_back(Pair("father", member.father));
+    objMember.push_back(Pair("rewards", member.nRewards));
+    return RESTWriteChainObject(req, rf, nHeight, hashTip, member, objMember);
+}
+
+static bool rest_club(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string strAddress;
+    const RetFormat rf = ParseDataFormat(strAddress, strURIPart);
+
+    if (!CBitcoinAddress(strAddress).IsValid())
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid address: " + strAddress);
+
+    // The club of any of its members, described by its leader
+    CRestMember leader;
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        CRestMember member;
+        if (!GetRestMember(strAddress, member) || !GetRestMember(member.club, leader))
+            return RESTERR(req, HTTP_NOT_FOUND, strAddress + " is not a club member");
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+
+    UniValue objClub(UniValue::VOBJ);
+    objClub.push_back(Pair("clubminer", leader.club));
+    objClub.push_back(Pair("clubpower", leader.nClubPower));
+    objClub.push_back(Pair("selfpower", leader.nMiningPower));
+    objClub.push_back(Pair("rewards", leader.nRewards));
+    return RESTWriteChainObject(req, rf, nHeight, hashTip, leader, objClub);
+}
+
+static bool rest_reward(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string strHeight;
+    const RetFormat rf = ParseDataFormat(strHeight, strURIPart);
+
+    // The reward rates are only kept with -updaterewardrate=true, see getrewardrate
+    if (!mapArgs.count("-updaterewardrate") || mapMultiArgs["-updaterewardrate"].size() == 0 ||
+        mapMultiArgs["-updaterewardrate"][0].compare("true") != 0)
+        return RESTERR(req, HTTP_NOT_FOUND, "Error: reward rates are not kept (-updaterewardrate)");
+
+    int32_t nRateHeight;
+    if (!ParseInt32(strHeight, &nRateHeight) || nRateHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + strHeight);
+
+    int nHeight;
+    uint256 hashTip;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+        hashTip = chainActive.Tip()->GetBlockHash();
+    }
+    if (nRateHeight > nHeight)
+        return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range");
+
+    std::string addr_rate;
+    if (!pclubinfodb->GetRewardRateDBPointer()->GetRewardRate(nRateHeight, addr_rate))
+        return RESTERR(req, HTTP_NOT_FOUND, strprintf("No reward rate at height %d", nRateHeight));
+
+    std::vector<std::string> fields;
+    boost::split(fields, addr_rate, boost::is_any_of("_"));
+    if (fields.size() != 2)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error: incorrect reward rate data");
+
+    CRestRewardRate rewardRate;
+    rewardRate.address = fields[0];
+    rewardRate.rate = 0;
+    std::stringstream stream(fields[1]);
+    stream >> rewardRate.rate;
+
+    UniValue objRate(UniValue::VOBJ);
+    objRate.push_back(Pair("height", nRateHeight));
+    objRate.push_back(Pair("address", rewardRate.address));
+    objRate.push_back(Pair("rewardrate", rewardRate.rate));
+    return RESTWriteChainObject(req, rf, nHeight, hashTip, rewardRate, objRate);
+}
+
+static bool rest_balances(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fTxOutsByAddressIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Error: the address index is disabled (-txoutsbyaddressindex)");
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    // keys are sent over URI scheme (/rest/balances/key1/key2/...) or as post data
+    vector<string> vKeys;
+    if (param.length() > 1)
+    {
+        std::string strUriParams = param.substr(1);
+        boost::split(vKeys, strUriParams, boost::is_any_of("/"));
+    }
+
+    std::string strRequestMutable = req->ReadBody();
+    if (strRequestMutable.length() > 0 && vKeys.size() > 0)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Combination of URI scheme inputs and raw post data is not allowed");
+
+    switch (rf) {
+    case RF_HEX: {
+        // convert hex to bin, continue then with bin part
+        std::vector<unsigned char> strRequestV = ParseHex(strRequestMutable);
+        strRequestMutable.assign(strRequestV.begin(), strRequestV.end());
+    }
+
+    case RF_BINARY: {
+        try {
+            if (strRequestMutable.size() > 0)
+            {
+                CDataStream oss(SER_NETWORK, PROTOCOL_VERSION);
+                oss << strRequestMutable;
+                oss >> vKeys;
+            }
+        } catch (const std::ios_base::failure& e) {
+            return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Parse error");
+        }
+        break;
+    }
+
+    case RF_JSON: {
+        if (strRequestMutable.size() > 0)
+        {
+            UniValue keys;
+            if (!keys.read(strRequestMutable) || !keys.isArray())
+                return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Parse error");
+            for (unsigned int i = 0; i < keys.size(); i++)
+            {
+                if (!keys[i].isStr())
+                    return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Parse error");
+                vKeys.push_back(keys[i].get_str());
+            }
+        }
+        break;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    if (vKeys.empty())
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Error: empty request");
+    if (vKeys.size() > MAX_ADDRESS_BALANCE_LOOKUPS)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, strprintf("Error: max keys exceeded (max: %d, tried: %d)", MAX_ADDRESS_BALANCE_LOOKUPS, vKeys.size()));
+
+    std::vector<CAddressBalance> vBalances;
+    vBalances.reserve(vKeys.size());
+    BOOST_FOREACH(const std::string& key, vKeys)
+        vBalances.push_back(CAddressBalance(key));
+
+    int nHeight;
+    uint256 hashTip;
+    GetAddressBalances(vBalances, nHeight, hashTip);
+
+    switch (rf) {
+    case RF_BINARY: {
+        CDataStream ssBalances(SER_NETWORK, PROTOCOL_VERSION);
+        ssBalances << nHeight << hashTip << vBalances;
+        string strBalances = ssBalances.str();
+        req->WriteHeader("Content-Type", "application/octet-stream");
+        req->WriteReply(HTTP_OK, strBalances);
+        return true;
+    }
+
+    case RF_HEX: {
+        CDataStream ssBalances(SER_NETWORK, PROTOCOL_VERSION);
+        ssBalances << nHeight << hashTip << vBalances;
+        string strHex = HexStr(ssBalances.begin(), ssBalances.end()) + "\n";
+        req->WriteHeader("Content-Type", "text/plain");
+        req->WriteReply(HTTP_OK, strHex);
+        return true;
+    }
+
+    case RF_JSON: {
+        UniValue objBalances(UniValue::VOBJ);
+        objBalances.push_back(Pair("chainHeight", nHeight));
+        objBalances.push_back(Pair("chaintipHash", hashTip.GetHex()));
+
+        UniValue balances(UniValue::VARR);
+        BOOST_FOREACH(const CAddressBalance& balance, vBalances) {
+            UniValue o(UniValue::VOBJ);
+            o.push_back(Pair("key", balance.key));
+            if (!balance.address.empty()) {
+                o.push_back(Pair("address", balance.address));
+                o.push_back(Pair("utxo", balance.nUtxo));
+                o.push_back(Pair("rewards", balance.nRewards));
+                o.push_back(Pair("miningpower", balance.nMiningPower));
+                o.push_back(Pair("club", balance.club));
+            }
+            balances.push_back(o);
+        }
+        objBalances.push_back(Pair("balances", balances));
+
+        string strJSON = objBalances.write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: " + AvailableDataFormatsString() + ")");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static const struct {
     const char* prefix;
     bool (*handler)(HTTPRequest* req, const std::string& strReq);
@@ -611,6 +946,10 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/balances", rest_balances},
+      {"/rest/member/", rest_member},
+      {"/rest/club/", rest_club},
+      {"/rest/reward/", rest_reward},
 };
 
 bool StartREST()
@@ -10,47 +10,392 @@ using namespace std;
 
 CAddrInfoDB::CAddrInfoDB(size_t nCacheSize, CClubInfoDB *pclubinfodb, bool fMemory, bool fWipe) :
     CDBWrapper(GetDataDir() / ADDRINFODBPATH, nCacheSize, fMemory, fWipe),
+    fLazyLoad(false),
+    nReadCacheMax(0),
     _pclubinfodb(pclubinfodb),
-    currentHeight(-1)
+    currentHeight(-1),
+    flushedHeight(-1),
+    historyStartHeight(0)
 {
-    batch = new CDBBatch(*this);
 }
 
 CAddrInfoDB::~CAddrInfoDB()
 {
-    delete batch;
-    batch = NULL;
     _pclubinfodb = NULL;
 }
 
-void CAddrInfoDB::WriteToBatch(const std::string& address, int nHeight, const CTAUAddrInfo& value)
+void CAddrInfoDB::WriteNewestToBatch(CDBBatch& batch, const std::string& address, const CTAUAddrInfo& value)
 {
-    WriteToBatch(make_pair(nHeight, address), value);
+    batch.Write(make_pair(NEWESTHEIGHFLAG, address), value);
 }
 
-void CAddrInfoDB::WriteNewestToBatch(const std::string& address, const CTAUAddrInfo& value)
+bool CAddrInfoDB::ReadDB(const std::string& address, int nHeight, CTAUAddrInfo& value) const
 {
-    WriteToBatch(make_pair(NEWESTHEIGHFLAG, address), value);
+    return Read(make_pair(nHeight, address), value);
 }
 
-bool CAddrInfoDB::WriteDB(const std::string& address, int nHeight, const CTAUAddrInfo& value)
+bool CAddrInfoDB::ReadRecordAt(const std::string& address, int nHeight, CTAUAddrInfo& value) const
 {
-    return Write(make_pair(nHeight, address), value);
+    map<string, map<int, CTAUAddrInfo> >::const_iterator itAddr = cacheHistory.find(address);
+    if (itAddr != cacheHistory.end())
+    {
+        map<int, CTAUAddrInfo>::const_iterator it = itAddr->second.find(nHeight);
+        if (it != itAddr->second.end())
+        {
+            value = it->second;
+            return true;
+        }
+    }
+    if (cacheHistoryErased.count(make_pair(address, nHeight)))
+        return false;
+
+    if (nHeight >= historyStartHeight)
+        return Read(CAddrHistoryKey(address, nHeight), value);
+    return ReadDB(address, nHeight, value);
 }
 
-bool CAddrInfoDB::ReadDB(const std::string& address, int nHeight, CTAUAddrInfo& value) const
+bool CAddrInfoDB::ReadHistory(const std::string& address, int nHeight, CTAUAddrInfo& value, int& recordHeight)
 {
-    return Read(make_pair(nHeight, address), value);
+    if (nHeight < 0)
+        return false;
+
+    bool found = false;
+    map<string, map<int, CTAUAddrInfo> >::const_iterator itAddr = cacheHistory.find(address);
+    if (itAddr != cacheHistory.end())
+    {
+        map<int, CTAUAddrInfo>::const_iterator it = itAddr->second.upper_bound(nHeight);
+        if (it != itAddr->second.begin())
+        {
+            --it;
+            value = it->second;
+            recordHeight = it->first;
+            found = true;
+        }
+    }
+
+    // The records on disk follow from the newest at or before the height, a newer one in memory wins
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    CAddrHistoryKey key;
+    for (pcursor->Seek(CAddrHistoryKey(address, nHeight)); pcursor->Valid(); pcursor->Next())
+    {
+        if (!pcursor->GetKey(key) || key.address != address || (found && key.nHeight <= recordHeight))
+            break;
+        if (cacheHistoryErased.count(make_pair(address, key.nHeight)))
+            continue;
+        if (!pcursor->GetValue(value))
+            return error("%s: unable to read history of %s at height %d", __func__, address, key.nHeight);
+        recordHeight = key.nHeight;
+        return true;
+    }
+
+    return found;
+}
+
+void CAddrInfoDB::WriteHistory(const std::string& address, int nHeight, const CTAUAddrInfo& value)
+{
+    cacheHistory[address][nHeight] = value;
+    cacheHistoryErased.erase(make_pair(address, nHeight));
+}
+
+void CAddrInfoDB::EraseHistory(const std::string& address, int nHeight)
+{
+    map<string, map<int, CTAUAddrInfo> >::iterator itAddr = cacheHistory.find(address);
+    if (itAddr != cacheHistory.end())
+    {
+        itAddr->second.erase(nHeight);
+        if (itAddr->second.empty())
+            cacheHistory.erase(itAddr);
+    }
+    cacheHistoryErased.insert(make_pair(address, nHeight));
+}
+
+bool CAddrInfoDB::ReadBlockUndo(int nHeight, CAddrInfoBlockUndo& blockUndo) const
+{
+    map<int, CAddrInfoBlockUndo>::const_iterator it = cacheBlockUndo.find(nHeight);
+    if (it != cacheBlockUndo.end())
+    {
+        blockUndo = it->second;
+        return true;
+    }
+    if (cacheBlockUndoErased.count(nHeight))
+        return false;
+
+    return Read(make_pair(ADDRUNDOFLAG, nHeight), blockUndo);
+}
+
+void CAddrInfoDB::WriteBlockUndo(int nHeight, const CAddrInfoBlockUndo& blockUndo)
+{
+    cacheBlockUndo[nHeight] = blockUndo;
+    cacheBlockUndoErased.erase(nHeight);
+}
+
+void CAddrInfoDB::EraseBlockUndo(int nHeight)
+{
+    cacheBlockUndo.erase(nHeight);
+    cacheBlockUndoErased.insert(nHeight);
+}
+
+static const uint32_t NO_ADDRESS_ID = 0;
+
+size_t CAddrInfoReadCache::FindSlot(const std::string& address, uint32_t nHash) const
+{
+    // The table is never full, so the probe ends at the address or at an empty slot
+    size_t mask = vSlot.size() - 1;
+    for(size_t i = nHash & mask; ; i = (i + 1) & mask)
+    {
+        const CSlot& slot = vSlot[i];
+        if (slot.nId == NO_ADDRESS_ID || (slot.nHash == nHash && vAddress[slot.nId - 1] == address))
+            return i;
+    }
+}
+
+uint32_t CAddrInfoReadCache::FindId(const std::string& address) const
+{
+    if (vSlot.empty())
+        return NO_ADDRESS_ID;
+    return vSlot[FindSlot(address, hasher(address))].nId;
+}
+
+void CAddrInfoReadCache::Grow()
+{
+    std::vector<CSlot> vOld;
+    vOld.swap(vSlot);
+    CSlot empty = {NO_ADDRESS_ID, 0};
+    vSlot.assign(vOld.empty() ? 16 : vOld.size() * 2, empty);
+
+    // The hashes are kept in the slots, so the addresses are not hashed again
+    size_t mask = vSlot.size() - 1;
+    for(size_t j = 0; j < vOld.size(); j++)
+    {
+        if (vOld[j].nId == NO_ADDRESS_ID)
+            continue;
+        size_t i = vOld[j].nHash & mask;
+        while (vSlot[i].nId != NO_ADDRESS_ID)
+            i = (i + 1) & mask;
+        vSlot[i] = vOld[j];
+    }
+}
+
+uint32_t CAddrInfoReadCache::Link(const std::string& address, unsigned char& nState)
+{
+    if (address.compare(" ") == 0)
+    {
+        nState = ADDRLINK_NONE;
+        return NO_ADDRESS_ID;
+    }
+    if (address.compare("0") == 0)
+    {
+        nState = ADDRLINK_SELF;
+        return NO_ADDRESS_ID;
+    }
+
+    nState = ADDRLINK_ADDRESS;
+    if ((nAddresses + 1) * 2 > vSlot.size())
+        Grow();
+    uint32_t nHash = hasher(address);
+    CSlot& slot = vSlot[FindSlot(address, nHash)];
+    if (slot.nId == NO_ADDRESS_ID)
+    {
+        if (vFreeId.empty())
+        {
+            vAddress.push_back(address);
+            vEntry.push_back(CAddressEntry());
+            slot.nId = vAddress.size();
+        }
+        else
+        {
+            slot.nId = vFreeId.back();
+            vFreeId.pop_back();
+            vAddress[slot.nId - 1] = address;
+        }
+        slot.nHash = nHash;
+        nAddresses++;
+    }
+    vEntry[slot.nId - 1].nRefCount++;
+    return slot.nId;
 }
 
-void CAddrInfoDB::DeleteToBatch(const std::string& address, int nHeight)
+void CAddrInfoReadCache::Unlink(uint32_t nId)
 {
-    DeleteToBatch(make_pair(nHeight, address));
+    if (nId == NO_ADDRESS_ID || --vEntry[nId - 1].nRefCount > 0)
+        return;
+
+    // Backward shift deletion, the slots after the freed one move up unless that would put them
+    // before their home slot, so that no probe sequence is broken
+    size_t mask = vSlot.size() - 1;
+    size_t i = FindSlot(vAddress[nId - 1], hasher(vAddress[nId - 1]));
+    for(size_t j = (i + 1) & mask; vSlot[j].nId != NO_ADDRESS_ID; j = (j + 1) & mask)
+    {
+        size_t k = vSlot[j].nHash & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j))
+        {
+            vSlot[i] = vSlot[j];
+            i = j;
+        }
+    }
+    vSlot[i].nId = NO_ADDRESS_ID;
+
+    std::string().swap(vAddress[nId - 1]);
+    vEntry[nId - 1] = CAddressEntry();
+    vFreeId.push_back(nId);
+    nAddresses--;
+}
+
+const std::string& CAddrInfoReadCache::GetAddress(unsigned char nState, uint32_t nId) const
+{
+    static const string strNone(" ");
+    static const string strSelf("0");
+    if (nState == ADDRLINK_NONE)
+        return strNone;
+    if (nState == ADDRLINK_SELF)
+        return strSelf;
+    return vAddress[nId - 1];
+}
+
+bool CAddrInfoReadCache::Get(const std::string& address, CTAUAddrInfo& value) const
+{
+    uint32_t nId = FindId(address);
+    if (nId == NO_ADDRESS_ID || !vEntry[nId - 1].fRecord)
+        return false;
+
+    const CCompactAddrInfo& record = vEntry[nId - 1].record;
+    value.miner = GetAddress(record.nMinerState, record.nMiner);
+    value.father = GetAddress(record.nFatherState, record.nFather);
+    value.index = record.index;
+    value.totalMP = record.totalMP;
+    value.lastHeight = record.lastHeight;
+    return true;
+}
+
+void CAddrInfoReadCache::Set(const std::string& address, const CTAUAddrInfo& value)
+{
+    // The new links are taken before the old ones are dropped, so that no shared id is freed meanwhile
+    CCompactAddrInfo record;
+    record.nMiner = Link(value.miner, record.nMinerState);
+    record.nFather = Link(value.father, record.nFatherState);
+    record.index = value.index;
+    record.totalMP = value.totalMP;
+    record.lastHeight = value.lastHeight;
+
+    unsigned char nState;
+    uint32_t nId = Link(address, nState);
+    CAddressEntry& entry = vEntry[nId - 1];
+    if (!entry.fRecord)
+    {
+        entry.fRecord = true;
+        entry.record = record;
+        nRecords++;
+        return;
+    }
+
+    CCompactAddrInfo old = entry.record;
+    entry.record = record;
+    entry.nRefCount--;
+    Unlink(old.nMiner);
+    Unlink(old.nFather);
+}
+
+void CAddrInfoReadCache::Erase(const std::string& address)
+{
+    uint32_t nId = FindId(address);
+    if (nId == NO_ADDRESS_ID || !vEntry[nId - 1].fRecord)
+        return;
+
+    CCompactAddrInfo old = vEntry[nId - 1].record;
+    vEntry[nId - 1].fRecord = false;
+    nRecords--;
+    Unlink(nId);
+    Unlink(old.nMiner);
+    Unlink(old.nFather);
+}
+
+bool CAddrInfoReadCache::Contains(const std::string& address) const
+{
+    uint32_t nId = FindId(address);
+    return nId != NO_ADDRESS_ID && vEntry[nId - 1].fRecord;
+}
+
+void CAddrInfoReadCache::Clear()
+{
+    vAddress.clear();
+    vEntry.clear();
+    vFreeId.clear();
+    vSlot.clear();
+    nAddresses = 0;
+    nRecords = 0;
+}
+
+bool CAddrInfoDB::ReadNewest(const std::string& address, CTAUAddrInfo& value)
+{
+    LOCK(cs_addrinfo);
+    if (cacheForRead.Get(address, value))
+    {
+        TouchReadCache(address);
+        return true;
+    }
+
+    // A record erased since the last flush is still on disk
+    if (!fLazyLoad || cacheForFlush.count(address))
+        return false;
+    if (!ReadDB(address, NEWESTHEIGHFLAG, value))
+        return false;
+    UpdateReadCache(address, value);
+
+    return true;
+}
+
+void CAddrInfoDB::UpdateReadCache(const std::string& address, const CTAUAddrInfo& value)
+{
+    cacheForRead.Set(address, value);
+    TouchReadCache(address);
+    TrimReadCache();
+}
+
+void CAddrInfoDB::EraseReadCache(const std::string& address)
+{
+    cacheForRead.Erase(address);
+    boost::unordered_map<string, list<string>::iterator, SaltedAddressHasher>::iterator it = cacheForReadPos.find(address);
+    if (it != cacheForReadPos.end())
+    {
+        cacheForReadOrder.erase(it->second);
+        cacheForReadPos.erase(it);
+    }
+}
+
+void CAddrInfoDB::TouchReadCache(const std::string& address)
+{
+    if (!fLazyLoad)
+        return;
+
+    boost::unordered_map<string, list<string>::iterator, SaltedAddressHasher>::iterator it = cacheForReadPos.find(address);
+    if (it != cacheForReadPos.end())
+        cacheForReadOrder.splice(cacheForReadOrder.begin(), cacheForReadOrder, it->second);
+    else
+    {
+        cacheForReadOrder.push_front(address);
+        cacheForReadPos[address] = cacheForReadOrder.begin();
+    }
 }
 
-bool CAddrInfoDB::DeleteDB(const std::string& address, int nHeight)
+void CAddrInfoDB::TrimReadCache()
 {
-    return Erase(make_pair(nHeight, address));
+    if (!fLazyLoad)
+        return;
+
+    // Records not flushed yet are only in memory, so they stay until the next flush
+    size_t nVisit = cacheForReadOrder.size();
+    while (cacheForRead.Size() > nReadCacheMax && nVisit-- > 0)
+    {
+        list<string>::iterator it = --cacheForReadOrder.end();
+        if (cacheForFlush.count(*it))
+        {
+            cacheForReadOrder.splice(cacheForReadOrder.begin(), cacheForReadOrder, it);
+            continue;
+        }
+        cacheForRead.Erase(*it);
+        cacheForReadPos.erase(*it);
+        cacheForReadOrder.erase(it);
+    }
 }
 
 void CAddrInfoDB::ClearCache()
@@ -70,7 +415,36 @@ void CAddrInfoDB::ClearUndoCache()
 
 void CAddrInfoDB::ClearReadCache()
 {
-    cacheForRead.clear();
+    cacheForRead.Clear();
+    cacheForReadOrder.clear();
+    cacheForReadPos.clear();
+}
+
+void CAddrInfoDB::EnableLazyLoad(size_t nReadCacheSize)
+{
+    LOCK(cs_addrinfo);
+    fLazyLoad = true;
+    nReadCacheMax = std::max(nReadCacheSize / ADDRINFO_READ_CACHE_ENTRY_SIZE, (size_t)1);
+    TrimReadCache();
+}
+
+bool CAddrInfoDB::HaveNewestInMemory(const std::string& address)
+{
+    LOCK(cs_addrinfo);
+    return !fLazyLoad || cacheRecord.count(address) || cacheForRead.Contains(address) || cacheForFlush.count(address);
+}
+
+bool CAddrInfoDB::ReadNewestFromDisk(const std::string& address, CTAUAddrInfo& value) const
+{
+    return ReadDB(address, NEWESTHEIGHFLAG, value);
+}
+
+void CAddrInfoDB::AddPrefetchedNewest(const std::string& address, const CTAUAddrInfo& value)
+{
+    LOCK(cs_addrinfo);
+    if (HaveNewestInMemory(address))
+        return;
+    UpdateReadCache(address, value);
 }
 
 bool CAddrInfoDB::UpdateCacheRecord(string address, int inputHeight, string newFather,
@@ -112,24 +486,37 @@ bool CAddrInfoDB::Commit(int nHeight, bool isUndo)
     _pclubinfodb->Commit(nHeight);
 
     AssertLockHeld(cs_addrinfo);
-    for(std::map<string, CTAUAddrInfo>::const_iterator it = cacheRecord.begin();
+    CAddrInfoBlockUndo blockUndo;
+    for(CAddrInfoMap::const_iterator it = cacheRecord.begin();
         it != cacheRecord.end(); it++)
     {
         string address = it->first;
         CTAUAddrInfo value = it->second;
-        CTAUAddrInfo valueOrig = cacheForRead[address];
-        cacheForRead[address] = value;
+        CTAUAddrInfo valueOrig;
+        ReadNewest(address, valueOrig);
+        cacheForFlush.insert(address);
         if ((valueOrig.father.compare(value.father) == 0) &&
             (valueOrig.miner.compare(value.miner) == 0) &&
             (valueOrig.totalMP == value.totalMP))
+        {
+            UpdateReadCache(address, value);
             continue;
+        }
         if (!isUndo)
         {
-            cacheForRead[address].lastHeight = nHeight;
-            if (!WriteDB(address, nHeight, value))
-                return false;
+            blockUndo.push_back(make_pair(address, valueOrig));
+            WriteHistory(address, nHeight, value);
+            value.lastHeight = nHeight;
         }
+        UpdateReadCache(address, value);
+    }
+    if (!isUndo)
+    {
+        WriteBlockUndo(nHeight, blockUndo);
+        _pclubinfodb->WriteUndoLog(nHeight);
     }
+    else
+        _pclubinfodb->ClearUndoLog();
 
     SetCurrentHeight(nHeight);
     _pclubinfodb->SetCurrentHeight(nHeight);
@@ -150,24 +537,36 @@ int CAddrInfoDB::GetCurrentHeight() const
     return currentHeight;
 }
 
+uint256 CAddrInfoDB::GetFlushedBlockHash() const
+{
+    LOCK(cs_addrinfo);
+    return flushedBlockHash;
+}
+
 bool CAddrInfoDB::LoadNewestDBToMemory()
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
     pair<int, string> key;
     int nHeight = -1;
+    uint256 hash;
     pcursor->Seek(make_pair(-1, string()));
     if (pcursor->Valid() && pcursor->GetKey(key))
     {
         nHeight = atoi(key.second);
-        Erase(key, true);
+        // Records written by older versions have no block hash
+        if (!pcursor->GetValue(hash))
+            hash.SetNull();
     }
     pcursor->Seek(make_pair(NEWESTHEIGHFLAG, string()));
 
     int keyHeight = 0;
     uint64_t cnt = 0;
     LOCK(cs_addrinfo);
-    LogPrintf("%s: loading newest records from addrInfodb...\n", __func__);
-    while (pcursor->Valid() && pcursor->GetKey(key))
+    if (fLazyLoad)
+        LogPrintf("%s: newest records of addrInfodb are read on demand\n", __func__);
+    else
+        LogPrintf("%s: loading newest records from addrInfodb...\n", __func__);
+    while (!fLazyLoad && pcursor->Valid() && pcursor->GetKey(key))
     {
         boost::this_thread::interruption_point();
         try
@@ -180,16 +579,9 @@ bool CAddrInfoDB::LoadNewestDBToMemory()
                     LogPrintf("%s: unable to read value in height %d\n", __func__, keyHeight);
                     break;
                 }
-                cacheForRead[key.second] = addrInfo;
-                DeleteToBatch(key);
+                cacheForRead.Set(key.second, addrInfo);
                 cnt++;
             }
-//            else if(keyHeight > nHeight && nHeight >= 0)
-//            {
-//                LogPrintf("%s: load value in height: %d, which is wrong, the newest height is: %d\n",
-//                          __func__, keyHeight, nHeight);
-//                return false;
-//            }
             else
                 break;
 
@@ -200,28 +592,73 @@ bool CAddrInfoDB::LoadNewestDBToMemory()
         }
     }
 
-    LogPrintf("%s: loaded %d newest records from addrInfodb\n", __func__, cnt);
+    LogPrintf("%s: loaded %d newest records from addrInfodb at height %d\n", __func__, cnt, nHeight);
+    if (!Read(make_pair(HISTORYSTARTFLAG, string()), historyStartHeight))
+    {
+        // Blocks connected from now on are recorded in the history index
+        historyStartHeight = nHeight + 1;
+        if (!Write(make_pair(HISTORYSTARTFLAG, string()), historyStartHeight, true))
+            return error("%s: unable to write the start of the history index", __func__);
+    }
+    cacheForFlush.clear();
+    flushedHeight = nHeight;
+    flushedBlockHash = hash;
     SetCurrentHeight(nHeight);
-    return CommitDB();
+    return true;
 }
 
-bool CAddrInfoDB::WriteNewestDataToDisk(int newestHeight, bool fSync)
+bool CAddrInfoDB::WriteNewestDataToDisk(int newestHeight, const uint256& newestHash, bool fSync)
 {
-    LogPrintf("%s: writing newest records to addrInfodb...\n", __func__);
-    stringstream ss;
-    string heightStr;
-    ss << newestHeight;
-    ss >> heightStr;
-    WriteToBatch(make_pair(-1, heightStr), CTAUAddrInfo());
-
     AssertLockHeld(cs_addrinfo);
-    for(map<string, CTAUAddrInfo>::const_iterator it = cacheForRead.begin();
-        it != cacheForRead.end(); it++)
-        WriteNewestToBatch(it->first, it->second);
+    if (cacheForFlush.empty() && cacheHistory.empty() && cacheHistoryErased.empty() &&
+        cacheBlockUndo.empty() && cacheBlockUndoErased.empty() &&
+        newestHeight == flushedHeight && newestHash == flushedBlockHash)
+        return true;
+
+    // The newest records, the history and their height are written in one batch, so that they are
+    // always consistent on disk
+    CDBBatch batch(*this);
+    if (flushedHeight != -1)
+        batch.Erase(make_pair(-1, strprintf("%d", flushedHeight)));
+    batch.Write(make_pair(-1, strprintf("%d", newestHeight)), newestHash);
+
+    for(set<string>::const_iterator it = cacheForFlush.begin(); it != cacheForFlush.end(); it++)
+    {
+        CTAUAddrInfo addrInfo;
+        if (cacheForRead.Get(*it, addrInfo))
+            WriteNewestToBatch(batch, *it, addrInfo);
+        else
+            batch.Erase(make_pair(NEWESTHEIGHFLAG, *it));
+    }
+
+    for(set<pair<string, int> >::const_iterator it = cacheHistoryErased.begin(); it != cacheHistoryErased.end(); it++)
+    {
+        batch.Erase(CAddrHistoryKey(it->first, it->second));
+        batch.Erase(make_pair(it->second, it->first));
+    }
+    for(map<string, map<int, CTAUAddrInfo> >::const_iterator itAddr = cacheHistory.begin();
+        itAddr != cacheHistory.end(); itAddr++)
+    {
+        for(map<int, CTAUAddrInfo>::const_iterator it = itAddr->second.begin(); it != itAddr->second.end(); it++)
+            batch.Write(CAddrHistoryKey(itAddr->first, it->first), it->second);
+    }
+    for(set<int>::const_iterator it = cacheBlockUndoErased.begin(); it != cacheBlockUndoErased.end(); it++)
+        batch.Erase(make_pair(ADDRUNDOFLAG, *it));
+    for(map<int, CAddrInfoBlockUndo>::const_iterator it = cacheBlockUndo.begin(); it != cacheBlockUndo.end(); it++)
+        batch.Write(make_pair(ADDRUNDOFLAG, it->first), it->second);
 
-    if (CommitDB(fSync))
+    if (WriteBatch(batch, fSync))
     {
-        LogPrintf("%s: wrote %d newest records to addrInfodb\n", __func__, cacheForRead.size());
+        LogPrint("addrinfo", "%s: wrote %d newest records to addrInfodb at height %d\n", __func__,
+                 cacheForFlush.size(), newestHeight);
+        cacheForFlush.clear();
+        cacheHistory.clear();
+        cacheHistoryErased.clear();
+        cacheBlockUndo.clear();
+        cacheBlockUndoErased.clear();
+        flushedHeight = newestHeight;
+        flushedBlockHash = newestHash;
+        TrimReadCache();
         return true;
     }
     else
@@ -233,10 +670,10 @@ bool CAddrInfoDB::InitGenesisDB(const std::vector<string>& addresses)
     for(size_t i = 0; i < addresses.size(); i++)
     {
         CTAUAddrInfo addrInfo("0", "0", 0, 1);
-        if (!WriteDB(addresses[i], 0, addrInfo))
-            return false;
+        WriteHistory(addresses[i], 0, addrInfo);
         addrInfo.lastHeight = 0;
-        cacheForRead[addresses[i]] = addrInfo;// Add to cache for accelerating
+        cacheForFlush.insert(addresses[i]);
+        UpdateReadCache(addresses[i], addrInfo);// Add to cache for accelerating
     }
 
     if (!_pclubinfodb->InitGenesisDB(addresses))
@@ -262,13 +699,8 @@ bool CAddrInfoDB::GetMiningPower(string address, int nHeight, uint64_t& miningPo
     if (father.compare(" ") != 0)
     {
         string actualFather = (addrInfo.father.compare("0") == 0) ? address : father;
-        const vector<CMemberInfo> &memberInfo = _pclubinfodb->GetCacheRecord(actualFather);
-        if (idx < memberInfo.size())
-        {
-            miningPower = (_pclubinfodb->GetCacheRecord(actualFather))[idx].MP;
-            return true;
-        }
-        else
+        CAmount rwd = 0;
+        if (!_pclubinfodb->GetMemberMPAndReward(actualFather, idx, miningPower, rwd))
         {
             LogPrintf("%s, The input address: %s, whose memberInfo is not exist\n", __func__, address);
             return false;
@@ -293,7 +725,10 @@ CAmount CAddrInfoDB::GetRwdBalance(std::string address, int nHeight)
     if (father.compare(" ") != 0)
     {
         string actualFather = (addrInfo.father.compare("0") == 0) ? address : father;
-        return (_pclubinfodb->GetCacheRecord(actualFather))[idx].rwd;
+        uint64_t MP = 0;
+        CAmount rwd = 0;
+        _pclubinfodb->GetMemberMPAndReward(actualFather, idx, MP, rwd);
+        return rwd;
     }
     else
         return 0;
@@ -315,29 +750,32 @@ CTAUAddrInfo CAddrInfoDB::GetAddrInfo(string address, int nHeight)
     {
         if (cacheForUndoRead.find(address) != cacheForUndoRead.end())
             return cacheForUndoRead[address];
+        int recordHeight = -1;
+        if (ReadHistory(address, nHeight, addrInfo, recordHeight))
+        {
+            cacheForUndoHeight[address] = recordHeight;
+            cacheForUndoRead[address] = addrInfo;
+            return addrInfo;
+        }
+        if (historyStartHeight == 0)
+            return CTAUAddrInfo(" ", " ", 0, 0);
+
+        // Records older than the history index are only reachable through their lastHeight links
         int h = -1;
-        if (cacheForRead.find(address) != cacheForRead.end())
-            h = cacheForRead[address].lastHeight;
+        CTAUAddrInfo newest;
+        if (ReadNewest(address, newest))
+            h = newest.lastHeight;
         while (h >= 0)
         {
+            if (!ReadRecordAt(address, h, addrInfo))
+                break;
             if (h <= nHeight)
             {
-                if (ReadDB(address, h, addrInfo))
-                {
-                    cacheForUndoHeight[address] = h;
-                    cacheForUndoRead[address] = addrInfo;
-                    return addrInfo;
-                }
-                else
-                    break;
-            }
-            else
-            {
-                if (ReadDB(address, h, addrInfo))
-                    h = addrInfo.lastHeight;
-                else
-                    break;
+                cacheForUndoHeight[address] = h;
+                cacheForUndoRead[address] = addrInfo;
+                return addrInfo;
             }
+            h = addrInfo.lastHeight;
         }
 
         return CTAUAddrInfo(" ", " ", 0, 0);
@@ -349,8 +787,9 @@ CTAUAddrInfo CAddrInfoDB::GetAddrInfo(string address, int nHeight)
             return cacheRecord[address];
     }
 
-    if (cacheForRead.find(address) != cacheForRead.end())
-        return cacheForRead[address];
+    CTAUAddrInfo newest;
+    if (ReadNewest(address, newest))
+        return newest;
 
     return addrInfo;
 }
@@ -359,13 +798,9 @@ bool CAddrInfoDB::RewardChangeUpdateByPubkey(CAmount rewardChange, string pubKey
 {
     string address;
 
-    if (pubKey.empty())
-        return false;
-    const CScript script = CScript() << ParseHex(pubKey) << OP_CHECKSIG;
-    CBitcoinAddress addr;
-    if (!addr.ScriptPub2Addr(script, address))
+    if (!ConvertPubkeyToAddress(pubKey, address))
         return false;
-    if (addr.IsScript())
+    if (CBitcoinAddress(address).IsScript())
     {
         LogPrintf("%s, The input address is a script: %s, which is not allowed to be spent\n", __func__, address);
         return false;
@@ -424,7 +859,7 @@ bool CAddrInfoDB::UpdateRewardsByTX(const CTransaction& tx, CAmount blockReward,
                 return false;
             uint64_t memberTotalMP = GetHarvestPowerByAddress(clubMinerAddress, nHeightQuery) - MP;
             if (!_pclubinfodb->UpdateRewardsByMinerAddress(clubMinerAddress, memberTotalRewards,
-                                                           memberTotalMP, distributedRewards, isUndo))
+                                                           memberTotalMP, distributedRewards, nHeight, isUndo))
                 return false;
         }
         else
@@ -437,12 +872,36 @@ bool CAddrInfoDB::UpdateRewardsByTX(const CTransaction& tx, CAmount blockReward,
     return true;
 }
 
-void CAddrInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, const CMemberInfo& memberinfo,
+bool CAddrInfoDB::UpdateRewardsByChanges(const vector<pair<string, CAmount> >& vRewardChanges,
+                                         int nHeight, bool isUndo)
+{
+    // The changes of an address are summed, which does not depend on their order in the block
+    map<string, CAmount> mapAddrChanges;
+    for(vector<pair<string, CAmount> >::const_iterator it = vRewardChanges.begin();
+        it != vRewardChanges.end(); it++)
+        mapAddrChanges[it->first] += it->second;
+
+    // The changes are grouped by the club record of the father and applied on this thread
+    map<string, vector<pair<uint64_t, CAmount> > > mapClubChanges;
+    for(map<string, CAmount>::const_iterator it = mapAddrChanges.begin(); it != mapAddrChanges.end(); it++)
+    {
+        CTAUAddrInfo addrInfo = GetAddrInfo(it->first, nHeight);
+        if (addrInfo.father.compare(" ") == 0)
+            return error("%s: the reward sender %s has no record", __func__, it->first);
+        string actualFather = (addrInfo.father.compare("0") == 0) ? it->first : addrInfo.father;
+        mapClubChanges[actualFather].push_back(make_pair(addrInfo.index, it->second));
+    }
+
+    return _pclubinfodb->UpdateRewardsByChanges(mapClubChanges, isUndo);
+}
+
+bool CAddrInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, const CMemberInfo& memberinfo,
                                                uint64_t& addrIndex, int nHeight, bool add, bool isUndo)
 {
     int nHeightQuery = isUndo ? nHeight : nHeight - 1;
-    string addressMove = _pclubinfodb->UpdateMembersByFatherAddress(fatherAddress, memberinfo,
-                                                                    addrIndex, nHeight, add);
+    string addressMove;
+    if (!_pclubinfodb->UpdateMembersByFatherAddress(fatherAddress, memberinfo, addrIndex, nHeight, add, &addressMove))
+        return false;
 
     CTAUAddrInfo addrInfo = GetAddrInfo(memberinfo.address, nHeightQuery);
     addrInfo.index = addrIndex;
@@ -459,6 +918,8 @@ void CAddrInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, cons
         cacheRecord[memberinfo.address].index = 0;
         addrIndex = 0;
     }
+
+    return true;
 }
 
 bool CAddrInfoDB::EntrustByAddress(string inputAddr, string voutAddress, int nHeight)
@@ -473,14 +934,11 @@ bool CAddrInfoDB::EntrustByAddress(string inputAddr, string voutAddress, int nHe
     fatherOfVout = voutAddrInfo.father;
     minerOfVout = voutAddrInfo.miner;
     string actualFather = (fatherOfVin.compare("0") == 0) ? inputAddr : fatherOfVin;
-    vector<CMemberInfo> vinputMBRInfo = _pclubinfodb->GetCacheRecord(actualFather);
     CMemberInfo inputMBRInfo;
-    if (vinputMBRInfo.size() > inputAddrInfo.index)
-        inputMBRInfo = vinputMBRInfo[inputAddrInfo.index];
-    else
+    if (!_pclubinfodb->GetMemberInfo(actualFather, inputAddrInfo.index, inputMBRInfo))
     {
-        LogPrintf("%s, The input index is : %d, which is overrange, the max size is: %d\n",
-                  __func__, inputAddrInfo.index, vinputMBRInfo.size());
+        LogPrintf("%s, The input index is : %d, which is overrange in the record of: %s\n",
+                  __func__, inputAddrInfo.index, actualFather);
         return false;
     }
     uint64_t inputAddrIndex = inputAddrInfo.index;
@@ -499,9 +957,11 @@ bool CAddrInfoDB::EntrustByAddress(string inputAddr, string voutAddress, int nHe
         (fatherOfVout.compare("0") == 0) && (minerOfVout.compare("0") == 0))
     {
         // Update club info
-        if ((fatherOfVin.compare("0") != 0) && (minerOfVin.compare("0") != 0))// The vin is not a miner
-            UpdateMembersByFatherAddress(fatherOfVin, inputMBRInfo, inputAddrIndex, nHeight, false);
-        UpdateMembersByFatherAddress(voutAddress, inputMBRInfo, inputAddrIndex, nHeight, true);
+        if ((fatherOfVin.compare("0") != 0) && (minerOfVin.compare("0") != 0) &&// The vin is not a miner
+            !UpdateMembersByFatherAddress(fatherOfVin, inputMBRInfo, inputAddrIndex, nHeight, false))
+            return false;
+        if (!UpdateMembersByFatherAddress(voutAddress, inputMBRInfo, inputAddrIndex, nHeight, true))
+            return false;
 
         newMinerAddr = voutAddress;
         changeRelationship = true;
@@ -510,8 +970,9 @@ bool CAddrInfoDB::EntrustByAddress(string inputAddr, string voutAddress, int nHe
     else if((voutAddress.compare(inputAddr) == 0) &&
             (fatherOfVin.compare("0") != 0) && (minerOfVin.compare("0") != 0))
     {
-        UpdateMembersByFatherAddress(fatherOfVin, inputMBRInfo, inputAddrIndex, nHeight, false);
-        UpdateMembersByFatherAddress(inputAddr, inputMBRInfo, inputAddrIndex, nHeight, true);
+        if (!UpdateMembersByFatherAddress(fatherOfVin, inputMBRInfo, inputAddrIndex, nHeight, false) ||
+            !UpdateMembersByFatherAddress(inputAddr, inputMBRInfo, inputAddrIndex, nHeight, true))
+            return false;
 
         newMinerAddr = "0";
         if (!UpdateCacheTotalMPByChange(voutAddress, nHeight, 0, false))
@@ -531,17 +992,20 @@ bool CAddrInfoDB::EntrustByAddress(string inputAddr, string voutAddress, int nHe
         if (!GetMiningPower(inputAddr, nHeightQuery, totalMPOfVin))
             return false;
         _pclubinfodb->GetTotalMembersByAddress(inputAddr, totalMembers);
-        string actualFather;
         for(size_t i = 0; i < totalMembers.size(); i++)
         {
             CTAUAddrInfo memberAddrInfo = GetAddrInfo(totalMembers[i], nHeightQuery);
             memberAddrInfo.miner = voutAddress;
             cacheRecord[totalMembers[i]] = memberAddrInfo;
 
+            // The mining power moved is summed from the member records, the subtree totals kept
+            // in memory only serve the RPCs
             string &father = memberAddrInfo.father;
-            uint64_t &idx = memberAddrInfo.index;
-            actualFather = (father.compare("0") == 0) ? totalMembers[i] : father;
-            totalMPOfVin += (_pclubinfodb->GetCacheRecord(actualFather))[idx].MP;
+            string actualFather = (father.compare("0") == 0) ? totalMembers[i] : father;
+            uint64_t MP = 0;
+            CAmount rwd = 0;
+            _pclubinfodb->GetMemberMPAndReward(actualFather, memberAddrInfo.index, MP, rwd);
+            totalMPOfVin += MP;
         }
 
         // Update the total MP of the vin's miner address
@@ -602,7 +1066,8 @@ bool CAddrInfoDB::UpdateMpAndTotalMPByAddress(string address, int nHeight, strin
         // It's a new address on the chain
         // Update clubInfo
         CMemberInfo memberInfo(address, 1, 0);
-        UpdateMembersByFatherAddress(fatherInput, memberInfo, addrInfo.index, nHeight, true);
+        if (!UpdateMembersByFatherAddress(fatherInput, memberInfo, addrInfo.index, nHeight, true))
+            return false;
 
         // Update addrInfo
         string minerOfFather = GetMiner(fatherInput, nHeightQuery);
@@ -804,7 +1269,10 @@ bool CAddrInfoDB::UndoMiningPowerByTX(const CTransaction& tx, const CCoinsViewCa
                 return false;
 
             // If the address is a new one on the chain
-            if ((_pclubinfodb->GetCacheRecord(curActualVoutFather))[curVoutInfo.index].MP == 0)
+            uint64_t MP = 0;
+            CAmount rwd = 0;
+            _pclubinfodb->GetMemberMPAndReward(curActualVoutFather, curVoutInfo.index, MP, rwd);
+            if (MP == 0)
             {
                 cacheForErs.insert(voutAddress);
                 if (cacheForClubRm.find(voutAddress) == cacheForClubRm.end())
@@ -843,7 +1311,8 @@ bool CAddrInfoDB::UndoClubMembers(int nHeight)
         CTAUAddrInfo addrInfo = GetAddrInfo(address, nHeight);
         const string &father = itRm->second;
         uint64_t idx = addrInfo.index;
-        CMemberInfo memberInfo = _pclubinfodb->GetCacheRecord(father)[idx];
+        CMemberInfo memberInfo;
+        _pclubinfodb->GetMemberInfo(father, idx, memberInfo);
         if (memberInfo.address.empty() || (memberInfo.address.compare(address) != 0))
         {
             if (memberInfo.MP <= 0)
@@ -852,10 +1321,12 @@ bool CAddrInfoDB::UndoClubMembers(int nHeight)
                       __func__, father, idx);
             return false;
         }
-        UpdateMembersByFatherAddress(father, memberInfo, idx, nHeight, false, true);
+        if (!UpdateMembersByFatherAddress(father, memberInfo, idx, nHeight, false, true))
+            return false;
         if (cacheForClubAdd.find(address) != cacheForClubAdd.end())
         {
-            UpdateMembersByFatherAddress(cacheForClubAdd[address], memberInfo, idx, nHeight, true, true);
+            if (!UpdateMembersByFatherAddress(cacheForClubAdd[address], memberInfo, idx, nHeight, true, true))
+                return false;
             alreadyAddedAddr.insert(address);
         }
     }
@@ -871,14 +1342,16 @@ bool CAddrInfoDB::UndoClubMembers(int nHeight)
         uint64_t idx = addrInfo.index;
         string actualFather =
                 (addrInfo.father.compare("0") == 0) ? address : addrInfo.father;
-        CMemberInfo memberInfo = _pclubinfodb->GetCacheRecord(actualFather)[idx];
+        CMemberInfo memberInfo;
+        _pclubinfodb->GetMemberInfo(actualFather, idx, memberInfo);
         if (memberInfo.address.empty() || (memberInfo.address.compare(address) != 0))
         {
             LogPrintf("%s: unable to read record in clubInfo db to be added, father: %s, index: %d\n",
                       __func__, actualFather, idx);
             return false;
         }
-        UpdateMembersByFatherAddress(father, memberInfo, idx, nHeight, true, true);
+        if (!UpdateMembersByFatherAddress(father, memberInfo, idx, nHeight, true, true))
+            return false;
         alreadyAddedAddr.insert(address);
     }
 
@@ -888,26 +1361,42 @@ bool CAddrInfoDB::UndoClubMembers(int nHeight)
 
 void CAddrInfoDB::UndoCacheRecords(int nHeight)
 {
-    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
-    pair<int, string> key;
-    CTAUAddrInfo addrInfo;
-    pcursor->Seek(make_pair(nHeight, string()));
-    while (pcursor->Valid() && pcursor->GetKey(key))
+    CAddrInfoBlockUndo blockUndo;
+    if (ReadBlockUndo(nHeight, blockUndo))
     {
-        boost::this_thread::interruption_point();
-        if (key.first == nHeight)
+        for(CAddrInfoBlockUndo::const_iterator it = blockUndo.begin(); it != blockUndo.end(); it++)
         {
-            if (!pcursor->GetValue(addrInfo)) {
-                LogPrintf("%s: unable to read value in height %d\n", __func__, key.first);
-                break;
-            }
-            cacheForUndo[key.second] = GetAddrInfo(key.second, nHeight-1);
-            DeleteDB(key.second, key.first);
+            cacheForUndo[it->first] = it->second;
+            if (it->second.lastHeight >= 0)
+                cacheForUndoHeight[it->first] = it->second.lastHeight;
+            EraseHistory(it->first, nHeight);
         }
-        else
-            break;
+        EraseBlockUndo(nHeight);
+    }
+    else
+    {
+        // Blocks connected before the history index only have their records keyed by height
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        pair<int, string> key;
+        CTAUAddrInfo addrInfo;
+        pcursor->Seek(make_pair(nHeight, string()));
+        while (pcursor->Valid() && pcursor->GetKey(key))
+        {
+            boost::this_thread::interruption_point();
+            if (key.first == nHeight)
+            {
+                if (!pcursor->GetValue(addrInfo)) {
+                    LogPrintf("%s: unable to read value in height %d\n", __func__, key.first);
+                    break;
+                }
+                cacheForUndo[key.second] = GetAddrInfo(key.second, nHeight-1);
+                EraseHistory(key.second, key.first);
+            }
+            else
+                break;
 
-        pcursor->Next();
+            pcursor->Next();
+        }
     }
 
     // Erase cacheRecord which is not exist before
@@ -915,33 +1404,82 @@ void CAddrInfoDB::UndoCacheRecords(int nHeight)
         itErs != cacheForErs.end(); itErs++)
     {
         const string &addrErs = *itErs;
-        map<string, CTAUAddrInfo>::iterator it = cacheRecord.find(addrErs);
+        CAddrInfoMap::iterator it = cacheRecord.find(addrErs);
         if (it != cacheRecord.end())
             cacheRecord.erase(it);
-        it = cacheForRead.find(addrErs);
-        if (it != cacheForRead.end())
-            cacheForRead.erase(it);
+        cacheForFlush.insert(addrErs);
+        EraseReadCache(addrErs);
         it = cacheForUndo.find(addrErs);
         if (it != cacheForUndo.end())
             cacheForUndo.erase(it);
-        DeleteDB(addrErs, nHeight);
+        EraseHistory(addrErs, nHeight);
     }
 
     // Update undo cache records to cacheRecord(except the index)
-    for(map<string, CTAUAddrInfo>::const_iterator it = cacheForUndo.begin();
+    for(CAddrInfoMap::const_iterator it = cacheForUndo.begin();
         it != cacheForUndo.end(); it++)
     {
         if (cacheRecord.find(it->first) == cacheRecord.end())
-            cacheRecord[it->first].index = cacheForRead[it->first].index;
+        {
+            CTAUAddrInfo newest;
+            ReadNewest(it->first, newest);
+            cacheRecord[it->first].index = newest.index;
+        }
         cacheRecord[it->first].father = cacheForUndo[it->first].father;
         cacheRecord[it->first].miner = cacheForUndo[it->first].miner;
         cacheRecord[it->first].totalMP = cacheForUndo[it->first].totalMP;
         if (cacheForUndoHeight.find(it->first) != cacheForUndoHeight.end())
             cacheRecord[it->first].lastHeight = cacheForUndoHeight[it->first];
 
-        DeleteDB(it->first, nHeight);
-        //DeleteToBatch(it->first, nHeight);
+        EraseHistory(it->first, nHeight);
+    }
+}
+
+bool CAddrInfoDB::UndoBlockByLog(int nHeight)
+{
+    AssertLockHeld(cs_addrinfo);
+    CAddrInfoBlockUndo blockUndo;
+    if (!ReadBlockUndo(nHeight, blockUndo))
+        return error("%s: no undo records at height %d", __func__, nHeight);
+
+    map<string, uint64_t> mapIndexes;
+    if (!_pclubinfodb->UndoBlock(nHeight, mapIndexes))
+        return false;
+
+    // The records are restored as they were before the block, the addresses it brought on the chain are erased
+    set<string> setErased;
+    for(CAddrInfoBlockUndo::const_iterator it = blockUndo.begin(); it != blockUndo.end(); it++)
+    {
+        if (it->second.father.compare(" ") == 0)
+        {
+            cacheRecord.erase(it->first);
+            cacheForFlush.insert(it->first);
+            EraseReadCache(it->first);
+            setErased.insert(it->first);
+        }
+        else
+            cacheRecord[it->first] = it->second;
+        EraseHistory(it->first, nHeight);
+    }
+    EraseBlockUndo(nHeight);
+
+    // Members which only moved inside the record of their father have no undo record
+    for(map<string, uint64_t>::const_iterator it = mapIndexes.begin(); it != mapIndexes.end(); it++)
+    {
+        if (setErased.count(it->first))
+            continue;
+        CAddrInfoMap::iterator itRecord = cacheRecord.find(it->first);
+        if (itRecord == cacheRecord.end())
+        {
+            CTAUAddrInfo addrInfo;
+            if (!ReadNewest(it->first, addrInfo))
+                return error("%s: no record of the member %s at height %d", __func__, it->first, nHeight);
+            itRecord = cacheRecord.insert(make_pair(it->first, addrInfo)).first;
+        }
+        itRecord->second.index = it->second;
     }
+
+    return true;
 }
 
 bool CAddrInfoDB::RewardRateUpdate(CAmount blockReward, CAmount distributedRewards, string clubLeaderAddress, int nHeight)
@@ -6,10 +6,12 @@
 #include "dbwrapper.h"
 #include "chain.h"
 #include "base58.h"
+#include "crypto/common.h"
 #include "leveldb/db.h"
 #include "clubinfodb.h"
 #include <stdio.h>
 
+#include <list>
 #include <map>
 #include <string>
 #include <utility>
@@ -17,6 +19,14 @@
 
 #define ADDRINFODBPATH "addrinfodb"
 #define NEWESTHEIGHFLAG (-10)
+#define HISTORYSTARTFLAG (-2)
+#define ADDRHISTORYFLAG (-20)
+#define ADDRUNDOFLAG (-30)
+
+//! Default for -lazyrewarddb
+static const bool DEFAULT_REWARDDB_LAZYLOAD = false;
+//! Approximate memory usage of a newest record held in the read cache
+static const size_t ADDRINFO_READ_CACHE_ENTRY_SIZE = 160;
 
 extern CCriticalSection cs_addrinfo;
 
@@ -62,18 +72,140 @@ typedef struct _CTAUAddrInfo {
 
 }CTAUAddrInfo;
 
+typedef boost::unordered_map<std::string, CTAUAddrInfo, SaltedAddressHasher> CAddrInfoMap;
+
+//! How the miner or father of a compact record is stored
+enum AddressLinkState
+{
+    ADDRLINK_NONE = 0,    // " ", no miner or father yet
+    ADDRLINK_SELF = 1,    // "0", the address itself
+    ADDRLINK_ADDRESS = 2, // another address of the read cache
+};
+
+/** A CTAUAddrInfo held in the read cache, with its miner and father as ids of the cache */
+typedef struct _CCompactAddrInfo {
+    uint32_t nMiner;
+    uint32_t nFather;
+    unsigned char nMinerState;
+    unsigned char nFatherState;
+    int lastHeight;
+    uint64_t index;
+    uint64_t totalMP;
+}CCompactAddrInfo;
+
+/** An address of the read cache, with its record if it has one */
+struct CAddressEntry
+{
+    //! number of records linking to the address, plus one for its own record
+    uint32_t nRefCount;
+    bool fRecord;
+    CCompactAddrInfo record;
+
+    CAddressEntry() : nRefCount(0), fRecord(false) { }
+};
+
+/**
+ * Newest records of the addresses held in memory. Every address is stored once under a dense id,
+ * and the miners and fathers shared by many records are ids as well. The ids are found by an open
+ * addressing table of (id, hash) slots, so that a lookup probes one flat array.
+ */
+class CAddrInfoReadCache
+{
+private:
+    struct CSlot
+    {
+        uint32_t nId;
+        uint32_t nHash;
+    };
+
+    //! address and entry of every id, id 0 being none
+    std::vector<std::string> vAddress;
+    std::vector<CAddressEntry> vEntry;
+    std::vector<uint32_t> vFreeId;
+
+    //! linear probing table with a power of two size, at most half full
+    std::vector<CSlot> vSlot;
+
+    //! number of ids in use
+    size_t nAddresses;
+
+    //! number of addresses having a record
+    size_t nRecords;
+
+    SaltedAddressHasher hasher;
+
+    size_t FindSlot(const std::string& address, uint32_t nHash) const;
+    uint32_t FindId(const std::string& address) const;
+    void Grow();
+    uint32_t Link(const std::string& address, unsigned char& nState);
+    void Unlink(uint32_t nId);
+    const std::string& GetAddress(unsigned char nState, uint32_t nId) const;
+
+public:
+    CAddrInfoReadCache() : nAddresses(0), nRecords(0) { }
+
+    bool Get(const std::string& address, CTAUAddrInfo& value) const;
+    void Set(const std::string& address, const CTAUAddrInfo& value);
+    void Erase(const std::string& address);
+    bool Contains(const std::string& address) const;
+    size_t Size() const { return nRecords; }
+    void Clear();
+};
+
+/**
+ * Key of a record in the history index. The heights of an address are stored inverted and big
+ * endian, so that seeking to (address, height) finds its newest record at or before the height.
+ */
+struct CAddrHistoryKey
+{
+    std::string address;
+    int nHeight;
+
+    CAddrHistoryKey() : nHeight(-1) { }
+
+    CAddrHistoryKey(const std::string& _address, int _nHeight) : address(_address), nHeight(_nHeight) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        int flag = ADDRHISTORYFLAG;
+        READWRITE(flag);
+        if (flag != ADDRHISTORYFLAG)
+            throw std::ios_base::failure("CAddrHistoryKey: not a history key");
+        READWRITE(address);
+        unsigned char height[4];
+        if (!ser_action.ForRead())
+            WriteBE32(height, ~(uint32_t)nHeight);
+        READWRITE(FLATDATA(height));
+        if (ser_action.ForRead())
+            nHeight = ~ReadBE32(height);
+    }
+};
+
+//! The records of the addresses changed by a block, as they were before it
+typedef std::vector<std::pair<std::string, CTAUAddrInfo> > CAddrInfoBlockUndo;
+
 /** View on the address info dataset. */
 class CAddrInfoDB : public CDBWrapper
 {
 private:
-    //! the level DB's WriteBatch
-    CDBBatch* batch;
-
     //! cache for db's multi-transaction updating
-    std::map<std::string, CTAUAddrInfo> cacheRecord;
+    CAddrInfoMap cacheRecord;
 
     //! cache for accelerating
-    std::map<std::string, CTAUAddrInfo> cacheForRead;
+    CAddrInfoReadCache cacheForRead;
+
+    //! usage order of cacheForRead in lazy mode, the least recently used last
+    std::list<std::string> cacheForReadOrder;
+    boost::unordered_map<std::string, std::list<std::string>::iterator, SaltedAddressHasher> cacheForReadPos;
+
+    //! Whether the newest records are read from disk on demand instead of all loaded at startup
+    bool fLazyLoad;
+
+    //! Max number of newest records kept in cacheForRead in lazy mode
+    size_t nReadCacheMax;
 
     //! cache for add members to the address
     std::map<std::string, std::string> cacheForClubAdd;
@@ -85,39 +217,71 @@ private:
     std::set<std::string> cacheForErs;
 
     //! cache used for undo
-    std::map<std::string, CTAUAddrInfo> cacheForUndo;
+    CAddrInfoMap cacheForUndo;
 
     //! cache used for undo acceleration
-    std::map<std::string, CTAUAddrInfo> cacheForUndoRead;
+    CAddrInfoMap cacheForUndoRead;
 
     //! cache used for height of undo in db
     std::map<std::string, int> cacheForUndoHeight;
 
+    //! addresses whose newest record changed since the last flush
+    std::set<std::string> cacheForFlush;
+
+    //! history records written since the last flush, by address and height
+    std::map<std::string, std::map<int, CTAUAddrInfo> > cacheHistory;
+
+    //! history records erased since the last flush, which may still be on disk
+    std::set<std::pair<std::string, int> > cacheHistoryErased;
+
+    //! block undo records written since the last flush
+    std::map<int, CAddrInfoBlockUndo> cacheBlockUndo;
+
+    //! heights of the block undo records erased since the last flush
+    std::set<int> cacheBlockUndoErased;
+
     //! clubinfo database used
     CClubInfoDB* _pclubinfodb;
 
     //! Current updated height
     int currentHeight;
 
-    void WriteToBatch(const std::string& address, int nHeight, const CTAUAddrInfo& value);
-    void WriteNewestToBatch(const std::string& address, const CTAUAddrInfo& value);
-    bool WriteDB(const std::string& address, int nHeight, const CTAUAddrInfo& value);
-    template <typename K, typename V>
-    void WriteToBatch(const K& key, const V& value) { batch->Write(key, value); }
+    //! Height and block hash of the newest records on disk
+    int flushedHeight;
+    uint256 flushedBlockHash;
+
+    //! First height recorded in the history index, older records are only linked by lastHeight
+    int historyStartHeight;
+
+    void WriteNewestToBatch(CDBBatch& batch, const std::string& address, const CTAUAddrInfo& value);
 
     bool ReadDB(const std::string& address, int nHeight, CTAUAddrInfo& value) const;
 
-    void DeleteToBatch(const std::string& address, int nHeight);
-    bool DeleteDB(const std::string& address, int nHeight);
-    template <typename K>
-    void DeleteToBatch(const K& key) { batch->Erase(key); }
+    //! Read the record of an address updated at exactly the height
+    bool ReadRecordAt(const std::string& address, int nHeight, CTAUAddrInfo& value) const;
+
+    //! Read the newest record of an address at or before the height from the history index
+    bool ReadHistory(const std::string& address, int nHeight, CTAUAddrInfo& value, int& recordHeight);
 
-    bool CommitDB(bool fSync = false) { return WriteBatch(*batch, fSync); }
+    //! History and block undo records are kept in memory until the next flush, so that they are
+    //! written together with the newest records
+    void WriteHistory(const std::string& address, int nHeight, const CTAUAddrInfo& value);
+    void EraseHistory(const std::string& address, int nHeight);
+    bool ReadBlockUndo(int nHeight, CAddrInfoBlockUndo& blockUndo) const;
+    void WriteBlockUndo(int nHeight, const CAddrInfoBlockUndo& blockUndo);
+    void EraseBlockUndo(int nHeight);
+
+    //! Retrieve the newest record of an address, reading it from disk on a cache miss in lazy mode
+    bool ReadNewest(const std::string& address, CTAUAddrInfo& value);
+    void UpdateReadCache(const std::string& address, const CTAUAddrInfo& value);
+    void EraseReadCache(const std::string& address);
+    void TouchReadCache(const std::string& address);
+    void TrimReadCache();
 
     bool RewardChangeUpdateByPubkey(CAmount rewardChange, std::string pubKey, int nHeight, bool isUndo=false);
     bool RewardChangeUpdate(CAmount rewardChange, std::string address, int nHeight, bool isUndo=false);
 
-    void UpdateMembersByFatherAddress(const std::string& fatherAddress, const CMemberInfo& memberinfo,
+    bool UpdateMembersByFatherAddress(const std::string& fatherAddress, const CMemberInfo& memberinfo,
                                       uint64_t& addrIndex, int nHeight, bool add, bool isUndo=false);
 
     bool GetBestFather(const CTransaction& tx, const CCoinsViewCache &view, std::string& bestFather,
@@ -148,6 +312,21 @@ public:
     //! Clear the rwdbalance accelerating cache
     void ClearReadCache();
 
+    //! Read the newest records from disk on demand, keeping at most nReadCacheSize bytes of them in memory
+    void EnableLazyLoad(size_t nReadCacheSize);
+
+    //! Whether the newest records are read from disk on demand
+    bool IsLazyLoad() const { return fLazyLoad; }
+
+    //! Whether the newest record of an address is known without reading the disk
+    bool HaveNewestInMemory(const std::string& address);
+
+    //! Read the newest record of an address from disk only, so that it can be read ahead on other threads
+    bool ReadNewestFromDisk(const std::string& address, CTAUAddrInfo& value) const;
+
+    //! Keep a record read ahead by ReadNewestFromDisk, unless a version of it is known already
+    void AddPrefetchedNewest(const std::string& address, const CTAUAddrInfo& value);
+
     //! Commit the database transaction
     bool Commit(int nHeight, bool isUndo=false);
 
@@ -157,11 +336,14 @@ public:
     //! Get current updated height
     int GetCurrentHeight() const;
 
+    //! Get the block hash of the newest records on disk
+    uint256 GetFlushedBlockHash() const;
+
     //! Read the newest data from disk to memory
     bool LoadNewestDBToMemory();
 
-    //! Write the newest data from memory to disk
-    bool WriteNewestDataToDisk(int newestHeight, bool fSync=false);
+    //! Write the newest data changed since the last flush from memory to disk
+    bool WriteNewestDataToDisk(int newestHeight, const uint256& newestHash, bool fSync=false);
 
     //! Init the father and mp of the address from genesis block
     bool InitGenesisDB(const std::vector<std::string>& addresses);
@@ -197,6 +379,11 @@ public:
     //! Update the Balance dataset
     bool UpdateRewardsByTX(const CTransaction& tx, CAmount blockReward, int nHeight, bool isUndo=false);
 
+    //! Apply the reward changes of a block by sender address, club by club. Nothing is changed
+    //! and false is returned if one of the senders is not a member of a club
+    bool UpdateRewardsByChanges(const std::vector<std::pair<std::string, CAmount> >& vRewardChanges,
+                                int nHeight, bool isUndo=false);
+
     //! Update the mining power and the father
     bool UpdateFatherAndMpByTX(const CTransaction& tx, const CCoinsViewCache &view, int nHeight,
                                std::map<std::string, CAmount> vin_val=std::map<std::string, CAmount>());
@@ -211,6 +398,9 @@ public:
     //! Undo cache records
     void UndoCacheRecords(int nHeight);
 
+    //! Undo the block at nHeight with the undo log of its club changes, see CClubInfoDB::HaveUndoLog
+    bool UndoBlockByLog(int nHeight);
+
     //! Update the club miner's distribution rate
     bool RewardRateUpdate(CAmount blockReward, CAmount distributedRewards, std::string clubLeaderAddress, int nHeight);
 
@@ -1,10 +1,15 @@
 #include "clubinfodb.h"
+#include "random.h"
 #include <time.h>
 
+#include <algorithm>
+
 CCriticalSection cs_clubinfo;
 
 using namespace std;
 
+SaltedAddressHasher::SaltedAddressHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
 bool CRewardRateViewDB::WriteDB(int nHeight, std::string address, double value)
 {
     std::stringstream ssVal;
@@ -92,24 +97,22 @@ bool CRewardRateViewDB::UpdateRewardRate(std::string leaderAddress, double val,
 
 CClubInfoDB::CClubInfoDB(size_t nCacheSize, bool fMemory, bool fWipe) :
     CDBWrapper(GetDataDir() / CLUBINFODBPATH, nCacheSize, fMemory, fWipe),
-    currentHeight(-1)
+    currentHeight(-1),
+    flushedHeight(-1)
 {
-    batch = new CDBBatch(*this);
 }
 
 CClubInfoDB::CClubInfoDB(size_t nCacheSize, CRewardRateViewDB *prewardratedbview,
                          bool fMemory, bool fWipe) :
     CDBWrapper(GetDataDir() / CLUBINFODBPATH, nCacheSize, fMemory, fWipe),
     _prewardratedbview(prewardratedbview),
-    currentHeight(-1)
+    currentHeight(-1),
+    flushedHeight(-1)
 {
-    batch = new CDBBatch(*this);
 }
 
 CClubInfoDB::~CClubInfoDB()
 {
-    delete batch;
-    batch = NULL;
     _prewardratedbview = NULL;
 }
 
@@ -123,6 +126,20 @@ bool CClubInfoDB::ReadDB(const std::string& address, vector<CMemberInfo>& value)
     return Read(address, value);
 }
 
+bool CClubInfoDB::ReadBlockUndo(int nHeight, CClubBlockUndo& blockUndo) const
+{
+    map<int, CClubBlockUndo>::const_iterator it = cacheBlockUndo.find(nHeight);
+    if (it != cacheBlockUndo.end())
+    {
+        blockUndo = it->second;
+        return true;
+    }
+    if (cacheBlockUndoErased.count(nHeight))
+        return false;
+
+    return Read(make_pair(CLUBUNDOFLAG, nHeight), blockUndo);
+}
+
 bool CClubInfoDB::DeleteDB(const std::string& address)
 {
     return Erase(address);
@@ -159,11 +176,19 @@ bool CClubInfoDB::InitGenesisDB(const std::vector<std::string>& addresses)
 void CClubInfoDB::ClearCache()
 {
     cacheRecord.clear();
+    cacheFather.clear();
+    cacheRewardLog.clear();
+    cacheRewardLogForFlush.clear();
+    cacheClubMP.clear();
+    cacheSubtree.clear();
+    cacheForFlush.clear();
+    cacheUndoLog.clear();
+    cacheBlockUndo.clear();
+    cacheBlockUndoErased.clear();
 }
 
 bool CClubInfoDB::Commit(int nHeight)
 {
-    CommitDB();
     SetCurrentHeight(nHeight);
     return true;
 }
@@ -189,15 +214,13 @@ bool CClubInfoDB::LoadDBToMemory()
     int nHeight = -1;
     pcursor->Seek(make_pair(-1, string()));
     if (pcursor->Valid() && pcursor->GetKey(keyNewestH))
-    {
         nHeight = atoi(keyNewestH.second);
-        Erase(keyNewestH, true);
-    }
     pcursor->SeekToFirst();
 
     uint64_t cnt = 0;
     LOCK(cs_clubinfo);
     LogPrintf("%s: loading newest records from clubInfodb...\n", __func__);
+    // The height record sorts after all the addresses and is not read as an address, which ends the scan
     while (pcursor->Valid() && pcursor->GetKey(key))
     {
         boost::this_thread::interruption_point();
@@ -218,28 +241,94 @@ bool CClubInfoDB::LoadDBToMemory()
         }
     }
 
-    LogPrintf("%s: loaded %d newest records from clubInfodb\n", __func__, cnt);
+    LogPrintf("%s: loaded %d newest records from clubInfodb at height %d\n", __func__, cnt, nHeight);
+    BuildClubIndex();
+    if (!LoadRewardLogs())
+        return false;
+    cacheForFlush.clear();
+    flushedHeight = nHeight;
     SetCurrentHeight(nHeight);
     return true;
 }
 
 bool CClubInfoDB::WriteDataToDisk(int newestHeight, bool fSync)
 {
-    LogPrintf("%s: writing newest records to clubInfodb...\n", __func__);
-    stringstream ss;
-    string heightStr;
-    ss << newestHeight;
-    ss >> heightStr;
-    WriteToBatch(make_pair(-1, heightStr), CMemberInfo());
-
     AssertLockHeld(cs_clubinfo);
-    for(map<string, vector<CMemberInfo> >::const_iterator it = cacheRecord.begin();
-        it != cacheRecord.end(); it++)
-        WriteToBatch(it->first, it->second);
 
-    if (CommitDB(fSync))
+    if (cacheForFlush.empty() && cacheRewardLogForFlush.empty() && cacheBlockUndo.empty() &&
+        cacheBlockUndoErased.empty() && newestHeight == flushedHeight)
+        return true;
+
+    // A reward log which grew long is settled to the whole club and dropped, the other logs are
+    // written as they are, and only the members of the changed records are settled to them
+    for(set<string>::const_iterator it = cacheRewardLogForFlush.begin(); it != cacheRewardLogForFlush.end(); it++)
+    {
+        if (GetRewardLogSize(*it) <= CLUB_REWARD_LOG_SETTLE_SIZE)
+            continue;
+        if (!SettleClub(*it))
+            return false;
+        cacheRewardLog.erase(*it);
+    }
+
+    // The changed records, the reward logs and their height are written in one batch, so that
+    // they are always consistent on disk
+    CDBBatch batch(*this);
+    if (flushedHeight != -1)
+        batch.Erase(make_pair(-1, strprintf("%d", flushedHeight)));
+    batch.Write(make_pair(-1, strprintf("%d", newestHeight)), CMemberInfo());
+
+    for(set<string>::const_iterator it = cacheForFlush.begin(); it != cacheForFlush.end(); it++)
     {
-        LogPrintf("%s: wrote %d newest records to clubInfodb\n", __func__, cacheRecord.size());
+        CMemberInfoMap::const_iterator itRecord = cacheRecord.find(*it);
+        if (itRecord == cacheRecord.end())
+        {
+            batch.Erase(*it);
+            batch.Erase(make_pair(CLUBSETTLEFLAG, *it));
+            continue;
+        }
+
+        if (!SettleRecord(*it))
+            return false;
+        batch.Write(itRecord->first, itRecord->second);
+        string leader = GetClubLeader(*it);
+        size_t nLogSize = GetRewardLogSize(leader);
+        if (itRecord->second.size() > 1 && nLogSize > 0)
+            batch.Write(make_pair(CLUBSETTLEFLAG, *it), CClubSettlePoint(leader, nLogSize));
+        else
+            batch.Erase(make_pair(CLUBSETTLEFLAG, *it));
+    }
+    for(set<string>::const_iterator it = cacheRewardLogForFlush.begin(); it != cacheRewardLogForFlush.end(); it++)
+    {
+        CClubRewardLogMap::const_iterator itLog = cacheRewardLog.find(*it);
+        if (itLog != cacheRewardLog.end() && !itLog->second.empty())
+            batch.Write(make_pair(CLUBREWARDLOGFLAG, *it), itLog->second);
+        else
+            batch.Erase(make_pair(CLUBREWARDLOGFLAG, *it));
+    }
+    for(set<int>::const_iterator it = cacheBlockUndoErased.begin(); it != cacheBlockUndoErased.end(); it++)
+        batch.Erase(make_pair(CLUBUNDOFLAG, *it));
+
+    // Undo logs beyond the reorg depth are not written, and those which fell below it since the last
+    // flush are erased
+    int nPruneHeight = newestHeight - CLUB_UNDO_LOG_DEPTH;
+    cacheBlockUndo.erase(cacheBlockUndo.begin(), cacheBlockUndo.upper_bound(nPruneHeight));
+    if (flushedHeight != -1)
+    {
+        for(int h = max(flushedHeight - CLUB_UNDO_LOG_DEPTH + 1, 0); h <= nPruneHeight; h++)
+            batch.Erase(make_pair(CLUBUNDOFLAG, h));
+    }
+    for(map<int, CClubBlockUndo>::const_iterator it = cacheBlockUndo.begin(); it != cacheBlockUndo.end(); it++)
+        batch.Write(make_pair(CLUBUNDOFLAG, it->first), it->second);
+
+    if (WriteBatch(batch, fSync))
+    {
+        LogPrint("clubinfo", "%s: wrote %d newest records to clubInfodb at height %d\n", __func__,
+                 cacheForFlush.size(), newestHeight);
+        cacheForFlush.clear();
+        cacheRewardLogForFlush.clear();
+        cacheBlockUndo.clear();
+        cacheBlockUndoErased.clear();
+        flushedHeight = newestHeight;
         return true;
     }
     else
@@ -255,40 +344,115 @@ bool CClubInfoDB::CacheRecordIsExist(const std::string& address)
 vector<CMemberInfo> CClubInfoDB::GetCacheRecord(const string& address)
 {
     LOCK(cs_clubinfo);
+    if (!SettleRecord(address))
+        return vector<CMemberInfo>();
     return cacheRecord[address];
 }
 
-string CClubInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, const CMemberInfo& memberinfo,
-                                                 uint64_t& index, int nHeight, bool add)
+bool CClubInfoDB::GetMemberInfo(const string& fatherAddress, uint64_t index, CMemberInfo& memberinfo)
+{
+    LOCK(cs_clubinfo);
+    const CMemberInfo* pmemberinfo = FindMember(fatherAddress, index);
+    if (!pmemberinfo)
+        return false;
+
+    memberinfo = *pmemberinfo;
+    return true;
+}
+
+bool CClubInfoDB::GetMemberMPAndReward(const string& fatherAddress, uint64_t index, uint64_t& MP, CAmount& rwd)
+{
+    LOCK(cs_clubinfo);
+    const CMemberInfo* pmemberinfo = FindMember(fatherAddress, index);
+    if (!pmemberinfo)
+        return false;
+
+    MP = pmemberinfo->MP;
+    rwd = pmemberinfo->rwd;
+    return true;
+}
+
+bool CClubInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, const CMemberInfo& memberinfo,
+                                               uint64_t& index, int nHeight, bool add, string* pAddressMoved)
 {
     AssertLockHeld(cs_clubinfo);
+    if (pAddressMoved)
+        *pAddressMoved = NO_MOVED_ADDRESS;
     if (add)
     {
+        cacheForFlush.insert(fatherAddress);
         CMemberInfo memberinfoNew = memberinfo;
         if (memberinfo.address.compare(fatherAddress) != 0)
         {
+            // The member and its own members join the club of the father
+            CClubSubtree subtree = GetSubtree(memberinfo.address);
+            string leader = UpdateSubtrees(fatherAddress, 1 + subtree.nMembers,
+                                           memberinfoNew.MP + subtree.nTotalMP, true);
+            string oldLeader = GetClubLeader(memberinfo.address);
+            cacheFather[memberinfo.address] = fatherAddress;
+            if (!MoveMembersToClub(memberinfo.address, oldLeader, leader))
+                return false;
+            memberinfoNew.rwdIndex = GetRewardLogSize(leader);
+            AddClubMP(leader, memberinfoNew.MP);
+
             if ((cacheRecord.find(fatherAddress) == cacheRecord.end()) ||
                 (cacheRecord[fatherAddress].size() == 0))
                 cacheRecord[fatherAddress].push_back(CMemberInfo(NOT_VALID_RECORD, 0, 0));
             cacheRecord[fatherAddress].push_back(memberinfoNew);
             index = cacheRecord[fatherAddress].size() - 1;
+            cacheUndoLog.push_back(CClubUndoEntry(CLUB_UNDO_ADD, fatherAddress, index));
         }
         else
         {
+            CClubUndoEntry entry(CLUB_UNDO_SELF, fatherAddress);
             if ((cacheRecord.find(fatherAddress) == cacheRecord.end()) ||
                 (cacheRecord[fatherAddress].size() == 0))
                 cacheRecord[fatherAddress].push_back(memberinfoNew);
             else
+            {
+                entry.fReplaced = true;
+                entry.memberinfo = cacheRecord[fatherAddress][0];
                 cacheRecord[fatherAddress][0] = memberinfoNew;
+            }
+            cacheUndoLog.push_back(entry);
             index = 0;
         }
         LogPrint("clubinfo", "%s, father: %s, add an address: %s, h:%d\n", __func__, fatherAddress,
                  memberinfo.address, nHeight);
-        return NO_MOVED_ADDRESS;
+        return true;
     }
     else if(cacheRecord.find(fatherAddress) != cacheRecord.end())
     {
         size_t length = cacheRecord[fatherAddress].size();
+        cacheForFlush.insert(fatherAddress);
+
+        // The removed member leaves the club together with its own members
+        if (index > 0 && length > 1)
+        {
+            size_t removedIdx = (index < length-1) ? index : length-1;
+            string removedAddress = cacheRecord[fatherAddress][removedIdx].address;
+            // Settled, so that the undo log keeps the reward of the member
+            if (!SettleMemberReward(GetClubLeader(fatherAddress), cacheRecord[fatherAddress][removedIdx]))
+                return false;
+            CClubSubtree subtree = GetSubtree(removedAddress);
+            string leader = UpdateSubtrees(fatherAddress, 1 + subtree.nMembers,
+                                           cacheRecord[fatherAddress][removedIdx].MP + subtree.nTotalMP, false);
+            RemoveClubMP(leader, cacheRecord[fatherAddress][removedIdx].MP);
+            CAddressMap::iterator itFather = cacheFather.find(removedAddress);
+            if (itFather != cacheFather.end() && itFather->second.compare(fatherAddress) == 0)
+            {
+                cacheFather.erase(itFather);
+                if (!MoveMembersToClub(removedAddress, leader, removedAddress))
+                    return false;
+            }
+        }
+
+        if (index > 0 || length == 1)
+        {
+            CClubUndoEntry entry(CLUB_UNDO_REMOVE, fatherAddress, (index < length-1) ? index : length-1);
+            entry.memberinfo = cacheRecord[fatherAddress][entry.index];
+            cacheUndoLog.push_back(entry);
+        }
         string addressMoved = NO_MOVED_ADDRESS;
         if (index > 0 && index < length-1)
         {
@@ -305,22 +469,40 @@ string CClubInfoDB::UpdateMembersByFatherAddress(const string& fatherAddress, co
              cacheRecord[fatherAddress][0].address.compare(NOT_VALID_RECORD) == 0))
         {
             cacheRecord.erase(fatherAddress);
-            return NO_MOVED_ADDRESS;
+            return true;
         }
-        return addressMoved;
+        if (pAddressMoved)
+            *pAddressMoved = addressMoved;
+        return true;
     }
     else
-        return NO_MOVED_ADDRESS;
+        return true;
 }
 
 void CClubInfoDB::GetTotalMembers(const string& fatherAddress, vector<string>& vmembers)
 {
     AssertLockHeld(cs_clubinfo);
-    const vector<CMemberInfo> &vmemberInfo = cacheRecord[fatherAddress];
-    for(size_t i = 1; i < vmemberInfo.size(); i++)
+    vmembers.reserve(vmembers.size() + GetSubtree(fatherAddress).nMembers);
+
+    // Depth first without recursion, so that long chains of fathers cannot overflow the stack
+    vector<pair<CMemberInfoMap::const_iterator, size_t> > vfathers;
+    CMemberInfoMap::const_iterator it = cacheRecord.find(fatherAddress);
+    if (it != cacheRecord.end())
+        vfathers.push_back(make_pair(it, 1));
+    while (!vfathers.empty())
     {
+        const vector<CMemberInfo>& vmemberInfo = vfathers.back().first->second;
+        size_t i = vfathers.back().second++;
+        if (i >= vmemberInfo.size())
+        {
+            vfathers.pop_back();
+            continue;
+        }
+
         vmembers.push_back(vmemberInfo[i].address);
-        GetTotalMembers(vmemberInfo[i].address, vmembers);
+        it = cacheRecord.find(vmemberInfo[i].address);
+        if (it != cacheRecord.end())
+            vfathers.push_back(make_pair(it, 1));
     }
 }
 
@@ -330,8 +512,160 @@ void CClubInfoDB::GetTotalMembersByAddress(const string& fatherAddress, vector<s
     GetTotalMembers(fatherAddress, vmembers);
 }
 
+CClubSubtree CClubInfoDB::GetSubtreeByAddress(const string& fatherAddress)
+{
+    LOCK(cs_clubinfo);
+    return GetSubtree(fatherAddress);
+}
+
+bool CClubInfoDB::VisitTotalMembers(const string& fatherAddress, CClubMemberVisitor& visitor, uint64_t nSkip)
+{
+    LOCK(cs_clubinfo);
+    string leader = GetClubLeader(fatherAddress);
+
+    // Depth first, every member is followed by its own members
+    vector<pair<CMemberInfoMap::iterator, size_t> > vfathers;
+    CMemberInfoMap::iterator it = cacheRecord.find(fatherAddress);
+    if (it != cacheRecord.end())
+        vfathers.push_back(make_pair(it, 1));
+    while (!vfathers.empty())
+    {
+        vector<CMemberInfo>& vmemberInfo = vfathers.back().first->second;
+        size_t i = vfathers.back().second++;
+        if (i >= vmemberInfo.size())
+        {
+            vfathers.pop_back();
+            continue;
+        }
+
+        CMemberInfo& memberinfo = vmemberInfo[i];
+        if (nSkip > 0)
+        {
+            // Members skipped together with all their own members are not walked at all
+            uint64_t nSubtree = 1 + GetSubtree(memberinfo.address).nMembers;
+            if (nSkip >= nSubtree)
+            {
+                nSkip -= nSubtree;
+                continue;
+            }
+            nSkip--;
+        }
+        else
+        {
+            if (!SettleMemberReward(leader, memberinfo))
+                return false;
+            if (!visitor.Visit(vfathers.back().first->first, i, memberinfo))
+                return true;
+        }
+        it = cacheRecord.find(memberinfo.address);
+        if (it != cacheRecord.end())
+            vfathers.push_back(make_pair(it, 1));
+    }
+
+    return true;
+}
+
+/** Add the rewards of the log entries the member has not been settled to, stopping at the first one which fails */
+static bool SettleMemberRewardByLog(const vector<CClubRewardEntry>& vlog, CMemberInfo& memberinfo)
+{
+    for(; memberinfo.rwdIndex < vlog.size(); memberinfo.rwdIndex++)
+    {
+        const CClubRewardEntry& entry = vlog[memberinfo.rwdIndex];
+        CAmount reward = 0;
+        if (!CClubInfoDB::ComputeMemberReward(memberinfo.MP, entry.memberTotalMP, entry.memberRewards, reward,
+                                              entry.fFixedPoint))
+            return error("%s: unable to settle the reward of %s, totalRewards: %d, totalMP: %d", __func__,
+                         memberinfo.address, entry.memberRewards, entry.memberTotalMP);
+        if (entry.isUndo)
+            memberinfo.rwd -= reward;
+        else
+            memberinfo.rwd += reward;
+    }
+
+    return true;
+}
+
+bool CClubInfoDB::VisitSnapshotMembers(const leveldb::Snapshot* snapshot, CClubMemberVisitor& visitor)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator(snapshot));
+
+    // The records are settled to their settle points only, the rest comes from the reward logs
+    CClubRewardLogMap mapRewardLog;
+    map<string, CClubSettlePoint> mapSettlePoint;
+    pair<int, string> logKey;
+    pcursor->Seek(make_pair(CLUBREWARDLOGFLAG, string()));
+    while (pcursor->Valid() && pcursor->GetKey(logKey) && logKey.first == CLUBREWARDLOGFLAG)
+    {
+        if (!pcursor->GetValue(mapRewardLog[logKey.second]))
+            return error("%s: unable to read the reward log of %s", __func__, logKey.second);
+        pcursor->Next();
+    }
+    pcursor->Seek(make_pair(CLUBSETTLEFLAG, string()));
+    while (pcursor->Valid() && pcursor->GetKey(logKey) && logKey.first == CLUBSETTLEFLAG)
+    {
+        if (!pcursor->GetValue(mapSettlePoint[logKey.second]))
+            return error("%s: unable to read the settle point of %s", __func__, logKey.second);
+        pcursor->Next();
+    }
+
+    // The records come first, up to the keys of the flags
+    pcursor->Seek(string());
+    unsigned char nPrefix;
+    while (pcursor->Valid() && pcursor->GetKey(nPrefix) && nPrefix < CLUB_FLAG_KEY_PREFIX)
+    {
+        boost::this_thread::interruption_point();
+        string key;
+        if (!pcursor->GetKey(key))
+            return error("%s: unable to read the key of a record", __func__);
+        vector<CMemberInfo> vmemberInfo;
+        if (!pcursor->GetValue(vmemberInfo))
+            return error("%s: unable to read the record of %s", __func__, key);
+        const vector<CClubRewardEntry>* pvlog = NULL;
+        uint64_t rwdIndex = 0;
+        if (vmemberInfo.size() > 1)
+        {
+            map<string, CClubSettlePoint>::const_iterator itPoint = mapSettlePoint.find(key);
+            if (itPoint != mapSettlePoint.end())
+            {
+                CClubRewardLogMap::const_iterator itLog = mapRewardLog.find(itPoint->second.leader);
+                if (itLog == mapRewardLog.end() || itPoint->second.rwdIndex > itLog->second.size())
+                    return error("%s: the settle point of %s does not match the reward logs", __func__, key);
+                pvlog = &itLog->second;
+                rwdIndex = itPoint->second.rwdIndex;
+            }
+        }
+        for(size_t i = 0; i < vmemberInfo.size(); i++)
+        {
+            if (i > 0 && pvlog)
+            {
+                vmemberInfo[i].rwdIndex = rwdIndex;
+                if (!SettleMemberRewardByLog(*pvlog, vmemberInfo[i]))
+                    return false;
+            }
+            if (!visitor.Visit(key, i, vmemberInfo[i]))
+                return true;
+        }
+        pcursor->Next();
+    }
+
+    return true;
+}
+
+/** floor(a * b / c) for a quotient that fits in 64 bits */
+static uint64_t MulDiv64(uint64_t a, uint64_t b, uint64_t c)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)((unsigned __int128)a * b / c);
+#else
+    arith_uint256 product = a;
+    product *= arith_uint256(b);
+    product /= arith_uint256(c);
+    return product.GetLow64();
+#endif
+}
+
 bool CClubInfoDB::ComputeMemberReward(const uint64_t& MP, const uint64_t& totalMP,
-                                      const CAmount& totalRewards, CAmount& memberReward)
+                                      const CAmount& totalRewards, CAmount& memberReward, bool fFixedPoint)
 {
     if ((totalMP < MP) || (totalMP == 0))
     {
@@ -344,15 +678,24 @@ bool CClubInfoDB::ComputeMemberReward(const uint64_t& MP, const uint64_t& totalM
         return false;
     }
 
-    arith_uint256 tmp = totalMP;
-    arith_uint256 mp = MP;
-    arith_uint256 tRwd_1 = totalRewards / (CENT*CENT);
-    arith_uint256 tRwd_2 = totalRewards % (CENT*CENT) / CENT;
-    arith_uint256 tRwd_3 = totalRewards % (CENT*CENT) % CENT;
-    double ratio = mp.getdouble() / tmp.getdouble();
-    CAmount memberReward_1 = ratio * tRwd_1.getdouble() * (CENT*CENT);
-    CAmount memberReward_2 = ratio * tRwd_2.getdouble() * CENT;
-    CAmount memberReward_3 = ratio * tRwd_3.getdouble();
+    if (fFixedPoint)
+    {
+        // MP <= totalMP, so only the product with the remainder needs more than 64 bits
+        uint64_t quotient = totalRewards / totalMP;
+        uint64_t remainder = totalRewards % totalMP;
+        memberReward = MP * quotient + MulDiv64(MP, remainder, totalMP);
+        return true;
+    }
+
+    // Values below 2^64 convert to the same doubles as arith_uint256::getdouble(),
+    // which the rewards of the blocks before FixedPointRewardHeight were computed with
+    CAmount tRwd_1 = totalRewards / (CENT*CENT);
+    CAmount tRwd_2 = totalRewards % (CENT*CENT) / CENT;
+    CAmount tRwd_3 = totalRewards % (CENT*CENT) % CENT;
+    double ratio = (double)MP / (double)totalMP;
+    CAmount memberReward_1 = ratio * (double)tRwd_1 * (CENT*CENT);
+    CAmount memberReward_2 = ratio * (double)tRwd_2 * CENT;
+    CAmount memberReward_3 = ratio * (double)tRwd_3;
     memberReward = memberReward_1 + memberReward_2 + memberReward_3;
     if (memberReward >= 0)
     {
@@ -370,15 +713,15 @@ bool CClubInfoDB::ComputeMemberReward(const uint64_t& MP, const uint64_t& totalM
     return true;
 }
 
-bool CClubInfoDB::UpdateRewards(const string& minerAddress, CAmount memberRewards,
-                                uint64_t memberTotalMP, CAmount& distributedRewards, bool isUndo)
+bool CClubInfoDB::UpdateRewards(const string& minerAddress, CAmount memberRewards, uint64_t memberTotalMP,
+                                CAmount& distributedRewards, bool isUndo, bool fFixedPoint)
 {
     AssertLockHeld(cs_clubinfo);
     const vector<CMemberInfo> &vmemberInfo = cacheRecord[minerAddress];
     for(size_t i = 1; i < vmemberInfo.size(); i++)
     {
         CAmount reward = 0;
-        if (!ComputeMemberReward(vmemberInfo[i].MP, memberTotalMP, memberRewards, reward))
+        if (!ComputeMemberReward(vmemberInfo[i].MP, memberTotalMP, memberRewards, reward, fFixedPoint))
         {
             LogPrintf("%s, ComputeMemberReward() error, fatherAddress: %s, totalRewards: %d, totalMP: %d\n",
                       __func__, minerAddress, memberRewards, memberTotalMP);
@@ -388,19 +731,54 @@ bool CClubInfoDB::UpdateRewards(const string& minerAddress, CAmount memberReward
             cacheRecord[minerAddress][i].rwd -= reward;
         else
             cacheRecord[minerAddress][i].rwd += reward;
+        cacheForFlush.insert(minerAddress);
         distributedRewards += reward;
-        UpdateRewards(vmemberInfo[i].address, memberRewards, memberTotalMP, distributedRewards, isUndo);
+        UpdateRewards(vmemberInfo[i].address, memberRewards, memberTotalMP, distributedRewards, isUndo, fFixedPoint);
+    }
+
+    return true;
+}
+
+bool CClubInfoDB::ShareRewards(const string& leaderAddress, CAmount memberRewards, uint64_t memberTotalMP,
+                               CAmount& distributedRewards, bool isUndo, bool fFixedPoint)
+{
+    AssertLockHeld(cs_clubinfo);
+    CClubMPMap::const_iterator itClub = cacheClubMP.find(leaderAddress);
+    if (itClub == cacheClubMP.end())
+        return true;
+
+    // Members with the same mining power get the same reward, so the distributed rewards
+    // are computed once per mining power and the members are settled when they are read
+    for(map<uint64_t, uint64_t>::const_iterator it = itClub->second.begin();
+        it != itClub->second.end(); it++)
+    {
+        CAmount reward = 0;
+        if (!ComputeMemberReward(it->first, memberTotalMP, memberRewards, reward, fFixedPoint))
+        {
+            LogPrintf("%s, ComputeMemberReward() error, fatherAddress: %s, totalRewards: %d, totalMP: %d\n",
+                      __func__, leaderAddress, memberRewards, memberTotalMP);
+            return false;
+        }
+        distributedRewards += reward * it->second;
     }
+    cacheRewardLog[leaderAddress].push_back(CClubRewardEntry(memberRewards, memberTotalMP, isUndo, fFixedPoint));
+    cacheRewardLogForFlush.insert(leaderAddress);
 
     return true;
 }
 
-bool CClubInfoDB::UpdateRewardsByMinerAddress(const string& minerAddress, CAmount memberRewards,
-                                              uint64_t memberTotalMP, CAmount& distributedRewards, bool isUndo)
+bool CClubInfoDB::UpdateRewardsByMinerAddress(const string& minerAddress, CAmount memberRewards, uint64_t memberTotalMP,
+                                              CAmount& distributedRewards, int nHeight, bool isUndo)
 {
     AssertLockHeld(cs_clubinfo);
     distributedRewards = 0;
-    if (!UpdateRewards(minerAddress, memberRewards, memberTotalMP, distributedRewards, isUndo))
+    bool fFixedPoint = nHeight >= Params().GetConsensus().FixedPointRewardHeight;
+    if (cacheFather.find(minerAddress) == cacheFather.end())
+    {
+        if (!ShareRewards(minerAddress, memberRewards, memberTotalMP, distributedRewards, isUndo, fFixedPoint))
+            return false;
+    }
+    else if (!UpdateRewards(minerAddress, memberRewards, memberTotalMP, distributedRewards, isUndo, fFixedPoint))
         return false;
 
     CAmount remainedReward = memberRewards - distributedRewards;
@@ -415,6 +793,12 @@ bool CClubInfoDB::UpdateRewardsByMinerAddress(const string& minerAddress, CAmoun
         cacheRecord[minerAddress][0].rwd -= remainedReward;
     else
         cacheRecord[minerAddress][0].rwd += remainedReward;
+    cacheForFlush.insert(minerAddress);
+
+    CClubUndoEntry entry(CLUB_UNDO_SHARE, minerAddress, 0, memberRewards);
+    entry.nTotalMP = memberTotalMP;
+    entry.fUndo = isUndo;
+    cacheUndoLog.push_back(entry);
 
     return true;
 }
@@ -435,12 +819,32 @@ bool CClubInfoDB::UpdateMpByChange(string fatherAddr, uint64_t index, bool isUnd
         return false;
     }
 
+    CMemberInfo& memberinfo = cacheRecord[fatherAddr][index];
+    string leader;
+    if (index > 0)
+    {
+        leader = GetClubLeader(fatherAddr);
+        if (!SettleMemberReward(leader, memberinfo))
+            return false;
+    }
+
+    cacheForFlush.insert(fatherAddr);
     if (isUndo)
         add = !add;
+    cacheUndoLog.push_back(CClubUndoEntry(CLUB_UNDO_MP, fatherAddr, index, add ? (int64_t)amount : -(int64_t)amount));
+    if (index > 0)
+    {
+        UpdateSubtrees(fatherAddr, 0, amount, add);
+        RemoveClubMP(leader, memberinfo.MP);
+    }
+
     if (add)
-        cacheRecord[fatherAddr][index].MP += amount;
+        memberinfo.MP += amount;
     else
-        cacheRecord[fatherAddr][index].MP -= amount;
+        memberinfo.MP -= amount;
+
+    if (index > 0)
+        AddClubMP(leader, memberinfo.MP);
 
     return true;
 }
@@ -451,15 +855,498 @@ void CClubInfoDB::UpdateRewardByChange(std::string fatherAddr, uint64_t index, C
     if (isUndo)
         rewardChange = 0 - rewardChange;
     cacheRecord[fatherAddr][index].rwd += rewardChange;
+    cacheUndoLog.push_back(CClubUndoEntry(CLUB_UNDO_REWARD, fatherAddr, index, rewardChange));
+    cacheForFlush.insert(fatherAddr);
+}
+
+bool CClubInfoDB::UpdateRewardsByChanges(const map<string, vector<pair<uint64_t, CAmount> > >& mapClubChanges,
+                                         bool isUndo)
+{
+    AssertLockHeld(cs_clubinfo);
+    typedef map<string, vector<pair<uint64_t, CAmount> > >::const_iterator ClubIter;
+
+    // Every member is looked up before any of them changes, so that a bad block leaves the records alone
+    for(ClubIter itClub = mapClubChanges.begin(); itClub != mapClubChanges.end(); itClub++)
+    {
+        CMemberInfoMap::const_iterator itRecord = cacheRecord.find(itClub->first);
+        if (itRecord == cacheRecord.end())
+            return error("%s: no club record of %s", __func__, itClub->first);
+        for(vector<pair<uint64_t, CAmount> >::const_iterator it = itClub->second.begin();
+            it != itClub->second.end(); it++)
+        {
+            if (it->first >= itRecord->second.size())
+                return error("%s: no member %d in the club record of %s", __func__, it->first, itClub->first);
+        }
+    }
+
+    for(ClubIter itClub = mapClubChanges.begin(); itClub != mapClubChanges.end(); itClub++)
+    {
+        vector<CMemberInfo>& vmembers = cacheRecord[itClub->first];
+        for(vector<pair<uint64_t, CAmount> >::const_iterator it = itClub->second.begin();
+            it != itClub->second.end(); it++)
+        {
+            CAmount rewardChange = isUndo ? 0 - it->second : it->second;
+            vmembers[it->first].rwd += rewardChange;
+            cacheUndoLog.push_back(CClubUndoEntry(CLUB_UNDO_REWARD, itClub->first, it->first, rewardChange));
+        }
+        cacheForFlush.insert(itClub->first);
+    }
+
+    return true;
+}
+
+string CClubInfoDB::GetClubLeader(const string& address) const
+{
+    AssertLockHeld(cs_clubinfo);
+    string leader = address;
+    size_t depth = 0;
+    CAddressMap::const_iterator it = cacheFather.find(leader);
+    while (it != cacheFather.end() && depth++ <= cacheFather.size())
+    {
+        leader = it->second;
+        it = cacheFather.find(leader);
+    }
+
+    return leader;
+}
+
+size_t CClubInfoDB::GetRewardLogSize(const string& leaderAddress) const
+{
+    CClubRewardLogMap::const_iterator it = cacheRewardLog.find(leaderAddress);
+    return (it == cacheRewardLog.end()) ? 0 : it->second.size();
+}
+
+bool CClubInfoDB::SettleMemberReward(const string& leaderAddress, CMemberInfo& memberinfo)
+{
+    AssertLockHeld(cs_clubinfo);
+    CClubRewardLogMap::const_iterator it = cacheRewardLog.find(leaderAddress);
+    if (it == cacheRewardLog.end())
+        return true;
+
+    return SettleMemberRewardByLog(it->second, memberinfo);
+}
+
+bool CClubInfoDB::SettleRecord(const string& fatherAddress)
+{
+    AssertLockHeld(cs_clubinfo);
+    CMemberInfoMap::iterator it = cacheRecord.find(fatherAddress);
+    if (it == cacheRecord.end() || it->second.size() <= 1)
+        return true;
+
+    string leader = GetClubLeader(fatherAddress);
+    for(size_t i = 1; i < it->second.size(); i++)
+    {
+        if (!SettleMemberReward(leader, it->second[i]))
+            return false;
+    }
+
+    return true;
+}
+
+CMemberInfo* CClubInfoDB::FindMember(const string& fatherAddress, uint64_t index)
+{
+    AssertLockHeld(cs_clubinfo);
+    CMemberInfoMap::iterator it = cacheRecord.find(fatherAddress);
+    if (it == cacheRecord.end() || index >= it->second.size())
+        return NULL;
+
+    CMemberInfo& memberinfo = it->second[index];
+    if (index > 0 && !SettleMemberReward(GetClubLeader(fatherAddress), memberinfo))
+        return NULL;
+    return &memberinfo;
+}
+
+void CClubInfoDB::AddClubMP(const string& leaderAddress, uint64_t MP)
+{
+    cacheClubMP[leaderAddress][MP]++;
+}
+
+CClubSubtree CClubInfoDB::GetSubtree(const string& address) const
+{
+    AssertLockHeld(cs_clubinfo);
+    CClubSubtreeMap::const_iterator it = cacheSubtree.find(address);
+    return (it == cacheSubtree.end()) ? CClubSubtree() : it->second;
+}
+
+string CClubInfoDB::UpdateSubtrees(const string& fatherAddress, uint64_t nMembers, uint64_t nMP, bool add)
+{
+    AssertLockHeld(cs_clubinfo);
+    string address = fatherAddress;
+    size_t depth = 0;
+    while (depth++ <= cacheFather.size())
+    {
+        CClubSubtree& subtree = cacheSubtree[address];
+        if (add)
+        {
+            subtree.nMembers += nMembers;
+            subtree.nTotalMP += nMP;
+        }
+        else
+        {
+            subtree.nMembers -= nMembers;
+            subtree.nTotalMP -= nMP;
+        }
+        if (subtree.nMembers == 0)
+            cacheSubtree.erase(address);
+
+        CAddressMap::const_iterator it = cacheFather.find(address);
+        if (it == cacheFather.end())
+            break;
+        address = it->second;
+    }
+
+    return address;
+}
+
+void CClubInfoDB::RemoveClubMP(const string& leaderAddress, uint64_t MP)
+{
+    CClubMPMap::iterator itClub = cacheClubMP.find(leaderAddress);
+    if (itClub == cacheClubMP.end())
+        return;
+
+    map<uint64_t, uint64_t>::iterator it = itClub->second.find(MP);
+    if (it != itClub->second.end() && --(it->second) == 0)
+        itClub->second.erase(it);
+    if (itClub->second.empty())
+        cacheClubMP.erase(itClub);
+}
+
+bool CClubInfoDB::MoveMembersToClub(const string& address, const string& oldLeader, const string& newLeader)
+{
+    AssertLockHeld(cs_clubinfo);
+    if (oldLeader.compare(newLeader) == 0)
+        return true;
+
+    // Settle the members with the old club's rewards before they share the new club's
+    size_t newIndex = GetRewardLogSize(newLeader);
+    vector<string> vfathers(1, address);
+    while (!vfathers.empty())
+    {
+        CMemberInfoMap::iterator it = cacheRecord.find(vfathers.back());
+        vfathers.pop_back();
+        if (it == cacheRecord.end())
+            continue;
+
+        vector<CMemberInfo>& vmemberInfo = it->second;
+        if (vmemberInfo.size() > 1)
+            cacheForFlush.insert(it->first);
+        for(size_t i = 1; i < vmemberInfo.size(); i++)
+        {
+            if (!SettleMemberReward(oldLeader, vmemberInfo[i]))
+                return false;
+            RemoveClubMP(oldLeader, vmemberInfo[i].MP);
+            vmemberInfo[i].rwdIndex = newIndex;
+            AddClubMP(newLeader, vmemberInfo[i].MP);
+            vfathers.push_back(vmemberInfo[i].address);
+        }
+    }
+
+    // A leader joining another club takes all its members along, nothing refers to its log any more
+    if (address.compare(oldLeader) == 0)
+        DropRewardLog(oldLeader);
+    return true;
+}
+
+void CClubInfoDB::DropRewardLog(const string& leaderAddress)
+{
+    AssertLockHeld(cs_clubinfo);
+    if (cacheRewardLog.erase(leaderAddress))
+        cacheRewardLogForFlush.insert(leaderAddress);
+}
+
+bool CClubInfoDB::SettleClub(const string& leaderAddress)
+{
+    AssertLockHeld(cs_clubinfo);
+    vector<string> vfathers(1, leaderAddress);
+    while (!vfathers.empty())
+    {
+        CMemberInfoMap::iterator it = cacheRecord.find(vfathers.back());
+        vfathers.pop_back();
+        if (it == cacheRecord.end() || it->second.size() <= 1)
+            continue;
+
+        vector<CMemberInfo>& vmemberInfo = it->second;
+        cacheForFlush.insert(it->first);
+        for(size_t i = 1; i < vmemberInfo.size(); i++)
+        {
+            if (!SettleMemberReward(leaderAddress, vmemberInfo[i]))
+                return false;
+            vmemberInfo[i].rwdIndex = 0;
+            vfathers.push_back(vmemberInfo[i].address);
+        }
+    }
+
+    return true;
+}
+
+bool CClubInfoDB::LoadRewardLogs()
+{
+    AssertLockHeld(cs_clubinfo);
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+    pair<int, string> key;
+    pcursor->Seek(make_pair(CLUBREWARDLOGFLAG, string()));
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == CLUBREWARDLOGFLAG)
+    {
+        if (!pcursor->GetValue(cacheRewardLog[key.second]))
+            return error("%s: unable to read the reward log of %s", __func__, key.second);
+        pcursor->Next();
+    }
+
+    // The members of a record are settled to the same position, the one the record was written at
+    pcursor->Seek(make_pair(CLUBSETTLEFLAG, string()));
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == CLUBSETTLEFLAG)
+    {
+        CClubSettlePoint point;
+        if (!pcursor->GetValue(point))
+            return error("%s: unable to read the settle point of %s", __func__, key.second);
+        CMemberInfoMap::iterator it = cacheRecord.find(key.second);
+        if (it == cacheRecord.end() || point.leader.compare(GetClubLeader(key.second)) != 0 ||
+            point.rwdIndex > GetRewardLogSize(point.leader))
+            return error("%s: the settle point of %s does not match the club records", __func__, key.second);
+        for(size_t i = 1; i < it->second.size(); i++)
+            it->second[i].rwdIndex = point.rwdIndex;
+        pcursor->Next();
+    }
+
+    LogPrintf("%s: loaded the reward logs of %d clubs\n", __func__, cacheRewardLog.size());
+    return true;
+}
+
+void CClubInfoDB::BuildClubIndex()
+{
+    AssertLockHeld(cs_clubinfo);
+    cacheFather.clear();
+    cacheRewardLog.clear();
+    cacheRewardLogForFlush.clear();
+    cacheClubMP.clear();
+    for(CMemberInfoMap::const_iterator it = cacheRecord.begin();
+        it != cacheRecord.end(); it++)
+    {
+        for(size_t i = 1; i < it->second.size(); i++)
+            cacheFather[it->second[i].address] = it->first;
+    }
+
+    for(CMemberInfoMap::iterator it = cacheRecord.begin();
+        it != cacheRecord.end(); it++)
+    {
+        if (it->second.size() <= 1)
+            continue;
+        string leader = GetClubLeader(it->first);
+        for(size_t i = 1; i < it->second.size(); i++)
+        {
+            it->second[i].rwdIndex = 0;
+            AddClubMP(leader, it->second[i].MP);
+        }
+    }
+
+    ComputeSubtrees(cacheSubtree);
+}
+
+void CClubInfoDB::ComputeSubtrees(CClubSubtreeMap& mapSubtree) const
+{
+    AssertLockHeld(cs_clubinfo);
+    mapSubtree.clear();
+    vector<pair<CMemberInfoMap::const_iterator, size_t> > vfathers;
+    for(CMemberInfoMap::const_iterator itRoot = cacheRecord.begin();
+        itRoot != cacheRecord.end(); itRoot++)
+    {
+        if (itRoot->second.size() <= 1 || cacheFather.find(itRoot->first) != cacheFather.end())
+            continue;
+
+        vfathers.push_back(make_pair(itRoot, 1));
+        while (!vfathers.empty())
+        {
+            CMemberInfoMap::const_iterator it = vfathers.back().first;
+            size_t i = vfathers.back().second++;
+            if (i >= it->second.size())
+            {
+                vfathers.pop_back();
+                if (!vfathers.empty())
+                {
+                    const CClubSubtree& subtree = mapSubtree[it->first];
+                    CClubSubtree& subtreeFather = mapSubtree[vfathers.back().first->first];
+                    subtreeFather.nMembers += subtree.nMembers;
+                    subtreeFather.nTotalMP += subtree.nTotalMP;
+                }
+                continue;
+            }
+
+            CClubSubtree& subtree = mapSubtree[it->first];
+            subtree.nMembers++;
+            subtree.nTotalMP += it->second[i].MP;
+            CMemberInfoMap::const_iterator itMember = cacheRecord.find(it->second[i].address);
+            if (itMember != cacheRecord.end() && itMember->second.size() > 1)
+                vfathers.push_back(make_pair(itMember, 1));
+        }
+    }
+}
+
+bool CClubInfoDB::CheckSubtrees()
+{
+    LOCK(cs_clubinfo);
+    CClubSubtreeMap mapSubtree;
+    ComputeSubtrees(mapSubtree);
+
+    bool fConsistent = true;
+    for(CClubSubtreeMap::const_iterator it = mapSubtree.begin(); it != mapSubtree.end(); it++)
+    {
+        CClubSubtree subtree = GetSubtree(it->first);
+        if (subtree.nMembers != it->second.nMembers || subtree.nTotalMP != it->second.nTotalMP)
+        {
+            LogPrintf("%s: subtree of %s has %u members and %u MP, %u and %u are kept\n", __func__, it->first,
+                      it->second.nMembers, it->second.nTotalMP, subtree.nMembers, subtree.nTotalMP);
+            fConsistent = false;
+        }
+    }
+    for(CClubSubtreeMap::const_iterator it = cacheSubtree.begin(); it != cacheSubtree.end(); it++)
+    {
+        if (mapSubtree.find(it->first) == mapSubtree.end())
+        {
+            LogPrintf("%s: subtree of %s is kept but has no members\n", __func__, it->first);
+            fConsistent = false;
+        }
+    }
+    return fConsistent;
 }
 
 vector<string> CClubInfoDB::GetAllFathers()
 {
     vector<string> fathers;
     LOCK(cs_clubinfo);
-    for(map<string, vector<CMemberInfo> >::const_iterator it = cacheRecord.begin();
+    for(CMemberInfoMap::const_iterator it = cacheRecord.begin();
         it != cacheRecord.end(); it++)
         fathers.push_back(it->first);
+    // Keep the order of the RPC results stable
+    std::sort(fathers.begin(), fathers.end());
 
     return fathers;
 }
+
+void CClubInfoDB::WriteUndoLog(int nHeight)
+{
+    AssertLockHeld(cs_clubinfo);
+    cacheBlockUndo[nHeight].swap(cacheUndoLog);
+    cacheBlockUndoErased.erase(nHeight);
+    cacheUndoLog.clear();
+}
+
+void CClubInfoDB::ClearUndoLog()
+{
+    AssertLockHeld(cs_clubinfo);
+    cacheUndoLog.clear();
+}
+
+bool CClubInfoDB::HaveUndoLog(int nHeight) const
+{
+    AssertLockHeld(cs_clubinfo);
+    if (cacheBlockUndo.count(nHeight))
+        return true;
+    if (cacheBlockUndoErased.count(nHeight))
+        return false;
+
+    return Exists(make_pair(CLUBUNDOFLAG, nHeight));
+}
+
+bool CClubInfoDB::UndoBlock(int nHeight, map<string, uint64_t>& mapIndexes)
+{
+    AssertLockHeld(cs_clubinfo);
+    CClubBlockUndo blockUndo;
+    if (!ReadBlockUndo(nHeight, blockUndo))
+        return error("%s: no undo log at height %d", __func__, nHeight);
+
+    // Every change is undone by the same updates the block was connected with, the undo log
+    // only keeps the arguments of the updates and what they replaced
+    for(CClubBlockUndo::const_reverse_iterator it = blockUndo.rbegin(); it != blockUndo.rend(); it++)
+    {
+        const CClubUndoEntry& entry = *it;
+        CMemberInfoMap::iterator itRecord = cacheRecord.find(entry.address);
+        switch (entry.nType)
+        {
+        case CLUB_UNDO_ADD:
+        {
+            if (itRecord == cacheRecord.end() || entry.index + 1 != itRecord->second.size())
+                return error("%s: member %d of %s is not the last one at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            CMemberInfo memberinfo = itRecord->second[entry.index];
+            uint64_t index = entry.index;
+            if (!UpdateMembersByFatherAddress(entry.address, memberinfo, index, nHeight, false))
+                return error("%s: unable to remove member %d of %s at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            mapIndexes.erase(memberinfo.address);
+            break;
+        }
+        case CLUB_UNDO_SELF:
+        {
+            if (itRecord == cacheRecord.end() || itRecord->second.empty() ||
+                (!entry.fReplaced && itRecord->second.size() != 1))
+                return error("%s: unexpected record of %s at height %d", __func__, entry.address, nHeight);
+            if (entry.fReplaced)
+                itRecord->second[0] = entry.memberinfo;
+            else
+                cacheRecord.erase(itRecord);
+            cacheForFlush.insert(entry.address);
+            break;
+        }
+        case CLUB_UNDO_REMOVE:
+        {
+            if (entry.index == 0)
+            {
+                if (itRecord != cacheRecord.end() && !itRecord->second.empty())
+                    return error("%s: unexpected record of %s at height %d", __func__, entry.address, nHeight);
+                cacheRecord[entry.address] = vector<CMemberInfo>(1, entry.memberinfo);
+                cacheForFlush.insert(entry.address);
+                break;
+            }
+
+            // The member joins again at the end, and swaps with the member which took its position
+            uint64_t index = 0;
+            if (!UpdateMembersByFatherAddress(entry.address, entry.memberinfo, index, nHeight, true))
+                return error("%s: unable to add member %d of %s again at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            vector<CMemberInfo>& vmemberInfo = cacheRecord[entry.address];
+            if (entry.index > index)
+                return error("%s: member %d of %s out of range at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            if (entry.index < index)
+            {
+                std::swap(vmemberInfo[entry.index], vmemberInfo[index]);
+                mapIndexes[vmemberInfo[index].address] = index;
+            }
+            mapIndexes[entry.memberinfo.address] = entry.index;
+            break;
+        }
+        case CLUB_UNDO_MP:
+        {
+            uint64_t amount = (entry.nValue < 0) ? -entry.nValue : entry.nValue;
+            if (!UpdateMpByChange(entry.address, entry.index, false, amount, entry.nValue < 0))
+                return error("%s: unable to undo the mining power of member %d of %s at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            break;
+        }
+        case CLUB_UNDO_REWARD:
+        {
+            if (itRecord == cacheRecord.end() || entry.index >= itRecord->second.size())
+                return error("%s: member %d of %s out of range at height %d", __func__,
+                             entry.index, entry.address, nHeight);
+            itRecord->second[entry.index].rwd -= entry.nValue;
+            cacheForFlush.insert(entry.address);
+            break;
+        }
+        case CLUB_UNDO_SHARE:
+        {
+            CAmount distributedRewards = 0;
+            if (!UpdateRewardsByMinerAddress(entry.address, entry.nValue, entry.nTotalMP, distributedRewards,
+                                             nHeight, !entry.fUndo))
+                return error("%s: unable to undo the rewards shared by %s at height %d", __func__,
+                             entry.address, nHeight);
+            break;
+        }
+        default:
+            return error("%s: unknown change %d at height %d", __func__, entry.nType, nHeight);
+        }
+    }
+
+    cacheBlockUndo.erase(nHeight);
+    cacheBlockUndoErased.insert(nHeight);
+    return true;
+}
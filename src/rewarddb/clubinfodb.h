@@ -6,19 +6,53 @@
 #include "dbwrapper.h"
 #include "chain.h"
 #include "base58.h"
+#include "hash.h"
 #include "leveldb/db.h"
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 
+#include <boost/unordered_map.hpp>
+
 
 #define CLUBINFODBPATH "clubinfodb"
 #define RWDBALDBRATEPATH "/rewardrate"
 #define NOT_VALID_RECORD "NOT_VALID"
 #define NO_MOVED_ADDRESS "NO_MOVED_ADDRESS"
+#define CLUBUNDOFLAG (-30)
+#define CLUBREWARDLOGFLAG (-31)
+#define CLUBSETTLEFLAG (-32)
+
+/** The records are keyed by the address alone, behind its length byte. The keys of the flags above
+ *  start with the low byte of a negative int, so every key from the lowest flag's up is not a record */
+static const unsigned char CLUB_FLAG_KEY_PREFIX = (unsigned char)CLUBSETTLEFLAG;
+
+/** Blocks deeper than this below the flushed height have their undo logs pruned, the same depth
+ *  as MIN_BLOCKS_TO_KEEP. Older blocks are undone by replaying their transactions */
+static const int CLUB_UNDO_LOG_DEPTH = 288;
+
+/** Reward logs longer than this are settled to every member of the club at a flush and dropped,
+ *  which bounds the log written for a club */
+static const size_t CLUB_REWARD_LOG_SETTLE_SIZE = 1024;
 
 extern CCriticalSection cs_clubinfo;
 
+/** Salted hasher for the caches keyed by address, so that chosen addresses cannot degrade lookups */
+class SaltedAddressHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedAddressHasher();
+
+    size_t operator()(const std::string& address) const {
+        return CSipHasher(k0, k1).Write((const unsigned char*)address.data(), address.size()).Finalize();
+    }
+};
+
 /** View on the reward rate dataset. */
 
 class CRewardRateViewDB
@@ -55,10 +89,12 @@ typedef struct _CMemberInfo {
 
     CAmount rwd; // The reward balance of the address
 
-    _CMemberInfo() : address(" "), MP(0), rwd(0) { }
+    uint64_t rwdIndex; // The position in the club's reward log which rwd has been settled to, see CClubSettlePoint
+
+    _CMemberInfo() : address(" "), MP(0), rwd(0), rwdIndex(0) { }
 
     _CMemberInfo(std::string _address, uint64_t _MP, CAmount _rwd) :
-        address(_address), MP(_MP), rwd(_rwd) { }
+        address(_address), MP(_MP), rwd(_rwd), rwdIndex(0) { }
 
     ADD_SERIALIZE_METHODS;
 
@@ -72,40 +108,233 @@ typedef struct _CMemberInfo {
 
 }CMemberInfo;
 
+typedef struct _CClubRewardEntry {
+    CAmount memberRewards; // The rewards shared by the members of the club
+
+    uint64_t memberTotalMP; // The total mining power of the members when the rewards were shared
+
+    bool isUndo; // Whether the entry takes back the rewards shared before
+
+    bool fFixedPoint; // Whether the rewards are split with exact integer arithmetic
+
+    _CClubRewardEntry() : memberRewards(0), memberTotalMP(0), isUndo(false), fFixedPoint(false) { }
+
+    _CClubRewardEntry(CAmount _memberRewards, uint64_t _memberTotalMP, bool _isUndo, bool _fFixedPoint) :
+        memberRewards(_memberRewards), memberTotalMP(_memberTotalMP), isUndo(_isUndo), fFixedPoint(_fFixedPoint) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(memberRewards);
+        READWRITE(VARINT(memberTotalMP));
+        READWRITE(isUndo);
+        READWRITE(fFixedPoint);
+    }
+
+}CClubRewardEntry;
+
+/** Where the members of a record on disk are settled to in the reward log of their club. Records
+ *  without one are settled to the start of the log */
+typedef struct _CClubSettlePoint {
+    std::string leader; // The leader of the club when the record was written
+
+    uint64_t rwdIndex; // The position in the leader's reward log which the members are settled to
+
+    _CClubSettlePoint() : rwdIndex(0) { }
+
+    _CClubSettlePoint(const std::string& _leader, uint64_t _rwdIndex) : leader(_leader), rwdIndex(_rwdIndex) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(leader);
+        READWRITE(VARINT(rwdIndex));
+    }
+
+}CClubSettlePoint;
+
+typedef struct _CClubSubtree {
+    uint64_t nMembers; // The number of members below the address, at any depth
+
+    uint64_t nTotalMP; // The total mining power of these members
+
+    _CClubSubtree() : nMembers(0), nTotalMP(0) { }
+
+}CClubSubtree;
+
+//! Changes of the club records kept in the undo log of a block, see CClubUndoEntry
+enum ClubUndoType
+{
+    CLUB_UNDO_ADD = 1,    // A member was appended to the father's record
+    CLUB_UNDO_SELF = 2,   // The father's own entry was set
+    CLUB_UNDO_REMOVE = 3, // A member was removed, the last member taking its position
+    CLUB_UNDO_MP = 4,     // The mining power of a member changed
+    CLUB_UNDO_REWARD = 5, // The reward of a member changed
+    CLUB_UNDO_SHARE = 6,  // The rewards of a block were shared by the club of a miner
+};
+
+/** One change of the club records by a block, undone in reverse order when the block is disconnected */
+typedef struct _CClubUndoEntry {
+    unsigned char nType; // The ClubUndoType of the change
+
+    std::string address; // The father of the record, or the miner sharing the rewards
+
+    uint64_t index; // The position in the father's record
+
+    int64_t nValue; // The change of mining power or reward, or the rewards shared
+
+    uint64_t nTotalMP; // The total mining power the rewards were shared by
+
+    bool fReplaced; // Whether the father's own entry replaced another one
+
+    bool fUndo; // Whether the rewards shared were taken back
+
+    CMemberInfo memberinfo; // The entry removed or replaced
+
+    _CClubUndoEntry() : nType(0), index(0), nValue(0), nTotalMP(0), fReplaced(false), fUndo(false) { }
+
+    _CClubUndoEntry(unsigned char _nType, const std::string& _address, uint64_t _index=0, int64_t _nValue=0) :
+        nType(_nType), address(_address), index(_index), nValue(_nValue), nTotalMP(0), fReplaced(false), fUndo(false) { }
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion)
+    {
+        READWRITE(this->nType);
+        READWRITE(address);
+        if (this->nType != CLUB_UNDO_SELF && this->nType != CLUB_UNDO_SHARE)
+            READWRITE(VARINT(index));
+        if (this->nType == CLUB_UNDO_MP || this->nType == CLUB_UNDO_REWARD || this->nType == CLUB_UNDO_SHARE)
+            READWRITE(nValue);
+        if (this->nType == CLUB_UNDO_SHARE)
+        {
+            READWRITE(VARINT(nTotalMP));
+            READWRITE(fUndo);
+        }
+        if (this->nType == CLUB_UNDO_SELF)
+            READWRITE(fReplaced);
+        if (this->nType == CLUB_UNDO_REMOVE || (this->nType == CLUB_UNDO_SELF && fReplaced))
+            READWRITE(memberinfo);
+    }
+
+}CClubUndoEntry;
+
+//! The changes of the club records by a block, in the order they were made
+typedef std::vector<CClubUndoEntry> CClubBlockUndo;
+
+typedef boost::unordered_map<std::string, std::vector<CMemberInfo>, SaltedAddressHasher> CMemberInfoMap;
+typedef boost::unordered_map<std::string, std::string, SaltedAddressHasher> CAddressMap;
+typedef boost::unordered_map<std::string, std::vector<CClubRewardEntry>, SaltedAddressHasher> CClubRewardLogMap;
+typedef boost::unordered_map<std::string, std::map<uint64_t, uint64_t>, SaltedAddressHasher> CClubMPMap;
+typedef boost::unordered_map<std::string, CClubSubtree, SaltedAddressHasher> CClubSubtreeMap;
+
+/** Visitor over the members of a club, see CClubInfoDB::VisitTotalMembers. */
+class CClubMemberVisitor
+{
+public:
+    virtual ~CClubMemberVisitor() {}
+
+    //! Called for every member with its father and its index there, return false to stop the visit
+    virtual bool Visit(const std::string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo) = 0;
+};
+
 /** View on the club info dataset. */
 class CClubInfoDB : public CDBWrapper
 {
 private:
-    //! the level DB's WriteBatch
-    CDBBatch* batch;
-
     //! clubinfo database used
     CRewardRateViewDB* _prewardratedbview;
 
     //! cache for accelerating
-    std::map<std::string, std::vector<CMemberInfo> > cacheRecord;
+    CMemberInfoMap cacheRecord;
+
+    //! the father of every address listed as a member(index > 0) in cacheRecord
+    CAddressMap cacheFather;
+
+    //! rewards shared by the club leaders, which are settled to the members lazily
+    CClubRewardLogMap cacheRewardLog;
+
+    //! leaders whose reward logs changed or were dropped since the last flush
+    std::set<std::string> cacheRewardLogForFlush;
+
+    //! count of members per mining power in each club, used to compute the shared rewards
+    CClubMPMap cacheClubMP;
+
+    //! size and mining power of the members below every address which has members
+    CClubSubtreeMap cacheSubtree;
+
+    //! fathers whose records changed since the last flush
+    std::set<std::string> cacheForFlush;
+
+    //! changes of the records since the last block, which become the undo log of the next one
+    CClubBlockUndo cacheUndoLog;
+
+    //! block undo logs written since the last flush
+    std::map<int, CClubBlockUndo> cacheBlockUndo;
+
+    //! heights of the block undo logs erased since the last flush
+    std::set<int> cacheBlockUndoErased;
 
     //! Current updated height
     int currentHeight;
 
+    //! Height of the newest records on disk
+    int flushedHeight;
+
     bool WriteDB(const std::string& address, const std::vector<CMemberInfo>& value);
-    template <typename K, typename V>
-    void WriteToBatch(const K& key, const V& value) { batch->Write(key, value); }
 
     bool ReadDB(const std::string& address, std::vector<CMemberInfo>& value) const;
 
     bool DeleteDB(const std::string& address);
-    void DeleteToBatch(const std::string& address) { batch->Erase(address); }
 
-    bool CommitDB(bool fSync = false) { return WriteBatch(*batch, fSync); }
+    bool ReadBlockUndo(int nHeight, CClubBlockUndo& blockUndo) const;
 
     void GetTotalMembers(const std::string& fatherAddress, std::vector<std::string>& vmembers);
 
-    bool ComputeMemberReward(const uint64_t& MP, const uint64_t& totalMP,
-                             const CAmount& totalRewards, CAmount& memberReward);
+    bool UpdateRewards(const std::string& minerAddress, CAmount memberRewards, uint64_t memberTotalMP,
+                       CAmount& distributedRewards, bool isUndo, bool fFixedPoint);
 
-    bool UpdateRewards(const std::string& minerAddress, CAmount memberRewards,
-                       uint64_t memberTotalMP, CAmount& distributedRewards, bool isUndo);
+    bool ShareRewards(const std::string& leaderAddress, CAmount memberRewards, uint64_t memberTotalMP,
+                      CAmount& distributedRewards, bool isUndo, bool fFixedPoint);
+
+    std::string GetClubLeader(const std::string& address) const;
+
+    size_t GetRewardLogSize(const std::string& leaderAddress) const;
+
+    bool SettleMemberReward(const std::string& leaderAddress, CMemberInfo& memberinfo);
+
+    bool SettleRecord(const std::string& fatherAddress);
+
+    CMemberInfo* FindMember(const std::string& fatherAddress, uint64_t index);
+
+    void AddClubMP(const std::string& leaderAddress, uint64_t MP);
+
+    CClubSubtree GetSubtree(const std::string& address) const;
+
+    //! Change the subtrees of the father and all the addresses above it, and return the club leader
+    std::string UpdateSubtrees(const std::string& fatherAddress, uint64_t nMembers, uint64_t nMP, bool add);
+
+    void RemoveClubMP(const std::string& leaderAddress, uint64_t MP);
+
+    bool MoveMembersToClub(const std::string& address, const std::string& oldLeader,
+                           const std::string& newLeader);
+
+    bool SettleClub(const std::string& leaderAddress);
+
+    void DropRewardLog(const std::string& leaderAddress);
+
+    //! Read the reward logs and the settle points of the records written by WriteDataToDisk
+    bool LoadRewardLogs();
+
+    void BuildClubIndex();
+
+    //! Sum the members below every address from the records, bottom up from the club leaders
+    void ComputeSubtrees(CClubSubtreeMap& mapSubtree) const;
 
 public:
     //! Constructor
@@ -124,7 +353,8 @@ public:
     //! Init the father and mp of the address from genesis block
     bool InitGenesisDB(const std::vector<std::string>& addresses);
 
-    //! Clear the clubinfo accelerating cache
+    //! Clear the clubinfo accelerating cache. Changes not yet written by WriteDataToDisk, including
+    //! the undo logs of the blocks since the last flush, are dropped as well
     void ClearCache();
 
     //! Commit the database transaction
@@ -139,7 +369,9 @@ public:
     //! Read data from disk to memory
     bool LoadDBToMemory();
 
-    //! Write data from memory to disk
+    //! Write data changed since the last flush from memory to disk and prune the undo logs
+    //! older than CLUB_UNDO_LOG_DEPTH blocks. Only the members of the changed records are settled,
+    //! the others are settled from the reward logs written along
     bool WriteDataToDisk(int newestHeight, bool fSync);
 
     //! Retrieve the existence of the address's item
@@ -148,16 +380,45 @@ public:
     //! Get cache record by address
     std::vector<CMemberInfo> GetCacheRecord(const std::string& address);
 
-    //! Update the leader's members
-    std::string UpdateMembersByFatherAddress(const std::string& fatherAddress, const CMemberInfo& memberinfo,
-                                             uint64_t& index, int nHeight, bool add);
+    //! Get one member of the father's record, without copying the whole record
+    bool GetMemberInfo(const std::string& fatherAddress, uint64_t index, CMemberInfo& memberinfo);
+
+    //! Get the mining power and the reward of one member of the father's record
+    bool GetMemberMPAndReward(const std::string& fatherAddress, uint64_t index, uint64_t& MP, CAmount& rwd);
+
+    //! Update the leader's members. The member which took the position of a removed one is returned
+    //! in pAddressMoved, or NO_MOVED_ADDRESS
+    bool UpdateMembersByFatherAddress(const std::string& fatherAddress, const CMemberInfo& memberinfo,
+                                      uint64_t& index, int nHeight, bool add, std::string* pAddressMoved=NULL);
 
     //! Retrieve the merbers' addresses
     void GetTotalMembersByAddress(const std::string& fatherAddress, std::vector<std::string>& vmembers);
 
-    //! Update rewards of all members in the club
+    //! Get the number and the total mining power of the members below the address
+    CClubSubtree GetSubtreeByAddress(const std::string& fatherAddress);
+
+    //! Recompute the subtrees from the records and compare them with the ones kept up to date, which
+    //! are not written to disk. Returns false and logs the addresses that differ
+    bool CheckSubtrees();
+
+    //! Visit the members below the address in the order of GetTotalMembersByAddress, the visitor must not
+    //! change the club records. The first nSkip members are passed over without visiting their subtrees.
+    //! False if the reward of a member cannot be settled
+    bool VisitTotalMembers(const std::string& fatherAddress, CClubMemberVisitor& visitor, uint64_t nSkip=0);
+
+    //! Visit every record of a snapshot of the flushed database, father by father. The members are
+    //! settled from the reward logs of the snapshot, which can be read without cs_clubinfo while
+    //! blocks connect
+    bool VisitSnapshotMembers(const leveldb::Snapshot* snapshot, CClubMemberVisitor& visitor);
+
+    //! Compute the member's share of the rewards, with the legacy floating point split or the exact
+    //! integer split floor(totalRewards * MP / totalMP)
+    static bool ComputeMemberReward(const uint64_t& MP, const uint64_t& totalMP,
+                                    const CAmount& totalRewards, CAmount& memberReward, bool fFixedPoint=false);
+
+    //! Update rewards of all members in the club by the rewards of the block at nHeight
     bool UpdateRewardsByMinerAddress(const std::string& minerAddress, CAmount memberRewards,
-                                     uint64_t memberTotalMP, CAmount& distributedRewards, bool isUndo);
+                                     uint64_t memberTotalMP, CAmount& distributedRewards, int nHeight, bool isUndo);
 
     //! Update mining power of the address
     bool UpdateMpByChange(std::string fatherAddr, uint64_t index, bool isUndo=false,
@@ -166,8 +427,26 @@ public:
     //! Update reward of the address
     void UpdateRewardByChange(std::string fatherAddr, uint64_t index, CAmount rewardChange, bool isUndo=false);
 
+    //! Update rewards of the members of several clubs, by father and index. Nothing is changed
+    //! and false is returned if one of the members does not exist
+    bool UpdateRewardsByChanges(const std::map<std::string, std::vector<std::pair<uint64_t, CAmount> > >& mapClubChanges,
+                                bool isUndo=false);
+
     //! Get all the fathers
     std::vector<std::string> GetAllFathers();
+
+    //! Keep the changes of the records since the last block as the undo log of the block at nHeight
+    void WriteUndoLog(int nHeight);
+
+    //! Drop the changes of the records since the last block, after they were undone
+    void ClearUndoLog();
+
+    //! Whether the block at nHeight has an undo log, blocks connected by older versions have none
+    bool HaveUndoLog(int nHeight) const;
+
+    //! Revert the changes in the undo log of the block at nHeight. The positions the members
+    //! were moved back to in the records of their fathers are returned by address
+    bool UndoBlock(int nHeight, std::map<std::string, uint64_t>& mapIndexes);
 };
 
 #endif // TAUCOIN_CLUBINFODB_H
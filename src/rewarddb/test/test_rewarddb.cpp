@@ -23,6 +23,7 @@
 #include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
 #include <boost/thread.hpp>
+#include <limits>
 #include <list>
 #include <map>
 #include <set>
@@ -269,10 +270,8 @@ BOOST_AUTO_TEST_CASE(clubInfodb_UpdateMembersByFatherAddress_test)
                         else
                         {
                             index = indexIn[l];
-                            addressMovedOut[j][k][l][m] =
-                                    pclubinfodb->UpdateMembersByFatherAddress(fatherAddress[j],
-                                                                              CMemberInfo(" ", 0, 0),
-                                                                              index, 2, add[i]);
+                            pclubinfodb->UpdateMembersByFatherAddress(fatherAddress[j], CMemberInfo(" ", 0, 0),
+                                                                      index, 2, add[i], &addressMovedOut[j][k][l][m]);
 
                             if (j == 1 && recordErased[j][k][l][m] == false)
                             {
@@ -347,4 +346,702 @@ BOOST_AUTO_TEST_CASE(addrInfodb_EntrustByAddress_test)
         cout<<members[i]<<endl;
 }
 
+BOOST_AUTO_TEST_CASE(addrInfodb_LazyLoad_test)
+{
+    vector<string> addresses;
+    for(int i = 0; i < 20; i++)
+        addresses.push_back(GetRandomAddress());
+
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    BOOST_CHECK(paddrinfodb->InitGenesisDB(vector<string>(1, addresses[0])));
+    paddrinfodb->Commit(0);
+    paddrinfodb->ClearCache();
+    int nHeight = addresses.size() - 1;
+    for(int i = 1; i <= nHeight; i++)
+    {
+        BOOST_CHECK(paddrinfodb->UpdateMpAndTotalMPByAddress(addresses[i], i, addresses[i-1]));
+        paddrinfodb->Commit(i);
+        paddrinfodb->ClearCache();
+    }
+
+    vector<CTAUAddrInfo> expected;
+    for(size_t i = 0; i < addresses.size(); i++)
+        expected.push_back(paddrinfodb->GetAddrInfo(addresses[i], nHeight));
+    BOOST_CHECK(paddrinfodb->WriteNewestDataToDisk(nHeight, uint256()));
+
+    // Keep a single record in memory, every other one is read back from disk
+    paddrinfodb->ClearReadCache();
+    paddrinfodb->EnableLazyLoad(1);
+    for(int n = 0; n < 2; n++)
+    {
+        for(size_t i = 0; i < addresses.size(); i++)
+        {
+            CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(addresses[i], nHeight);
+            BOOST_CHECK_EQUAL(addrInfo.father, expected[i].father);
+            BOOST_CHECK_EQUAL(addrInfo.miner, expected[i].miner);
+            BOOST_CHECK_EQUAL(addrInfo.index, expected[i].index);
+            BOOST_CHECK_EQUAL(addrInfo.totalMP, expected[i].totalMP);
+            BOOST_CHECK_EQUAL(addrInfo.lastHeight, expected[i].lastHeight);
+        }
+    }
+    BOOST_CHECK_EQUAL(paddrinfodb->GetAddrInfo(GetRandomAddress(), nHeight).father, " ");
+
+    // A record read ahead is kept like one read on demand
+    CTAUAddrInfo addrInfo;
+    BOOST_CHECK(!paddrinfodb->HaveNewestInMemory(addresses[1]));
+    BOOST_CHECK(paddrinfodb->ReadNewestFromDisk(addresses[1], addrInfo));
+    BOOST_CHECK_EQUAL(addrInfo.totalMP, expected[1].totalMP);
+    paddrinfodb->AddPrefetchedNewest(addresses[1], addrInfo);
+    BOOST_CHECK(paddrinfodb->HaveNewestInMemory(addresses[1]));
+    BOOST_CHECK_EQUAL(paddrinfodb->GetAddrInfo(addresses[1], nHeight).father, expected[1].father);
+}
+
+BOOST_AUTO_TEST_CASE(addrInfodb_ReadCache_test)
+{
+    string leader = GetRandomAddress();
+    string member = GetRandomAddress();
+    string other = GetRandomAddress();
+
+    CAddrInfoReadCache cache;
+    cache.Set(leader, CTAUAddrInfo("0", "0", 0, 2, 1));
+    cache.Set(member, CTAUAddrInfo(leader, leader, 1, 0, 2));
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+
+    CTAUAddrInfo addrInfo;
+    BOOST_CHECK(cache.Get(leader, addrInfo));
+    BOOST_CHECK_EQUAL(addrInfo.miner, "0");
+    BOOST_CHECK_EQUAL(addrInfo.father, "0");
+    BOOST_CHECK_EQUAL(addrInfo.totalMP, 2);
+    BOOST_CHECK(cache.Get(member, addrInfo));
+    BOOST_CHECK_EQUAL(addrInfo.miner, leader);
+    BOOST_CHECK_EQUAL(addrInfo.father, leader);
+    BOOST_CHECK_EQUAL(addrInfo.index, 1);
+    BOOST_CHECK_EQUAL(addrInfo.lastHeight, 2);
+
+    // An address only linked as a father has no record of its own
+    cache.Set(member, CTAUAddrInfo(" ", other, 1, 0, 3));
+    BOOST_CHECK(!cache.Contains(other));
+    BOOST_CHECK(!cache.Get(other, addrInfo));
+    BOOST_CHECK(cache.Get(member, addrInfo));
+    BOOST_CHECK_EQUAL(addrInfo.miner, " ");
+    BOOST_CHECK_EQUAL(addrInfo.father, other);
+
+    // Erasing a record keeps the address while other records link to it
+    cache.Erase(leader);
+    BOOST_CHECK(!cache.Contains(leader));
+    cache.Set(member, CTAUAddrInfo(leader, leader, 1, 0, 4));
+    cache.Erase(other);
+    BOOST_CHECK(cache.Get(member, addrInfo));
+    BOOST_CHECK_EQUAL(addrInfo.father, leader);
+    BOOST_CHECK_EQUAL(cache.Size(), 1);
+
+    cache.Erase(member);
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+    BOOST_CHECK(!cache.Get(member, addrInfo));
+
+    // The ids freed above are reused, and enough addresses to grow the table stay found
+    vector<string> addresses;
+    for(int i = 0; i < 100; i++)
+    {
+        addresses.push_back(GetRandomAddress());
+        cache.Set(addresses[i], CTAUAddrInfo(i > 0 ? addresses[i - 1] : "0", leader, i, i, i));
+    }
+    for(int i = 0; i < 100; i += 2)
+        cache.Erase(addresses[i]);
+    BOOST_CHECK_EQUAL(cache.Size(), 50);
+    for(int i = 1; i < 100; i += 2)
+    {
+        BOOST_CHECK(cache.Get(addresses[i], addrInfo));
+        BOOST_CHECK_EQUAL(addrInfo.miner, addresses[i - 1]);
+        BOOST_CHECK_EQUAL(addrInfo.father, leader);
+        BOOST_CHECK_EQUAL(addrInfo.index, i);
+    }
+    cache.Clear();
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(addrInfodb_History_test)
+{
+    vector<string> addresses;
+    for(int i = 0; i < 20; i++)
+        addresses.push_back(GetRandomAddress());
+
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    BOOST_CHECK(paddrinfodb->InitGenesisDB(vector<string>(1, addresses[0])));
+    paddrinfodb->Commit(0);
+    paddrinfodb->ClearCache();
+
+    // The leader's record changes in every block, half of the history is flushed to disk
+    int nHeight = addresses.size() - 1;
+    vector<CTAUAddrInfo> expected(1, paddrinfodb->GetAddrInfo(addresses[0], 0));
+    for(int i = 1; i <= nHeight; i++)
+    {
+        BOOST_CHECK(paddrinfodb->UpdateMpAndTotalMPByAddress(addresses[i], i, addresses[0]));
+        paddrinfodb->Commit(i);
+        paddrinfodb->ClearCache();
+        expected.push_back(paddrinfodb->GetAddrInfo(addresses[0], i));
+        if (i == nHeight / 2)
+            BOOST_CHECK(paddrinfodb->WriteNewestDataToDisk(i, uint256()));
+    }
+
+    for(int i = 0; i < nHeight; i++)
+    {
+        paddrinfodb->ClearUndoCache();
+        CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(addresses[0], i);
+        BOOST_CHECK_EQUAL(addrInfo.father, expected[i].father);
+        BOOST_CHECK_EQUAL(addrInfo.miner, expected[i].miner);
+        BOOST_CHECK_EQUAL(addrInfo.totalMP, expected[i].totalMP);
+
+        // A member has no record before it joined
+        paddrinfodb->ClearUndoCache();
+        BOOST_CHECK_EQUAL(paddrinfodb->GetAddrInfo(addresses[i+1], i).father, " ");
+        paddrinfodb->ClearUndoCache();
+        BOOST_CHECK_EQUAL(paddrinfodb->GetAddrInfo(addresses[i+1], i+1).father, addresses[0]);
+    }
+    paddrinfodb->ClearUndoCache();
+}
+
+BOOST_AUTO_TEST_CASE(addrInfodb_UpdateRewardsByChanges_test)
+{
+    vector<string> addresses;
+    for(int i = 0; i < 10; i++)
+        addresses.push_back(GetRandomAddress());
+
+    LOCK2(cs_addrinfo, cs_clubinfo);
+    BOOST_CHECK(paddrinfodb->InitGenesisDB(vector<string>(1, addresses[0])));
+    paddrinfodb->Commit(0);
+    paddrinfodb->ClearCache();
+    int nHeight = addresses.size() - 1;
+    for(int i = 1; i <= nHeight; i++)
+    {
+        BOOST_CHECK(paddrinfodb->UpdateMpAndTotalMPByAddress(addresses[i], i, addresses[(i-1)/2]));
+        paddrinfodb->Commit(i);
+        paddrinfodb->ClearCache();
+    }
+
+    // Several changes of the same address, in no particular order
+    vector<pair<string, CAmount> > vRewardChanges;
+    vector<CAmount> expected;
+    for(size_t i = 0; i < addresses.size(); i++)
+        expected.push_back(paddrinfodb->GetRwdBalance(addresses[i], nHeight));
+    for(int n = 1; n <= 3; n++)
+    {
+        for(size_t i = 0; i < addresses.size(); i += n)
+        {
+            vRewardChanges.push_back(make_pair(addresses[i], n * (i + 1) * CENT));
+            expected[i] += n * (i + 1) * CENT;
+        }
+    }
+
+    BOOST_CHECK(paddrinfodb->UpdateRewardsByChanges(vRewardChanges, nHeight));
+    for(size_t i = 0; i < addresses.size(); i++)
+        BOOST_CHECK_EQUAL(paddrinfodb->GetRwdBalance(addresses[i], nHeight), expected[i]);
+
+    BOOST_CHECK(paddrinfodb->UpdateRewardsByChanges(vRewardChanges, nHeight, true));
+    for(size_t i = 0; i < addresses.size(); i++)
+    {
+        for(int n = 1; n <= 3; n++)
+        {
+            if (i % n == 0)
+                expected[i] -= n * (i + 1) * CENT;
+        }
+        BOOST_CHECK_EQUAL(paddrinfodb->GetRwdBalance(addresses[i], nHeight), expected[i]);
+    }
+
+    // A sender without a record rejects the whole block, the other changes are not applied
+    vRewardChanges.push_back(make_pair(GetRandomAddress(), CENT));
+    BOOST_CHECK(!paddrinfodb->UpdateRewardsByChanges(vRewardChanges, nHeight));
+    for(size_t i = 0; i < addresses.size(); i++)
+        BOOST_CHECK_EQUAL(paddrinfodb->GetRwdBalance(addresses[i], nHeight), expected[i]);
+}
+
+static CAmount ExpectedMemberReward(uint64_t MP, uint64_t totalMP, CAmount totalRewards)
+{
+    arith_uint256 tmp = totalMP;
+    arith_uint256 mp = MP;
+    arith_uint256 tRwd_1 = totalRewards / (CENT*CENT);
+    arith_uint256 tRwd_2 = totalRewards % (CENT*CENT) / CENT;
+    arith_uint256 tRwd_3 = totalRewards % (CENT*CENT) % CENT;
+    double ratio = mp.getdouble() / tmp.getdouble();
+    CAmount memberReward_1 = ratio * tRwd_1.getdouble() * (CENT*CENT);
+    CAmount memberReward_2 = ratio * tRwd_2.getdouble() * CENT;
+    CAmount memberReward_3 = ratio * tRwd_3.getdouble();
+    return std::min(memberReward_1 + memberReward_2 + memberReward_3, totalRewards);
+}
+
+/** Collects the visited members, to compare with GetTotalMembersByAddress */
+class CMemberCollector : public CClubMemberVisitor
+{
+public:
+    vector<string> vmembers;
+    vector<CAmount> vrewards;
+
+    bool Visit(const string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
+    {
+        vmembers.push_back(memberinfo.address);
+        vrewards.push_back(memberinfo.rwd);
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(clubInfodb_UpdateRewardsByMinerAddress_test)
+{
+    LOCK(cs_clubinfo);
+    pclubinfodb->ClearCache();
+    const string leader = "TNELcnfUUak1J1Cw1bUdF3UBXunfR71Hmb";
+    vector<string> inits(1, leader);
+    pclubinfodb->InitGenesisDB(inits);
+
+    // leader <- A, B; A <- C; C <- D
+    const string member[4] = {"A", "B", "C", "D"};
+    const string father[4] = {leader, leader, "A", "C"};
+    uint64_t index[4] = {0};
+    for(int i = 0; i < 4; i++)
+        pclubinfodb->UpdateMembersByFatherAddress(father[i], CMemberInfo(member[i], i + 1, 0), index[i], 1, true);
+
+    // Rewards are shared by the MP at the time of the block, so the members' MP changes in between
+    CAmount expected[4] = {0};
+    CAmount expectedLeader = 0;
+    const CAmount rewards[3] = {123456789, 987654321, 5555};
+    for(int h = 0; h < 3; h++)
+    {
+        uint64_t totalMP = 0;
+        for(int i = 0; i < 4; i++)
+            totalMP += pclubinfodb->GetCacheRecord(father[i])[index[i]].MP;
+        totalMP += h;
+
+        CAmount distributed = 0;
+        BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, rewards[h], totalMP, distributed, h + 2, false));
+        CAmount sum = 0;
+        for(int i = 0; i < 4; i++)
+        {
+            CAmount reward = ExpectedMemberReward(pclubinfodb->GetCacheRecord(father[i])[index[i]].MP,
+                                                  totalMP, rewards[h]);
+            expected[i] += reward;
+            sum += reward;
+        }
+        BOOST_CHECK_EQUAL(distributed, sum);
+        expectedLeader += rewards[h] - sum;
+
+        BOOST_CHECK(pclubinfodb->UpdateMpByChange(father[h], index[h], false, 7, true));
+    }
+
+    // Taking back the last rewards, after the MP change of that block is undone
+    BOOST_CHECK(pclubinfodb->UpdateMpByChange(father[2], index[2], true, 7, true));
+    uint64_t totalMP = 0;
+    for(int i = 0; i < 4; i++)
+        totalMP += pclubinfodb->GetCacheRecord(father[i])[index[i]].MP;
+    totalMP += 2;
+    CAmount distributed = 0;
+    BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, rewards[2], totalMP, distributed, 4, true));
+    for(int i = 0; i < 4; i++)
+        expected[i] -= ExpectedMemberReward(pclubinfodb->GetCacheRecord(father[i])[index[i]].MP,
+                                            totalMP, rewards[2]);
+    expectedLeader -= rewards[2] - distributed;
+
+    // Moving C(with D) out of the club stops its rewards
+    CMemberInfo memberC = pclubinfodb->GetCacheRecord("A")[index[2]];
+    uint64_t idx = index[2];
+    pclubinfodb->UpdateMembersByFatherAddress("A", memberC, idx, 4, false);
+    pclubinfodb->UpdateMembersByFatherAddress("TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG", memberC, idx, 4, true);
+    distributed = 0;
+    BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, 1000000, 100, distributed, 4, false));
+    for(int i = 0; i < 2; i++)
+        expected[i] += ExpectedMemberReward(pclubinfodb->GetCacheRecord(father[i])[index[i]].MP, 100, 1000000);
+    expectedLeader += 1000000 - distributed;
+
+    BOOST_CHECK_EQUAL(pclubinfodb->GetCacheRecord(leader)[0].rwd, expectedLeader);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetCacheRecord(leader)[index[0]].rwd, expected[0]);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetCacheRecord(leader)[index[1]].rwd, expected[1]);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetCacheRecord("TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG")[idx].rwd, expected[2]);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetCacheRecord("C")[index[3]].rwd, expected[3]);
+
+    // The member accessors and the visitor read the same settled records
+    uint64_t MP = 0;
+    CAmount rwd = 0;
+    BOOST_CHECK(pclubinfodb->GetMemberMPAndReward(leader, index[1], MP, rwd));
+    BOOST_CHECK_EQUAL(MP, pclubinfodb->GetCacheRecord(leader)[index[1]].MP);
+    BOOST_CHECK_EQUAL(rwd, expected[1]);
+    BOOST_CHECK(!pclubinfodb->GetMemberMPAndReward(leader, 10, MP, rwd));
+    BOOST_CHECK(!pclubinfodb->GetMemberMPAndReward("B", 1, MP, rwd));
+
+    CMemberCollector collector;
+    pclubinfodb->VisitTotalMembers("TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG", collector);
+    vector<string> members;
+    pclubinfodb->GetTotalMembersByAddress("TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG", members);
+    BOOST_CHECK(collector.vmembers == members);
+    BOOST_CHECK_EQUAL(collector.vrewards.size(), 2U);
+    BOOST_CHECK_EQUAL(collector.vrewards[0], expected[2]);
+    BOOST_CHECK_EQUAL(collector.vrewards[1], expected[3]);
+
+    pclubinfodb->ClearCache();
+}
+
+BOOST_AUTO_TEST_CASE(clubInfodb_ComputeMemberReward_test)
+{
+    // The legacy split gives the results of the blocks before FixedPointRewardHeight bit for bit,
+    // the fixed point split is floor(totalRewards * MP / totalMP)
+    const uint64_t maxMP[4] = {10, 100000, 1ULL << 40, std::numeric_limits<uint64_t>::max()};
+    const CAmount maxRewards[3] = {100 * COIN, 100000 * COIN, MAX_MONEY};
+    for(int i = 0; i < 30000; i++)
+    {
+        uint64_t totalMP = 1 + GetRand(maxMP[i % 4]);
+        uint64_t MP = (i % 7 == 0) ? totalMP : GetRand(totalMP);
+        CAmount totalRewards = GetRand(maxRewards[i % 3]);
+
+        CAmount reward = -1;
+        BOOST_CHECK(CClubInfoDB::ComputeMemberReward(MP, totalMP, totalRewards, reward, false));
+        BOOST_CHECK_EQUAL(reward, ExpectedMemberReward(MP, totalMP, totalRewards));
+
+        arith_uint256 exact = totalRewards;
+        exact *= arith_uint256(MP);
+        exact /= arith_uint256(totalMP);
+        BOOST_CHECK(CClubInfoDB::ComputeMemberReward(MP, totalMP, totalRewards, reward, true));
+        BOOST_CHECK_EQUAL(reward, (CAmount)exact.GetLow64());
+    }
+
+    CAmount reward = 0;
+    BOOST_CHECK(CClubInfoDB::ComputeMemberReward(1, 3, 100, reward, true));
+    BOOST_CHECK_EQUAL(reward, 33);
+    BOOST_CHECK(CClubInfoDB::ComputeMemberReward(7, 7, MAX_MONEY - 1, reward, true));
+    BOOST_CHECK_EQUAL(reward, MAX_MONEY - 1);
+    BOOST_CHECK(!CClubInfoDB::ComputeMemberReward(4, 3, 100, reward, true));
+    BOOST_CHECK(!CClubInfoDB::ComputeMemberReward(0, 0, 100, reward, true));
+    BOOST_CHECK(!CClubInfoDB::ComputeMemberReward(1, 3, MAX_MONEY, reward, true));
+}
+
+/** Collect the addresses of the entries visited */
+class CEntryCollector : public CClubMemberVisitor
+{
+public:
+    vector<string> vaddresses;
+
+    bool Visit(const std::string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
+    {
+        vaddresses.push_back(memberinfo.address);
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(clubInfodb_VisitSnapshotMembers_test)
+{
+    LOCK(cs_clubinfo);
+    BOOST_CHECK(pclubinfodb->InitGenesisDB(vector<string>(1, "TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG")));
+    const leveldb::Snapshot* snapshot = pclubinfodb->GetSnapshot();
+
+    // Records written after the snapshot are not visited
+    BOOST_CHECK(pclubinfodb->InitGenesisDB(vector<string>(1, "TNELcnfUUak1J1Cw1bUdF3UBXunfR71Hmb")));
+    CEntryCollector pinned;
+    BOOST_CHECK(pclubinfodb->VisitSnapshotMembers(snapshot, pinned));
+    BOOST_CHECK(pinned.vaddresses == vector<string>(1, "TP6t7swv4SDcDuN5pQxdk4MGGEcVpsExHG"));
+    pclubinfodb->ReleaseSnapshot(snapshot);
+
+    snapshot = pclubinfodb->GetSnapshot();
+    CEntryCollector current;
+    BOOST_CHECK(pclubinfodb->VisitSnapshotMembers(snapshot, current));
+    BOOST_CHECK_EQUAL(current.vaddresses.size(), 2U);
+    pclubinfodb->ReleaseSnapshot(snapshot);
+}
+
+BOOST_AUTO_TEST_CASE(clubInfodb_Subtree_test)
+{
+    LOCK(cs_clubinfo);
+    pclubinfodb->ClearCache();
+    const string leader = "S0";
+    const string otherLeader = "S9";
+    vector<string> inits;
+    inits.push_back(leader);
+    inits.push_back(otherLeader);
+    pclubinfodb->InitGenesisDB(inits);
+
+    // S0 <- S1, S2; S1 <- S3; S3 <- S4, S5
+    const string member[5] = {"S1", "S2", "S3", "S4", "S5"};
+    const string father[5] = {leader, leader, "S1", "S3", "S3"};
+    uint64_t index[5] = {0};
+    for(int i = 0; i < 5; i++)
+        pclubinfodb->UpdateMembersByFatherAddress(father[i], CMemberInfo(member[i], i + 1, 0), index[i], 1, true);
+
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nMembers, 5U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nTotalMP, 15U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S1").nMembers, 3U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S1").nTotalMP, 12U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S2").nMembers, 0U);
+
+    // The mining power of a member counts for every address above it
+    BOOST_CHECK(pclubinfodb->UpdateMpByChange("S3", index[3], false, 10, true));
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S3").nTotalMP, 19U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S1").nTotalMP, 22U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nTotalMP, 25U);
+
+    // Every page is the rest of the full listing from its first member on
+    vector<string> members;
+    pclubinfodb->GetTotalMembersByAddress(leader, members);
+    BOOST_CHECK_EQUAL(members.size(), 5U);
+    for(size_t nSkip = 0; nSkip <= members.size(); nSkip++)
+    {
+        CMemberCollector page;
+        pclubinfodb->VisitTotalMembers(leader, page, nSkip);
+        BOOST_CHECK(page.vmembers == vector<string>(members.begin() + nSkip, members.end()));
+    }
+
+    // S3 moves to the other club together with its members
+    CMemberInfo memberS3 = pclubinfodb->GetCacheRecord("S1")[index[2]];
+    uint64_t idx = index[2];
+    pclubinfodb->UpdateMembersByFatherAddress("S1", memberS3, idx, 2, false);
+    pclubinfodb->UpdateMembersByFatherAddress(otherLeader, memberS3, idx, 2, true);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("S1").nMembers, 0U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nMembers, 2U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nTotalMP, 3U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(otherLeader).nMembers, 3U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(otherLeader).nTotalMP, 22U);
+
+    // The subtrees rebuilt from the records on disk are the ones kept up to date
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(2, false));
+    pclubinfodb->ClearCache();
+    BOOST_CHECK(pclubinfodb->LoadDBToMemory());
+    const string addresses[4] = {leader, otherLeader, "S1", "S3"};
+    const uint64_t expectedMembers[4] = {2, 3, 0, 2};
+    const uint64_t expectedMP[4] = {3, 22, 0, 19};
+    for(int i = 0; i < 4; i++)
+    {
+        BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(addresses[i]).nMembers, expectedMembers[i]);
+        BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(addresses[i]).nTotalMP, expectedMP[i]);
+    }
+
+    pclubinfodb->ClearCache();
+}
+
+BOOST_AUTO_TEST_CASE(clubInfodb_UndoBlock_test)
+{
+    LOCK(cs_clubinfo);
+    pclubinfodb->ClearCache();
+    const string leader = "U0";
+    pclubinfodb->InitGenesisDB(vector<string>(1, leader));
+
+    // U0 <- U1, U2, U3; U1 <- U4
+    const string member[4] = {"U1", "U2", "U3", "U4"};
+    const string father[4] = {leader, leader, leader, "U1"};
+    uint64_t index[4] = {0};
+    for(int i = 0; i < 4; i++)
+        pclubinfodb->UpdateMembersByFatherAddress(father[i], CMemberInfo(member[i], i + 2, 0), index[i], 1, true);
+    pclubinfodb->ClearUndoLog();
+    const vector<CMemberInfo> leaderRecord = pclubinfodb->GetCacheRecord(leader);
+    const vector<CMemberInfo> fatherRecord = pclubinfodb->GetCacheRecord("U1");
+
+    // The changes of a block: a new member, more mining power, a member leaving, a reward spent and rewards shared
+    uint64_t idx = 0;
+    pclubinfodb->UpdateMembersByFatherAddress(leader, CMemberInfo("U5", 1, 0), idx, 2, true);
+    BOOST_CHECK(pclubinfodb->UpdateMpByChange(leader, index[1], false, 3, true));
+    idx = index[0];
+    pclubinfodb->UpdateMembersByFatherAddress(leader, pclubinfodb->GetCacheRecord(leader)[idx], idx, 2, false);
+    pclubinfodb->UpdateRewardByChange("U1", index[3], 7);
+    CAmount distributedRewards = 0;
+    BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, 1000, pclubinfodb->GetSubtreeByAddress(leader).nTotalMP,
+                                                         distributedRewards, 2, false));
+    BOOST_CHECK(distributedRewards > 0);
+    BOOST_CHECK(!pclubinfodb->HaveUndoLog(2));
+    pclubinfodb->WriteUndoLog(2);
+    BOOST_CHECK(pclubinfodb->HaveUndoLog(2));
+
+    // The log survives a flush, and undoing it puts every member back at its position
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(2, false));
+    BOOST_CHECK(pclubinfodb->HaveUndoLog(2));
+    map<string, uint64_t> mapIndexes;
+    BOOST_CHECK(pclubinfodb->UndoBlock(2, mapIndexes));
+    BOOST_CHECK(!pclubinfodb->HaveUndoLog(2));
+    BOOST_CHECK_EQUAL(mapIndexes["U1"], index[0]);
+    BOOST_CHECK(mapIndexes.find("U5") == mapIndexes.end());
+
+    const vector<CMemberInfo> undoneLeaderRecord = pclubinfodb->GetCacheRecord(leader);
+    const vector<CMemberInfo> undoneFatherRecord = pclubinfodb->GetCacheRecord("U1");
+    BOOST_CHECK_EQUAL(undoneLeaderRecord.size(), leaderRecord.size());
+    BOOST_CHECK_EQUAL(undoneFatherRecord.size(), fatherRecord.size());
+    for(size_t i = 0; i < leaderRecord.size() && i < undoneLeaderRecord.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(undoneLeaderRecord[i].address, leaderRecord[i].address);
+        BOOST_CHECK_EQUAL(undoneLeaderRecord[i].MP, leaderRecord[i].MP);
+        BOOST_CHECK_EQUAL(undoneLeaderRecord[i].rwd, leaderRecord[i].rwd);
+    }
+    for(size_t i = 0; i < fatherRecord.size() && i < undoneFatherRecord.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(undoneFatherRecord[i].address, fatherRecord[i].address);
+        BOOST_CHECK_EQUAL(undoneFatherRecord[i].MP, fatherRecord[i].MP);
+        BOOST_CHECK_EQUAL(undoneFatherRecord[i].rwd, fatherRecord[i].rwd);
+    }
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nMembers, 4U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nTotalMP, 14U);
+    BOOST_CHECK(!pclubinfodb->CacheRecordIsExist("U5"));
+
+    // Logs deeper than the reorg depth are pruned by a later flush
+    pclubinfodb->WriteUndoLog(3);
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(3, false));
+    BOOST_CHECK(pclubinfodb->HaveUndoLog(3));
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(3 + CLUB_UNDO_LOG_DEPTH - 1, false));
+    BOOST_CHECK(pclubinfodb->HaveUndoLog(3));
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(3 + CLUB_UNDO_LOG_DEPTH, false));
+    BOOST_CHECK(!pclubinfodb->HaveUndoLog(3));
+
+    pclubinfodb->ClearCache();
+}
+
+/** Collect the rewards of the entries visited by address */
+class CRewardCollector : public CClubMemberVisitor
+{
+public:
+    map<string, CAmount> mapRewards;
+
+    bool Visit(const string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
+    {
+        mapRewards[memberinfo.address] = memberinfo.rwd;
+        return true;
+    }
+};
+
+BOOST_AUTO_TEST_CASE(clubInfodb_RewardLog_test)
+{
+    LOCK(cs_clubinfo);
+    pclubinfodb->ClearCache();
+    const string leader = "R0";
+    pclubinfodb->InitGenesisDB(vector<string>(1, leader));
+
+    // R0 <- R1, R2; R1 <- R3
+    const string member[3] = {"R1", "R2", "R3"};
+    const string father[3] = {leader, leader, "R1"};
+    uint64_t index[3] = {0};
+    for(int i = 0; i < 3; i++)
+        pclubinfodb->UpdateMembersByFatherAddress(father[i], CMemberInfo(member[i], i + 1, 0), index[i], 1, true);
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(1, false));
+
+    // Sharing the rewards changes the record of R0 only, so the one of R1 stays unsettled on disk
+    CAmount distributed = 0;
+    BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, 600000, 6, distributed, 2, false));
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(2, false));
+    BOOST_CHECK(pclubinfodb->Exists(make_pair(CLUBREWARDLOGFLAG, leader)));
+
+    CAmount expected[3] = {0};
+    for(int i = 0; i < 3; i++)
+    {
+        uint64_t MP = 0;
+        BOOST_CHECK(pclubinfodb->GetMemberMPAndReward(father[i], index[i], MP, expected[i]));
+        BOOST_CHECK(expected[i] > 0);
+    }
+
+    // The members read back from disk and from a snapshot are settled from the reward log
+    pclubinfodb->ClearCache();
+    BOOST_CHECK(pclubinfodb->LoadDBToMemory());
+    const leveldb::Snapshot* snapshot = pclubinfodb->GetSnapshot();
+    CRewardCollector collector;
+    BOOST_CHECK(pclubinfodb->VisitSnapshotMembers(snapshot, collector));
+    pclubinfodb->ReleaseSnapshot(snapshot);
+    for(int i = 0; i < 3; i++)
+    {
+        uint64_t MP = 0;
+        CAmount rwd = 0;
+        BOOST_CHECK(pclubinfodb->GetMemberMPAndReward(father[i], index[i], MP, rwd));
+        BOOST_CHECK_EQUAL(rwd, expected[i]);
+        BOOST_CHECK_EQUAL(collector.mapRewards[member[i]], expected[i]);
+    }
+
+    // A long log is settled to the whole club and dropped at a flush
+    BOOST_CHECK(pclubinfodb->UpdateMpByChange("R1", index[2], false, 4, true));
+    const uint64_t MPs[3] = {1, 2, 7};
+    for(size_t h = 0; h <= CLUB_REWARD_LOG_SETTLE_SIZE; h++)
+    {
+        BOOST_CHECK(pclubinfodb->UpdateRewardsByMinerAddress(leader, 12345, 10, distributed, 3, false));
+        for(int i = 0; i < 3; i++)
+            expected[i] += ExpectedMemberReward(MPs[i], 10, 12345);
+    }
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(3, false));
+    BOOST_CHECK(!pclubinfodb->Exists(make_pair(CLUBREWARDLOGFLAG, leader)));
+    pclubinfodb->ClearCache();
+    BOOST_CHECK(pclubinfodb->LoadDBToMemory());
+    for(int i = 0; i < 3; i++)
+    {
+        uint64_t MP = 0;
+        CAmount rwd = 0;
+        BOOST_CHECK(pclubinfodb->GetMemberMPAndReward(father[i], index[i], MP, rwd));
+        BOOST_CHECK_EQUAL(rwd, expected[i]);
+    }
+
+    pclubinfodb->ClearCache();
+}
+
+/** Count the members below the address and sum their mining power, walking the records */
+static CClubSubtree RecomputeSubtree(const string& address)
+{
+    CClubSubtree subtree;
+    if (!pclubinfodb->CacheRecordIsExist(address))
+        return subtree;
+    vector<CMemberInfo> record = pclubinfodb->GetCacheRecord(address);
+    for(size_t i = 1; i < record.size(); i++)
+    {
+        CClubSubtree below = RecomputeSubtree(record[i].address);
+        subtree.nMembers += 1 + below.nMembers;
+        subtree.nTotalMP += record[i].MP + below.nTotalMP;
+    }
+    return subtree;
+}
+
+static void CheckSubtreesAgainstRecords()
+{
+    BOOST_CHECK(pclubinfodb->CheckSubtrees());
+    vector<string> fathers = pclubinfodb->GetAllFathers();
+    for(size_t i = 0; i < fathers.size(); i++)
+    {
+        CClubSubtree expected = RecomputeSubtree(fathers[i]);
+        BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(fathers[i]).nMembers, expected.nMembers);
+        BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(fathers[i]).nTotalMP, expected.nTotalMP);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(clubInfodb_CheckSubtrees_test)
+{
+    LOCK(cs_clubinfo);
+    pclubinfodb->ClearCache();
+    const string leader = "K0";
+    const string otherLeader = "K9";
+    vector<string> inits;
+    inits.push_back(leader);
+    inits.push_back(otherLeader);
+    pclubinfodb->InitGenesisDB(inits);
+
+    // Block 1 connects K0 <- K1, K2; K1 <- K3; K3 <- K4
+    const string member[4] = {"K1", "K2", "K3", "K4"};
+    const string father[4] = {leader, leader, "K1", "K3"};
+    uint64_t index[4] = {0};
+    for(int i = 0; i < 4; i++)
+        pclubinfodb->UpdateMembersByFatherAddress(father[i], CMemberInfo(member[i], i + 1, 0), index[i], 1, true);
+    pclubinfodb->ClearUndoLog();
+    CheckSubtreesAgainstRecords();
+
+    // Block 2 raises the mining power of K3, moves it to the other club and adds K5 below K4
+    BOOST_CHECK(pclubinfodb->UpdateMpByChange("K1", index[2], false, 5, true));
+    CMemberInfo memberK3 = pclubinfodb->GetCacheRecord("K1")[index[2]];
+    uint64_t idx = index[2];
+    pclubinfodb->UpdateMembersByFatherAddress("K1", memberK3, idx, 2, false);
+    pclubinfodb->UpdateMembersByFatherAddress(otherLeader, memberK3, idx, 2, true);
+    uint64_t idxK5 = 0;
+    pclubinfodb->UpdateMembersByFatherAddress("K4", CMemberInfo("K5", 6, 0), idxK5, 2, true);
+    pclubinfodb->WriteUndoLog(2);
+    CheckSubtreesAgainstRecords();
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(otherLeader).nMembers, 3U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(otherLeader).nTotalMP, 18U);
+
+    // Disconnecting block 2 moves K3 back
+    map<string, uint64_t> mapIndexes;
+    BOOST_CHECK(pclubinfodb->UndoBlock(2, mapIndexes));
+    CheckSubtreesAgainstRecords();
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress("K1").nMembers, 2U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(otherLeader).nMembers, 0U);
+    BOOST_CHECK_EQUAL(pclubinfodb->GetSubtreeByAddress(leader).nTotalMP, 10U);
+
+    // The subtrees rebuilt from disk agree with the records
+    BOOST_CHECK(pclubinfodb->WriteDataToDisk(1, false));
+    pclubinfodb->ClearCache();
+    BOOST_CHECK(pclubinfodb->LoadDBToMemory());
+    CheckSubtreesAgainstRecords();
+
+    pclubinfodb->ClearCache();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
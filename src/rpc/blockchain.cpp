@@ -51,8 +51,8 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("chaindiff", blockindex->nChainDiff.GetHex()));
     result.push_back(Pair("basetarget", blockindex->baseTarget));
     result.push_back(Pair("harvestPower", blockindex->harvestPower));
-    result.push_back(Pair("generationsignature", blockindex->generationSignature));
-    result.push_back(Pair("pubkeyofpackager", blockindex->pubKeyOfpackager));
+    result.push_back(Pair("generationsignature", blockindex->generationSignature.ToString()));
+    result.push_back(Pair("pubkeyofpackager", blockindex->pubKeyOfpackager.ToString()));
     result.push_back(Pair("cumulativedifficulty", blockindex->cumulativeDifficulty.GetHex()));
 
     if (blockindex->pprev)
@@ -1204,6 +1204,7 @@ UniValue gettxoutsbyaddress(const UniValue& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
+    LOCK(cs_main);
     for (unsigned int i = 0; i < inputs.size(); i++) {
         const std::string input = inputs[i].get_str();
         CScript script;
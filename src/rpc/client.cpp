@@ -103,16 +103,17 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "sendtransactiontoaddress", 4 },
     { "getbalancebypubkey", 0 },
     { "getbalancebypubkey", 1 },
+    { "getaddressbalances", 0 },
     { "getminingpowerbyaddress", 0},
     { "getminingpowerbyaddress", 1},
-    { "dumpclubmembers", 0},
-    { "dumpclubmembers", 1},
     { "getminingpowerbyaddress", 2},
     { "getrewardrate", 0},
     { "getrewardrate", 1},
     { "getmemberinfo", 0},
     { "getmemberinfo", 1},
     { "getmemberinfo", 2},
+    { "getclubmembers", 1},
+    { "getclubmembers", 2},
     { "keypoolrefill", 0 },
     { "getrawmempool", 0 },
     { "estimatefee", 0 },
@@ -32,9 +32,14 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include <univalue.h>
 
+//! Members listed by getclubmembers when no count is given, and at most
+static const int64_t DEFAULT_CLUB_MEMBERS_PAGE = 100;
+static const int64_t MAX_CLUB_MEMBERS_PAGE = 1000;
+
 //#define tautest    //it is a debug function switch,if you does not want please turn off it
 using namespace std;
 
@@ -85,126 +90,238 @@ UniValue getminingpowerbyaddress(const UniValue& params, bool fHelp)
     return result;
 }
 
-UniValue dumpclubmembers(const UniValue& params, bool fHelp)
+/** Members, mining power and rewards summed over entries of the club records */
+struct CClubDumpTotals
 {
-    if (fHelp || params.size() != 1)
-        throw runtime_error(
-            "dumpclubmembers \\\"filename\\\"\n"
-            "\nDumps all mining clubs and members in a readable format.\n"
-            "\nArguments:\n"
-            "1. \"filename\"    (string, required) The filename\n"
-            "\nExamples:\n"
-            + HelpExampleCli("dumpclubmembers", "\"test\"")
-            + HelpExampleRpc("dumpclubmembers", "\"test\"")
-        );
-
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VNUM), true);
+    uint64_t nMembers;
+    uint64_t nMiningPower;
+    CAmount nRewards;
 
-    std::ofstream file;
-    file.open(params[0].get_str().c_str());
-    if (!file.is_open())
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open dump file");
+    CClubDumpTotals() : nMembers(0), nMiningPower(0), nRewards(0) { }
 
-    int height = 0;
-    LOCK(cs_main);
-    height = chainActive.Height();
+    void Add(const CClubDumpTotals& other)
+    {
+        nMembers += other.nMembers;
+        nMiningPower += other.nMiningPower;
+        nRewards += other.nRewards;
+    }
+};
 
-    // produce output
-    file << strprintf("Height %i \n", height);
+/** Write the records of a club info snapshot to the dump file of dumpclubmembers, one line per entry */
+class CClubMemberDumper : public CClubMemberVisitor
+{
+private:
+    std::ofstream& file;
+    bool fJson;
 
-    std::vector<std::string> miners;
-    miners = paddrinfodb->GetAllClubMiners();
+public:
+    uint64_t nEntries;
+    //! the entries of every record, by father
+    std::map<std::string, CClubDumpTotals> mapFatherTotals;
 
-    // Output clubinfo
-    file << "club information table:\n";
-    file << "\n";
-    file << "club miners count:" << miners.size() << "\n";
-    file << "index \t\t address \t\t\t\tmining power(MP)" << "\n";
+    CClubMemberDumper(std::ofstream& fileIn, bool fJsonIn) : file(fileIn), fJson(fJsonIn), nEntries(0) { }
 
-    int i = 0;
-    uint64_t allTotalMP = 0;
-    for (std::vector<std::string>::iterator it = miners.begin();
-        it != miners.end(); it++, i++)
+    bool Visit(const std::string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
     {
-        std::string address = *it;
-        CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(address, height);
-        uint64_t totalMP = addrInfo.totalMP;
+        if (fJson)
+            file << "{\"father\":\"" << fatherAddress << "\",\"index\":" << index << ",\"address\":\"" << memberinfo.address
+                 << "\",\"miningpower\":" << memberinfo.MP << ",\"rewards\":" << memberinfo.rwd << "}\n";
+        else
+            file << fatherAddress << ',' << index << ',' << memberinfo.address << ',' << memberinfo.MP << ',' << memberinfo.rwd << '\n';
+        nEntries++;
+
+        // The entry at index 0 is the club leader itself, or a placeholder in the record of any other father
+        CClubDumpTotals& totals = mapFatherTotals[fatherAddress];
+        if (index > 0)
+            totals.nMembers++;
+        if (index > 0 || memberinfo.address.compare(NOT_VALID_RECORD) != 0)
+        {
+            totals.nMiningPower += memberinfo.MP;
+            totals.nRewards += memberinfo.rwd;
+        }
+        return file.good();
+    }
+};
+
+/** Find the father of every address that has a record, on a second visit of the snapshot */
+class CClubFatherFinder : public CClubMemberVisitor
+{
+private:
+    const std::map<std::string, CClubDumpTotals>& mapFatherTotals;
+
+public:
+    std::map<std::string, std::string> mapFather;
+
+    CClubFatherFinder(const std::map<std::string, CClubDumpTotals>& mapFatherTotalsIn) : mapFatherTotals(mapFatherTotalsIn) { }
 
-        allTotalMP += totalMP;
-        file << i + 1 << "\t\t" << address << "\t" << totalMP << "\n";
+    bool Visit(const std::string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
+    {
+        if (index > 0 && mapFatherTotals.count(memberinfo.address))
+            mapFather[memberinfo.address] = fatherAddress;
+        return true;
     }
-    file << "\n";
-    file << "All totalMP:" << allTotalMP  << "\n";
-    file << "\n\n\n";
-
-    file << "member information table:\n";
-    file << "\n";
-    file << "\n";
-
-    i = 1;
-    uint64_t allTotalMP_2 = 0;
-    uint64_t totalRewards = 0;
-    for (std::vector<std::string>::iterator it = miners.begin();
-        it != miners.end(); it++, i++)
+};
+
+/** Sum the records up to the club leaders and write one line per club, then one for all of them */
+static void WriteClubTotals(std::ofstream& file, bool fJson, const std::map<std::string, CClubDumpTotals>& mapFatherTotals,
+                            const std::map<std::string, std::string>& mapFather)
+{
+    std::map<std::string, CClubDumpTotals> mapClubTotals;
+    std::map<std::string, std::string> mapLeader;
+    for (std::map<std::string, CClubDumpTotals>::const_iterator it = mapFatherTotals.begin(); it != mapFatherTotals.end(); ++it)
     {
-        uint64_t  iTotalMP = 0;
-        uint64_t  itRewards = 0;
-        std::string address = *it;
-        CTAUAddrInfo addrInfo = paddrinfodb->GetAddrInfo(address, height);
-        uint64_t totalMP = addrInfo.totalMP;
-        file << i << " club:" << address << ", totalMP:" << totalMP << "\n";
-        file << "\t" << "index\t\t" << "address\t\t\t\t\t\t" << "miner\t\t\t\t\t\t" << "father\t\t\t\t\t"
-             << "MP\t\t   " << "reward" << "\n";
-
-        // Firstly, output miners info
-        //addrInfo = paddrinfodb->GetAddrInfo(address, height);
-        uint64_t index = addrInfo.index;
-        std::string miner = (addrInfo.miner.compare("0") == 0) ? address : addrInfo.miner;
-        std::string father = (addrInfo.father.compare("0") == 0) ? address : addrInfo.father;
-        uint64_t MP = pclubinfodb->GetCacheRecord(father)[index].MP;
-        CAmount value = pclubinfodb->GetCacheRecord(father)[index].rwd;
-
-        int j = 1;
-
-        file << "\t" << j <<"\t\t" << address <<"\t" << miner <<"\t\t" << father << "\t\t"
-             << MP << "\t\t" << value << "\n";
-        iTotalMP += MP;
-        itRewards += value;
-        j++;
-
-        // Secondly, output members info
-        std::vector<std::string> members;
-        pclubinfodb->GetTotalMembersByAddress(address, members);
-        std::string memberFather;
-        for (std::vector<std::string>::iterator itr = members.begin();
-            itr != members.end(); itr++, j++)
+        // Walk up to the leader, then remember it for every father passed on the way
+        std::vector<std::string> vPath(1, it->first);
+        std::string leader;
+        while (true)
         {
-            addrInfo = paddrinfodb->GetAddrInfo(*itr, height);
-            index = addrInfo.index;
-            memberFather = (addrInfo.father.compare("0") == 0) ? *itr : addrInfo.father;
-            file << "\t" << j <<"\t\t" << *itr <<"\t" << addrInfo.miner <<"\t\t" << addrInfo.father << "\t\t"
-                << pclubinfodb->GetCacheRecord(memberFather)[index].MP << "\t\t"
-                << pclubinfodb->GetCacheRecord(memberFather)[index].rwd << "\n";
-            iTotalMP += pclubinfodb->GetCacheRecord(memberFather)[index].MP;
-            itRewards += pclubinfodb->GetCacheRecord(memberFather)[index].rwd;
+            std::map<std::string, std::string>::const_iterator itLeader = mapLeader.find(vPath.back());
+            if (itLeader != mapLeader.end()) {
+                leader = itLeader->second;
+                break;
+            }
+            std::map<std::string, std::string>::const_iterator itFather = mapFather.find(vPath.back());
+            if (itFather == mapFather.end() || vPath.size() > mapFatherTotals.size()) {
+                leader = vPath.back();
+                break;
+            }
+            vPath.push_back(itFather->second);
         }
+        for (size_t i = 0; i < vPath.size(); i++)
+            mapLeader[vPath[i]] = leader;
+        mapClubTotals[leader].Add(it->second);
+    }
 
-        file << "\n\n\ttotalMP:" << iTotalMP
-            << ", totalRewards:" << itRewards << "\n";
+    CClubDumpTotals all;
+    if (!fJson)
+        file << "# club,members,miningpower,rewards\n";
+    for (std::map<std::string, CClubDumpTotals>::const_iterator it = mapClubTotals.begin(); it != mapClubTotals.end(); ++it)
+    {
+        const CClubDumpTotals& totals = it->second;
+        if (fJson)
+            file << "{\"club\":\"" << it->first << "\",\"members\":" << totals.nMembers << ",\"miningpower\":"
+                 << totals.nMiningPower << ",\"rewards\":" << totals.nRewards << "}\n";
+        else
+            file << "# " << it->first << ',' << totals.nMembers << ',' << totals.nMiningPower << ',' << totals.nRewards << '\n';
+        all.Add(totals);
+    }
+    if (fJson)
+        file << "{\"clubs\":" << mapClubTotals.size() << ",\"members\":" << all.nMembers << ",\"miningpower\":"
+             << all.nMiningPower << ",\"rewards\":" << all.nRewards << "}\n";
+    else
+        file << "# all " << mapClubTotals.size() << " clubs," << all.nMembers << ',' << all.nMiningPower << ',' << all.nRewards << '\n';
+}
 
-        allTotalMP_2 += iTotalMP;
-        totalRewards += itRewards;
+/** The export of dumpclubmembers running in the background */
+static CCriticalSection cs_clubdump;
+static boost::thread* pclubDumpThread = NULL;
 
-        file << "\n\n";
+static void ThreadDumpClubMembers(const leveldb::Snapshot* snapshot, std::string strFilename, bool fJson, int nHeight, uint256 hashBlock)
+{
+    RenameThread("bitcoin-clubdump");
+    int64_t nStart = GetTimeMillis();
+    std::ofstream file(strFilename.c_str());
+    if (!file.is_open())
+        LogPrintf("%s: cannot open %s\n", __func__, strFilename);
+    else
+    {
+        if (fJson)
+            file << "{\"height\":" << nHeight << ",\"bestblockhash\":\"" << hashBlock.GetHex() << "\"}\n";
+        else
+            file << "# height " << nHeight << ", block " << hashBlock.GetHex() << "\n"
+                 << "father,index,address,miningpower,rewards\n";
+
+        CClubMemberDumper dumper(file, fJson);
+        try {
+            bool fOk = pclubinfodb->VisitSnapshotMembers(snapshot, dumper) && file.good();
+            if (fOk) {
+                CClubFatherFinder finder(dumper.mapFatherTotals);
+                fOk = pclubinfodb->VisitSnapshotMembers(snapshot, finder);
+                if (fOk)
+                    WriteClubTotals(file, fJson, dumper.mapFatherTotals, finder.mapFather);
+            }
+            if (fOk && file.good())
+                LogPrintf("%s: wrote %u entries of height %d to %s in %dms\n", __func__, dumper.nEntries, nHeight,
+                          strFilename, GetTimeMillis() - nStart);
+            else
+                LogPrintf("%s: failed to write %s\n", __func__, strFilename);
+        } catch (const boost::thread_interrupted&) {
+            LogPrintf("%s: interrupted after %u entries\n", __func__, dumper.nEntries);
+        }
     }
+    pclubinfodb->ReleaseSnapshot(snapshot);
+}
 
-    file << "\n\n";
-    file << "All totalMP:" << allTotalMP_2 << ", total rewards:" << totalRewards << "\n";
+static void StopDumpClubMembers()
+{
+    LOCK(cs_clubdump);
+    if (pclubDumpThread) {
+        pclubDumpThread->interrupt();
+        pclubDumpThread->join();
+        delete pclubDumpThread;
+        pclubDumpThread = NULL;
+    }
+}
 
-    file.close();
+UniValue dumpclubmembers(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "dumpclubmembers \\\"filename\\\" ( \\\"format\\\" )\n"
+            "\nExports the entries of all mining clubs at the current tip, in the background.\n"
+            "The block height is pinned when the call returns, blocks keep connecting during the export.\n"
+            "Every father lists its own entry at index 0, followed by its members.\n"
+            "The entries are followed by the members, mining power and rewards of every club and of all of them.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The filename\n"
+            "2. \"format\"      (string, optional, default=csv) csv, or jsonl for one json object per line\n"
+            "\nResult\n"
+            "{\n"
+            "  \"height\" : n,             (numeric) The height exported\n"
+            "  \"bestblockhash\" : \"hash\", (string) The hash of the block exported\n"
+            "  \"filename\" : \"filename\"   (string) The file being written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumpclubmembers", "\"test\"")
+            + HelpExampleCli("dumpclubmembers", "\"test.jsonl\" \"jsonl\"")
+            + HelpExampleRpc("dumpclubmembers", "\"test\"")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VSTR), true);
+
+    std::string strFilename = params[0].get_str();
+    bool fJson = false;
+    if (params.size() > 1) {
+        if (params[1].get_str() == "jsonl")
+            fJson = true;
+        else if (params[1].get_str() != "csv")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown format, use csv or jsonl");
+    }
+
+    LOCK(cs_clubdump);
+    if (pclubDumpThread && !pclubDumpThread->timed_join(boost::posix_time::seconds(0)))
+        throw JSONRPCError(RPC_MISC_ERROR, "A dump of the club members is already running");
+    delete pclubDumpThread;
+    pclubDumpThread = NULL;
+
+    // Flush the reward databases up to the tip and pin them, the export then reads the snapshot alone
+    int nHeight;
+    uint256 hashBlock;
+    const leveldb::Snapshot* snapshot;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        nHeight = chainActive.Height();
+        hashBlock = chainActive.Tip()->GetBlockHash();
+        snapshot = pclubinfodb->GetSnapshot();
+    }
+
+    pclubDumpThread = new boost::thread(boost::bind(&ThreadDumpClubMembers, snapshot, strFilename, fJson, nHeight, hashBlock));
 
     UniValue ret(UniValue::VOBJ);
-    ret.push_back(Pair("Result", "finished"));
+    ret.push_back(Pair("height", nHeight));
+    ret.push_back(Pair("bestblockhash", hashBlock.GetHex()));
+    ret.push_back(Pair("filename", strFilename));
     return ret;
 }
 
@@ -328,13 +445,12 @@ UniValue getmemberinfo(const UniValue& params, bool fHelp)
     uint64_t index = addrInfo.index;
     std::string miner = (addrInfo.miner.compare("0") == 0) ? addrStr : addrInfo.miner;
     std::string father = (addrInfo.father.compare("0") == 0) ? addrStr : addrInfo.father;
-    std::vector<CMemberInfo> vc = pclubinfodb->GetCacheRecord(father);
-    if(vc.empty()||index >=vc.size()){
+    uint64_t selfMP = 0;
+    CAmount rewards = 0;
+    if (!pclubinfodb->GetMemberMPAndReward(father, index, selfMP, rewards)) {
        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Error: Invalid address,index out of range");
     }
-    uint64_t selfMP = vc[index].MP;
     uint64_t clubMP = addrInfo.totalMP;
-    CAmount rewards = vc[index].rwd;
 
     clubMP = paddrinfodb->GetHarvestPowerByAddress(miner, height);
 
@@ -350,6 +466,96 @@ UniValue getmemberinfo(const UniValue& params, bool fHelp)
     return result;
 }
 
+/** Collect one page of the members listed by getclubmembers */
+class CClubMemberPage : public CClubMemberVisitor
+{
+private:
+    uint64_t nCount;
+
+public:
+    UniValue members;
+
+    CClubMemberPage(uint64_t nCountIn) : nCount(nCountIn), members(UniValue::VARR) { }
+
+    bool Visit(const std::string& fatherAddress, uint64_t index, const CMemberInfo& memberinfo)
+    {
+        UniValue member(UniValue::VOBJ);
+        member.push_back(Pair("address", memberinfo.address));
+        member.push_back(Pair("father", fatherAddress));
+        member.push_back(Pair("index", index));
+        member.push_back(Pair("miningpower", memberinfo.MP));
+        member.push_back(Pair("rewards", memberinfo.rwd));
+        members.push_back(member);
+        return members.size() < nCount;
+    }
+};
+
+UniValue getclubmembers(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getclubmembers \"address\" ( skip count )\n"
+            "\nList the members below an address, every member followed by its own members.\n"
+            "\nArguments:\n"
+            "1. \"address\"  (string, required) The club leader, or any member to list the members it brought in\n"
+            "2. skip         (numeric, optional, default=0) The number of members to pass over\n"
+            "3. count        (numeric, optional, default=" + itostr(DEFAULT_CLUB_MEMBERS_PAGE) + ") The number of members to list, at most "
+                + itostr(MAX_CLUB_MEMBERS_PAGE) + "\n"
+            "\nResult\n"
+            "{\n"
+            "  \"height\" : n,          (numeric) The height of the tip\n"
+            "  \"address\" : \"addr\",    (string) The address\n"
+            "  \"totalmembers\" : n,    (numeric) The number of members below the address\n"
+            "  \"totalpower\" : n,      (numeric) The total mining power of these members\n"
+            "  \"members\" : [          (array) The members from skip on\n"
+            "    {\n"
+            "      \"address\" : \"addr\",  (string) The member\n"
+            "      \"father\" : \"addr\",   (string) The address which brought the member in\n"
+            "      \"index\" : n,         (numeric) The index of the member in the father's record\n"
+            "      \"miningpower\" : n,   (numeric) The mining power of the member\n"
+            "      \"rewards\" : n        (numeric) The rewards of the member\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getclubmembers", "\"myaddress\"")
+            + HelpExampleCli("getclubmembers", "\"myaddress\" 100 50")
+            + HelpExampleRpc("getclubmembers", "\"myaddress\", 100, 50")
+        );
+
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VSTR)(UniValue::VNUM)(UniValue::VNUM), true);
+
+    std::string addrStr = params[0].get_str();
+    if (!CBitcoinAddress(addrStr).IsValid())
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Error: Invalid address");
+
+    int64_t nSkip = 0;
+    if (params.size() > 1)
+        nSkip = params[1].get_int64();
+    int64_t nCount = DEFAULT_CLUB_MEMBERS_PAGE;
+    if (params.size() > 2)
+        nCount = params[2].get_int64();
+    if (nSkip < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative skip");
+    if (nCount < 1 || nCount > MAX_CLUB_MEMBERS_PAGE)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("count must be between 1 and %d", MAX_CLUB_MEMBERS_PAGE));
+
+    // The members skipped are passed over by the sizes of their subtrees, a page costs about count entries
+    LOCK(cs_main);
+    CClubSubtree subtree = pclubinfodb->GetSubtreeByAddress(addrStr);
+    CClubMemberPage page(nCount);
+    if ((uint64_t)nSkip < subtree.nMembers && !pclubinfodb->VisitTotalMembers(addrStr, page, nSkip))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Error: unable to settle the rewards of the club members");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", chainActive.Height()));
+    result.push_back(Pair("address", addrStr));
+    result.push_back(Pair("totalmembers", subtree.nMembers));
+    result.push_back(Pair("totalpower", subtree.nTotalMP));
+    result.push_back(Pair("members", page.members));
+
+    return result;
+}
 
 static const CRPCCommand commands[] =
 { //  category              name                        actor (function)           okSafeMode
@@ -358,10 +564,14 @@ static const CRPCCommand commands[] =
     { "clubmember",         "dumpclubmembers",          &dumpclubmembers,          true  },
     { "clubmember",         "getrewardrate",            &getrewardrate,            true  },
     { "clubmember",         "getmemberinfo",            &getmemberinfo,            true  },
+    { "clubmember",         "getclubmembers",           &getclubmembers,           true  },
 };
 
 void RegisterClubmemberRPCCommands(CRPCTable &tableRPC)
 {
+    // A running dump reads the club info database, which is closed after the RPC server stops
+    RPCServer::OnStopped(&StopDumpClubMembers);
+
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
 }
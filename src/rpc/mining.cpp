@@ -67,6 +67,7 @@ UniValue generateBlocksWithPot(boost::shared_ptr<CReserveScript> coinbaseScript,
      }
 
      uint64_t harverstPower = 0;
+     CForgingTipWatcher tipWatcher;
 
      while (nHeight < nHeightEnd && !ShutdownRequested())
      {
@@ -75,7 +76,6 @@ UniValue generateBlocksWithPot(boost::shared_ptr<CReserveScript> coinbaseScript,
              LOCK(cs_main);
              prevIndex = chainActive.Tip();
          }
-         int64_t now = GetAdjustedTime();
          uint64_t baseTarget = getNextPotRequired(prevIndex);
          PotErr error;
 
@@ -86,7 +86,24 @@ UniValue generateBlocksWithPot(boost::shared_ptr<CReserveScript> coinbaseScript,
              break;
          }
 
-         if (CheckProofOfTransaction(prevIndex->generationSignature, coinbaseScript->pubkeyString,
+         // The hit only depends on the previous block and our pubkey, so sleep until the first
+         // second it is below the thresold, or until the tip changes, instead of polling
+         int64_t nDeadline = GetProofOfTransactionDeadline(prevIndex->GetBlockGenerationSignature(),
+                 coinbaseScript->pubkeyString, baseTarget, harverstPower);
+         int64_t nWait = (nDeadline < 0) ? (int64_t)nMaxTries : prevIndex->nTime + nDeadline - GetAdjustedTime();
+         if (nWait > 0)
+         {
+             if (nMaxTries <= 0)
+                 break;
+             int64_t nStart = GetAdjustedTime();
+             tipWatcher.WaitUntil(prevIndex, nStart + std::min(nWait, (int64_t)nMaxTries));
+             uint64_t nWaited = std::max(GetAdjustedTime() - nStart, (int64_t)1);
+             nMaxTries -= std::min(nWaited, nMaxTries);
+             continue;
+         }
+
+         int64_t now = GetAdjustedTime();
+         if (CheckProofOfTransaction(prevIndex->GetBlockGenerationSignature(), coinbaseScript->pubkeyString,
                  prevIndex->nHeight + 1, now - prevIndex->nTime, baseTarget, harverstPower, Params().GetConsensus(), error))
          {
               std::unique_ptr<CBlockTemplate> pblocktemplate(BlockAssembler(Params()).CreateNewBlock(coinbaseScript->reserveScript,coinbaseScript->pubkeyString));
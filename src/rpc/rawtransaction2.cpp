@@ -1093,51 +1093,101 @@ UniValue getbalancebypubkey(const UniValue& params, bool fHelp)
     if (queries.size() == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid inputs: pubkey1|pubkey2|...|pubkeyn ");
 
+    std::vector<CAddressBalance> vBalances;
     for (unsigned int i = 0; i < queries.size(); i++) {
-        const std::string pubkey = queries[i];
-        if (pubkey.empty())
-            continue;
-        std::string strAddr;
-        ConvertPubkeyToAddress(pubkey, strAddr);
+        if (!queries[i].empty())
+            vBalances.push_back(CAddressBalance(queries[i]));
+    }
+    if (vBalances.size() > MAX_ADDRESS_BALANCE_LOOKUPS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Too many pubkeys (max: %u)", MAX_ADDRESS_BALANCE_LOOKUPS));
 
-        CScript script;
-        CBitcoinAddress address(strAddr);
-        if (address.IsValid()) {
-            script = GetScriptForDestination(address.Get());
-        } else {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid tau pubkey: " + pubkey);
-        }
+    int nHeight;
+    uint256 hashTip;
+    GetAddressBalances(vBalances, nHeight, hashTip);
 
-        CCoinsByScript coinsByScript;
-        pcoinsByScript->GetCoinsByScript(script, coinsByScript);
+    BOOST_FOREACH(const CAddressBalance& balance, vBalances) {
+        if (balance.address.empty())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid tau pubkey: " + balance.key);
 
-        uint64_t utxoTotal = 0;
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("pubkey", balance.key));
+        o.push_back(Pair("utxo", balance.nUtxo));
+        o.push_back(Pair("rewards", balance.nRewards));
+        results.push_back(o);
+    }
 
-        BOOST_FOREACH(const COutPoint &outpoint, coinsByScript.setCoins)
-        {
-            CCoins coins;
+    return results;
+}
+
+UniValue getaddressbalances(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalances [\"key\",...]\n"
+            "\nReturns the unspent outputs value, rewards, mining power and club of pubkeys or addresses,\n"
+            "all taken at the same tip. The keys are decoded on the script verification threads.\n"
+            "\nTo use this function, you must start taucoin with the -txoutsbyaddressindex parameter.\n"
+            "\nArguments:\n"
+            "1. \"keys\"    (string, required) A json array of taucoin pubkeys or addresses\n"
+            "\nResult\n"
+            "{\n"
+            "  \"height\" : n,              (numeric) The height of the tip\n"
+            "  \"bestblockhash\" : \"hash\",  (string) The hash of the tip\n"
+            "  \"balances\" : [\n"
+            "    {\n"
+            "      \"key\" : \"key\",          (string) The key passed\n"
+            "      \"address\" : \"address\",  (string) The address of the key, missing if the key is invalid\n"
+            "      \"utxo\" : n,              (numeric) The value of the unspent outputs in satoshis\n"
+            "      \"rewards\" : n,           (numeric) The rewards in satoshis\n"
+            "      \"miningpower\" : n,       (numeric) The mining power\n"
+            "      \"club\" : \"address\"      (string) The leader of the club, empty if the address is in none\n"
+            "    }\n"
+            "    ,...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalances", "\"[\\\"TMDn4wYB3iEc2eiDHBLGx1zGkqBPgYV3AT\\\",\\\"TGwH9btZVNtP7HqLyULt2e8EmFkqfJJCbZ\\\"]\"")
+            + HelpExampleRpc("getaddressbalances", "[\"TMDn4wYB3iEc2eiDHBLGx1zGkqBPgYV3AT\",\"TGwH9btZVNtP7HqLyULt2e8EmFkqfJJCbZ\"]")
+        );
 
-            if (!pcoinsTip->GetCoins(outpoint.hash, coins))
-                continue;
+    if (!fTxOutsByAddressIndex)
+        throw JSONRPCError(RPC_METHOD_NOT_FOUND, "To use this function, you must start taucoin with the -txoutsbyaddressindex parameter.");
 
-            if (outpoint.n < coins.vout.size() && !coins.vout[outpoint.n].IsNull() && !coins.vout[outpoint.n].scriptPubKey.IsUnspendable())
-            {
-                utxoTotal += coins.vout[outpoint.n].nValue;
-            }
-        }
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VARR));
 
-        UniValue o(UniValue::VOBJ);
-        o.push_back(Pair("pubkey", pubkey));
-        o.push_back(Pair("utxo", utxoTotal));
+    UniValue keys = params[0].get_array();
+    if (keys.size() > MAX_ADDRESS_BALANCE_LOOKUPS)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Too many keys (max: %u)", MAX_ADDRESS_BALANCE_LOOKUPS));
 
-        uint64_t rewards = 0;
-        rewards = paddrinfodb->GetRwdByPubkey(pubkey);
-        o.push_back(Pair("rewards", rewards));
+    std::vector<CAddressBalance> vBalances;
+    vBalances.reserve(keys.size());
+    for (unsigned int i = 0; i < keys.size(); i++)
+        vBalances.push_back(CAddressBalance(keys[i].get_str()));
 
-        results.push_back(o);
+    int nHeight;
+    uint256 hashTip;
+    GetAddressBalances(vBalances, nHeight, hashTip);
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("height", nHeight));
+    result.push_back(Pair("bestblockhash", hashTip.GetHex()));
+
+    UniValue balances(UniValue::VARR);
+    BOOST_FOREACH(const CAddressBalance& balance, vBalances) {
+        UniValue o(UniValue::VOBJ);
+        o.push_back(Pair("key", balance.key));
+        if (!balance.address.empty()) {
+            o.push_back(Pair("address", balance.address));
+            o.push_back(Pair("utxo", balance.nUtxo));
+            o.push_back(Pair("rewards", balance.nRewards));
+            o.push_back(Pair("miningpower", balance.nMiningPower));
+            o.push_back(Pair("club", balance.club));
+        }
+        balances.push_back(o);
     }
+    result.push_back(Pair("balances", balances));
 
-    return results;
+    return result;
 }
 
 static const CRPCCommand commands[] =
@@ -1151,6 +1201,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false }, /* uses wallet if enabled */
     { "rawtransactions",    "sendtransactiontoaddress", &sendtransactiontoaddress,  true  },
     { "rawtransactions",    "getbalancebypubkey",     &getbalancebypubkey,     true  },
+    { "rawtransactions",    "getaddressbalances",     &getaddressbalances,     true  },
 
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
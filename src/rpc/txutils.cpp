@@ -115,7 +115,7 @@ int CTransactionUtils::GetBlocksToMaturity(CCoins& coins)
     return max(0, (COINBASE_MATURITY + 1) - GetDepthInMainChain(coins));
 }
 
-bool CTransactionUtils::SelectCoinsMinConf(const CAmount& nTargetValue, int nConf, std::vector<COutPoint>& vCoins,
+bool CTransactionUtils::SelectCoinsMinConf(const CAmount& nTargetValue, int nConf, std::vector<std::pair<COutPoint, CAddressOutput> >& vCoins,
         std::set<COutPoint>& setCoinsRet, CAmount& nValueRet)
 {
     LogPrint("selectcoins", "%s entry\n", __func__);
@@ -138,21 +138,15 @@ bool CTransactionUtils::SelectCoinsMinConf(const CAmount& nTargetValue, int nCon
 
     random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
 
-    BOOST_FOREACH(const COutPoint& output, vCoins)
+    for (unsigned int i = 0; i < vCoins.size(); i++)
     {
-        CCoins coins;
-        if (!pcoinsTip->GetCoins(output.hash, coins))
-        {
-            LogPrintf("%s get coins fail:%s\n", __func__, output.hash.ToString());
-            return false;
-        }
-
-        int nDepth = tipHeight - coins.nHeight + 1;
+        const COutPoint& output = vCoins[i].first;
+        int nDepth = tipHeight - vCoins[i].second.nHeight + 1;
         if ( nDepth < nConf)
             continue;
 
         int n = output.n;
-        CAmount v = coins.vout[output.n].nValue;
+        CAmount v = vCoins[i].second.nValue;
         if (v < 0)
             continue;
         std::pair<CAmount, COutPoint> coin = std::make_pair(v, COutPoint(output.hash, n));
@@ -238,7 +232,7 @@ bool CTransactionUtils::SelectCoinsMinConf(const CAmount& nTargetValue, int nCon
     return true;
 }
 
-bool CTransactionUtils::SelectCoins(std::vector<COutPoint>& vAvailableCoins, const CAmount& nTargetValue, std::set<COutPoint>& setCoinsRet, CAmount& nValueRet)
+bool CTransactionUtils::SelectCoins(std::vector<std::pair<COutPoint, CAddressOutput> >& vAvailableCoins, const CAmount& nTargetValue, std::set<COutPoint>& setCoinsRet, CAmount& nValueRet)
 {
     bool res = SelectCoinsMinConf(nTargetValue, 6, vAvailableCoins, setCoinsRet, nValueRet) ||
         SelectCoinsMinConf(nTargetValue, 1, vAvailableCoins, setCoinsRet, nValueRet);
@@ -246,7 +240,29 @@ bool CTransactionUtils::SelectCoins(std::vector<COutPoint>& vAvailableCoins, con
     return res;
 }
 
-bool CTransactionUtils::AvailableCoins(const std::string& pubKey, std::vector<COutPoint>& vCoins)
+namespace {
+
+/** Collects the outputs of the address index that can be spent in the next block */
+struct CMatureOutputCollector
+{
+    std::vector<std::pair<COutPoint, CAddressOutput> >& vCoins;
+    int nSpendHeight;
+
+    CMatureOutputCollector(std::vector<std::pair<COutPoint, CAddressOutput> >& vCoinsIn, int nSpendHeightIn) :
+        vCoins(vCoinsIn), nSpendHeight(nSpendHeightIn) { }
+
+    bool operator()(const COutPoint& outpoint, const CAddressOutput& output) const {
+        if (output.fCoinBase && nSpendHeight - output.nHeight <= COINBASE_MATURITY)
+            return true;
+        if (output.nValue > 0)
+            vCoins.push_back(std::make_pair(outpoint, output));
+        return true;
+    }
+};
+
+}
+
+bool CTransactionUtils::AvailableCoins(const std::string& pubKey, std::vector<std::pair<COutPoint, CAddressOutput> >& vCoins)
 {
     vCoins.clear();
     std::string addrStr;
@@ -272,27 +288,9 @@ bool CTransactionUtils::AvailableCoins(const std::string& pubKey, std::vector<CO
         return false;
     }
 
-    CCoinsByScript coinsByScript;
-    pcoinsByScript->GetCoinsByScript(script, coinsByScript);
-
-    BOOST_FOREACH(const COutPoint &outpoint, coinsByScript.setCoins)
-    {
-        CCoins coins;
-        if (!pcoinsTip->GetCoins(outpoint.hash, coins))
-        {
-            LogPrintf("get coins failed: %s\n", outpoint.hash.ToString());
-            continue;
-        }
-
-        if (coins.IsCoinBase() && GetBlocksToMaturity(coins) > 0)
-            continue;
-
-        if (outpoint.n < coins.vout.size() && !coins.vout[outpoint.n].IsNull()
-                && coins.vout[outpoint.n].nValue > 0 && !coins.vout[outpoint.n].scriptPubKey.IsUnspendable())
-        {
-            vCoins.push_back(COutPoint(outpoint.hash, outpoint.n));
-        }
-    }
+    LOCK(cs_main);
+    if (!pcoinsByScript->ForEachOutputByScript(script, CMatureOutputCollector(vCoins, chainActive.Height() + 1)))
+        return false;
 
     return true;
 }
@@ -410,7 +408,7 @@ bool CTransactionUtils::CreateTransaction(std::map<std::string, CAmount>& receip
     }
     assert(tx.nLockTime < LOCKTIME_THRESHOLD);
 
-    std::vector<COutPoint> coins;
+    std::vector<std::pair<COutPoint, CAddressOutput> > coins;
     std::vector<CTxReward> vAvailableRewards;
     if (!AvailableCoins(pubKey, coins))
     {
@@ -437,9 +435,9 @@ bool CTransactionUtils::CreateTransaction(std::map<std::string, CAmount>& receip
     }
 
     LogPrint("selectcoins", "available coins:[\n");
-    BOOST_FOREACH(const COutPoint& c, coins)
+    for (unsigned int i = 0; i < coins.size(); i++)
     {
-        LogPrint("selectcoins", "\t%s,\t%d\n", c.hash.ToString(), c.n);
+        LogPrint("selectcoins", "\t%s,\t%d\n", coins[i].first.hash.ToString(), coins[i].first.n);
     }
     LogPrint("selectcoins", "]\n");
 
@@ -19,12 +19,13 @@ class CTransactionUtils
     private:
         CTransactionUtils() {}
 
-        static bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConf, std::vector<COutPoint>& vCoins,
+        static bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConf, std::vector<std::pair<COutPoint, CAddressOutput> >& vCoins,
                 std::set<COutPoint>& setCoinsRet, CAmount& nValueRet);
 
-        static bool SelectCoins(std::vector<COutPoint>& vAvailableCoins, const CAmount& nTargetValue, std::set<COutPoint>& setCoinsRet, CAmount& nValueRet);
+        static bool SelectCoins(std::vector<std::pair<COutPoint, CAddressOutput> >& vAvailableCoins, const CAmount& nTargetValue, std::set<COutPoint>& setCoinsRet, CAmount& nValueRet);
 
-        static bool AvailableCoins(const std::string& pubKey, std::vector<COutPoint>& vCoins);
+        //! The unspent outputs of the address of pubKey that can be spent in the next block, from the address index
+        static bool AvailableCoins(const std::string& pubKey, std::vector<std::pair<COutPoint, CAddressOutput> >& vCoins);
 
         static bool SelectRewards(std::vector<CTxReward>& vAvailableRewards, const CAmount& nTargetValue, std::vector<CTxReward>& setRewardsRet, CAmount& nValueRet);
 
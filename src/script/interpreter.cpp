@@ -11,6 +11,7 @@
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
 
@@ -1169,10 +1170,87 @@ public:
     }
 };
 
+uint256 GetPrevoutHash(const CTransaction& txTo) {
+    CHashWriter ss(SER_GETHASH, 0);
+    for (unsigned int n = 0; n < txTo.vin.size(); n++) {
+        ss << txTo.vin[n].prevout;
+    }
+    return ss.GetHash();
+}
+
+uint256 GetSequenceHash(const CTransaction& txTo) {
+    CHashWriter ss(SER_GETHASH, 0);
+    for (unsigned int n = 0; n < txTo.vin.size(); n++) {
+        ss << txTo.vin[n].nSequence;
+    }
+    return ss.GetHash();
+}
+
+uint256 GetOutputsHash(const CTransaction& txTo) {
+    CHashWriter ss(SER_GETHASH, 0);
+    for (unsigned int n = 0; n < txTo.vout.size(); n++) {
+        ss << txTo.vout[n];
+    }
+    return ss.GetHash();
+}
+
+/** Write the bytes of vch from nBegin on to the hash */
+void WriteBytes(CHashWriter& ss, const std::vector<unsigned char>& vch, unsigned int nBegin, unsigned int nEnd) {
+    if (nEnd > nBegin)
+        ss.write((const char*)&vch[nBegin], nEnd - nBegin);
+}
+
 } // anon namespace
 
+PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
+{
+    hashPrevouts = GetPrevoutHash(txTo);
+    hashSequence = GetSequenceHash(txTo);
+    hashOutputs = GetOutputsHash(txTo);
+
+    // Past the last input and reward spend, the serializer blanks out the signatures of all of them
+    const CScript scriptCode;
+    const unsigned int nNone = std::max(txTo.vin.size(), txTo.vreward.size());
+    CTransactionSignatureSerializer txTmp(txTo, scriptCode, nNone, SIGHASH_ALL);
+
+    CDataStream ss(SER_GETHASH, 0);
+    ::WriteCompactSize(ss, txTo.vin.size());
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++) {
+        vInputPos.push_back(ss.size());
+        txTmp.SerializeInput(ss, nInput, SER_GETHASH, 0);
+    }
+    vInputPos.push_back(ss.size());
+    vchInputs.assign(ss.begin(), ss.end());
+
+    ss.clear();
+    ::WriteCompactSize(ss, txTo.vout.size());
+    for (unsigned int nOutput = 0; nOutput < txTo.vout.size(); nOutput++)
+        txTmp.SerializeOutput(ss, nOutput, SER_GETHASH, 0);
+    vchOutputs.assign(ss.begin(), ss.end());
+
+    ss.clear();
+    ::WriteCompactSize(ss, txTo.vreward.size());
+    for (unsigned int nReward = 0; nReward < txTo.vreward.size(); nReward++) {
+        vRewardPos.push_back(ss.size());
+        txTmp.SerializeReward(ss, nReward, SER_GETHASH, 0);
+    }
+    vRewardPos.push_back(ss.size());
+    vchRewards.assign(ss.begin(), ss.end());
+
+    CHashWriter hw(SER_GETHASH, 0);
+    hw << txTo.nVersion;
+    WriteBytes(hw, vchInputs, 0, vInputPos[0]);
+    vInputMidstate.reserve(vInputPos.size());
+    for (unsigned int nInput = 0; nInput < txTo.vin.size(); nInput++) {
+        vInputMidstate.push_back(hw);
+        WriteBytes(hw, vchInputs, vInputPos[nInput], vInputPos[nInput + 1]);
+    }
+    vInputMidstate.push_back(hw);
+}
+
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
-                      const CAmount& amount, SigVersion sigversion, bool bCheckReward)
+                      const CAmount& amount, SigVersion sigversion, bool bCheckReward,
+                      const PrecomputedTransactionData* cache)
 {
     if (sigversion == SIGVERSION_WITNESS_V0) {
         uint256 hashPrevouts;
@@ -1180,27 +1258,15 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
         uint256 hashOutputs;
 
         if (!(nHashType & SIGHASH_ANYONECANPAY)) {
-            CHashWriter ss(SER_GETHASH, 0);
-            for (unsigned int n = 0; n < txTo.vin.size(); n++) {
-                ss << txTo.vin[n].prevout;
-            }
-            hashPrevouts = ss.GetHash(); // TODO: cache this value for all signatures in a transaction
+            hashPrevouts = cache ? cache->hashPrevouts : GetPrevoutHash(txTo);
         }
 
         if (!(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            CHashWriter ss(SER_GETHASH, 0);
-            for (unsigned int n = 0; n < txTo.vin.size(); n++) {
-                ss << txTo.vin[n].nSequence;
-            }
-            hashSequence = ss.GetHash(); // TODO: cache this value for all signatures in a transaction
+            hashSequence = cache ? cache->hashSequence : GetSequenceHash(txTo);
         }
 
         if ((nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
-            CHashWriter ss(SER_GETHASH, 0);
-            for (unsigned int n = 0; n < txTo.vout.size(); n++) {
-                ss << txTo.vout[n];
-            }
-            hashOutputs = ss.GetHash(); // TODO: cache this value for all signatures in a transaction
+            hashOutputs = cache ? cache->hashOutputs : GetOutputsHash(txTo);
         } else if ((nHashType & 0x1f) == SIGHASH_SINGLE && nIn < txTo.vout.size()) {
             CHashWriter ss(SER_GETHASH, 0);
             ss << txTo.vout[nIn];
@@ -1251,6 +1317,28 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // With SIGHASH_ALL only the input and the reward spend at nIn differ from the precomputed
+    // serialization, the hash goes on from the midstate before that input
+    if (cache && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        const unsigned int nInputs = txTo.vin.size();
+        CHashWriter ss(cache->vInputMidstate[std::min(nIn, nInputs)]);
+        if (nIn < nInputs) {
+            txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+            WriteBytes(ss, cache->vchInputs, cache->vInputPos[nIn + 1], cache->vchInputs.size());
+        }
+        WriteBytes(ss, cache->vchOutputs, 0, cache->vchOutputs.size());
+        if (nIn < txTo.vreward.size()) {
+            WriteBytes(ss, cache->vchRewards, 0, cache->vRewardPos[nIn]);
+            txTmp.SerializeReward(ss, nIn, SER_GETHASH, 0);
+            WriteBytes(ss, cache->vchRewards, cache->vRewardPos[nIn + 1], cache->vchRewards.size());
+        } else {
+            WriteBytes(ss, cache->vchRewards, 0, cache->vchRewards.size());
+        }
+        ss << txTo.nLockTime << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1275,7 +1363,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     int nHashType = vchSig.back();
     vchSig.pop_back();
 
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, bCheckReward);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, amount, sigversion, bCheckReward, this->txdata);
 
     if (!VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -104,8 +105,31 @@ enum SigVersion
     SIGVERSION_WITNESS_V0 = 1,
 };
 
+/**
+ * Data of a transaction that the signature hashes of all its inputs and reward spends share,
+ * computed once so that checking a signature does not go through the whole transaction again
+ */
+struct PrecomputedTransactionData
+{
+    //! Hashes of the prevouts, sequences and outputs for the witness v0 signature hash
+    uint256 hashPrevouts, hashSequence, hashOutputs;
+
+    //! The inputs (with their count), the outputs (with their count) and the reward spends (with their count)
+    //! serialized as in the legacy SIGHASH_ALL signature hash, with every signature blanked out
+    std::vector<unsigned char> vchInputs, vchOutputs, vchRewards;
+
+    //! Where each input and reward spend starts in vchInputs and vchRewards, followed by where the last one ends
+    std::vector<unsigned int> vInputPos, vRewardPos;
+
+    //! The legacy SIGHASH_ALL signature hash written up to each input, followed by the one past the last input
+    std::vector<CHashWriter> vInputMidstate;
+
+    PrecomputedTransactionData(const CTransaction& tx);
+};
+
 uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType,
-                      const CAmount& amount, SigVersion sigversion, bool bCheckReward=false);
+                      const CAmount& amount, SigVersion sigversion, bool bCheckReward=false,
+                      const PrecomputedTransactionData* cache = NULL);
 
 class BaseSignatureChecker
 {
@@ -134,13 +158,15 @@ private:
     const CTransaction* txTo;
     unsigned int nIn;
     const CAmount amount;
+    const PrecomputedTransactionData* txdata;
 
 protected:
     bool bCheckReward;
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool isCheckReward=false) : txTo(txToIn), nIn(nInIn), amount(amountIn), bCheckReward(isCheckReward) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, bool isCheckReward=false) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(NULL), bCheckReward(isCheckReward) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amountIn, const PrecomputedTransactionData& txdataIn, bool isCheckReward=false) : txTo(txToIn), nIn(nInIn), amount(amountIn), txdata(&txdataIn), bCheckReward(isCheckReward) {}
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode, SigVersion sigversion) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     bool CheckSequence(const CScriptNum& nSequence) const;
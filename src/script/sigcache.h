@@ -22,10 +22,7 @@ private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, bool isCheckReward=false) : TransactionSignatureChecker(txToIn, nInIn, amount), store(storeIn)
-    {
-        bCheckReward = isCheckReward;
-    }
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const CAmount& amount, bool storeIn, PrecomputedTransactionData& txdataIn, bool isCheckReward=false) : TransactionSignatureChecker(txToIn, nInIn, amount, txdataIn, isCheckReward), store(storeIn) {}
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
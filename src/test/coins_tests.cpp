@@ -82,6 +82,12 @@ public:
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    const CCoinsCacheEntry& GetEntry(const uint256& txid) const
+    {
+        CCoinsMap::const_iterator it = cacheCoins.find(txid);
+        assert(it != cacheCoins.end());
+        return it->second;
+    }
 };
 
 }
@@ -433,6 +439,85 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+// The coin database writes only the outputs of an entry that are dirty, so
+// every spend and every new output has to be tracked through the cache stack.
+BOOST_AUTO_TEST_CASE(ccoins_dirty_outputs)
+{
+    CCoinsViewTest base;
+    uint256 txid = GetRandHash();
+    {
+        CCoinsViewCacheTest cache(&base);
+        {
+            CCoinsModifier coins = cache.ModifyNewCoins(txid, false);
+            coins->nVersion = 1;
+            coins->vout.resize(3);
+            for (unsigned int i = 0; i < 3; i++) {
+                coins->vout[i].nValue = i + 1;
+                coins->vout[i].scriptPubKey = CScript() << OP_TRUE;
+            }
+        }
+        for (unsigned int i = 0; i < 3; i++)
+            BOOST_CHECK(cache.GetEntry(txid).IsOutputDirty(i));
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsViewCacheTest cache(&base);
+    cache.ModifyCoins(txid)->Spend(1);
+    BOOST_CHECK(!cache.GetEntry(txid).IsOutputDirty(0));
+    BOOST_CHECK(cache.GetEntry(txid).IsOutputDirty(1));
+    BOOST_CHECK(!cache.GetEntry(txid).IsOutputDirty(2));
+
+    // Spending the last output drops it from the coins, it is dirty all the same
+    {
+        CCoinsViewCacheTest child(&cache);
+        child.ModifyCoins(txid)->Spend(2);
+        BOOST_CHECK(child.GetEntry(txid).IsOutputDirty(2));
+        BOOST_CHECK(!child.GetEntry(txid).IsOutputDirty(1));
+        BOOST_CHECK(child.Flush());
+    }
+    BOOST_CHECK(!cache.GetEntry(txid).IsOutputDirty(0));
+    BOOST_CHECK(cache.GetEntry(txid).IsOutputDirty(1));
+    BOOST_CHECK(cache.GetEntry(txid).IsOutputDirty(2));
+    BOOST_CHECK(cache.AccessCoins(txid)->IsAvailable(0));
+    BOOST_CHECK_EQUAL(cache.AccessCoins(txid)->vout.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(ccoins_prefetched)
+{
+    CCoinsViewTest base;
+    uint256 txid = GetRandHash();
+    CCoins coins;
+    coins.nVersion = 1;
+    coins.vout.resize(2);
+    coins.vout[0].nValue = 1;
+    coins.vout[1].nValue = 2;
+    {
+        CCoinsViewCacheTest cache(&base);
+        *cache.ModifyNewCoins(txid, false) = coins;
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // Coins read ahead are cached as if they were fetched, and are not written back
+    CCoinsViewCacheTest cache(&base);
+    CCoins prefetched;
+    BOOST_CHECK(cache.GetCoinsFromBase(txid, prefetched));
+    BOOST_CHECK(!cache.HaveCoinsInCache(txid));
+    cache.AddPrefetchedCoins(txid, prefetched);
+    BOOST_CHECK(cache.HaveCoinsInCache(txid));
+    BOOST_CHECK(*cache.AccessCoins(txid) == coins);
+    BOOST_CHECK_EQUAL(cache.GetEntry(txid).flags, 0);
+    cache.SelfTest();
+
+    // A version in the cache is not replaced by one read before it changed
+    cache.ModifyCoins(txid)->Spend(1);
+    BOOST_CHECK(cache.GetCoinsFromBase(txid, prefetched));
+    cache.AddPrefetchedCoins(txid, prefetched);
+    BOOST_CHECK(!cache.AccessCoins(txid)->IsAvailable(1));
+    cache.SelfTest();
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
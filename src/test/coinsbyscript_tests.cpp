@@ -0,0 +1,200 @@
+// Copyright (c) 2014-2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "coinsbyscript.h"
+#include "main.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+//! Gives the tests access to the keys of the coin database
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+    CDBWrapper& GetDB() { return db; }
+};
+
+struct COutputCollector
+{
+    std::map<COutPoint, CAddressOutput>& mapOutputs;
+    size_t nMax;
+
+    COutputCollector(std::map<COutPoint, CAddressOutput>& mapOutputsIn, size_t nMaxIn = 0) : mapOutputs(mapOutputsIn), nMax(nMaxIn) {}
+
+    bool operator()(const COutPoint& outpoint, const CAddressOutput& output) const {
+        mapOutputs[outpoint] = output;
+        return nMax == 0 || mapOutputs.size() < nMax;
+    }
+};
+
+void AddCoins(CCoinsViewCache& cache, const uint256& txid, const std::vector<CTxOut>& vout, int nHeight)
+{
+    CCoinsModifier coins = cache.ModifyNewCoins(txid, false);
+    coins->vout = vout;
+    coins->nHeight = nHeight;
+    coins->nVersion = 1;
+}
+
+CAmount GetBalance(const CCoinsViewByScript& view, const CScript& script)
+{
+    CAmount nBalance = 0;
+    BOOST_CHECK(view.GetBalanceByScript(script, nBalance));
+    return nBalance;
+}
+
+//! The address index in the database has one entry per unspent output
+void CheckStats(const CCoinsViewDB& view, uint64_t nAddresses, uint64_t nOutputs)
+{
+    CCoinsStats stats;
+    BOOST_CHECK(view.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, nOutputs);
+    BOOST_CHECK_EQUAL(stats.nAddressesOutputs, nOutputs);
+    BOOST_CHECK_EQUAL(stats.nAddresses, nAddresses);
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(coinsbyscript_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(address_index_build_spend_reorg)
+{
+    CCoinsViewDBTest base;
+    CCoinsViewCache cache(&base);
+    CScript scriptA = CScript() << OP_1 << OP_EQUAL;
+    CScript scriptB = CScript() << OP_2 << OP_EQUAL;
+
+    uint256 txid1 = GetRandHash();
+    std::vector<CTxOut> vout1;
+    vout1.push_back(CTxOut(10 * COIN, scriptA));
+    vout1.push_back(CTxOut(20 * COIN, scriptB));
+    vout1.push_back(CTxOut(5 * COIN, scriptA));
+    AddCoins(cache, txid1, vout1, 1);
+    uint256 txid2 = GetRandHash();
+    AddCoins(cache, txid2, std::vector<CTxOut>(1, CTxOut(7 * COIN, scriptB)), 2);
+    BOOST_CHECK(cache.Flush());
+
+    // Build the index from the coins
+    BOOST_CHECK(base.GenerateAllCoinsByScript());
+    CCoinsViewByScript view(&base);
+    base.SetCoinsViewByScript(&view);
+    CheckStats(base, 2, 4);
+    CCoinsStats statsBuilt;
+    BOOST_CHECK(base.GetStats(statsBuilt));
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptA), 15 * COIN);
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptB), 27 * COIN);
+    CCoinsByScript coinsA;
+    BOOST_CHECK(view.GetCoinsByScript(scriptA, coinsA));
+    BOOST_CHECK_EQUAL(coinsA.setCoins.size(), 2);
+    BOOST_CHECK(coinsA.setCoins.count(COutPoint(txid1, 0)));
+    BOOST_CHECK(coinsA.setCoins.count(COutPoint(txid1, 2)));
+
+    // A visitor stops the iteration
+    std::map<COutPoint, CAddressOutput> mapOutputs;
+    BOOST_CHECK(view.ForEachOutputByScript(scriptA, COutputCollector(mapOutputs, 1)));
+    BOOST_CHECK_EQUAL(mapOutputs.size(), 1);
+
+    // Spend an output of A and create one in a block, the way ConnectBlock does
+    uint256 txid3 = GetRandHash();
+    cache.ModifyCoins(txid1)->Spend(0);
+    AddCoins(cache, txid3, std::vector<CTxOut>(1, CTxOut(3 * COIN, scriptA)), 3);
+    view.SpendOutput(scriptA, COutPoint(txid1, 0));
+    view.AddOutput(scriptA, COutPoint(txid3, 0), CAddressOutput(3 * COIN, 3, false));
+
+    // The cached changes take precedence over the database until they are flushed
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptA), 8 * COIN);
+    mapOutputs.clear();
+    BOOST_CHECK(base.ForEachAddressOutput(CCoinsViewByScript::getKey(scriptA), COutputCollector(mapOutputs)));
+    BOOST_CHECK_EQUAL(mapOutputs.size(), 2);
+    BOOST_CHECK(mapOutputs.count(COutPoint(txid1, 0)));
+
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(view.cacheAddressOutputs.empty());
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptA), 8 * COIN);
+    mapOutputs.clear();
+    BOOST_CHECK(base.ForEachAddressOutput(CCoinsViewByScript::getKey(scriptA), COutputCollector(mapOutputs)));
+    BOOST_CHECK_EQUAL(mapOutputs.size(), 2);
+    BOOST_CHECK(!mapOutputs.count(COutPoint(txid1, 0)));
+    BOOST_CHECK_EQUAL(mapOutputs[COutPoint(txid3, 0)].nValue, 3 * COIN);
+    BOOST_CHECK_EQUAL(mapOutputs[COutPoint(txid3, 0)].nHeight, 3);
+    CheckStats(base, 2, 4);
+
+    // Disconnect the block again, the way DisconnectBlock does
+    cache.ModifyCoins(txid1)->vout[0] = CTxOut(10 * COIN, scriptA);
+    cache.ModifyCoins(txid3)->Spend(0);
+    view.AddOutput(scriptA, COutPoint(txid1, 0), CAddressOutput(10 * COIN, 1, false));
+    view.SpendOutput(scriptA, COutPoint(txid3, 0));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptA), 15 * COIN);
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptB), 27 * COIN);
+    CheckStats(base, 2, 4);
+    CCoinsStats statsReorg;
+    BOOST_CHECK(base.GetStats(statsReorg));
+    BOOST_CHECK(statsReorg.hashSerialized == statsBuilt.hashSerialized);
+
+    // Spending every output of a script drops it from the index
+    cache.ModifyCoins(txid1)->Spend(1);
+    cache.ModifyCoins(txid2)->Spend(0);
+    view.SpendOutput(scriptB, COutPoint(txid1, 1));
+    view.SpendOutput(scriptB, COutPoint(txid2, 0));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(GetBalance(view, scriptB), 0);
+    CheckStats(base, 1, 2);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_migration)
+{
+    CCoinsViewDBTest base;
+    CCoinsViewCache cache(&base);
+    CScript script = CScript() << OP_1 << OP_EQUAL;
+    uint256 hashScript = CCoinsViewByScript::getKey(script);
+    uint256 txid = GetRandHash();
+    std::vector<CTxOut> vout;
+    vout.push_back(CTxOut(1 * COIN, script));
+    vout.push_back(CTxOut(2 * COIN, script));
+    AddCoins(cache, txid, vout, 1);
+    BOOST_CHECK(cache.Flush());
+
+    // An index of the old layout, one value per script under 's', and a stale output
+    CCoinsByScript coinsOld;
+    coinsOld.setCoins.insert(COutPoint(txid, 0));
+    coinsOld.setCoins.insert(COutPoint(txid, 1));
+    BOOST_CHECK(base.GetDB().Write(std::make_pair('s', hashScript), coinsOld));
+    BOOST_CHECK(base.GetDB().Write(std::make_pair('a', std::make_pair(hashScript, COutPoint(GetRandHash(), 0))), CAddressOutput(5 * COIN, 1, false)));
+    pblocktree->WriteFlag("txoutsbyaddressindex", true);
+
+    // Without the txoutsbyaddressoutput flag the index is rebuilt, as AppInit2 does
+    bool fAddressIndexByOutput = false;
+    pblocktree->ReadFlag("txoutsbyaddressoutput", fAddressIndexByOutput);
+    BOOST_CHECK(!fAddressIndexByOutput);
+    BOOST_CHECK(base.DeleteAllCoinsByScript());
+    BOOST_CHECK(!base.GetDB().Exists(std::make_pair('s', hashScript)));
+    BOOST_CHECK(base.GenerateAllCoinsByScript());
+    CheckStats(base, 1, 2);
+    pblocktree->WriteFlag("txoutsbyaddressoutput", true);
+    BOOST_CHECK(pblocktree->ReadFlag("txoutsbyaddressoutput", fAddressIndexByOutput));
+    BOOST_CHECK(fAddressIndexByOutput);
+
+    CCoinsViewByScript view(&base);
+    base.SetCoinsViewByScript(&view);
+    BOOST_CHECK_EQUAL(GetBalance(view, script), 3 * COIN);
+
+    // Deleting the index for -txoutsbyaddressindex=0 leaves the coins alone
+    BOOST_CHECK(base.DeleteAllCoinsByScript());
+    CCoinsStats stats;
+    BOOST_CHECK(base.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 2);
+    BOOST_CHECK_EQUAL(stats.nAddressesOutputs, 0);
+    BOOST_CHECK_EQUAL(GetBalance(view, script), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,7 +3,16 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "keystore.h"
 #include "main.h"
+#include "policy/policy.h"
+#include "pot.h"
+#include "random.h"
+#include "script/sign.h"
+#include "utilstrencodings.h"
 
 #include "test/test_bitcoin.h"
 
@@ -41,4 +50,114 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+BOOST_AUTO_TEST_CASE(proof_of_transaction_batch)
+{
+    // Headers forged at their deadline pass, the check threads are started by the fixture
+    CKey key;
+    key.MakeNewKey(true);
+    std::string pubKey = HexStr(key.GetPubKey());
+    std::string prevGenerationSignature = GetRandHash().GetHex();
+    std::vector<CBlockHeader> headers;
+    std::vector<CProofOfTransactionCheck> vChecks;
+    unsigned int nPrevTime = 1000;
+    for (int i = 0; i < 20; i++) {
+        CBlockHeader header;
+        header.baseTarget = 1ULL << 40;
+        header.harvestPower = 1 << 20;
+        header.pubKeyOfpackager = pubKey;
+        int64_t nDeadline = GetProofOfTransactionDeadline(prevGenerationSignature, pubKey, header.baseTarget,
+                                                          header.harvestPower);
+        BOOST_CHECK(nDeadline > 0);
+        header.nTime = nPrevTime + nDeadline;
+        header.generationSignature = GetRandHash().GetHex();
+        vChecks.push_back(CProofOfTransactionCheck(header, prevGenerationSignature, i, nPrevTime));
+        headers.push_back(header);
+        prevGenerationSignature = header.generationSignature;
+        nPrevTime = header.nTime;
+    }
+    std::vector<CProofOfTransactionCheck> vCopy(vChecks);
+    BOOST_CHECK(CheckProofOfTransactions(vCopy));
+
+    // One header forged a second too early fails the whole batch
+    CBlockHeader early = headers[10];
+    early.nTime -= 1;
+    vChecks[10] = CProofOfTransactionCheck(early, headers[9].generationSignature, 10, headers[9].nTime);
+    BOOST_CHECK(!vChecks[10]());
+    BOOST_CHECK(!CheckProofOfTransactions(vChecks));
+}
+
+BOOST_AUTO_TEST_CASE(proof_of_transaction_block_index)
+{
+    // The checks on the signature held in the block index agree with the ones on its hex string
+    CKey key;
+    key.MakeNewKey(true);
+    std::string pubKey = HexStr(key.GetPubKey());
+    CBlockIndex index;
+    BOOST_CHECK_EQUAL(index.GetBlockGenerationSignature(), "");
+    PotErr error;
+    BOOST_CHECK(!CheckProofOfTransaction(index.generationSignature, pubKey, 1, 60, 1ULL << 40, 1 << 20,
+                                         Params().GetConsensus(), error));
+    BOOST_CHECK(error == POT_ARGS_ERR);
+
+    for (int i = 0; i < 2; i++) {
+        std::string signature = i == 0 ? GetRandHash().GetHex() : "not hex";
+        index.generationSignature.Set(signature);
+        BOOST_CHECK_EQUAL(index.GetBlockGenerationSignature(), signature);
+        BOOST_CHECK(getPotHash(index.generationSignature, pubKey) == getPotHash(signature, pubKey));
+        std::string generationSignature = HexStr(getPotHash(signature, pubKey));
+        BOOST_CHECK(verifyGenerationSignature(index.generationSignature, generationSignature, pubKey));
+        int64_t nDeadline = GetProofOfTransactionDeadline(signature, pubKey, 1ULL << 40, 1 << 20);
+        BOOST_CHECK(CheckProofOfTransaction(index.generationSignature, pubKey, 1, nDeadline, 1ULL << 40, 1 << 20,
+                                            Params().GetConsensus(), error));
+        BOOST_CHECK(!CheckProofOfTransaction(index.generationSignature, pubKey, 1, nDeadline - 1, 1ULL << 40, 1 << 20,
+                                             Params().GetConsensus(), error));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(reward_signature_checks)
+{
+    // A reward spend with a bad signature fails CheckRewards inline, and the check ConnectBlock
+    // queues for it fails on the script check threads, so its block is rejected
+    CBasicKeyStore keystore;
+    CKey key;
+    key.MakeNewKey(true);
+    keystore.AddKey(key);
+    std::string pubKey = HexStr(key.GetPubKey());
+
+    CMutableTransaction mtx;
+    mtx.vreward.push_back(CTxReward(pubKey, 100, 1000));
+    const CTransaction txToSign(mtx);
+    const CScript scriptPubKey = CScript() << ParseHex(pubKey) << OP_CHECKREWARDSIG;
+    SignatureData sigdata;
+    BOOST_CHECK(ProduceSignatureForRewards(TransactionSignatureCreator(&keystore, &txToSign, 0, 100, SIGHASH_ALL, true),
+                                           scriptPubKey, sigdata));
+    mtx.vreward[0].scriptSig = sigdata.scriptSig;
+    const CTransaction goodTx(mtx);
+
+    CScript::const_iterator pc = sigdata.scriptSig.begin();
+    opcodetype opcode;
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(sigdata.scriptSig.GetOp(pc, opcode, vchSig));
+    vchSig[10] ^= 1; // in R, the encoding stays valid
+    mtx.vreward[0].scriptSig = CScript() << vchSig;
+    const CTransaction badTx(mtx);
+
+    CCoinsViewCache view(pcoinsTip);
+    for (int i = 0; i < 2; i++) {
+        const CTransaction& tx = i == 0 ? goodTx : badTx;
+        PrecomputedTransactionData txdata(tx);
+        CValidationState state;
+        BOOST_CHECK_EQUAL(CheckRewards(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, false, txdata), i == 0);
+        if (i == 1)
+            BOOST_CHECK_EQUAL(state.GetRejectReason().compare(0, 32, "reward-script-verify-flag-failed"), 0);
+
+        std::vector<CScriptCheck> vChecks;
+        CValidationState queuedState;
+        BOOST_CHECK(CheckRewards(tx, queuedState, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, false, txdata, &vChecks));
+        BOOST_CHECK_EQUAL(vChecks.size(), 1U);
+        BOOST_CHECK_EQUAL(vChecks[0](), i == 0);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
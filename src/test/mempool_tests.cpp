@@ -579,4 +579,99 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRewardSpendsTest)
+{
+    CTxMemPool pool(CFeeRate(0), false);
+    TestMemPoolEntryHelper entry;
+    std::string pubkeyA = "A";
+    std::string pubkeyB = "B";
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vreward.push_back(CTxReward(pubkeyA, 10 * COIN, 1));
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1, &pool));
+
+    // Listed once for each of its two rewards
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vreward.push_back(CTxReward(pubkeyA, 5 * COIN, 2));
+    tx2.vreward.push_back(CTxReward(pubkeyA, 5 * COIN, 3));
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2, &pool));
+
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vreward.push_back(CTxReward(pubkeyA, 20 * COIN, 4));
+    tx3.vreward.push_back(CTxReward(pubkeyB, 30 * COIN, 4));
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 50 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.FromTx(tx3, &pool));
+
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vin.resize(1);
+    tx4.vin[0].prevout = COutPoint(tx3.GetHash(), 0);
+    tx4.vin[0].scriptSig = CScript() << OP_3;
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_4 << OP_EQUAL;
+    tx4.vout[0].nValue = 50 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.FromTx(tx4, &pool));
+
+    // Spends of a pubkey chain up
+    BOOST_CHECK_EQUAL(pool.mapMemReward[pubkeyA].nPending, 40 * COIN);
+    BOOST_CHECK_EQUAL(pool.mapMemReward[pubkeyA].vtx.size(), 4);
+    BOOST_CHECK_EQUAL(pool.mapMemReward[pubkeyB].nPending, 30 * COIN);
+
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vreward.push_back(CTxReward(pubkeyA, 7 * COIN, 5));
+    tx5.vreward.push_back(CTxReward(pubkeyA, 1 * COIN, 6));
+    std::map<std::string, CAmount> mapPending;
+    BOOST_CHECK(pool.CalculateRewardSpends(tx5, 5, mapPending));
+    BOOST_CHECK_EQUAL(mapPending[pubkeyA], 48 * COIN);
+
+    // and are rejected at the limit
+    mapPending.clear();
+    BOOST_CHECK(!pool.CalculateRewardSpends(tx5, 4, mapPending));
+
+    // Nothing is evicted while the balance covers the pending spends
+    std::map<std::string, CAmount> mapBalance;
+    mapBalance[pubkeyA] = 40 * COIN;
+    BOOST_CHECK_EQUAL(pool.TrimRewardSpends(mapBalance), 0);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+
+    // The newest spend goes with its descendant once the balance drops
+    mapBalance[pubkeyA] = 25 * COIN;
+    BOOST_CHECK_EQUAL(pool.TrimRewardSpends(mapBalance), 2);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+    BOOST_CHECK(!pool.exists(tx4.GetHash()));
+    BOOST_CHECK_EQUAL(pool.mapMemReward[pubkeyA].nPending, 20 * COIN);
+    BOOST_CHECK(!pool.mapMemReward.count(pubkeyB));
+
+    // A transaction listed twice is subtracted once
+    mapBalance[pubkeyA] = 5 * COIN;
+    BOOST_CHECK_EQUAL(pool.TrimRewardSpends(mapBalance), 2);
+    BOOST_CHECK_EQUAL(pool.size(), 0);
+    BOOST_CHECK(pool.mapMemReward.empty());
+
+    // A spend evicted for one pubkey counts for the others it spends from
+    pool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1, &pool));
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vreward.push_back(CTxReward(pubkeyA, 10 * COIN, 7));
+    tx6.vreward.push_back(CTxReward(pubkeyB, 10 * COIN, 7));
+    pool.addUnchecked(tx6.GetHash(), entry.FromTx(tx6, &pool));
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vreward.push_back(CTxReward(pubkeyB, 10 * COIN, 8));
+    pool.addUnchecked(tx7.GetHash(), entry.FromTx(tx7, &pool));
+    mapBalance[pubkeyA] = 10 * COIN;
+    mapBalance[pubkeyB] = 10 * COIN;
+    BOOST_CHECK_EQUAL(pool.TrimRewardSpends(mapBalance), 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(!pool.exists(tx6.GetHash()));
+    BOOST_CHECK(pool.exists(tx7.GetHash()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
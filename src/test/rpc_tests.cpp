@@ -6,7 +6,13 @@
 #include "rpc/client.h"
 
 #include "base58.h"
+#include "coinsbyscript.h"
+#include "key.h"
+#include "main.h"
 #include "netbase.h"
+#include "tool.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
 
 #include "test/test_bitcoin.h"
 
@@ -332,4 +338,51 @@ BOOST_AUTO_TEST_CASE(rpc_convert_values_generatetoaddress)
     BOOST_CHECK_EQUAL(result[2].get_int(), 9);
 }
 
+BOOST_AUTO_TEST_CASE(rpc_getaddressbalances)
+{
+    // The address index has to be enabled
+    BOOST_CHECK_THROW(CallRPC("getaddressbalances []"), runtime_error);
+    fTxOutsByAddressIndex = true;
+    pcoinsByScript = new CCoinsViewByScript(pcoinsdbview);
+    pcoinsdbview->SetCoinsViewByScript(pcoinsByScript);
+
+    CKey key;
+    key.MakeNewKey(true);
+    std::string strPubkey = HexStr(key.GetPubKey());
+    std::string strAddress;
+    BOOST_CHECK(ConvertPubkeyToAddress(strPubkey, strAddress));
+
+    // Unknown pubkeys and addresses have nothing, an invalid key has no address
+    UniValue r;
+    BOOST_CHECK_NO_THROW(r = CallRPC("getaddressbalances [\"" + strPubkey + "\",\"" + strAddress + "\",\"notakey\"]"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "height").get_int(), chainActive.Height());
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "bestblockhash").get_str(), chainActive.Tip()->GetBlockHash().GetHex());
+    UniValue balances = find_value(r.get_obj(), "balances").get_array();
+    BOOST_CHECK_EQUAL(balances.size(), 3);
+    for (unsigned int i = 0; i < 2; i++) {
+        const UniValue& o = balances[i].get_obj();
+        BOOST_CHECK_EQUAL(find_value(o, "address").get_str(), strAddress);
+        BOOST_CHECK_EQUAL(find_value(o, "utxo").get_int64(), 0);
+        BOOST_CHECK_EQUAL(find_value(o, "rewards").get_int64(), 0);
+        BOOST_CHECK_EQUAL(find_value(o, "miningpower").get_int64(), 0);
+        BOOST_CHECK_EQUAL(find_value(o, "club").get_str(), "");
+    }
+    BOOST_CHECK_EQUAL(find_value(balances[0].get_obj(), "key").get_str(), strPubkey);
+    BOOST_CHECK_EQUAL(find_value(balances[2].get_obj(), "key").get_str(), "notakey");
+    BOOST_CHECK(find_value(balances[2].get_obj(), "address").isNull());
+
+    // Up to MAX_ADDRESS_BALANCE_LOOKUPS keys are looked up in one call
+    std::string strKeys = "[\"" + strAddress + "\"";
+    for (unsigned int i = 1; i < MAX_ADDRESS_BALANCE_LOOKUPS; i++)
+        strKeys += ",\"" + strAddress + "\"";
+    BOOST_CHECK_NO_THROW(r = CallRPC("getaddressbalances " + strKeys + "]"));
+    BOOST_CHECK_EQUAL(find_value(r.get_obj(), "balances").get_array().size(), MAX_ADDRESS_BALANCE_LOOKUPS);
+    BOOST_CHECK_THROW(CallRPC("getaddressbalances " + strKeys + ",\"" + strAddress + "\"]"), runtime_error);
+
+    pcoinsdbview->SetCoinsViewByScript(NULL);
+    delete pcoinsByScript;
+    pcoinsByScript = NULL;
+    fTxOutsByAddressIndex = false;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -166,6 +166,37 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that the signature hashes from the precomputed data of a transaction are the same
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    seed_insecure_rand(false);
+
+    for (int i=0; i<5000; i++) {
+        int nHashType = insecure_rand();
+        CMutableTransaction txTo;
+        RandomTransaction(txTo, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        int nRewards = insecure_rand() % 4;
+        for (int r=0; r<nRewards; r++) {
+            CScript scriptSig;
+            RandomScript(scriptSig);
+            txTo.vreward.push_back(CTxReward(GetRandHash().GetHex(), insecure_rand() % 100000000, insecure_rand(), scriptSig));
+        }
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        const CTransaction tx(txTo);
+        PrecomputedTransactionData txdata(tx);
+
+        int nIn = insecure_rand() % (tx.vin.size() + 1);
+        BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, false, &txdata) ==
+                    SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, false));
+        BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, true, &txdata) ==
+                    SignatureHash(scriptCode, tx, nIn, nHashType, 0, SIGVERSION_BASE, true));
+        if (nIn < (int)tx.vin.size())
+            BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, 1000, SIGVERSION_WITNESS_V0, false, &txdata) ==
+                        SignatureHash(scriptCode, tx, nIn, nHashType, 1000, SIGVERSION_WITNESS_V0, false));
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
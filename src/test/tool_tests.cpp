@@ -0,0 +1,73 @@
+// Copyright (c) 2018- The imorpheus Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "tool.h"
+#include "utilstrencodings.h"
+
+#include "test/test_bitcoin.h"
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(tool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pubkey_address_cache_lru)
+{
+    CPubkeyAddressCache cache(2);
+    std::string addrStr;
+    BOOST_CHECK(!cache.Get("a", addrStr));
+
+    cache.Put("a", "A");
+    cache.Put("b", "B");
+    BOOST_CHECK(cache.Get("a", addrStr));
+    BOOST_CHECK_EQUAL(addrStr, "A");
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+
+    // "a" was used last, so "b" is dropped for "c"
+    cache.Put("c", "C");
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+    BOOST_CHECK(!cache.Get("b", addrStr));
+    BOOST_CHECK(cache.Get("a", addrStr));
+    BOOST_CHECK_EQUAL(addrStr, "A");
+    BOOST_CHECK(cache.Get("c", addrStr));
+    BOOST_CHECK_EQUAL(addrStr, "C");
+
+    // Putting a kept pubkey again updates it without dropping another one
+    cache.Put("a", "A2");
+    BOOST_CHECK_EQUAL(cache.Size(), 2U);
+    BOOST_CHECK(cache.Get("c", addrStr));
+    BOOST_CHECK(cache.Get("a", addrStr));
+    BOOST_CHECK_EQUAL(addrStr, "A2");
+
+    // "c" is now the least recently used
+    cache.Put("d", "D");
+    BOOST_CHECK(!cache.Get("c", addrStr));
+    BOOST_CHECK(cache.Get("a", addrStr));
+    BOOST_CHECK(cache.Get("d", addrStr));
+}
+
+BOOST_AUTO_TEST_CASE(convert_pubkey_to_address)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    std::string pubKey = HexStr(key.GetPubKey());
+    const CScript script = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    std::string expected;
+    CBitcoinAddress addr;
+    BOOST_CHECK(addr.ScriptPub2Addr(script, expected));
+
+    // The first conversion fills the cache and the second one is answered from it
+    std::string addrStr;
+    BOOST_CHECK(ConvertPubkeyToAddress(pubKey, addrStr));
+    BOOST_CHECK_EQUAL(addrStr, expected);
+    addrStr.clear();
+    BOOST_CHECK(ConvertPubkeyToAddress(pubKey, addrStr));
+    BOOST_CHECK_EQUAL(addrStr, expected);
+
+    BOOST_CHECK(!ConvertPubkeyToAddress("", addrStr));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
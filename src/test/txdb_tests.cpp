@@ -0,0 +1,192 @@
+// Copyright (c) 2014-2015 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+//! Gives the tests access to the keys of the coin database
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+    CDBWrapper& GetDB() { return db; }
+};
+
+CCoins MakeCoins(const std::vector<CTxOut>& vout, int nHeight, bool fCoinBase)
+{
+    CCoins coins;
+    coins.vout = vout;
+    coins.nHeight = nHeight;
+    coins.fCoinBase = fCoinBase;
+    coins.nVersion = 1;
+    return coins;
+}
+
+void AddCoins(CCoinsViewCache& cache, const uint256& txid, const CCoins& coinsIn)
+{
+    CCoinsModifier coins = cache.ModifyNewCoins(txid, coinsIn.fCoinBase);
+    coins->vout = coinsIn.vout;
+    coins->nHeight = coinsIn.nHeight;
+    coins->fCoinBase = coinsIn.fCoinBase;
+    coins->nVersion = coinsIn.nVersion;
+}
+
+void CheckCoins(const CCoins& coins, const CCoins& expected)
+{
+    BOOST_CHECK_EQUAL(coins.nHeight, expected.nHeight);
+    BOOST_CHECK_EQUAL(coins.fCoinBase, expected.fCoinBase);
+    BOOST_CHECK_EQUAL(coins.nVersion, expected.nVersion);
+    for (unsigned int n = 0; n < std::max(coins.vout.size(), expected.vout.size()); n++)
+        BOOST_CHECK(coins.IsAvailable(n) == expected.IsAvailable(n));
+    for (unsigned int n = 0; n < coins.vout.size() && n < expected.vout.size(); n++)
+        BOOST_CHECK(coins.vout[n] == expected.vout[n]);
+}
+
+std::map<uint256, CCoins> ReadAllCoins(const CCoinsView& view)
+{
+    std::map<uint256, CCoins> mapCoins;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    while (pcursor->Valid()) {
+        uint256 txid;
+        CCoins coins;
+        BOOST_CHECK(pcursor->GetKey(txid));
+        BOOST_CHECK(pcursor->GetValue(coins));
+        BOOST_CHECK(pcursor->GetValueSize() > 0);
+        mapCoins[txid] = coins;
+        pcursor->Next();
+    }
+    return mapCoins;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(coins_db_roundtrip)
+{
+    CCoinsViewDBTest base;
+    CScript script = CScript() << OP_1 << OP_EQUAL;
+    std::vector<CTxOut> vout;
+    vout.push_back(CTxOut(10 * COIN, script));
+    vout.push_back(CTxOut(20 * COIN, script));
+    vout.push_back(CTxOut(5 * COIN, script));
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    CCoins coins1 = MakeCoins(vout, 1, true);
+    CCoins coins2 = MakeCoins(std::vector<CTxOut>(1, CTxOut(7 * COIN, script)), 2, false);
+    uint256 hashBlock = GetRandHash();
+    {
+        CCoinsViewCache cache(&base);
+        AddCoins(cache, txid1, coins1);
+        AddCoins(cache, txid2, coins2);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(base.GetBestBlock() == hashBlock);
+
+    CCoins coins;
+    BOOST_CHECK(base.HaveCoins(txid1));
+    BOOST_CHECK(base.GetCoins(txid1, coins));
+    CheckCoins(coins, coins1);
+    BOOST_CHECK(!base.HaveCoins(GetRandHash()));
+    BOOST_CHECK(!base.GetCoins(GetRandHash(), coins));
+
+    // Spend an output in the middle of the first transaction and all of the second one
+    {
+        CCoinsViewCache cache(&base);
+        cache.ModifyCoins(txid1)->Spend(1);
+        cache.ModifyCoins(txid2)->Spend(0);
+        BOOST_CHECK(cache.Flush());
+    }
+    coins1.Spend(1);
+
+    // The lookups see the writes made after the previous ones
+    BOOST_CHECK(base.HaveCoins(txid1));
+    BOOST_CHECK(base.GetCoins(txid1, coins));
+    CheckCoins(coins, coins1);
+    BOOST_CHECK(!base.HaveCoins(txid2));
+    BOOST_CHECK(!base.GetCoins(txid2, coins));
+
+    std::map<uint256, CCoins> mapCoins = ReadAllCoins(base);
+    BOOST_CHECK_EQUAL(mapCoins.size(), 1U);
+    BOOST_CHECK(mapCoins.count(txid1));
+    CheckCoins(mapCoins[txid1], coins1);
+
+    CCoinsStats stats;
+    BOOST_CHECK(base.GetStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 2U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 15 * COIN);
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CScript script = CScript() << OP_2 << OP_EQUAL;
+    std::vector<CTxOut> vout;
+    vout.push_back(CTxOut(1 * COIN, script));
+    vout.push_back(CTxOut(2 * COIN, script));
+    vout.push_back(CTxOut(3 * COIN, script));
+    std::map<uint256, CCoins> mapExpected;
+    for (int i = 0; i < 20; i++) {
+        CCoins coins = MakeCoins(vout, i + 1, i % 2 == 0);
+        if (i % 3 == 0)
+            coins.Spend(1);
+        mapExpected[GetRandHash()] = coins;
+    }
+    uint256 hashBlock = GetRandHash();
+
+    // The same coins written in the current layout
+    CCoinsViewDBTest current;
+    {
+        CCoinsViewCache cache(&current);
+        for (std::map<uint256, CCoins>::const_iterator it = mapExpected.begin(); it != mapExpected.end(); ++it)
+            AddCoins(cache, it->first, it->second);
+        cache.SetBestBlock(hashBlock);
+        BOOST_CHECK(cache.Flush());
+    }
+    CCoinsStats statsCurrent;
+    BOOST_CHECK(current.GetStats(statsCurrent));
+
+    // and as the records of one transaction each written by older versions
+    CCoinsViewDBTest legacy;
+    for (std::map<uint256, CCoins>::const_iterator it = mapExpected.begin(); it != mapExpected.end(); ++it)
+        BOOST_CHECK(legacy.GetDB().Write(std::make_pair('c', it->first), it->second));
+    BOOST_CHECK(legacy.GetDB().Write('B', hashBlock));
+    BOOST_CHECK(!legacy.HaveCoins(mapExpected.begin()->first));
+
+    BOOST_CHECK(legacy.Upgrade());
+    BOOST_CHECK(!legacy.GetDB().Exists(std::make_pair('c', mapExpected.begin()->first)));
+    CCoinsStats statsUpgraded;
+    BOOST_CHECK(legacy.GetStats(statsUpgraded));
+    BOOST_CHECK(statsUpgraded.hashBlock == statsCurrent.hashBlock);
+    BOOST_CHECK_EQUAL(statsUpgraded.nTransactions, statsCurrent.nTransactions);
+    BOOST_CHECK_EQUAL(statsUpgraded.nTransactionOutputs, statsCurrent.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsUpgraded.nSerializedSize, statsCurrent.nSerializedSize);
+    BOOST_CHECK_EQUAL(statsUpgraded.nTotalAmount, statsCurrent.nTotalAmount);
+    BOOST_CHECK(statsUpgraded.hashSerialized == statsCurrent.hashSerialized);
+
+    CCoins coins;
+    for (std::map<uint256, CCoins>::const_iterator it = mapExpected.begin(); it != mapExpected.end(); ++it) {
+        BOOST_CHECK(legacy.GetCoins(it->first, coins));
+        CheckCoins(coins, it->second);
+    }
+
+    // Upgrading again finds nothing left to do
+    BOOST_CHECK(legacy.Upgrade());
+    BOOST_CHECK(legacy.GetStats(statsUpgraded));
+    BOOST_CHECK(statsUpgraded.hashSerialized == statsCurrent.hashSerialized);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -7,18 +7,72 @@
 #include "amount.h"
 #include "chainparams.h"
 #include "main.h"
+#include "sync.h"
 #include "txdb.h"
 #include "utilstrencodings.h"
 
+namespace {
+
+//! Addresses of the pubkeys converted lately
+CPubkeyAddressCache cachePubkeyAddress(PUBKEY_ADDRESS_CACHE_SIZE);
+CCriticalSection cs_pubkeyaddress;
+
+}
+
+CPubkeyAddressCache::CPubkeyAddressCache(size_t nMaxSizeIn) : nMaxSize(nMaxSizeIn)
+{
+}
+
+bool CPubkeyAddressCache::Get(const std::string& pubKey, std::string& addrStr)
+{
+    std::map<std::string, EntryList::iterator>::iterator it = mapEntries.find(pubKey);
+    if (it == mapEntries.end())
+        return false;
+    listEntries.splice(listEntries.begin(), listEntries, it->second);
+    addrStr = it->second->second;
+    return true;
+}
+
+void CPubkeyAddressCache::Put(const std::string& pubKey, const std::string& addrStr)
+{
+    std::map<std::string, EntryList::iterator>::iterator it = mapEntries.find(pubKey);
+    if (it != mapEntries.end())
+    {
+        it->second->second = addrStr;
+        listEntries.splice(listEntries.begin(), listEntries, it->second);
+        return;
+    }
+    if (nMaxSize == 0)
+        return;
+    if (mapEntries.size() >= nMaxSize)
+    {
+        mapEntries.erase(listEntries.back().first);
+        listEntries.pop_back();
+    }
+    listEntries.push_front(std::make_pair(pubKey, addrStr));
+    mapEntries[pubKey] = listEntries.begin();
+}
+
 bool ConvertPubkeyToAddress(const std::string& pubKey, std::string& addrStr)
 {
     if (pubKey.empty())
         return false;
 
+    {
+        LOCK(cs_pubkeyaddress);
+        if (cachePubkeyAddress.Get(pubKey, addrStr))
+            return true;
+    }
+
     const CScript script = CScript() << ParseHex(pubKey) << OP_CHECKSIG;
     CBitcoinAddress addr;
 
     bool ret = addr.ScriptPub2Addr(script, addrStr);
+    if (ret)
+    {
+        LOCK(cs_pubkeyaddress);
+        cachePubkeyAddress.Put(pubKey, addrStr);
+    }
     return ret;
 }
 
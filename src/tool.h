@@ -11,6 +11,40 @@
 #include "base58.h"
 #include "script/script.h"
 
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+
+//! Number of pubkeys whose addresses are kept by ConvertPubkeyToAddress
+static const size_t PUBKEY_ADDRESS_CACHE_SIZE = 50000;
+
+/** Addresses of hex encoded pubkeys, the least recently used one is dropped when the cache is full */
+class CPubkeyAddressCache
+{
+private:
+    typedef std::list<std::pair<std::string, std::string> > EntryList;
+
+    //! Max number of pubkeys kept
+    size_t nMaxSize;
+
+    //! pubkeys and their addresses, the least recently used last
+    EntryList listEntries;
+    std::map<std::string, EntryList::iterator> mapEntries;
+
+public:
+    explicit CPubkeyAddressCache(size_t nMaxSizeIn);
+
+    //! Get the address of the pubkey and mark it used
+    bool Get(const std::string& pubKey, std::string& addrStr);
+
+    //! Keep the address of the pubkey, dropping the least recently used one when full
+    void Put(const std::string& pubKey, const std::string& addrStr);
+
+    size_t Size() const { return mapEntries.size(); }
+};
+
+//! Get the address of a hex encoded pubkey, the addresses of the pubkeys met lately are cached
 bool ConvertPubkeyToAddress(const std::string& pubKey, std::string& addrStr);
 
 bool ConvertPubKeyIntoBitAdress(const CScript& script, CBitcoinAddress& addr);
@@ -7,9 +7,12 @@
 
 #include "arith_uint256.h"
 #include "chainparams.h"
+#include "compressor.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "uint256.h"
+#include "ui_interface.h"
 
 #include <stdint.h>
 
@@ -18,8 +21,10 @@
 
 using namespace std;
 
-static const char DB_COINS = 'c';
-static const char DB_COINS_BYSCRIPT = 's';
+static const char DB_COINS = 'c'; // one record per transaction, replaced by DB_COIN
+static const char DB_COIN = 'C';
+static const char DB_COINS_BYSCRIPT = 's'; // index of one value per script, replaced by DB_ADDRESS_OUTPUT
+static const char DB_ADDRESS_OUTPUT = 'a';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
@@ -29,6 +34,80 @@ static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
 
+namespace {
+
+/** Key of one unspent output in the coin database, the outputs of a transaction are adjacent */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/** One unspent output in the coin database, with the data of its transaction */
+struct CoinValue {
+    CTxOut out;
+    int nHeight;
+    bool fCoinBase;
+    int nTxVersion;
+
+    CoinValue() : nHeight(0), fCoinBase(false), nTxVersion(0) {}
+    CoinValue(const CCoins& coins, unsigned int n) :
+        out(coins.vout[n]), nHeight(coins.nHeight), fCoinBase(coins.fCoinBase), nTxVersion(coins.nVersion) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        unsigned int nCode = nHeight * 2 + (fCoinBase ? 1 : 0);
+        READWRITE(VARINT(nCode));
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        READWRITE(VARINT(nTxVersion));
+        READWRITE(REF(CTxOutCompressor(out)));
+    }
+};
+
+}
+
+/**
+ * Read the outputs of the transaction at the cursor into coins, leaving the cursor at the next
+ * transaction. Returns false at the end of the outputs, or if one cannot be read.
+ */
+static bool ReadCoinsAtCursor(CDBIterator& cursor, uint256& txid, CCoins& coins, unsigned int& nValueSize)
+{
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
+    if (!cursor.Valid() || !cursor.GetKey(entry) || entry.key != DB_COIN)
+        return false;
+
+    txid = outpoint.hash;
+    coins.Clear();
+    nValueSize = 0;
+    do {
+        CoinValue value;
+        if (!cursor.GetValue(value))
+            return error("%s: unable to read value for type %c", __func__, DB_COIN);
+        if (coins.vout.size() <= outpoint.n)
+            coins.vout.resize(outpoint.n + 1);
+        coins.vout[outpoint.n] = value.out;
+        coins.nHeight = value.nHeight;
+        coins.fCoinBase = value.fCoinBase;
+        coins.nVersion = value.nTxVersion;
+        nValueSize += cursor.GetValueSize();
+        cursor.Next();
+    } while (cursor.Valid() && cursor.GetKey(entry) && entry.key == DB_COIN && outpoint.hash == txid);
+    return true;
+}
+
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
 {
@@ -40,15 +119,40 @@ void CCoinsViewDB::SetCoinsViewByScript(CCoinsViewByScript* pcoinsViewByScriptIn
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    COutPoint outpoint(txid, 0);
+    pcursor->Seek(CoinEntry(&outpoint));
+
+    uint256 txidFound;
+    unsigned int nValueSize;
+    return ReadCoinsAtCursor(*pcursor, txidFound, coins, nValueSize) && txidFound == txid;
 }
 
-bool CCoinsViewDB::GetCoinsByHashOfScript(const uint256 &hash, CCoinsByScript &coins) const {
-    return db.Read(make_pair(DB_COINS_BYSCRIPT, hash), coins);
+bool CCoinsViewDB::ForEachAddressOutput(const uint256 &hash, const AddressOutputVisitor &visitor) const {
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_ADDRESS_OUTPUT, hash));
+
+    std::pair<char, CAddressOutputKey> key;
+    while (pcursor->Valid() && pcursor->GetKey(key)) {
+        if (key.first != DB_ADDRESS_OUTPUT || key.second.first != hash)
+            break;
+        CAddressOutput output;
+        if (!pcursor->GetValue(output))
+            return error("%s: unable to read value for type %c", __func__, DB_ADDRESS_OUTPUT);
+        if (!visitor(key.second.second, output))
+            break;
+        pcursor->Next();
+    }
+    return true;
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    COutPoint outpoint(txid, 0);
+    pcursor->Seek(CoinEntry(&outpoint));
+
+    CoinEntry entry(&outpoint);
+    return pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN && outpoint.hash == txid;
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -62,12 +166,23 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
+    size_t outputs = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            // Only the outputs spent or added since the entry was read are written
+            const CCoins &coins = it->second.coins;
+            for (unsigned int n = 0; n < it->second.vDirtyOutputs.size(); n++) {
+                if (!it->second.vDirtyOutputs[n])
+                    continue;
+                COutPoint outpoint(it->first, n);
+                if (coins.IsAvailable(n))
+                    batch.Write(CoinEntry(&outpoint), CoinValue(coins, n));
+                else if (!(it->second.flags & CCoinsCacheEntry::FRESH))
+                    batch.Erase(CoinEntry(&outpoint));
+                else
+                    continue;
+                outputs++;
+            }
             changed++;
         }
         count++;
@@ -77,28 +192,23 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
 
     if (pcoinsViewByScript) // only if -txoutsbyaddressindex
     {
-        for (CCoinsMapByScript::iterator it = pcoinsViewByScript->cacheCoinsByScript.begin(); it != pcoinsViewByScript->cacheCoinsByScript.end();) {
-            BatchWriteCoinsByScript(batch, it->first, it->second);
-            CCoinsMapByScript::iterator itOld = it++;
-            pcoinsViewByScript->cacheCoinsByScript.erase(itOld);
-        }
-        pcoinsViewByScript->cacheCoinsByScript.clear();
+        for (CAddressOutputMap::iterator it = pcoinsViewByScript->cacheAddressOutputs.begin(); it != pcoinsViewByScript->cacheAddressOutputs.end(); ++it)
+            BatchWriteAddressOutput(batch, it->first, it->second);
+        pcoinsViewByScript->cacheAddressOutputs.clear();
     }
 
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed outputs of %u changed transactions (out of %u) to coin database...\n", (unsigned int)outputs, (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
-bool CCoinsViewDB::BatchWriteCoinsByScript(CDBBatch& batch, const uint256 &hash, const CCoinsByScript &coins) {
-    if (coins.IsEmpty())
-        batch.Erase(make_pair(DB_COINS_BYSCRIPT, hash));
+void CCoinsViewDB::BatchWriteAddressOutput(CDBBatch& batch, const CAddressOutputKey &key, const CAddressOutput &output) {
+    if (output.IsNull())
+        batch.Erase(make_pair(DB_ADDRESS_OUTPUT, key));
     else
-        batch.Write(make_pair(DB_COINS_BYSCRIPT, hash), coins);
-
-    return true;
+        batch.Write(make_pair(DB_ADDRESS_OUTPUT, key), output);
 }
 
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
@@ -114,20 +224,22 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     CAmount nTotalAmount = 0;
     std::pair<char, uint256> key;
     char chType;
+    uint256 hashLastScript;
 
     while (pcursor->Valid() && pcursor->GetKey(key)) {
         boost::this_thread::interruption_point();
         try {
             chType = key.first;
-            LogPrintf("%s read %c type from coindb...\n", __func__, chType);
 
-            if (chType == DB_COINS) {
+            if (chType == DB_COIN) {
+                // The outputs of a transaction are hashed together, as they were with a record per transaction
+                uint256 txhash;
                 CCoins coins;
-                if (!pcursor->GetValue(coins)) {
-                    LogPrintf("%s: unable to read value for type %c", __func__, DB_COINS);
+                unsigned int nValueSize = 0;
+                if (!ReadCoinsAtCursor(*pcursor, txhash, coins, nValueSize)) {
+                    LogPrintf("%s: unable to read value for type %c", __func__, DB_COIN);
                     break;
                 }
-                uint256 txhash = key.second;
                 ss << txhash;
                 ss << VARINT(coins.nVersion);
                 ss << (coins.fCoinBase ? 'c' : 'n');
@@ -142,17 +254,17 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
                         nTotalAmount += out.nValue;
                     }
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
+                stats.nSerializedSize += 32 + nValueSize;
                 ss << VARINT(0);
+                continue;
             }
-            if (chType == DB_COINS_BYSCRIPT) {
-                CCoinsByScript coinsByScript;
-                if (!pcursor->GetValue(coinsByScript)) {
-                    LogPrintf("%s: unable to read value for type %c", __func__, DB_COINS_BYSCRIPT);
-                    break;
+            if (chType == DB_ADDRESS_OUTPUT) {
+                // The outputs of a script are adjacent, key.second is the hash of the script
+                if (stats.nAddressesOutputs == 0 || key.second != hashLastScript) {
+                    stats.nAddresses++;
+                    hashLastScript = key.second;
                 }
-                stats.nAddresses++;
-                stats.nAddressesOutputs += coinsByScript.setCoins.size();
+                stats.nAddressesOutputs++;
             }
             pcursor->Next();
         } catch (const std::exception& e) {
@@ -171,57 +283,57 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
-bool CCoinsViewDB::DeleteAllCoinsByScript()
+/** Erase all keys of type K starting with chType, in batches */
+template<typename K>
+static bool EraseAllWithPrefix(CDBWrapper& db, char chType, int64_t& nErased)
 {
-    LogPrintf("Delete address index for -txoutsbyaddressindex. Be patient...\n");
-    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    //ssKeySet << DB_COINS_BYSCRIPT;
-    pcursor->Seek(DB_COINS_BYSCRIPT);
-
-    std::vector<uint256> v;
-    int64_t i = 0;
-    std::pair<char, uint256> key;
-    char chType;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(chType);
 
-    while (pcursor->Valid() && pcursor->GetKey(key)) {
+    std::vector<K> v;
+    K key;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == chType) {
         boost::this_thread::interruption_point();
-        try {
-            chType = key.first;
-            LogPrintf("%s read %c type from coindb...\n", __func__, chType);
-
-            if (chType != DB_COINS_BYSCRIPT)
-                break;
-
-            uint256 scripthash = key.second;
-            v.push_back(scripthash);
-            if (v.size() >= 10000)
-            {
-                i += v.size();
-                CDBBatch batch(db);
-                CCoinsByScript empty;
-                BOOST_FOREACH(const uint256& hash, v)
-                    BatchWriteCoinsByScript(batch, hash, empty); // delete
-                db.WriteBatch(batch);
-                v.clear();
-            }
-
-            pcursor->Next();
-        } catch (std::exception &e) {
-            return error("%s : Deserialize or I/O error - %s", __func__, e.what());
+        v.push_back(key);
+        if (v.size() >= 10000)
+        {
+            nErased += v.size();
+            CDBBatch batch(db);
+            BOOST_FOREACH(const K& k, v)
+                batch.Erase(k);
+            if (!db.WriteBatch(batch))
+                return false;
+            v.clear();
         }
+        pcursor->Next();
     }
     if (!v.empty())
     {
-        i += v.size();
+        nErased += v.size();
         CDBBatch batch(db);
-        CCoinsByScript empty;
-        BOOST_FOREACH(const uint256& hash, v)
-            BatchWriteCoinsByScript(batch, hash, empty); // delete
-        db.WriteBatch(batch);
+        BOOST_FOREACH(const K& k, v)
+            batch.Erase(k);
+        if (!db.WriteBatch(batch))
+            return false;
+    }
+    return true;
+}
+
+bool CCoinsViewDB::DeleteAllCoinsByScript()
+{
+    LogPrintf("Delete address index for -txoutsbyaddressindex. Be patient...\n");
+    int64_t i = 0;
+    try {
+        // Also drop the index written by older versions, one value per script
+        if (!EraseAllWithPrefix<std::pair<char, uint256> >(db, DB_COINS_BYSCRIPT, i))
+            return error("%s : failed to erase the old address index", __func__);
+        if (!EraseAllWithPrefix<std::pair<char, CAddressOutputKey> >(db, DB_ADDRESS_OUTPUT, i))
+            return error("%s : failed to erase the address index", __func__);
+    } catch (const std::exception &e) {
+        return error("%s : Deserialize or I/O error - %s", __func__, e.what());
     }
     if (i > 0)
-        LogPrintf("Address index with %d addresses successfully deleted.\n", i);
+        LogPrintf("Address index with %d entries successfully deleted.\n", i);
 
     return true;
 }
@@ -231,58 +343,38 @@ bool CCoinsViewDB::GenerateAllCoinsByScript()
     LogPrintf("Building address index for -txoutsbyaddressindex. Be patient...\n");
 
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    CDataStream ssKeySet(SER_DISK, CLIENT_VERSION);
-    //ssKeySet << DB_COINS;
-    pcursor->Seek(DB_COINS);
+    pcursor->Seek(DB_COIN);
 
-    CCoinsMapByScript mapCoinsByScript;
+    // Every output is a key of its own, so nothing has to be read back while building
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(db));
+    size_t nBatched = 0;
     int64_t i = 0;
-    std::pair<char, uint256> key;
-    char chType;
+    COutPoint outpoint;
+    CoinEntry entry(&outpoint);
 
-    while (pcursor->Valid() && pcursor->GetKey(key)) {
+    while (pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN) {
         boost::this_thread::interruption_point();
         try {
-            chType = key.first;
-            LogPrintf("%s read %c type from coindb...\n", __func__, chType);
-
-            if (chType != DB_COINS)
-                break;
-
-            CCoins coins;
-            if (!pcursor->GetValue(coins)) {
-                LogPrintf("%s: unable to read value for type %c", __func__, DB_COINS);
+            CoinValue value;
+            if (!pcursor->GetValue(value)) {
+                LogPrintf("%s: unable to read value for type %c", __func__, DB_COIN);
                 break;
             }
 
-            uint256 txhash = key.second;
-
-            for (unsigned int j = 0; j < coins.vout.size(); j++)
+            if (!value.out.scriptPubKey.IsUnspendable())
             {
-                if (coins.vout[j].IsNull() || coins.vout[j].scriptPubKey.IsUnspendable())
-                    continue;
-
-                const uint256 key = CCoinsViewByScript::getKey(coins.vout[j].scriptPubKey);
-                if (!mapCoinsByScript.count(key))
-                {
-                    CCoinsByScript coinsByScript;
-                    GetCoinsByHashOfScript(key, coinsByScript);
-                    mapCoinsByScript.insert(make_pair(key, coinsByScript));
-                }
-                mapCoinsByScript[key].setCoins.insert(COutPoint(txhash, (uint32_t)j));
+                const CAddressOutputKey outputKey(CCoinsViewByScript::getKey(value.out.scriptPubKey), outpoint);
+                BatchWriteAddressOutput(*pbatch, outputKey, CAddressOutput(value.out.nValue, value.nHeight, value.fCoinBase));
+                nBatched++;
                 i++;
             }
 
-            if (mapCoinsByScript.size() >= 10000)
+            if (nBatched >= 10000)
             {
-                CDBBatch batch(db);
-                for (CCoinsMapByScript::iterator it = mapCoinsByScript.begin(); it != mapCoinsByScript.end();) {
-                    BatchWriteCoinsByScript(batch, it->first, it->second);
-                    CCoinsMapByScript::iterator itOld = it++;
-                    mapCoinsByScript.erase(itOld);
-                }
-                db.WriteBatch(batch);
-                mapCoinsByScript.clear();
+                if (!db.WriteBatch(*pbatch))
+                    return error("%s : failed to write the address index", __func__);
+                pbatch.reset(new CDBBatch(db));
+                nBatched = 0;
             }
 
             pcursor->Next();
@@ -290,20 +382,68 @@ bool CCoinsViewDB::GenerateAllCoinsByScript()
             return error("%s : Deserialize or I/O error - %s", __func__, e.what());
         }
     }
-    if (!mapCoinsByScript.empty())
-    {
-       CDBBatch batch(db);
-       for (CCoinsMapByScript::iterator it = mapCoinsByScript.begin(); it != mapCoinsByScript.end();) {
-           BatchWriteCoinsByScript(batch, it->first, it->second);
-           CCoinsMapByScript::iterator itOld = it++;
-           mapCoinsByScript.erase(itOld);
-       }
-       db.WriteBatch(batch);
-    }
+    if (nBatched > 0 && !db.WriteBatch(*pbatch))
+        return error("%s : failed to write the address index", __func__);
     LogPrintf("Address index with %d outputs successfully built.\n", i);
     return true;
 }
 
+bool CCoinsViewDB::Upgrade()
+{
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS)
+        return true;
+
+    LogPrintf("Upgrading the coin database to one record per output. Be patient...\n");
+    uiInterface.InitMessage(_("Upgrading UTXO database"));
+
+    // The records of a transaction are replaced by its outputs in the same batch,
+    // so an interrupted upgrade goes on from where it stopped
+    boost::scoped_ptr<CDBBatch> pbatch(new CDBBatch(db));
+    size_t nBatched = 0;
+    int64_t nTransactions = 0;
+    int64_t nOutputs = 0;
+    while (pcursor->Valid() && pcursor->GetKey(key) && key.first == DB_COINS) {
+        boost::this_thread::interruption_point();
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to read value for type %c", __func__, DB_COINS);
+
+        for (unsigned int n = 0; n < coins.vout.size(); n++) {
+            if (coins.vout[n].IsNull())
+                continue;
+            COutPoint outpoint(key.second, n);
+            pbatch->Write(CoinEntry(&outpoint), CoinValue(coins, n));
+            nBatched++;
+            nOutputs++;
+        }
+        pbatch->Erase(key);
+        nBatched++;
+        nTransactions++;
+
+        if (nBatched >= 10000)
+        {
+            if (!db.WriteBatch(*pbatch))
+                return error("%s : failed to write the upgraded coins", __func__);
+            pbatch.reset(new CDBBatch(db));
+            nBatched = 0;
+            if (ShutdownRequested())
+                break;
+        }
+        pcursor->Next();
+    }
+    if (nBatched > 0 && !db.WriteBatch(*pbatch))
+        return error("%s : failed to write the upgraded coins", __func__);
+    if (ShutdownRequested()) {
+        LogPrintf("Coin database upgrade interrupted, %d outputs of %d transactions done.\n", nOutputs, nTransactions);
+        return false;
+    }
+    LogPrintf("Coin database upgraded, %d outputs of %d transactions.\n", nOutputs, nTransactions);
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -333,17 +473,17 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
-    // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    i->pcursor->Seek(DB_COIN);
+    // Read the outputs of the first transaction
+    i->Next();
     return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
-        key = keyTmp.second;
+    if (fValid) {
+        key = txidTmp;
         return true;
     }
     return false;
@@ -351,24 +491,26 @@ bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 
 bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
 {
-    return pcursor->GetValue(coins);
+    if (!fValid)
+        return false;
+    coins = coinsTmp;
+    return true;
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
 {
-    return pcursor->GetValueSize();
+    return nValueSizeTmp;
 }
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return fValid;
 }
 
 void CCoinsViewDBCursor::Next()
 {
-    pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
-        keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+    // Invalidate the cached transaction after the last one so that Valid() and GetKey() return false
+    fValid = ReadCoinsAtCursor(*pcursor, txidTmp, coinsTmp, nValueSizeTmp);
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
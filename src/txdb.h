@@ -85,7 +85,7 @@ public:
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** CCoinsView backed by the coin database (chainstate/), with one record per unspent output */
 class CCoinsViewDB : public CCoinsView
 {
 
@@ -98,18 +98,21 @@ public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
     bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool GetCoinsByHashOfScript(const uint256 &hash, CCoinsByScript &coins) const;
+    bool ForEachAddressOutput(const uint256 &hash, const AddressOutputVisitor &visitor) const;
     bool HaveCoins(const uint256 &txid) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
     bool DeleteAllCoinsByScript();   // removes txoutsbyaddressindex
     bool GenerateAllCoinsByScript(); // creates txoutsbyaddressindex
+    //! Replace the records of the transactions written by older versions by one record per output.
+    //! Returns false if a shutdown interrupted it, the next start goes on from where it stopped
+    bool Upgrade();
     void SetCoinsViewByScript(CCoinsViewByScript* pcoinsViewByScriptIn);
     bool GetStats(CCoinsStats &stats) const;
 
 private:
-    bool BatchWriteCoinsByScript(CDBBatch& batch, const uint256 &hash, const CCoinsByScript &coins);
+    void BatchWriteAddressOutput(CDBBatch& batch, const CAddressOutputKey &key, const CAddressOutput &output);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -127,9 +130,13 @@ public:
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), fValid(false), nValueSizeTmp(0) {}
     boost::scoped_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    //! The transaction at the cursor, read from its outputs
+    bool fValid;
+    uint256 txidTmp;
+    CCoins coinsTmp;
+    unsigned int nValueSizeTmp;
 
     friend class CCoinsViewDB;
 };
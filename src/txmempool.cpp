@@ -18,6 +18,8 @@
 #include "utiltime.h"
 #include "version.h"
 
+#include <algorithm>
+
 using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -442,8 +444,11 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     // In that case, our disconnect block logic will call UpdateTransactionsFromBlock
     // to clean up the mess we're leaving here.
 
-    for (unsigned int j = 0; j < tx.vreward.size(); j++)
-        mapMemReward.insert(std::make_pair(&tx.vreward[j].senderPubkey, tx.vreward[j].rewardBalance));
+    for (unsigned int j = 0; j < tx.vreward.size(); j++) {
+        CMemPoolRewardSpends& spends = mapMemReward[tx.vreward[j].senderPubkey];
+        spends.nPending += tx.vreward[j].rewardBalance;
+        spends.vtx.push_back(&tx);
+    }
 
     // Update ancestors with information about this tx
     BOOST_FOREACH (const uint256 &phash, setParentTransactions) {
@@ -475,8 +480,19 @@ void CTxMemPool::removeUnchecked(txiter it)
     const uint256 hash = it->GetTx().GetHash();
     BOOST_FOREACH(const CTxIn& txin, it->GetTx().vin)
         mapNextTx.erase(txin.prevout);
-    BOOST_FOREACH(const CTxReward &txReward, it->GetTx().vreward)
-        mapMemReward.erase(txReward.senderPubkey);
+    BOOST_FOREACH(const CTxReward &txReward, it->GetTx().vreward) {
+        std::map<std::string, CMemPoolRewardSpends>::iterator itSpends = mapMemReward.find(txReward.senderPubkey);
+        if (itSpends == mapMemReward.end())
+            continue;
+        CMemPoolRewardSpends& spends = itSpends->second;
+        std::vector<const CTransaction*>::iterator itTx = std::find(spends.vtx.begin(), spends.vtx.end(), &it->GetTx());
+        if (itTx != spends.vtx.end()) {
+            spends.vtx.erase(itTx);
+            spends.nPending -= txReward.rewardBalance;
+        }
+        if (spends.vtx.empty())
+            mapMemReward.erase(itSpends);
+    }
 
     if (vTxHashes.size() > 1) {
         vTxHashes[it->vTxHashesIdx] = std::move(vTxHashes.back());
@@ -673,6 +689,7 @@ void CTxMemPool::_clear()
     mapLinks.clear();
     mapTx.clear();
     mapNextTx.clear();
+    mapMemReward.clear();
     totalTxSize = 0;
     cachedInnerUsage = 0;
     lastRollingFeeUpdate = GetTime();
@@ -781,8 +798,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             waitingOnDependants.push_back(&(*it));
         else {
             CValidationState state;
-            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, NULL));
-            assert(CheckRewards(tx, state, mempoolDuplicate, false, 0, false));
+            PrecomputedTransactionData txdata(tx);
+            assert(CheckInputs(tx, state, mempoolDuplicate, false, 0, false, txdata));
+            assert(CheckRewards(tx, state, mempoolDuplicate, false, 0, false, txdata));
             UpdateCoins(tx, mempoolDuplicate, 1000000);
         }
     }
@@ -796,8 +814,9 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove++;
             assert(stepsSinceLastRemove < waitingOnDependants.size());
         } else {
-            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, NULL));
-            assert(CheckRewards(entry->GetTx(), state, mempoolDuplicate, false, 0, false));
+            PrecomputedTransactionData txdata(entry->GetTx());
+            assert(CheckInputs(entry->GetTx(), state, mempoolDuplicate, false, 0, false, txdata));
+            assert(CheckRewards(entry->GetTx(), state, mempoolDuplicate, false, 0, false, txdata));
             UpdateCoins(entry->GetTx(), mempoolDuplicate, 1000000);
             stepsSinceLastRemove = 0;
         }
@@ -1029,7 +1048,7 @@ bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
 size_t CTxMemPool::DynamicMemoryUsage() const {
     LOCK(cs);
     // Estimate the overhead of mapTx to be 15 pointers + an allocation, as no exact formula for boost::multi_index_contained is implemented.
-    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
+    return memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 15 * sizeof(void*)) * mapTx.size() + memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapMemReward) + memusage::DynamicUsage(mapDeltas) + memusage::DynamicUsage(mapLinks) + memusage::DynamicUsage(vTxHashes) + cachedInnerUsage;
 }
 
 void CTxMemPool::RemoveStaged(setEntries &stage, bool updateDescendants) {
@@ -1056,6 +1075,69 @@ int CTxMemPool::Expire(int64_t time) {
     return stage.size();
 }
 
+bool CTxMemPool::CalculateRewardSpends(const CTransaction& tx, size_t nLimit, std::map<std::string, CAmount>& mapPending) const
+{
+    LOCK(cs);
+    BOOST_FOREACH(const CTxReward& txReward, tx.vreward) {
+        if (!mapPending.count(txReward.senderPubkey)) {
+            CAmount nPending = 0;
+            std::map<std::string, CMemPoolRewardSpends>::const_iterator itSpends = mapMemReward.find(txReward.senderPubkey);
+            if (itSpends != mapMemReward.end()) {
+                if (itSpends->second.vtx.size() >= nLimit)
+                    return false;
+                nPending = itSpends->second.nPending;
+            }
+            mapPending[txReward.senderPubkey] = nPending;
+        }
+        mapPending[txReward.senderPubkey] += txReward.rewardBalance;
+    }
+    return true;
+}
+
+unsigned int CTxMemPool::TrimRewardSpends(const std::map<std::string, CAmount>& mapBalance)
+{
+    LOCK(cs);
+    // A transaction is listed once for every reward it spends from a pubkey and may spend from several
+    // pubkeys, so each one is subtracted once per pubkey and evicted once
+    setEntries toremove;
+    for (std::map<std::string, CAmount>::const_iterator it = mapBalance.begin(); it != mapBalance.end(); it++) {
+        std::map<std::string, CMemPoolRewardSpends>::const_iterator itSpends = mapMemReward.find(it->first);
+        if (itSpends == mapMemReward.end())
+            continue;
+        const CMemPoolRewardSpends& spends = itSpends->second;
+        CAmount nPending = spends.nPending;
+        std::set<const CTransaction*> setCounted;
+        // Spends already evicted for another pubkey count first
+        BOOST_FOREACH(const CTransaction* ptx, spends.vtx) {
+            txiter itTx = mapTx.find(ptx->GetHash());
+            if (!toremove.count(itTx))
+                continue;
+            if (!setCounted.insert(ptx).second)
+                continue;
+            BOOST_FOREACH(const CTxReward& txReward, ptx->vreward) {
+                if (txReward.senderPubkey == it->first)
+                    nPending -= txReward.rewardBalance;
+            }
+        }
+        for (size_t i = spends.vtx.size(); i-- > 0 && nPending > it->second;) {
+            const CTransaction* ptx = spends.vtx[i];
+            if (!setCounted.insert(ptx).second)
+                continue;
+            BOOST_FOREACH(const CTxReward& txReward, ptx->vreward) {
+                if (txReward.senderPubkey == it->first)
+                    nPending -= txReward.rewardBalance;
+            }
+            toremove.insert(mapTx.find(ptx->GetHash()));
+        }
+    }
+    setEntries stage;
+    BOOST_FOREACH(txiter removeit, toremove) {
+        CalculateDescendants(removeit, stage);
+    }
+    RemoveStaged(stage, false);
+    return stage.size();
+}
+
 bool CTxMemPool::addUnchecked(const uint256&hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
     LOCK(cs);
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <map>
 #include <memory>
 #include <set>
 
@@ -313,6 +314,19 @@ struct ancestor_score {};
 
 class CBlockPolicyEstimator;
 
+/**
+ * The unconfirmed transactions spending the rewards of one pubkey, oldest first. A transaction is
+ * listed once for every reward it spends from the pubkey.
+ */
+struct CMemPoolRewardSpends
+{
+    /** The sum of the rewards spent by the transactions */
+    CAmount nPending;
+    std::vector<const CTransaction*> vtx;
+
+    CMemPoolRewardSpends() : nPending(0) {}
+};
+
 /**
  * Information about a mempool transaction.
  */
@@ -495,7 +509,7 @@ private:
 
 public:
     indirectmap<COutPoint, const CTransaction*> mapNextTx;
-    indirectmap<std::string, CAmount> mapMemReward;
+    std::map<std::string, CMemPoolRewardSpends> mapMemReward;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     /** Create a new CTxMemPool.
@@ -601,6 +615,16 @@ public:
     /** Expire all transaction (and their dependencies) in the mempool older than time. Return the number of removed transactions. */
     int Expire(int64_t time);
 
+    /** Add the reward spends of tx to the pending spends of its senders in the mempool, per sender in mapPending.
+      *  Returns false if a sender already has nLimit or more reward spends in the mempool.
+      */
+    bool CalculateRewardSpends(const CTransaction& tx, size_t nLimit, std::map<std::string, CAmount>& mapPending) const;
+
+    /** Remove the newest reward spends of every pubkey in mapBalance, with their descendants, until the pending
+      *  spends of the pubkey fit the balance given for it. Return the number of transactions evicted.
+      */
+    unsigned int TrimRewardSpends(const std::map<std::string, CAmount>& mapBalance);
+
     unsigned long size()
     {
         LOCK(cs);
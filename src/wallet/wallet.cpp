@@ -1931,9 +1931,22 @@ void CWallet::AvailableRewards(vector<CTxReward>& vRewards, const CCoinControl *
                 CAmount value = paddrinfodb->GetRwdByPubkey(strPubkey);
                 if (value > 0)
                 {
-                    // The rewards spent in mempool is not available
-                    std::map<string, bool>::const_iterator itermap = mapSpentReward.find(strPubkey);
-                    if (itermap != mapSpentReward.end() && itermap->second)
+                    // The rewards spent in mempool is not available, the rest can be chained on them
+                    {
+                        LOCK(mempool.cs);
+                        std::map<std::string, CMemPoolRewardSpends>::const_iterator itSpends = mempool.mapMemReward.find(strPubkey);
+                        if (itSpends != mempool.mapMemReward.end()) {
+                            if (itSpends->second.vtx.size() >= (size_t)GetArg("-limitrewardspends", DEFAULT_REWARD_SPEND_LIMIT))
+                                continue;
+                            value -= itSpends->second.nPending;
+                        } else {
+                            // Spent by a wallet transaction that did not make it into the mempool
+                            std::map<string, bool>::const_iterator itermap = mapSpentReward.find(strPubkey);
+                            if (itermap != mapSpentReward.end() && itermap->second)
+                                continue;
+                        }
+                    }
+                    if (value <= 0)
                         continue;
 
                     CTxReward reward = CTxReward(HexStr(ToByteVector(key.GetPubKey())), value, GetTime());